@@ -420,6 +420,54 @@ volatile pte_t* ArmArchVmAspace::GetPageTable(vaddr_t index, uint page_size_shif
     }
 }
 
+// Replace the block mapping at page_table[index] with a table of the next
+// level mapping the same range with the same attributes, so that part of it
+// can be unmapped or protected. Follows break-before-make, so |vaddr|, which
+// falls in the block, is briefly unmapped.
+// NOTE: caller must DSB afterwards to ensure TLB entries are flushed
+volatile pte_t* ArmArchVmAspace::SplitBlock(vaddr_t vaddr, vaddr_t index, uint index_shift,
+                                            uint page_size_shift,
+                                            volatile pte_t* page_table) {
+    pte_t pte = page_table[index];
+    DEBUG_ASSERT(index_shift > page_size_shift);
+    DEBUG_ASSERT((pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK);
+
+    paddr_t paddr;
+    zx_status_t ret = AllocPageTable(&paddr, page_size_shift);
+    if (ret) {
+        TRACEF("failed to allocate page table\n");
+        return NULL;
+    }
+    volatile pte_t* next_page_table = static_cast<volatile pte_t*>(paddr_to_physmap(paddr));
+
+    const uint next_shift = index_shift - (page_size_shift - 3);
+    const uint count = 1U << (page_size_shift - 3);
+    const paddr_t block_paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
+    pte_t attrs = pte & ~(MMU_PTE_OUTPUT_ADDR_MASK | MMU_PTE_DESCRIPTOR_MASK);
+    attrs |= (next_shift > page_size_shift) ? MMU_PTE_L012_DESCRIPTOR_BLOCK
+                                            : MMU_PTE_L3_DESCRIPTOR_PAGE;
+    for (uint i = 0; i < count; i++) {
+        next_page_table[i] = (block_paddr + ((paddr_t)i << next_shift)) | attrs;
+    }
+
+    LTRACEF("split block %p[%#" PRIxPTR "] %#" PRIx64 " into table %#" PRIxPTR "\n",
+            page_table, index, pte, paddr);
+
+    // the architecture requires the block to be invalidated and flushed
+    // before it is replaced by a table mapping the same range
+    page_table[index] = MMU_PTE_DESCRIPTOR_INVALID;
+    DMB_ISHST;
+    FlushTLBEntry(vaddr, true);
+    DSB;
+
+    page_table[index] = paddr | MMU_PTE_L012_DESCRIPTOR_TABLE;
+
+    // ensure that the update is observable from hardware page table walkers
+    DMB_ISHST;
+
+    return next_page_table;
+}
+
 static bool page_table_is_clear(volatile pte_t* page_table, uint page_size_shift) {
     int i;
     int count = 1U << (page_size_shift - 3);
@@ -490,13 +538,23 @@ ssize_t ArmArchVmAspace::UnmapPageTable(vaddr_t vaddr, vaddr_t vaddr_rel,
 
         pte = page_table[index];
 
+        if (index_shift > page_size_shift && chunk_size != block_size &&
+            (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK) {
+            // only part of the block is going away, split it first
+            if (!SplitBlock(vaddr, index, index_shift, page_size_shift, page_table))
+                return ZX_ERR_NO_MEMORY;
+            pte = page_table[index];
+        }
+
         if (index_shift > page_size_shift &&
             (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_TABLE) {
             page_table_paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
             next_page_table = static_cast<volatile pte_t*>(paddr_to_physmap(page_table_paddr));
-            UnmapPageTable(vaddr, vaddr_rem, chunk_size,
-                           index_shift - (page_size_shift - 3),
-                           page_size_shift, next_page_table);
+            ssize_t ret = UnmapPageTable(vaddr, vaddr_rem, chunk_size,
+                                         index_shift - (page_size_shift - 3),
+                                         page_size_shift, next_page_table);
+            if (ret < 0)
+                return ret;
             if (chunk_size == block_size ||
                 page_table_is_clear(next_page_table, page_size_shift)) {
                 LTRACEF("pte %p[0x%lx] = 0 (was page table)\n", page_table, index);
@@ -654,6 +712,14 @@ int ArmArchVmAspace::ProtectPageTable(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
         index = vaddr_rel >> index_shift;
         pte = page_table[index];
 
+        if (index_shift > page_size_shift && chunk_size != block_size &&
+            (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK) {
+            // only part of the block changes permissions, split it first
+            if (!SplitBlock(vaddr, index, index_shift, page_size_shift, page_table))
+                return ZX_ERR_NO_MEMORY;
+            pte = page_table[index];
+        }
+
         if (index_shift > page_size_shift &&
             (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_TABLE) {
             page_table_paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
@@ -26,6 +26,9 @@ uint arm64_cpu_cpu_ids[SMP_MAX_CPUS] = {0};
 // total number of detected cpus
 uint arm_num_cpus = 1;
 
+// the cpus of each cluster, for arch_cpu_package_siblings()
+static cpu_mask_t arm64_cluster_masks[SMP_CPU_MAX_CLUSTERS];
+
 // per cpu structures, each cpu will point to theirs using the x18 register
 arm64_percpu arm64_percpu_array[SMP_MAX_CPUS];
 
@@ -49,6 +52,8 @@ void arch_init_cpu_map(uint cluster_count, const uint* cluster_cpus) {
             // set the per cpu structure's cpu id
             arm64_percpu_array[cpu_id].cpu_num = cpu_id;
 
+            arm64_cluster_masks[cluster] |= cpu_num_to_mask(cpu_id);
+
             cpu_id++;
         }
     }
@@ -65,6 +70,18 @@ static uint arch_curr_cpu_num_slow() {
     return arm64_cpu_map[cluster][cpu];
 }
 
+cpu_mask_t arch_cpu_smt_siblings(cpu_num_t cpu) {
+    // None of the supported cores are multithreaded.
+    return cpu_num_to_mask(cpu);
+}
+
+cpu_mask_t arch_cpu_package_siblings(cpu_num_t cpu) {
+    if (cpu >= arm_num_cpus)
+        return 0;
+
+    return arm64_cluster_masks[arm64_cpu_cluster_ids[cpu]] | cpu_num_to_mask(cpu);
+}
+
 zx_status_t arch_mp_send_ipi(mp_ipi_target_t target, cpu_mask_t mask, mp_ipi_t ipi) {
     LTRACEF("target %d mask %#x, ipi %d\n", target, mask, ipi);
 
@@ -41,8 +41,7 @@ private:
     IntermediatePtFlags intermediate_flags() final;
     PtFlags terminal_flags(PageTableLevel level, uint flags) final;
     PtFlags split_flags(PageTableLevel level, PtFlags flags) final;
-    void TlbInvalidatePage(PageTableLevel level, vaddr_t vaddr, bool global_page,
-                           bool was_terminal) final;
+    void TlbInvalidate(PendingTlbInvalidation* pending) final;
     uint pt_flags_to_mmu_flags(PtFlags flags, PageTableLevel level) final;
     bool needs_cache_flushes() final { return false; }
 
@@ -64,8 +63,7 @@ private:
     IntermediatePtFlags intermediate_flags() final;
     PtFlags terminal_flags(PageTableLevel level, uint flags) final;
     PtFlags split_flags(PageTableLevel level, PtFlags flags) final;
-    void TlbInvalidatePage(PageTableLevel level, vaddr_t vaddr, bool global_page,
-                           bool was_terminal) final;
+    void TlbInvalidate(PendingTlbInvalidation* pending) final;
     uint pt_flags_to_mmu_flags(PtFlags flags, PageTableLevel level) final;
     bool needs_cache_flushes() final { return false; }
 };
@@ -98,6 +96,21 @@ public:
 
     int active_cpus() { return active_cpus_.load(); }
 
+    // CPUs that are running a kernel thread but still have this aspace
+    // loaded, having skipped the switch to the kernel page tables.
+    int lazy_cpus() { return lazy_cpus_.load(); }
+    void ClearLazyCpu(cpu_mask_t cpu_bit) { lazy_cpus_.fetch_and(~cpu_bit); }
+
+    // Process-context identifier tagging this aspace's TLB entries, or 0 if
+    // it does not have one.
+    uint16_t pcid() const { return pcid_; }
+
+    // Note that every CPU that has run in this aspace may hold stale TLB
+    // entries for it, either tagged with its PCID or left loaded while running
+    // a kernel thread, so that they flush them the next time they switch to
+    // it. CPUs that never ran in it have nothing of it cached.
+    void MarkPcidStale() { pcid_stale_cpus_.fetch_or(ran_cpus_.load()); }
+
     IoBitmap& io_bitmap() { return io_bitmap_; }
 
     static void ContextSwitch(X86ArchVmAspace* from, X86ArchVmAspace* to);
@@ -131,6 +144,20 @@ private:
     // CPUs that are currently executing in this aspace.
     // Actually an mp_cpu_mask_t, but header dependencies.
     fbl::atomic_int active_cpus_{0};
+
+    // CPUs that have this aspace loaded while running kernel threads.
+    // Actually an mp_cpu_mask_t, but header dependencies.
+    fbl::atomic_int lazy_cpus_{0};
+
+    // CPUs that have ever switched into this aspace. Only ever grows.
+    // Actually an mp_cpu_mask_t, but header dependencies.
+    fbl::atomic_int ran_cpus_{0};
+
+    // CPUs that must flush this aspace's TLB entries before next running in it.
+    // Actually an mp_cpu_mask_t, but header dependencies.
+    fbl::atomic_int pcid_stale_cpus_{-1};
+
+    uint16_t pcid_ = 0;
 };
 
 using ArchVmAspace = X86ArchVmAspace;
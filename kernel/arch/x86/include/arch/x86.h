@@ -278,6 +278,26 @@ static inline void x86_set_cr3(ulong in_val)
         :"r" (in_val));
 }
 
+/* INVPCID invalidation types */
+#define X86_INVPCID_TYPE_INDIVIDUAL_ADDR  0
+#define X86_INVPCID_TYPE_SINGLE_CONTEXT   1
+#define X86_INVPCID_TYPE_ALL_INCL_GLOBAL  2
+#define X86_INVPCID_TYPE_ALL_NON_GLOBAL   3
+
+static inline void x86_invpcid(uint64_t type, uint64_t pcid, uint64_t addr)
+{
+    struct {
+        uint64_t pcid;
+        uint64_t addr;
+    } desc = { pcid, addr };
+
+    __asm__ __volatile__ (
+        "invpcid %0, %1"
+        :
+        : "m" (desc), "r" (type)
+        : "memory");
+}
+
 static inline ulong x86_get_cr0(void)
 {
     ulong rv;
@@ -72,6 +72,11 @@ struct x86_percpu {
 
     /* Reserved space for interrupt stacks */
     uint8_t interrupt_stacks[NUM_ASSIGNED_IST_ENTRIES][PAGE_SIZE] __ALIGNED(16);
+
+    /* cpus in the same core and package, worked out once at boot; see
+     * arch_cpu_smt_siblings() and arch_cpu_package_siblings() */
+    cpu_mask_t smt_siblings;
+    cpu_mask_t package_siblings;
 } __CPU_ALIGN;
 
 static_assert(__offsetof(struct x86_percpu, direct) == PERCPU_DIRECT_OFFSET, "");
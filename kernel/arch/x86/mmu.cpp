@@ -16,7 +16,10 @@
 #include <arch/x86/feature.h>
 #include <arch/x86/mmu.h>
 #include <arch/x86/mmu_mem_types.h>
+#include <fbl/algorithm.h>
+#include <kernel/auto_lock.h>
 #include <kernel/mp.h>
+#include <kernel/spinlock.h>
 #include <vm/arch_vm_aspace.h>
 #include <vm/pmm.h>
 #include <vm/vm.h>
@@ -33,6 +36,52 @@ uint8_t g_paddr_width = 32;
 /* True if the system supports 1GB pages */
 static bool supports_huge_pages = false;
 
+/* True if CR4.PCIDE has been set, so that user address spaces get tagged TLB
+ * entries and do not need to be flushed on every context switch */
+static bool g_x86_pcid_enabled = false;
+
+/* True if the INVPCID instruction may be used for TLB invalidation */
+static bool g_x86_invpcid_supported = false;
+
+/* Allocator for the PCIDs assigned to user address spaces.  PCID 0 is used
+ * by the kernel aspace and by any aspace that could not get its own PCID;
+ * switching to it always flushes the TLB. */
+static SpinLock pcid_lock;
+static uint64_t pcid_bitmap[(X86_CR3_PCID_MASK + 1) / 64] TA_GUARDED(pcid_lock) = {1};
+
+/* The user aspace each CPU kept loaded when it last switched to a kernel
+ * thread, if any.  Only accessed by the owning CPU with interrupts disabled,
+ * except that X86ArchVmAspace::Destroy() clears the slots of offline CPUs
+ * that could not be asked to leave the aspace; an offline CPU is not running
+ * and checks its slot again in x86_mmu_percpu_init() when it comes back. */
+static X86ArchVmAspace* lazy_aspace[SMP_MAX_CPUS];
+
+static uint16_t x86_pcid_alloc() {
+    if (!g_x86_pcid_enabled) {
+        return 0;
+    }
+
+    AutoSpinLock guard(&pcid_lock);
+    for (size_t i = 0; i < fbl::count_of(pcid_bitmap); ++i) {
+        if (pcid_bitmap[i] != ~0ull) {
+            uint bit = __builtin_ctzll(~pcid_bitmap[i]);
+            pcid_bitmap[i] |= 1ull << bit;
+            return static_cast<uint16_t>(i * 64 + bit);
+        }
+    }
+    return 0;
+}
+
+static void x86_pcid_free(uint16_t pcid) {
+    if (pcid == 0) {
+        return;
+    }
+
+    AutoSpinLock guard(&pcid_lock);
+    DEBUG_ASSERT(pcid_bitmap[pcid / 64] & (1ull << (pcid % 64)));
+    pcid_bitmap[pcid / 64] &= ~(1ull << (pcid % 64));
+}
+
 /* top level kernel page tables, initialized in start.S */
 volatile pt_entry_t pml4[NO_OF_PT_ENTRIES] __ALIGNED(PAGE_SIZE);
 volatile pt_entry_t pdp[NO_OF_PT_ENTRIES] __ALIGNED(PAGE_SIZE); /* temporary */
@@ -110,6 +159,10 @@ static bool x86_mmu_check_paddr(paddr_t paddr) {
  */
 static void x86_tlb_global_invalidate() {
     /* See Intel 3A section 4.10.4.1 */
+    if (g_x86_invpcid_supported) {
+        x86_invpcid(X86_INVPCID_TYPE_ALL_INCL_GLOBAL, 0, 0);
+        return;
+    }
     ulong cr4 = x86_get_cr4();
     if (likely(cr4 & X86_CR4_PGE)) {
         x86_set_cr4(cr4 & ~X86_CR4_PGE);
@@ -119,53 +172,85 @@ static void x86_tlb_global_invalidate() {
     }
 }
 
-/* Task used for invalidating a TLB entry on each CPU */
-struct TlbInvalidatePage_context {
+/**
+ * @brief  invalidate all non-global TLB entries for the current address space
+ */
+static void x86_tlb_nonglobal_invalidate() {
+    ulong cr3 = x86_get_cr3();
+    if (g_x86_invpcid_supported) {
+        x86_invpcid(X86_INVPCID_TYPE_SINGLE_CONTEXT, cr3 & X86_CR3_PCID_MASK, 0);
+    } else {
+        /* Reloading cr3 without the no-flush bit set flushes the non-global
+         * entries tagged with the current PCID. */
+        x86_set_cr3(cr3);
+    }
+}
+
+/* Task used for invalidating a batch of TLB entries on each CPU */
+struct TlbInvalidate_context {
     ulong target_cr3;
-    vaddr_t vaddr;
-    enum PageTableLevel level;
-    bool global_page;
+    const PendingTlbInvalidation* pending;
 };
-static void TlbInvalidatePage_task(void* raw_context) {
+static void TlbInvalidate_task(void* raw_context) {
     DEBUG_ASSERT(arch_ints_disabled());
-    TlbInvalidatePage_context* context = (TlbInvalidatePage_context*)raw_context;
+    TlbInvalidate_context* context = (TlbInvalidate_context*)raw_context;
+    const PendingTlbInvalidation* pending = context->pending;
 
-    ulong cr3 = x86_get_cr3();
-    if (context->target_cr3 != cr3 && !context->global_page) {
+    ulong cr3 = x86_get_cr3() & ~X86_CR3_PCID_MASK;
+    if (context->target_cr3 != cr3 && !pending->contains_global) {
         /* This invalidation doesn't apply to this CPU, ignore it */
         return;
     }
 
-    switch (context->level) {
-    case PML4_L:
-        x86_tlb_global_invalidate();
-        break;
-    case PDP_L:
-    case PD_L:
-    case PT_L:
-        __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)context->vaddr));
-        break;
+    if (pending->full_shootdown) {
+        if (pending->contains_global) {
+            x86_tlb_global_invalidate();
+        } else {
+            x86_tlb_nonglobal_invalidate();
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < pending->count; ++i) {
+        const auto& item = pending->item[i];
+        switch (item.level) {
+        case PML4_L:
+            x86_tlb_global_invalidate();
+            return;
+        case PDP_L:
+        case PD_L:
+        case PT_L:
+            /* invlpg only drops the paging-structure cache entries tagged
+             * with the current PCID, so an unlinked kernel page table must
+             * be flushed from every PCID. */
+            if (g_x86_pcid_enabled && item.is_global && !item.is_terminal) {
+                x86_tlb_global_invalidate();
+                return;
+            }
+            __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)item.addr));
+            break;
+        }
     }
 }
 
 /**
- * @brief Invalidate a single page at a given page table level
- *
- * @param pt The page table we're invalidating for (if nullptr, assume for current one)
- * @param vaddr The virtual address we are invalidating the TLB entry for
- * @param level The page table level that maps this vaddr
- * @param global_page True if we are invalidating a global mapping
+ * @brief Execute a batch of TLB invalidations on all CPUs that may hold
+ * stale translations for |pt|
  *
- * TODO(ZX-979): Optimize this.  This is horribly inefficient.
- * We should also change this to pool invalidations from a single
- * "transaction" and then only execute a single mp_sync_exec for that
- * transaction, rather than one per page.
+ * @param pt The page table we're invalidating for
+ * @param pending The invalidations to perform
  */
-static void x86_tlb_invalidate_page(X86PageTableBase* pt, vaddr_t vaddr,
-                                    enum PageTableLevel level, bool global_page) {
-    ulong cr3 = pt ? pt->phys() : x86_get_cr3();
-    struct TlbInvalidatePage_context task_context = {
-        .target_cr3 = cr3, .vaddr = vaddr, .level = level, .global_page = global_page,
+static void x86_tlb_invalidate(X86PageTableBase* pt, PendingTlbInvalidation* pending) {
+    auto aspace = static_cast<X86ArchVmAspace*>(pt->ctx());
+
+    /* CPUs that are not currently running in this aspace may still hold
+     * translations tagged with its PCID; make them flush on their next
+     * switch into it.  This must happen before the load of the active mask
+     * below, see X86ArchVmAspace::ContextSwitch. */
+    aspace->MarkPcidStale();
+
+    struct TlbInvalidate_context task_context = {
+        .target_cr3 = pt->phys(), .pending = pending,
     };
 
     /* Target only CPUs this aspace is active on.  It may be the case that some
@@ -175,14 +260,22 @@ static void x86_tlb_invalidate_page(X86PageTableBase* pt, vaddr_t vaddr,
      * case, it will get a spurious request to flush. */
     mp_ipi_target_t target;
     cpu_mask_t target_mask = 0;
-    if (global_page || pt == nullptr) {
+    if (pending->contains_global) {
         target = MP_IPI_TARGET_ALL;
     } else {
         target = MP_IPI_TARGET_MASK;
-        target_mask = static_cast<X86ArchVmAspace*>(pt->ctx())->active_cpus();
+        target_mask = aspace->active_cpus();
+        /* CPUs that still have this aspace loaded while running a kernel
+         * thread will flush it when they next run a thread in it, since they
+         * were marked stale above.  They must still be interrupted if a page
+         * table is going away, since the hardware may walk it speculatively. */
+        if (pending->contains_nonterminal) {
+            target_mask |= aspace->lazy_cpus();
+        }
     }
 
-    mp_sync_exec(target, target_mask, TlbInvalidatePage_task, &task_context);
+    mp_sync_exec(target, target_mask, TlbInvalidate_task, &task_context);
+    pending->clear();
 }
 
 bool X86PageTableMmu::check_paddr(paddr_t paddr) {
@@ -282,9 +375,8 @@ X86PageTableBase::PtFlags X86PageTableMmu::split_flags(PageTableLevel level,
     return flags;
 }
 
-void X86PageTableMmu::TlbInvalidatePage(PageTableLevel level, vaddr_t vaddr, bool global_page,
-                                        bool was_terminal) {
-    x86_tlb_invalidate_page(this, vaddr, level, global_page);
+void X86PageTableMmu::TlbInvalidate(PendingTlbInvalidation* pending) {
+    x86_tlb_invalidate(this, pending);
 }
 
 uint X86PageTableMmu::pt_flags_to_mmu_flags(PtFlags flags, PageTableLevel level) {
@@ -392,9 +484,9 @@ X86PageTableBase::PtFlags X86PageTableEpt::split_flags(PageTableLevel level,
     return flags;
 }
 
-void X86PageTableEpt::TlbInvalidatePage(PageTableLevel level, vaddr_t vaddr, bool global_page,
-                                        bool was_terminal) {
+void X86PageTableEpt::TlbInvalidate(PendingTlbInvalidation* pending) {
     // TODO(ZX-981): Implement this.
+    pending->clear();
 }
 
 uint X86PageTableEpt::pt_flags_to_mmu_flags(PtFlags flags, PageTableLevel level) {
@@ -420,7 +512,7 @@ void x86_mmu_early_init() {
 
     // Unmap the lower identity mapping.
     pml4[0] = 0;
-    x86_tlb_invalidate_page(nullptr, 0, PML4_L, false);
+    x86_tlb_global_invalidate();
 
     /* get the address width from the CPU */
     uint8_t vaddr_width = x86_linear_address_width();
@@ -532,22 +624,61 @@ zx_status_t X86ArchVmAspace::Init(vaddr_t base, size_t size, uint mmu_flags) {
             return status;
         }
 
-        LTRACEF("user aspace: pt phys %#" PRIxPTR ", virt %p\n", pt_->phys(), pt_->virt());
+        pcid_ = x86_pcid_alloc();
+
+        LTRACEF("user aspace: pt phys %#" PRIxPTR ", virt %p, pcid %u\n", pt_->phys(), pt_->virt(),
+                pcid_);
     }
     fbl::atomic_init(&active_cpus_, 0);
+    fbl::atomic_init(&ran_cpus_, 0);
+    // A recycled PCID may still have translations from its previous owner in
+    // any CPU's TLB.
+    fbl::atomic_init(&pcid_stale_cpus_, -1);
 
     return ZX_OK;
 }
 
+/* Task used for switching CPUs that lazily kept an aspace loaded over to
+ * the kernel page tables */
+static void LeaveLazyAspace_task(void* raw_context) {
+    DEBUG_ASSERT(arch_ints_disabled());
+    X86ArchVmAspace* aspace = static_cast<X86ArchVmAspace*>(raw_context);
+
+    cpu_num_t cpu = arch_curr_cpu_num();
+    if (lazy_aspace[cpu] != aspace) {
+        return;
+    }
+    x86_set_cr3(kernel_pt_phys);
+    lazy_aspace[cpu] = nullptr;
+    aspace->ClearLazyCpu(cpu_num_to_mask(cpu));
+}
+
 zx_status_t X86ArchVmAspace::Destroy() {
     canary_.Assert();
     DEBUG_ASSERT(active_cpus_.load() == 0);
 
+    // No thread can switch into this aspace anymore, but some CPUs may still
+    // have it loaded; move them off of it before freeing the page tables.
+    cpu_mask_t lazy = lazy_cpus_.load();
+    if (lazy != 0) {
+        mp_sync_exec(MP_IPI_TARGET_MASK, lazy, LeaveLazyAspace_task, this);
+        // Any CPUs left over are offline and will reload CR3 when brought back.
+        lazy = lazy_cpus_.load();
+        for (cpu_num_t cpu = 0; lazy != 0; cpu++, lazy >>= 1) {
+            if ((lazy & 1) && lazy_aspace[cpu] == this) {
+                lazy_aspace[cpu] = nullptr;
+            }
+        }
+        lazy_cpus_.store(0);
+    }
+
     if (flags_ & ARCH_ASPACE_FLAG_GUEST) {
         static_cast<X86PageTableEpt*>(pt_)->Destroy(base_, size_);
     } else {
         static_cast<X86PageTableMmu*>(pt_)->Destroy(base_, size_);
     }
+    x86_pcid_free(pcid_);
+    pcid_ = 0;
     return ZX_OK;
 }
 
@@ -582,23 +713,65 @@ zx_status_t X86ArchVmAspace::Protect(vaddr_t vaddr, size_t count, uint mmu_flags
 }
 
 void X86ArchVmAspace::ContextSwitch(X86ArchVmAspace* old_aspace, X86ArchVmAspace* aspace) {
-    cpu_mask_t cpu_bit = cpu_num_to_mask(arch_curr_cpu_num());
+    cpu_num_t cpu = arch_curr_cpu_num();
+    cpu_mask_t cpu_bit = cpu_num_to_mask(cpu);
     if (aspace != nullptr) {
         aspace->canary_.Assert();
         paddr_t phys = aspace->pt_phys();
-        LTRACEF_LEVEL(3, "switching to aspace %p, pt %#" PRIXPTR "\n", aspace, phys);
-        x86_set_cr3(phys);
+        LTRACEF_LEVEL(3, "switching to aspace %p, pt %#" PRIXPTR ", pcid %u\n", aspace, phys,
+                      aspace->pcid_);
+
+        // Become active before consuming our stale bit: a concurrent shootdown
+        // either marks us stale before we clear the bit below, or observes us
+        // in the active mask and sends us an IPI. Joining the ran mask first
+        // means a shootdown that misses us there also ran before we loaded
+        // anything of this aspace into the TLB.
+        aspace->ran_cpus_.fetch_or(cpu_bit);
+        aspace->active_cpus_.fetch_or(cpu_bit);
+        bool stale = aspace->pcid_stale_cpus_.fetch_and(~cpu_bit) & cpu_bit;
+
+        X86ArchVmAspace* lazy = lazy_aspace[cpu];
+        lazy_aspace[cpu] = nullptr;
+        if (lazy == aspace) {
+            // We're returning to the aspace we kept loaded while running a
+            // kernel thread, so only flush if it changed in the meantime.
+            if (stale) {
+                x86_tlb_nonglobal_invalidate();
+            }
+            aspace->lazy_cpus_.fetch_and(~cpu_bit);
+        } else {
+            ulong cr3 = phys;
+            if (aspace->pcid_ != 0) {
+                cr3 |= aspace->pcid_;
+                if (!stale) {
+                    cr3 |= X86_CR3_NOFLUSH;
+                }
+            }
+            x86_set_cr3(cr3);
+
+            // This must be the last access to |lazy|, since once its bit is
+            // clear it may be destroyed without waiting for us.
+            if (lazy != nullptr) {
+                lazy->lazy_cpus_.fetch_and(~cpu_bit);
+            }
+        }
 
         if (old_aspace != nullptr) {
             old_aspace->active_cpus_.fetch_and(~cpu_bit);
         }
-        aspace->active_cpus_.fetch_or(cpu_bit);
     } else {
-        LTRACEF_LEVEL(3, "switching to kernel aspace, pt %#" PRIxPTR "\n", kernel_pt_phys);
-        x86_set_cr3(kernel_pt_phys);
-        if (old_aspace != nullptr) {
-            old_aspace->active_cpus_.fetch_and(~cpu_bit);
-        }
+        // Kernel threads never touch user mappings, so rather than switching
+        // to the kernel page tables keep the old aspace loaded.  If the next
+        // user thread to run here is in the same aspace, we avoid both the
+        // CR3 write and the TLB flush.
+        DEBUG_ASSERT(old_aspace != nullptr);
+        DEBUG_ASSERT(lazy_aspace[cpu] == nullptr);
+        LTRACEF_LEVEL(3, "switching to kernel thread, keeping aspace %p loaded\n", old_aspace);
+        // Join the lazy mask before leaving the active one, so that a
+        // shootdown that frees page tables always interrupts us.
+        old_aspace->lazy_cpus_.fetch_or(cpu_bit);
+        lazy_aspace[cpu] = old_aspace;
+        old_aspace->active_cpus_.fetch_and(~cpu_bit);
     }
 
     // Cleanup io bitmap entries from previous thread.
@@ -631,12 +804,28 @@ void x86_mmu_percpu_init(void) {
         cr4 |= X86_CR4_SMEP;
     if (x86_feature_test(X86_FEATURE_SMAP))
         cr4 |= X86_CR4_SMAP;
+    // CR4.PCIDE may only be set while CR3[11:0] is zero, which holds here
+    // since we are running on the kernel page tables.
+    if (x86_feature_test(X86_FEATURE_PCID)) {
+        DEBUG_ASSERT((x86_get_cr3() & X86_CR3_PCID_MASK) == 0);
+        cr4 |= X86_CR4_PCIDE;
+        g_x86_pcid_enabled = true;
+        g_x86_invpcid_supported = x86_feature_test(X86_FEATURE_INVPCID);
+    }
     x86_set_cr4(cr4);
 
     // Set NXE bit in X86_MSR_IA32_EFER.
     uint64_t efer_msr = read_msr(X86_MSR_IA32_EFER);
     efer_msr |= X86_EFER_NXE;
     write_msr(X86_MSR_IA32_EFER, efer_msr);
+
+    // If this CPU is coming back online, it is no longer running on whatever
+    // aspace it had lazily kept loaded.
+    cpu_num_t cpu = arch_curr_cpu_num();
+    if (lazy_aspace[cpu] != nullptr) {
+        lazy_aspace[cpu]->ClearLazyCpu(cpu_num_to_mask(cpu));
+        lazy_aspace[cpu] = nullptr;
+    }
 }
 
 X86ArchVmAspace::~X86ArchVmAspace() {
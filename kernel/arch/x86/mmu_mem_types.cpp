@@ -6,6 +6,7 @@
 
 #include <arch/x86.h>
 #include <arch/x86/mmu.h>
+#include <arch/x86/feature.h>
 #include <arch/x86/mmu_mem_types.h>
 #include <arch/x86/registers.h>
 #include <assert.h>
@@ -129,6 +130,22 @@ void x86_pat_sync(cpu_mask_t targets) {
     mp_sync_exec(MP_IPI_TARGET_MASK, targets, x86_pat_sync_task, &context);
 }
 
+/* Flush the TLB for every PCID.  Reloading CR3 only flushes the entries
+ * tagged with the current one, and the others would keep their old memory
+ * types. */
+static void x86_pat_tlb_flush(void) {
+    ulong cr4 = x86_get_cr4();
+    if (!(cr4 & X86_CR4_PCIDE)) {
+        x86_set_cr3(x86_get_cr3());
+    } else if (x86_feature_test(X86_FEATURE_INVPCID)) {
+        x86_invpcid(X86_INVPCID_TYPE_ALL_INCL_GLOBAL, 0, 0);
+    } else {
+        /* Any change to CR4.PGE flushes the entries of all PCIDs */
+        x86_set_cr4(cr4 ^ X86_CR4_PGE);
+        x86_set_cr4(cr4);
+    }
+}
+
 static void x86_pat_sync_task(void* raw_context) {
     /* Step 2: Disable interrupts */
     DEBUG_ASSERT(arch_ints_disabled());
@@ -162,7 +179,7 @@ static void x86_pat_sync_task(void* raw_context) {
 
     /* Step 7: If the PGE flag wasn't set, flush the TLB via CR3 */
     if (!pge_was_set) {
-        x86_set_cr3(x86_get_cr3());
+        x86_pat_tlb_flush();
     }
 
     /* Step 8: Disable MTRRs */
@@ -208,7 +225,7 @@ static void x86_pat_sync_task(void* raw_context) {
     /* Step 11: Flush all cache and the TLB again */
     __asm volatile("wbinvd" ::
                        : "memory");
-    x86_set_cr3(x86_get_cr3());
+    x86_pat_tlb_flush();
 
     /* Step 12: Enter the normal cache mode */
     cr0 = x86_get_cr0();
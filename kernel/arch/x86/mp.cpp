@@ -38,6 +38,8 @@ uint8_t x86_num_cpus = 1;
 
 extern struct idt _idt;
 
+static void x86_init_topology_masks();
+
 zx_status_t x86_allocate_ap_structures(uint32_t* apic_ids, uint8_t cpu_count) {
     ASSERT(ap_percpus == nullptr);
 
@@ -75,6 +77,7 @@ zx_status_t x86_allocate_ap_structures(uint32_t* apic_ids, uint8_t cpu_count) {
     }
 
     x86_num_cpus = cpu_count;
+    x86_init_topology_masks();
     return ZX_OK;
 }
 
@@ -199,6 +202,49 @@ int x86_apic_id_to_cpu_num(uint32_t apic_id) {
     return -1;
 }
 
+static struct x86_percpu* x86_cpu_num_to_percpu(cpu_num_t cpu) {
+    return (cpu == 0) ? &bp_percpu : &ap_percpus[cpu - 1];
+}
+
+// Fills in every cpu's |smt_siblings| and |package_siblings| from the
+// topology encoded in the APIC ids, so that the scheduler does not have to
+// decode it on its hot paths.
+static void x86_init_topology_masks() {
+    x86_cpu_topology_t topo[SMP_MAX_CPUS];
+    const cpu_num_t num_cpus = (x86_num_cpus < SMP_MAX_CPUS) ? x86_num_cpus : SMP_MAX_CPUS;
+    for (cpu_num_t i = 0; i < num_cpus; ++i) {
+        x86_cpu_topology_decode(x86_cpu_num_to_percpu(i)->apic_id, &topo[i]);
+    }
+
+    for (cpu_num_t cpu = 0; cpu < num_cpus; ++cpu) {
+        cpu_mask_t smt = 0;
+        cpu_mask_t package = 0;
+        for (cpu_num_t i = 0; i < num_cpus; ++i) {
+            if (topo[i].package_id != topo[cpu].package_id)
+                continue;
+            package |= cpu_num_to_mask(i);
+            if (topo[i].core_id == topo[cpu].core_id)
+                smt |= cpu_num_to_mask(i);
+        }
+        struct x86_percpu* percpu = x86_cpu_num_to_percpu(cpu);
+        percpu->smt_siblings = smt;
+        percpu->package_siblings = package;
+    }
+}
+
+cpu_mask_t arch_cpu_smt_siblings(cpu_num_t cpu) {
+    if (cpu >= x86_num_cpus)
+        return 0;
+    // The masks are unset until the APs are known, so always include |cpu|.
+    return x86_cpu_num_to_percpu(cpu)->smt_siblings | cpu_num_to_mask(cpu);
+}
+
+cpu_mask_t arch_cpu_package_siblings(cpu_num_t cpu) {
+    if (cpu >= x86_num_cpus)
+        return 0;
+    return x86_cpu_num_to_percpu(cpu)->package_siblings | cpu_num_to_mask(cpu);
+}
+
 zx_status_t arch_mp_send_ipi(mp_ipi_target_t target, cpu_mask_t mask, mp_ipi_t ipi) {
     uint8_t vector = 0;
     switch (ipi) {
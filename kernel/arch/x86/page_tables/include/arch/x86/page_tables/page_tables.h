@@ -20,6 +20,42 @@ enum PageTableLevel {
     PML4_L,
 };
 
+// Structure for tracking the TLB invalidations that an operation on the page
+// tables has made necessary, so that they can be issued as a single batch at
+// the end of the operation.
+struct PendingTlbInvalidation {
+    struct Item {
+        vaddr_t addr;
+        PageTableLevel level;
+        bool is_global;
+        bool is_terminal;
+    };
+
+    // If more than this many pages need invalidating, a full shootdown of
+    // the address space is cheaper than invalidating them one at a time.
+    static constexpr size_t kMaxPending = 32;
+
+    // Add address |v|, translated at depth |level|, to the set of addresses
+    // to be invalidated.
+    void enqueue(vaddr_t v, PageTableLevel level, bool is_global, bool is_terminal);
+
+    // Reset this to an empty set.
+    void clear();
+
+    ~PendingTlbInvalidation();
+
+    // The number of valid entries in |item|.
+    size_t count = 0;
+    // If true, ignore |item| and invalidate the whole address space.
+    bool full_shootdown = false;
+    // If true, at least one enqueued entry was for a global page.
+    bool contains_global = false;
+    // If true, at least one enqueued entry was for a non-terminal entry, so a
+    // page table may be about to be freed.
+    bool contains_nonterminal = false;
+    Item item[kMaxPending];
+};
+
 class X86PageTableBase {
 public:
     X86PageTableBase();
@@ -74,9 +110,8 @@ protected:
     // Return the hardware flags to use on smaller pages after a splitting a
     // large page with flags |flags|.
     virtual PtFlags split_flags(PageTableLevel level, PtFlags flags) = 0;
-    // Invalidate a single page at the given level
-    virtual void TlbInvalidatePage(PageTableLevel level, vaddr_t vaddr, bool global_page,
-                                   bool was_terminal) = 0;
+    // Perform the TLB invalidations described by |pending|, then clear it.
+    virtual void TlbInvalidate(PendingTlbInvalidation* pending) = 0;
     // Convert PtFlags to ARCH_MMU_* flags.
     virtual uint pt_flags_to_mmu_flags(PtFlags flags, PageTableLevel level) = 0;
     // Returns true if a cache flush is necessary for pagetable changes to be
@@ -98,28 +133,29 @@ private:
     DISALLOW_COPY_ASSIGN_AND_MOVE(X86PageTableBase);
 
     class CacheLineFlusher;
+    class ConsistencyManager;
     struct MappingCursor;
 
     zx_status_t AddMapping(volatile pt_entry_t* table, uint mmu_flags,
                            PageTableLevel level, const MappingCursor& start_cursor,
-                           MappingCursor* new_cursor) TA_REQ(lock_);
+                           MappingCursor* new_cursor, ConsistencyManager* cm) TA_REQ(lock_);
     zx_status_t AddMappingL0(volatile pt_entry_t* table, uint mmu_flags,
                              const MappingCursor& start_cursor,
-                             MappingCursor* new_cursor) TA_REQ(lock_);
+                             MappingCursor* new_cursor, ConsistencyManager* cm) TA_REQ(lock_);
 
     bool RemoveMapping(volatile pt_entry_t* table,
                        PageTableLevel level, const MappingCursor& start_cursor,
-                       MappingCursor* new_cursor) TA_REQ(lock_);
+                       MappingCursor* new_cursor, ConsistencyManager* cm) TA_REQ(lock_);
     bool RemoveMappingL0(volatile pt_entry_t* table,
                          const MappingCursor& start_cursor,
-                         MappingCursor* new_cursor) TA_REQ(lock_);
+                         MappingCursor* new_cursor, ConsistencyManager* cm) TA_REQ(lock_);
 
     zx_status_t UpdateMapping(volatile pt_entry_t* table, uint mmu_flags,
                               PageTableLevel level, const MappingCursor& start_cursor,
-                              MappingCursor* new_cursor) TA_REQ(lock_);
+                              MappingCursor* new_cursor, ConsistencyManager* cm) TA_REQ(lock_);
     zx_status_t UpdateMappingL0(volatile pt_entry_t* table, uint mmu_flags,
                                 const MappingCursor& start_cursor,
-                                MappingCursor* new_cursor) TA_REQ(lock_);
+                                MappingCursor* new_cursor, ConsistencyManager* cm) TA_REQ(lock_);
 
     zx_status_t GetMapping(volatile pt_entry_t* table, vaddr_t vaddr,
                            PageTableLevel level,
@@ -130,12 +166,12 @@ private:
                              volatile pt_entry_t** mapping) TA_REQ(lock_);
 
     zx_status_t SplitLargePage(PageTableLevel level, vaddr_t vaddr,
-                               volatile pt_entry_t* pte) TA_REQ(lock_);
+                               volatile pt_entry_t* pte, ConsistencyManager* cm) TA_REQ(lock_);
 
-    void UpdateEntry(CacheLineFlusher* flusher,
+    void UpdateEntry(ConsistencyManager* cm, CacheLineFlusher* flusher,
                      PageTableLevel level, vaddr_t vaddr, volatile pt_entry_t* pte,
                      paddr_t paddr, PtFlags flags, bool was_terminal) TA_REQ(lock_);
-    void UnmapEntry(CacheLineFlusher* flusher,
+    void UnmapEntry(ConsistencyManager* cm, CacheLineFlusher* flusher,
                     PageTableLevel level, vaddr_t vaddr, volatile pt_entry_t* pte,
                     bool was_terminal) TA_REQ(lock_);
 
@@ -42,4 +42,12 @@ zx_status_t arch_mp_cpu_unplug(cpu_num_t cpu_id);
 
 void arch_mp_init_percpu(void);
 
+/* Topology hints for the scheduler. Both masks include |cpu| itself. They are
+ * looked up on every wakeup with thread_lock held, so the arch code works them
+ * out once at boot and these just return the stored values. */
+/* cpus sharing a core with |cpu|, i.e. its SMT siblings */
+cpu_mask_t arch_cpu_smt_siblings(cpu_num_t cpu);
+/* cpus in the same package or cluster as |cpu|, which share its last level cache */
+cpu_mask_t arch_cpu_package_siblings(cpu_num_t cpu);
+
 __END_CDECLS
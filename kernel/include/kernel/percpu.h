@@ -18,8 +18,10 @@
 __BEGIN_CDECLS
 
 struct percpu {
-    /* per cpu timer queue */
+    /* per cpu timer queue, sorted by deadline */
     struct list_node timer_queue;
+    /* search tree over timer_queue; its left child is the root */
+    struct timer_tree_node timer_tree;
 
     /* per cpu preemption timer */
     timer_t preempt_timer;
@@ -27,6 +29,18 @@ struct percpu {
     /* per cpu run queue and bitmap to indicate which queues are non empty */
     struct list_node run_queue[NUM_PRIORITIES];
     uint32_t run_queue_bitmap;
+    /* number of threads in run_queue */
+    uint32_t run_queue_count;
+
+    /* ready threads of the deadline class, see sched.c */
+    struct list_node deadline_run_queue;
+    /* fires when a throttled deadline thread gets its next budget, at
+     * deadline_release, which is ZX_TIME_INFINITE while it is not set */
+    timer_t deadline_timer;
+    zx_time_t deadline_release;
+    /* cpu bandwidth reserved by deadline threads, as a fraction of
+     * SCHED_DEADLINE_UTIL_ONE */
+    uint32_t deadline_util;
 
     /* thread/cpu level statistics */
     struct cpu_stats stats;
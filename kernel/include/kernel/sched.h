@@ -23,6 +23,20 @@ void sched_resched_internal(void);
 void sched_unblock_idle(thread_t* t);
 void sched_migrate(thread_t* t);
 
+/* the priority the thread is scheduled at */
+int sched_effective_priority(const thread_t* t);
+/* set the thread's inherited priority, moving it between run queues if needed */
+void sched_inherit_priority(thread_t* t, int pri);
+
+/* deadline class bandwidth is accounted as a fixed point fraction of a cpu */
+#define SCHED_DEADLINE_UTIL_ONE (1u << 20)
+/* reserve |capacity| every |period| on one of the current thread's cpus for
+ * it to run in the deadline class, or return it to the priority scheduler if
+ * |capacity| is 0; fails with ZX_ERR_NO_RESOURCES if no cpu has the
+ * bandwidth left. the caller should reschedule afterwards */
+zx_status_t sched_set_deadline(thread_t* t, zx_duration_t capacity, zx_duration_t deadline,
+                               zx_duration_t period);
+
 /* return true if the thread was placed on the current cpu's run queue */
 /* this usually means the caller should locally reschedule soon */
 bool sched_unblock(thread_t* t) __WARN_UNUSED_RESULT;
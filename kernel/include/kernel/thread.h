@@ -92,6 +92,28 @@ typedef struct thread {
 
     int base_priority;
     int priority_boost;
+    /* the highest priority of the threads blocked on something this thread
+     * holds, which this thread runs at if it is higher than its own */
+    int inherited_priority;
+
+    /* threads blocked on something this thread holds */
+    struct list_node pi_waiters;
+    /* if blocked on something another thread holds, that thread, and our
+     * node in its pi_waiters list */
+    struct thread* pi_owner;
+    struct list_node pi_waiter_node;
+
+    /* deadline class parameters, see thread_set_deadline(); zero capacity
+     * means the thread is scheduled by priority */
+    zx_duration_t deadline_capacity;
+    zx_duration_t deadline_relative;
+    zx_duration_t deadline_period;
+    /* the cpu the thread's bandwidth is reserved on */
+    cpu_num_t deadline_cpu;
+    /* the current period, its absolute deadline and the budget left in it */
+    zx_time_t deadline_period_start;
+    zx_time_t deadline_abs;
+    zx_duration_t deadline_remaining;
 
     /* current cpu the thread is either running on or in the ready queue, undefined otherwise */
     cpu_num_t curr_cpu;
@@ -194,6 +216,17 @@ void thread_construct_first(thread_t* t, const char* name);
 thread_t* thread_create_idle_thread(uint cpu_num);
 void thread_set_name(const char* name);
 void thread_set_priority(int priority);
+/* move the current thread into the deadline class, which gives it |capacity|
+ * of cpu time every |period|, to be used within |deadline| of the start of
+ * the period; a zero |capacity| moves it back to priority scheduling */
+zx_status_t thread_set_deadline(zx_duration_t capacity, zx_duration_t deadline,
+                                zx_duration_t period);
+/* priority inheritance: until thread_inherit_priority_end() is called, the
+ * current thread is about to block, or blocked, on something |owner| holds,
+ * so |owner| (and whatever it is in turn blocked on) runs at no less than
+ * the current thread's priority */
+void thread_inherit_priority_begin(thread_t* owner);
+void thread_inherit_priority_end(void);
 void thread_set_user_callback(thread_t* t, thread_user_callback_t cb);
 thread_t* thread_create(const char* name, thread_start_routine entry, void* arg, int priority, size_t stack_size);
 thread_t* thread_create_etc(thread_t* t, const char* name, thread_start_routine entry, void* arg, int priority, void* stack, void* unsafe_stack, size_t stack_size, thread_trampoline_routine alt_trampoline);
@@ -285,6 +318,10 @@ static inline bool thread_is_real_time_or_idle(thread_t* t) {
     return !!(t->flags & (THREAD_FLAG_REAL_TIME | THREAD_FLAG_IDLE));
 }
 
+static inline bool thread_is_deadline(const thread_t* t) {
+    return t->deadline_capacity != 0;
+}
+
 /* the current thread */
 #include <arch/current_thread.h>
 thread_t* get_current_thread(void);
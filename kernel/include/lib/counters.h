@@ -54,4 +54,9 @@ static inline void kcounter_add(const struct k_counter_desc* var,
     *kcounter_slot(var) += add;
 }
 
+// The page-aligned block of the kernel image holding the counter
+// descriptors and the per-cpu arenas, laid out as zircon/kcounters.h
+// describes. It can be handed to userspace as a read-only VMO.
+void kcounters_get_block(void** base, size_t* size);
+
 __END_CDECLS
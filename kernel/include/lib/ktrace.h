@@ -23,14 +23,10 @@ struct ktrace_probe_info {
     uint32_t num;
 } __ALIGNED(16); // align on multiple of 16 to match linker packing of the ktrace_probe section
 
-void* ktrace_open(uint32_t tag);
 void ktrace_tiny(uint32_t tag, uint32_t arg);
-static inline void ktrace(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
-    uint32_t* data = (uint32_t*) ktrace_open(tag);
-    if (data) {
-        data[0] = a; data[1] = b; data[2] = c; data[3] = d;
-    }
-}
+// Writes a record of the size given by |tag|, with as many of the
+// arguments as fit after the header.
+void ktrace(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d);
 
 #define _ktrace_probe_prologue(_name) \
     static ktrace_probe_info_t info = { NULL, _name, 0 };       \
@@ -39,31 +35,25 @@ static inline void ktrace(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint
 
 #define ktrace_probe0(_name) do {                               \
     _ktrace_probe_prologue(_name);                              \
-    ktrace_open(TAG_PROBE_16(info.num));                        \
+    ktrace(TAG_PROBE_16(info.num), 0, 0, 0, 0);                 \
 } while (0)
 
 #define ktrace_probe2(_name,arg0,arg1) do {                  \
     _ktrace_probe_prologue(_name);                           \
-    uint32_t* args = (uint32_t*)ktrace_open(TAG_PROBE_24(info.num));    \
-    if (args) {                                              \
-      args[0] = arg0;                                        \
-      args[1] = arg1;                                        \
-    }                                                        \
+    ktrace(TAG_PROBE_24(info.num), arg0, arg1, 0, 0);        \
 } while (0)
 
 #define ktrace_probe64(_name,arg) do {                  \
     _ktrace_probe_prologue(_name);                           \
-    uint64_t* args = (uint64_t*)ktrace_open(TAG_PROBE_24(info.num));    \
-    if (args) {                                              \
-      *args = arg;                                           \
-    }                                                        \
+    uint64_t _arg = (arg);                                   \
+    ktrace(TAG_PROBE_24(info.num), (uint32_t)_arg,           \
+           (uint32_t)(_arg >> 32), 0, 0);                    \
 } while (0)
 
 void ktrace_name(uint32_t tag, uint32_t id, uint32_t arg, const char* name);
 int ktrace_read_user(void* ptr, uint32_t off, uint32_t len);
 zx_status_t ktrace_control(uint32_t action, uint32_t options, void* ptr);
 #else
-static inline void* ktrace_open(uint32_t tag) { return NULL; }
 static inline void ktrace_tiny(uint32_t tag, uint32_t arg) {}
 static inline void ktrace(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {}
 static inline void ktrace_probe0(const char* name) {}
@@ -81,7 +71,7 @@ static inline zx_status_t ktrace_control(uint32_t action, uint32_t options, void
 }
 #endif
 
-#define KTRACE_DEFAULT_BUFSIZE 32 // MB
+#define KTRACE_DEFAULT_BUFSIZE 32 // MB, split between the cpus
 #define KTRACE_DEFAULT_GRPMASK 0xFFF
 
 void ktrace_report_live_threads(void);
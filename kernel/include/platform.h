@@ -45,6 +45,12 @@ uint64_t ticks_per_second(void);
 /* high-precision timer current_ticks */
 uint64_t current_ticks(void);
 
+/* if current_time() is current_ticks() times a fixed scale, store the scale
+ * in |ns_per_tick| and return true, so the vDSO can compute the time without
+ * entering the kernel */
+struct fp_32_64;
+bool platform_current_time_scale(struct fp_32_64* ns_per_tick);
+
 /* super early platform initialization, before almost everything */
 void platform_early_init(void);
 
@@ -6,15 +6,19 @@
 // https://opensource.org/licenses/MIT
 #include <kernel/sched.h>
 
+#include <arch/mp.h>
 #include <assert.h>
 #include <debug.h>
 #include <err.h>
 #include <inttypes.h>
+#include <kernel/cmdline.h>
 #include <kernel/mp.h>
 #include <kernel/percpu.h>
 #include <kernel/thread.h>
+#include <lib/counters.h>
 #include <lib/ktrace.h>
 #include <list.h>
+#include <lk/init.h>
 #include <platform.h>
 #include <printf.h>
 #include <string.h>
@@ -52,11 +56,43 @@
 /* threads get 10ms to run before they use up their time slice and the scheduler is invoked */
 #define THREAD_INITIAL_TIME_SLICE ZX_MSEC(10)
 
+/* how many queued threads load balancing looks at on another cpu */
+#define BALANCE_MAX_SCAN 16
+
+/* how find_cpu_mask() places a waking thread, see kernel.sched.wakeup */
+enum wakeup_placement {
+    WAKEUP_SPREAD, /* any idle cpu */
+    WAKEUP_CACHE,  /* prefer idle cpus sharing a cache with the thread's last cpu */
+    WAKEUP_WAKER,  /* as WAKEUP_CACHE, then the waker's cpu if it shares that cache */
+};
+static enum wakeup_placement wakeup_placement = WAKEUP_CACHE;
+
+/* at most this much of a cpu can be reserved by deadline threads, so the
+ * priority scheduled threads are never starved entirely */
+#define DEADLINE_MAX_UTIL (SCHED_DEADLINE_UTIL_ONE / 20 * 19)
+
+/* limits on the deadline class period; the upper one keeps budgets below the
+ * preemption timer's sanity check */
+#define DEADLINE_MIN_PERIOD ZX_USEC(100)
+#define DEADLINE_MAX_PERIOD ZX_SEC(1)
+
+KCOUNTER(sched_steal_count, "kernel.sched.steal");
+KCOUNTER(sched_push_count, "kernel.sched.push");
+KCOUNTER(sched_migrate_count, "kernel.sched.migrate");
+KCOUNTER(sched_block_count, "kernel.sched.block");
+KCOUNTER(sched_yield_count, "kernel.sched.yield");
+KCOUNTER(sched_preempt_count, "kernel.sched.preempt");
+KCOUNTER(sched_reschedule_count, "kernel.sched.reschedule");
+KCOUNTER(sched_slice_expired_count, "kernel.sched.slice_expired");
+KCOUNTER(sched_context_switch_count, "kernel.sched.context_switch");
+
 static bool local_migrate_if_needed(thread_t* curr_thread);
 
 /* compute the effective priority of a thread */
 static int effec_priority(const thread_t* t) {
     int ep = t->base_priority + t->priority_boost;
+    if (unlikely(t->inherited_priority > ep))
+        ep = t->inherited_priority;
     DEBUG_ASSERT(ep >= LOWEST_PRIORITY && ep <= HIGHEST_PRIORITY);
     return ep;
 }
@@ -135,8 +171,89 @@ static cpu_mask_t rand_cpu(cpu_mask_t mask) {
     }
 }
 
+/* with WAKEUP_WAKER, returns true if |t| should be queued behind the thread
+ * waking it, because the waker's cpu shares a cache with |t|'s last cpu */
+static bool wakeup_near_waker(const thread_t* t, cpu_mask_t curr_cpu_mask) {
+    if (wakeup_placement != WAKEUP_WAKER || !(t->cpu_affinity & curr_cpu_mask))
+        return false;
+    if (!is_valid_cpu_num(t->last_cpu))
+        return true;
+    return (arch_cpu_package_siblings(t->last_cpu) & curr_cpu_mask) != 0;
+}
+
+/* fixed point fraction of a cpu that |capacity| every |period| takes, rounded up */
+static uint32_t deadline_util(zx_duration_t capacity, zx_duration_t period) {
+    return (uint32_t)((capacity * SCHED_DEADLINE_UTIL_ONE + period - 1) / period);
+}
+
+/* give back the bandwidth |t| reserved for the deadline class */
+static void deadline_release_bandwidth(thread_t* t) {
+    if (!thread_is_deadline(t))
+        return;
+
+    struct percpu* c = &percpu[t->deadline_cpu];
+    uint32_t util = deadline_util(t->deadline_capacity, t->deadline_period);
+    DEBUG_ASSERT(c->deadline_util >= util);
+    c->deadline_util -= util;
+    t->deadline_capacity = 0;
+}
+
+/* admission control: the cpu |t| may run on with the most deadline bandwidth
+ * left, if |util| more fits there, counting what |t| already holds as free */
+static cpu_num_t deadline_pick_cpu(const thread_t* t, uint32_t util) {
+    cpu_num_t cpu = INVALID_CPU;
+    uint32_t least = 0;
+    for (cpu_mask_t mask = t->cpu_affinity & mp_get_active_mask(); mask; mask &= mask - 1) {
+        cpu_num_t i = lowest_cpu_set(mask);
+        uint32_t used = percpu[i].deadline_util;
+        if (thread_is_deadline(t) && t->deadline_cpu == i)
+            used -= deadline_util(t->deadline_capacity, t->deadline_period);
+        if (used + util > DEADLINE_MAX_UTIL)
+            continue;
+        if (cpu == INVALID_CPU || used < least) {
+            cpu = i;
+            least = used;
+        }
+    }
+    return cpu;
+}
+
+/* the cpu a deadline thread has its bandwidth reserved on, if it may run there */
+static cpu_mask_t deadline_cpu_mask(const thread_t* t) {
+    if (!thread_is_deadline(t))
+        return 0;
+    return cpu_num_to_mask(t->deadline_cpu) & t->cpu_affinity & mp_get_active_mask();
+}
+
+/* if a deadline thread may no longer run where its bandwidth is reserved,
+ * because its affinity changed or the cpu went offline, move the reservation
+ * to a cpu it may run on. If none has room the thread drops back to the
+ * priority scheduler rather than run off another cpu's reservation. */
+static void deadline_check_reservation(thread_t* t) {
+    if (!thread_is_deadline(t) || deadline_cpu_mask(t))
+        return;
+
+    uint32_t util = deadline_util(t->deadline_capacity, t->deadline_period);
+    cpu_num_t cpu = deadline_pick_cpu(t, util);
+    LOCAL_KTRACE2("sched_deadline_move", (uint32_t)t->user_tid, cpu);
+    if (cpu == INVALID_CPU) {
+        deadline_release_bandwidth(t);
+        return;
+    }
+    DEBUG_ASSERT(percpu[t->deadline_cpu].deadline_util >= util);
+    percpu[t->deadline_cpu].deadline_util -= util;
+    percpu[cpu].deadline_util += util;
+    t->deadline_cpu = cpu;
+}
+
 /* find a cpu to wake up */
 static cpu_mask_t find_cpu_mask(thread_t* t) {
+    /* deadline threads run where their bandwidth is reserved */
+    deadline_check_reservation(t);
+    cpu_mask_t reserved = deadline_cpu_mask(t);
+    if (reserved)
+        return reserved;
+
     /* get the last cpu the thread ran on */
     cpu_mask_t last_ran_cpu_mask = cpu_num_to_mask(t->last_cpu);
 
@@ -165,6 +282,19 @@ static cpu_mask_t find_cpu_mask(thread_t* t) {
             return last_ran_cpu_mask;
         }
 
+        if (wakeup_placement != WAKEUP_SPREAD && last_ran_cpu_mask != 0) {
+            /* an idle cpu that still has the thread's working set in cache;
+             * the topology masks are precomputed, so this is two lookups */
+            cpu_mask_t near = idle_cpu_mask & arch_cpu_smt_siblings(t->last_cpu);
+            if (near == 0)
+                near = idle_cpu_mask & arch_cpu_package_siblings(t->last_cpu);
+            if (near != 0)
+                return rand_cpu(near);
+        }
+
+        if (wakeup_near_waker(t, curr_cpu_mask))
+            return curr_cpu_mask;
+
         /* pick an idle_cpu */
         DEBUG_ASSERT((idle_cpu_mask & mp_get_active_mask()) == idle_cpu_mask);
         return rand_cpu(idle_cpu_mask);
@@ -172,6 +302,9 @@ static cpu_mask_t find_cpu_mask(thread_t* t) {
 
     /* no idle cpus in our affinity mask */
 
+    if (wakeup_near_waker(t, curr_cpu_mask))
+        return curr_cpu_mask;
+
     /* if the last cpu it ran on is in the affinity mask and not the current cpu, pick that */
     if ((last_ran_cpu_mask & cpu_affinity & active_cpu_mask) &&
         last_ran_cpu_mask != curr_cpu_mask) {
@@ -195,13 +328,26 @@ static cpu_mask_t find_cpu_mask(thread_t* t) {
 }
 
 /* run queue manipulation */
+static void insert_in_deadline_queue(cpu_num_t cpu, thread_t* t) {
+    list_add_tail(&percpu[cpu].deadline_run_queue, &t->queue_node);
+
+    /* mark the cpu as busy since the run queue now has at least one item in it */
+    mp_set_cpu_busy(cpu);
+}
+
 static void insert_in_run_queue_head(cpu_num_t cpu, thread_t* t) {
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
 
+    if (thread_is_deadline(t)) {
+        insert_in_deadline_queue(cpu, t);
+        return;
+    }
+
     int ep = effec_priority(t);
 
     list_add_head(&percpu[cpu].run_queue[ep], &t->queue_node);
     percpu[cpu].run_queue_bitmap |= (1u << ep);
+    percpu[cpu].run_queue_count++;
 
     /* mark the cpu as busy since the run queue now has at least one item in it */
     mp_set_cpu_busy(cpu);
@@ -210,15 +356,36 @@ static void insert_in_run_queue_head(cpu_num_t cpu, thread_t* t) {
 static void insert_in_run_queue_tail(cpu_num_t cpu, thread_t* t) {
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
 
+    if (thread_is_deadline(t)) {
+        insert_in_deadline_queue(cpu, t);
+        return;
+    }
+
     int ep = effec_priority(t);
 
     list_add_tail(&percpu[cpu].run_queue[ep], &t->queue_node);
     percpu[cpu].run_queue_bitmap |= (1u << ep);
+    percpu[cpu].run_queue_count++;
 
     /* mark the cpu as busy since the run queue now has at least one item in it */
     mp_set_cpu_busy(cpu);
 }
 
+/* remove a ready thread from the run queue of the cpu it is assigned to */
+static void remove_from_run_queue(thread_t* t, int ep) {
+    DEBUG_ASSERT_MSG(list_in_list(&t->queue_node), "thread %p name %s curr_cpu %u\n", t, t->name, t->curr_cpu);
+    DEBUG_ASSERT(is_valid_cpu_num(t->curr_cpu));
+
+    struct percpu* c = &percpu[t->curr_cpu];
+    list_delete(&t->queue_node);
+    if (thread_is_deadline(t))
+        return;
+    if (list_is_empty(&c->run_queue[ep])) {
+        c->run_queue_bitmap &= ~(1u << ep);
+    }
+    c->run_queue_count--;
+}
+
 static thread_t* sched_get_top_thread(cpu_num_t cpu) {
     /* pop the head of the highest priority queue with any threads
      * queued up on the passed in cpu.
@@ -238,6 +405,7 @@ static thread_t* sched_get_top_thread(cpu_num_t cpu) {
 
         if (list_is_empty(&c->run_queue[highest_queue]))
             c->run_queue_bitmap &= ~(1u << highest_queue);
+        c->run_queue_count--;
 
         LOCAL_KTRACE2("sched_get_top", newthread->priority_boost, newthread->base_priority);
 
@@ -248,6 +416,76 @@ static thread_t* sched_get_top_thread(cpu_num_t cpu) {
     return &c->idle_thread;
 }
 
+/* Deadline class.
+ *
+ * A thread with deadline parameters (see sched_set_deadline()) is given
+ * |capacity| of cpu time in every |period| and runs ahead of all priority
+ * scheduled threads while it has budget left. Ready deadline threads sit in
+ * their cpu's deadline_run_queue and the one with the earliest absolute
+ * deadline runs first. A thread that uses up its budget stays queued but is
+ * throttled until its next period starts, which the cpu's deadline_timer
+ * catches. The queue is unsorted: it is only as long as the number of
+ * deadline threads on the cpu, which admission control keeps small.
+ */
+static void deadline_timer_tick(timer_t* t, zx_time_t now, void* arg) {
+    /* a throttled thread has a new budget, let the scheduler have a look */
+    get_local_percpu()->deadline_release = ZX_TIME_INFINITE;
+    thread_preempt_set_pending();
+}
+
+/* start the period that contains |now|, refilling the budget */
+static void deadline_replenish(thread_t* t, zx_time_t now) {
+    zx_time_t start = t->deadline_period_start + t->deadline_period;
+
+    /* a thread that has slept through whole periods starts afresh */
+    if (now - start >= t->deadline_period)
+        start = now;
+
+    t->deadline_period_start = start;
+    t->deadline_abs = start + t->deadline_relative;
+    t->deadline_remaining = t->deadline_capacity;
+}
+
+/* pop the deadline thread with the earliest deadline and budget left, or
+ * return NULL if there is none */
+static thread_t* deadline_get_top_thread(cpu_num_t cpu, zx_time_t now) {
+    struct percpu* c = &percpu[cpu];
+    thread_t* best = NULL;
+    zx_time_t next_release = ZX_TIME_INFINITE;
+
+    thread_t* t;
+    list_for_every_entry (&c->deadline_run_queue, t, thread_t, queue_node) {
+        zx_time_t release = t->deadline_period_start + t->deadline_period;
+        if (now >= release) {
+            deadline_replenish(t, now);
+        } else if (t->deadline_remaining == 0) {
+            next_release = MIN(next_release, release);
+            continue;
+        }
+        if (best == NULL || t->deadline_abs < best->deadline_abs)
+            best = t;
+    }
+
+    if (best) {
+        DEBUG_ASSERT(best->curr_cpu == cpu);
+        list_delete(&best->queue_node);
+    }
+
+    /* come back when the first throttled thread may run again */
+    if (next_release != c->deadline_release) {
+        c->deadline_release = next_release;
+        if (next_release == ZX_TIME_INFINITE) {
+            timer_cancel(&c->deadline_timer);
+        } else {
+            timer_reset_oneshot_local(&c->deadline_timer, next_release, deadline_timer_tick, NULL);
+        }
+    }
+
+    LOCAL_KTRACE2("sched_get_deadline", best ? (uint32_t)best->user_tid : 0, (uint32_t)next_release);
+
+    return best;
+}
+
 void sched_block(void) {
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
@@ -257,6 +495,7 @@ void sched_block(void) {
     DEBUG_ASSERT(current_thread->state != THREAD_RUNNING);
 
     LOCAL_KTRACE0("sched_block");
+    kcounter_add(sched_block_count, 1u);
 
     /* we are blocking on something. the blocking code should have already stuck us on a queue */
     sched_resched_internal();
@@ -287,6 +526,123 @@ static void find_cpu_and_insert(thread_t* t, bool* local_resched, cpu_mask_t* ac
     }
 }
 
+/* Load balancing.
+ *
+ * find_cpu_mask() spreads threads out when they wake up, but a thread that
+ * keeps running never moves again. Two things even out the queues: a cpu
+ * about to go idle steals a waiting thread from the busiest nearby cpu,
+ * and a cpu that preempts a thread while others are still waiting pushes
+ * one of them to a nearby idle cpu. Nearby means SMT siblings first, then
+ * the rest of the package, then any other cpu.
+ */
+#define BALANCE_LEVELS 3
+
+/* the cpus at topology distance |level| from |cpu| */
+static cpu_mask_t balance_domain(cpu_num_t cpu, int level) {
+    cpu_mask_t self = cpu_num_to_mask(cpu);
+    cpu_mask_t smt = arch_cpu_smt_siblings(cpu) | self;
+    switch (level) {
+    case 0:
+        return smt & ~self;
+    case 1:
+        return arch_cpu_package_siblings(cpu) & ~smt;
+    default:
+        return ~(arch_cpu_package_siblings(cpu) | smt);
+    }
+}
+
+/* find a thread queued on |cpu| that may run on one of the cpus in |mask|,
+ * looking at the highest priority threads first */
+static thread_t* find_movable_thread(cpu_num_t cpu, cpu_mask_t mask, const thread_t* skip) {
+    struct percpu* c = &percpu[cpu];
+    uint32_t bitmap = c->run_queue_bitmap;
+    int scanned = 0;
+    while (bitmap) {
+        int pri = (int)(sizeof(bitmap) * CHAR_BIT - 1) - __builtin_clz(bitmap);
+        thread_t* t;
+        list_for_every_entry (&c->run_queue[pri], t, thread_t, queue_node) {
+            if ((t->cpu_affinity & mask) && t != skip && !thread_is_idle(t))
+                return t;
+            if (++scanned == BALANCE_MAX_SCAN)
+                return NULL;
+        }
+        bitmap &= ~(1u << pri);
+    }
+    return NULL;
+}
+
+/* move a ready thread to the run queue of |cpu| */
+static void move_ready_thread(thread_t* t, cpu_num_t cpu) {
+    remove_from_run_queue(t, effec_priority(t));
+    t->curr_cpu = cpu;
+    if (t->remaining_time_slice > 0) {
+        insert_in_run_queue_head(cpu, t);
+    } else {
+        insert_in_run_queue_tail(cpu, t);
+    }
+}
+
+/* called on |cpu| when its run queue is empty; returns true if a thread was
+ * stolen onto it */
+static bool sched_steal(cpu_num_t cpu) {
+    if (!mp_is_cpu_active(cpu))
+        return false;
+
+    cpu_mask_t active = mp_get_active_mask();
+    for (int level = 0; level < BALANCE_LEVELS; level++) {
+        /* pick the cpu in this domain with the most queued threads */
+        cpu_num_t busiest = INVALID_CPU;
+        uint32_t most = 0;
+        for (cpu_mask_t mask = balance_domain(cpu, level) & active; mask; mask &= mask - 1) {
+            cpu_num_t i = lowest_cpu_set(mask);
+            if (percpu[i].run_queue_count > most) {
+                most = percpu[i].run_queue_count;
+                busiest = i;
+            }
+        }
+        if (busiest == INVALID_CPU)
+            continue;
+
+        thread_t* t = find_movable_thread(busiest, cpu_num_to_mask(cpu), NULL);
+        if (t == NULL)
+            continue;
+
+        LOCAL_KTRACE2("sched_steal", (uint32_t)t->user_tid, busiest);
+        move_ready_thread(t, cpu);
+        kcounter_add(sched_steal_count, 1u);
+        return true;
+    }
+    return false;
+}
+
+/* called on |cpu| after preempting the current thread; if other threads are
+ * waiting behind it and a nearby cpu is idle, hand one of them over */
+static void sched_push(cpu_num_t cpu) {
+    if (percpu[cpu].run_queue_count < 2)
+        return;
+
+    cpu_mask_t idle = mp_get_idle_mask() & mp_get_active_mask() & ~cpu_num_to_mask(cpu);
+    if (idle == 0)
+        return;
+
+    for (int level = 0; level < BALANCE_LEVELS; level++) {
+        cpu_mask_t mask = balance_domain(cpu, level) & idle;
+        if (mask == 0)
+            continue;
+
+        thread_t* t = find_movable_thread(cpu, mask, get_current_thread());
+        if (t == NULL)
+            continue;
+
+        cpu_num_t target = lowest_cpu_set(t->cpu_affinity & mask);
+        LOCAL_KTRACE2("sched_push", (uint32_t)t->user_tid, target);
+        move_ready_thread(t, target);
+        kcounter_add(sched_push_count, 1u);
+        mp_reschedule(MP_IPI_TARGET_MASK, cpu_num_to_mask(target), 0);
+        return;
+    }
+}
+
 bool sched_unblock(thread_t* t) {
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
@@ -361,9 +717,12 @@ void sched_yield(void) {
     DEBUG_ASSERT(!thread_is_idle(current_thread));
 
     LOCAL_KTRACE0("sched_yield");
+    kcounter_add(sched_yield_count, 1u);
 
     /* consume the rest of the time slice, deboost ourself, and go to the end of a queue */
     current_thread->remaining_time_slice = 0;
+    /* a deadline thread is done until its next period */
+    current_thread->deadline_remaining = 0;
     deboost_thread(current_thread, false);
 
     current_thread->state = THREAD_READY;
@@ -385,6 +744,7 @@ void sched_preempt(void) {
     DEBUG_ASSERT(current_thread->curr_cpu == curr_cpu);
     DEBUG_ASSERT(current_thread->last_cpu == current_thread->curr_cpu);
     LOCAL_KTRACE0("sched_preempt");
+    kcounter_add(sched_preempt_count, 1u);
 
     current_thread->state = THREAD_READY;
 
@@ -403,6 +763,10 @@ void sched_preempt(void) {
         } else {
             insert_in_run_queue_tail(curr_cpu, current_thread);
         }
+
+        /* this is driven by the time slice timer, so it is also where busy
+         * cpus periodically shed load */
+        sched_push(curr_cpu);
     }
 
     sched_resched_internal();
@@ -423,6 +787,7 @@ void sched_reschedule(void) {
     DEBUG_ASSERT(current_thread->curr_cpu == curr_cpu);
     DEBUG_ASSERT(current_thread->last_cpu == current_thread->curr_cpu);
     LOCAL_KTRACE0("sched_reschedule");
+    kcounter_add(sched_reschedule_count, 1u);
 
     current_thread->state = THREAD_READY;
 
@@ -468,6 +833,10 @@ void sched_transition_off_cpu(cpu_num_t old_cpu) {
     thread_t* t;
     bool local_resched = false;
     cpu_mask_t accum_cpu_mask = 0;
+    while ((t = list_remove_head_type(&percpu[old_cpu].deadline_run_queue, thread_t, queue_node))) {
+        find_cpu_and_insert(t, &local_resched, &accum_cpu_mask);
+        DEBUG_ASSERT(!local_resched);
+    }
     while (!thread_is_idle(t = sched_get_top_thread(old_cpu))) {
         find_cpu_and_insert(t, &local_resched, &accum_cpu_mask);
         DEBUG_ASSERT(!local_resched);
@@ -484,8 +853,13 @@ static bool local_migrate_if_needed(thread_t* curr_thread) {
     DEBUG_ASSERT(curr_thread == get_current_thread());
     DEBUG_ASSERT(curr_thread->state == THREAD_READY);
 
-    /* if the affinity mask does not include the current cpu, migrate us right now */
-    if (unlikely((curr_thread->cpu_affinity & cpu_num_to_mask(curr_thread->curr_cpu)) == 0)) {
+    /* if the affinity mask does not include the current cpu, or the thread's
+     * deadline bandwidth is reserved elsewhere, migrate us right now */
+    cpu_mask_t curr_cpu_mask = cpu_num_to_mask(curr_thread->curr_cpu);
+    deadline_check_reservation(curr_thread);
+    cpu_mask_t reserved = deadline_cpu_mask(curr_thread);
+    if (unlikely((curr_thread->cpu_affinity & curr_cpu_mask) == 0 ||
+                 (reserved && reserved != curr_cpu_mask))) {
         migrate_current_thread(curr_thread);
         return true;
     }
@@ -527,16 +901,7 @@ void sched_migrate(thread_t* t) {
         }
 
         // it's sitting in a run queue somewhere, so pull it out of that one and find a new home
-        DEBUG_ASSERT_MSG(list_in_list(&t->queue_node), "thread %p name %s curr_cpu %u\n", t, t->name, t->curr_cpu);
-        list_delete(&t->queue_node);
-
-        DEBUG_ASSERT(is_valid_cpu_num(t->curr_cpu));
-
-        struct percpu* c = &percpu[t->curr_cpu];
-        int pri = effec_priority(t);
-        if (list_is_empty(&c->run_queue[pri])) {
-            c->run_queue_bitmap &= ~(1u << pri);
-        }
+        remove_from_run_queue(t, effec_priority(t));
 
         find_cpu_and_insert(t, &local_resched, &accum_cpu_mask);
         break;
@@ -554,6 +919,39 @@ void sched_migrate(thread_t* t) {
     }
 }
 
+int sched_effective_priority(const thread_t* t) {
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    return effec_priority(t);
+}
+
+void sched_inherit_priority(thread_t* t, int pri) {
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(pri >= LOWEST_PRIORITY && pri <= HIGHEST_PRIORITY);
+
+    int old_ep = effec_priority(t);
+    t->inherited_priority = pri;
+    int ep = effec_priority(t);
+    if (ep == old_ep)
+        return;
+
+    LOCAL_KTRACE2("sched_inherit", (uint32_t)t->user_tid, ep);
+
+    /* a running or blocked thread picks up its new priority the next time
+     * it is put in a run queue, but a ready one has to move queues now.
+     * deadline threads already run ahead of every priority */
+    if (t->state != THREAD_READY || thread_is_idle(t) || thread_is_deadline(t))
+        return;
+
+    remove_from_run_queue(t, old_ep);
+    insert_in_run_queue_head(t->curr_cpu, t);
+
+    /* let a remote cpu notice it has a more important thread to run */
+    if (ep > old_ep && t->curr_cpu != arch_curr_cpu_num()) {
+        mp_reschedule(MP_IPI_TARGET_MASK, cpu_num_to_mask(t->curr_cpu), 0);
+    }
+}
+
 /* preemption timer that is set whenever a thread is scheduled */
 static void sched_timer_tick(timer_t* t, zx_time_t now, void* arg) {
     /* if the preemption timer went off on the idle or a real time thread, ignore it */
@@ -563,12 +961,17 @@ static void sched_timer_tick(timer_t* t, zx_time_t now, void* arg) {
 
     LOCAL_KTRACE2("timer_tick", (uint32_t)current_thread->user_tid, current_thread->remaining_time_slice);
 
+    /* deadline threads run until their budget is used up */
+    zx_duration_t* slice = thread_is_deadline(current_thread) ? &current_thread->deadline_remaining
+                                                              : &current_thread->remaining_time_slice;
+
     /* did this tick complete the time slice? */
     DEBUG_ASSERT(now > current_thread->last_started_running);
     zx_time_t delta = now - current_thread->last_started_running;
-    if (delta >= current_thread->remaining_time_slice) {
+    if (delta >= *slice) {
         /* we completed the time slice, do not restart it and let the scheduler run */
-        current_thread->remaining_time_slice = 0;
+        *slice = 0;
+        kcounter_add(sched_slice_expired_count, 1u);
 
         /* set a timer to go off on the time slice interval from now */
         timer_set_oneshot(t, now + THREAD_INITIAL_TIME_SLICE, sched_timer_tick, NULL);
@@ -578,7 +981,7 @@ static void sched_timer_tick(timer_t* t, zx_time_t now, void* arg) {
         thread_preempt_set_pending();
     } else {
         /* the timer tick must have fired early, reschedule and continue */
-        timer_set_oneshot(t, current_thread->last_started_running + current_thread->remaining_time_slice,
+        timer_set_oneshot(t, current_thread->last_started_running + *slice,
                           sched_timer_tick, NULL);
     }
 }
@@ -611,8 +1014,20 @@ void sched_resched_internal(void) {
 
     CPU_STATS_INC(reschedules);
 
-    /* pick a new thread to run */
-    thread_t* newthread = sched_get_top_thread(cpu);
+    /* the deadline class goes first; note the current period, picking may refill it */
+    zx_time_t period_start = current_thread->deadline_period_start;
+    thread_t* newthread = NULL;
+    if (!list_is_empty(&percpu[cpu].deadline_run_queue))
+        newthread = deadline_get_top_thread(cpu, current_time());
+
+    if (newthread == NULL) {
+        /* if there is nothing left to run here, see if a nearby cpu has work to spare */
+        if (percpu[cpu].run_queue_bitmap == 0)
+            sched_steal(cpu);
+
+        /* pick a new thread to run */
+        newthread = sched_get_top_thread(cpu);
+    }
 
     DEBUG_ASSERT(newthread);
 
@@ -624,8 +1039,23 @@ void sched_resched_internal(void) {
     LOCAL_KTRACE2("resched new pri", (uint32_t)newthread->user_tid, effec_priority(newthread));
 
     /* if it's the same thread as we're already running, exit */
-    if (newthread == oldthread)
+    if (newthread == oldthread) {
+        if (thread_is_deadline(newthread)) {
+            /* its budget may have changed under the preemption timer, so
+             * charge it for the time used and restart the timer from now */
+            zx_time_t now = current_time();
+            zx_duration_t runtime = now - newthread->last_started_running;
+            newthread->runtime_ns += runtime;
+            newthread->remaining_time_slice -= MIN(runtime, newthread->remaining_time_slice);
+            /* a refilled budget is not charged for the previous period */
+            if (newthread->deadline_period_start == period_start)
+                newthread->deadline_remaining -= MIN(runtime, newthread->deadline_remaining);
+            newthread->last_started_running = now;
+            timer_reset_oneshot_local(&percpu[cpu].preempt_timer,
+                                      now + newthread->deadline_remaining, sched_timer_tick, NULL);
+        }
         return;
+    }
 
     zx_time_t now = current_time();
 
@@ -634,6 +1064,8 @@ void sched_resched_internal(void) {
     zx_duration_t old_runtime = now - oldthread->last_started_running;
     oldthread->runtime_ns += old_runtime;
     oldthread->remaining_time_slice -= MIN(old_runtime, oldthread->remaining_time_slice);
+    if (thread_is_deadline(oldthread))
+        oldthread->deadline_remaining -= MIN(old_runtime, oldthread->deadline_remaining);
 
     /* set up quantum for the new thread if it was consumed */
     if (newthread->remaining_time_slice == 0) {
@@ -642,6 +1074,9 @@ void sched_resched_internal(void) {
 
     newthread->last_started_running = now;
 
+    if (newthread->last_cpu != cpu && newthread->last_cpu != INVALID_CPU)
+        kcounter_add(sched_migrate_count, 1u);
+
     /* mark the cpu ownership of the threads */
     if (oldthread->state != THREAD_READY)
         oldthread->curr_cpu = INVALID_CPU;
@@ -661,6 +1096,7 @@ void sched_resched_internal(void) {
     }
 
     CPU_STATS_INC(context_switches);
+    kcounter_add(sched_context_switch_count, 1u);
 
     if (thread_is_idle(oldthread)) {
         percpu[cpu].stats.idle_time += now - oldthread->last_started_running;
@@ -685,13 +1121,17 @@ void sched_resched_internal(void) {
         TRACE_CONTEXT_SWITCH("start preempt, cpu %u, old %p (%s), new %p (%s)\n",
                              cpu, oldthread, oldthread->name, newthread, newthread->name);
 
+        /* a deadline thread runs until its budget is used up */
+        zx_duration_t slice = thread_is_deadline(newthread) ? newthread->deadline_remaining
+                                                            : newthread->remaining_time_slice;
+
         /* make sure the time slice is reasonable */
-        DEBUG_ASSERT(newthread->remaining_time_slice > 0 && newthread->remaining_time_slice < ZX_SEC(1));
+        DEBUG_ASSERT(slice > 0 && slice < ZX_SEC(1));
 
         /* use a special version of the timer set api that lets it reset an existing timer efficiently, given
          * that we cannot possibly race with our own timer because interrupts are disabled.
          */
-        timer_reset_oneshot_local(&percpu[cpu].preempt_timer, now + newthread->remaining_time_slice, sched_timer_tick, NULL);
+        timer_reset_oneshot_local(&percpu[cpu].preempt_timer, now + slice, sched_timer_tick, NULL);
     }
 
     /* set some optional target debug leds */
@@ -736,9 +1176,88 @@ void sched_resched_internal(void) {
     final_context_switch(oldthread, newthread);
 }
 
+zx_status_t sched_set_deadline(thread_t* t, zx_duration_t capacity, zx_duration_t deadline,
+                               zx_duration_t period) {
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(t == get_current_thread());
+
+    uint32_t util = 0;
+    cpu_num_t cpu = INVALID_CPU;
+    if (capacity != 0) {
+        if (capacity > deadline || deadline > period ||
+            period < DEADLINE_MIN_PERIOD || period > DEADLINE_MAX_PERIOD)
+            return ZX_ERR_INVALID_ARGS;
+        if (thread_is_real_time_or_idle(t))
+            return ZX_ERR_NOT_SUPPORTED;
+
+        util = deadline_util(capacity, period);
+        cpu = deadline_pick_cpu(t, util);
+        if (cpu == INVALID_CPU)
+            return ZX_ERR_NO_RESOURCES;
+    }
+
+    /* charge the time run so far to the class it was run in */
+    zx_time_t now = current_time();
+    zx_duration_t ran = now - t->last_started_running;
+    t->runtime_ns += ran;
+    t->remaining_time_slice -= MIN(ran, t->remaining_time_slice);
+    if (thread_is_deadline(t))
+        t->deadline_remaining -= MIN(ran, t->deadline_remaining);
+    t->last_started_running = now;
+
+    deadline_release_bandwidth(t);
+
+    if (capacity != 0) {
+        percpu[cpu].deadline_util += util;
+        t->deadline_capacity = capacity;
+        t->deadline_relative = deadline;
+        t->deadline_period = period;
+        t->deadline_cpu = cpu;
+
+        /* the first period starts now */
+        t->deadline_period_start = now;
+        t->deadline_abs = now + deadline;
+        t->deadline_remaining = capacity;
+    }
+
+    LOCAL_KTRACE2("sched_set_deadline", (uint32_t)t->user_tid, util);
+
+    /* the preemption timer was set for the old class */
+    zx_duration_t slice = thread_is_deadline(t) ? t->deadline_remaining : t->remaining_time_slice;
+    if (slice > 0 && t->state == THREAD_RUNNING && !thread_is_real_time_or_idle(t)) {
+        timer_reset_oneshot_local(&percpu[arch_curr_cpu_num()].preempt_timer, now + slice,
+                                  sched_timer_tick, NULL);
+    }
+
+    return ZX_OK;
+}
+
+static void sched_init_wakeup_placement(uint level) {
+    const char* mode = cmdline_get("kernel.sched.wakeup");
+    if (mode == NULL)
+        return;
+
+    if (!strcmp(mode, "spread")) {
+        wakeup_placement = WAKEUP_SPREAD;
+    } else if (!strcmp(mode, "cache")) {
+        wakeup_placement = WAKEUP_CACHE;
+    } else if (!strcmp(mode, "waker")) {
+        wakeup_placement = WAKEUP_WAKER;
+    } else {
+        printf("sched: unknown kernel.sched.wakeup value '%s'\n", mode);
+    }
+}
+
+LK_INIT_HOOK(sched_wakeup, sched_init_wakeup_placement, LK_INIT_LEVEL_THREADING);
+
 void sched_init_early(void) {
     /* initialize the run queues */
-    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++)
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
         for (unsigned int i = 0; i < NUM_PRIORITIES; i++)
             list_initialize(&percpu[cpu].run_queue[i]);
+
+        list_initialize(&percpu[cpu].deadline_run_queue);
+        timer_init(&percpu[cpu].deadline_timer);
+        percpu[cpu].deadline_release = ZX_TIME_INFINITE;
+    }
 }
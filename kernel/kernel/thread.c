@@ -73,6 +73,7 @@ static void init_thread_struct(thread_t* t, const char* name) {
     t->magic = THREAD_MAGIC;
     strlcpy(t->name, name, sizeof(t->name));
     wait_queue_init(&t->retcode_wait_queue);
+    list_initialize(&t->pi_waiters);
 }
 
 static void initial_thread_func(void) TA_REQ(thread_lock) __NO_RETURN;
@@ -490,6 +491,10 @@ __NO_RETURN static void thread_exit_locked(thread_t* current_thread, int retcode
      */
     dpc_t free_dpc;
 
+    /* give back any bandwidth reserved for the deadline class */
+    if (thread_is_deadline(current_thread))
+        sched_set_deadline(current_thread, 0, 0, 0);
+
     /* enter the dead state */
     current_thread->state = THREAD_DEATH;
     current_thread->retcode = retcode;
@@ -1053,6 +1058,92 @@ void thread_set_priority(int priority) {
     THREAD_UNLOCK(state);
 }
 
+/**
+ * @brief Move the current thread in or out of the deadline class
+ *
+ * The thread gets |capacity| of cpu time every |period|, which it may use
+ * up to |deadline| after the period starts, ahead of all threads scheduled
+ * by priority. Passing a zero |capacity| returns it to priority scheduling.
+ *
+ * @return ZX_ERR_NO_RESOURCES if none of the thread's cpus can take on the
+ * bandwidth.
+ */
+zx_status_t thread_set_deadline(zx_duration_t capacity, zx_duration_t deadline,
+                                zx_duration_t period) {
+    thread_t* current_thread = get_current_thread();
+
+    THREAD_LOCK(state);
+
+    zx_status_t status = sched_set_deadline(current_thread, capacity, deadline, period);
+    if (status == ZX_OK)
+        sched_reschedule();
+
+    THREAD_UNLOCK(state);
+
+    return status;
+}
+
+/* how far priority is passed down a chain of threads blocked on each other */
+#define MAX_PI_CHAIN_DEPTH 16
+
+/* recompute the inherited priority of |t|, and of the threads it is blocked on */
+static void pi_update_chain(thread_t* t) TA_REQ(thread_lock) {
+    for (int depth = 0; t != NULL && depth < MAX_PI_CHAIN_DEPTH; depth++) {
+        int pri = LOWEST_PRIORITY;
+        thread_t* waiter;
+        list_for_every_entry (&t->pi_waiters, waiter, thread_t, pi_waiter_node) {
+            int wp = sched_effective_priority(waiter);
+            if (wp > pri)
+                pri = wp;
+        }
+        if (pri == t->inherited_priority)
+            return;
+        sched_inherit_priority(t, pri);
+        t = t->pi_owner;
+    }
+}
+
+/**
+ * @brief Lend the current thread's priority to the thread it is about to block on
+ *
+ * Until thread_inherit_priority_end() is called, |owner| and, transitively,
+ * the threads it is blocked on in the same way, run at no less than the
+ * current thread's priority. This bounds how long a high priority thread can
+ * be held up by a lower priority one holding something it needs.
+ */
+void thread_inherit_priority_begin(thread_t* owner) {
+    thread_t* current_thread = get_current_thread();
+
+    DEBUG_ASSERT(owner != current_thread);
+
+    THREAD_LOCK(state);
+
+    DEBUG_ASSERT(current_thread->pi_owner == NULL);
+    current_thread->pi_owner = owner;
+    list_add_tail(&owner->pi_waiters, &current_thread->pi_waiter_node);
+    pi_update_chain(owner);
+
+    THREAD_UNLOCK(state);
+}
+
+/**
+ * @brief Stop lending priority after thread_inherit_priority_begin()
+ */
+void thread_inherit_priority_end(void) {
+    thread_t* current_thread = get_current_thread();
+
+    THREAD_LOCK(state);
+
+    thread_t* owner = current_thread->pi_owner;
+    if (owner != NULL) {
+        list_delete(&current_thread->pi_waiter_node);
+        current_thread->pi_owner = NULL;
+        pi_update_chain(owner);
+    }
+
+    THREAD_UNLOCK(state);
+}
+
 /**
  * @brief  Become an idle thread
  *
@@ -28,6 +28,7 @@
 #include <kernel/stats.h>
 #include <kernel/thread.h>
 #include <kernel/timer.h>
+#include <lib/counters.h>
 #include <list.h>
 #include <malloc.h>
 #include <platform.h>
@@ -39,10 +40,156 @@
 
 static spin_lock_t timer_lock;
 
+// counts the timers whose callback ran.
+KCOUNTER(timer_fired_count, "kernel.timer.fired");
+// counts the timers coalesced with an existing one by firing them late.
+KCOUNTER(timer_coalesced_late_count, "kernel.timer.coalesced.late");
+// counts the timers coalesced with an existing one by firing them early.
+KCOUNTER(timer_coalesced_early_count, "kernel.timer.coalesced.early");
+
 void timer_init(timer_t* timer) {
     *timer = (timer_t)TIMER_INITIAL_VALUE(*timer);
 }
 
+// Each cpu's timer queue is a list sorted by scheduled_time, which keeps
+// timer_tick() and the coalescing logic below simple. To avoid walking the
+// list when inserting, it is also indexed by a treap whose in-order
+// sequence is exactly the list. The per-cpu |timer_tree| node is a sentinel
+// whose left child is the root; it is the only node with a null parent.
+// Node priorities are a hash of the node's address.
+
+static inline timer_t* tree_to_timer(struct timer_tree_node* n) {
+    return containerof(n, timer_t, tree);
+}
+
+static inline uint32_t tree_priority(const struct timer_tree_node* n) {
+    return (uint32_t)(((uint64_t)(uintptr_t)n * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+static inline bool tree_is_sentinel(const struct timer_tree_node* n) {
+    return n->parent == NULL;
+}
+
+static void tree_replace_child(struct timer_tree_node* parent,
+                               struct timer_tree_node* old_child,
+                               struct timer_tree_node* new_child) {
+    if (parent->left == old_child) {
+        parent->left = new_child;
+    } else {
+        DEBUG_ASSERT(parent->right == old_child);
+        parent->right = new_child;
+    }
+    if (new_child)
+        new_child->parent = parent;
+}
+
+// Rotates |n| above its parent, preserving the in-order sequence.
+static void tree_rotate_up(struct timer_tree_node* n) {
+    struct timer_tree_node* p = n->parent;
+    tree_replace_child(p->parent, p, n);
+    if (p->left == n) {
+        p->left = n->right;
+        if (p->left)
+            p->left->parent = p;
+        n->right = p;
+    } else {
+        p->right = n->left;
+        if (p->right)
+            p->right->parent = p;
+        n->left = p;
+    }
+    p->parent = n;
+}
+
+// Links the leaf |n| below |parent| and restores the heap order.
+static void tree_link(struct timer_tree_node* parent, struct timer_tree_node** link,
+                      struct timer_tree_node* n) {
+    n->parent = parent;
+    n->left = NULL;
+    n->right = NULL;
+    *link = n;
+    while (!tree_is_sentinel(n->parent) && tree_priority(n) > tree_priority(n->parent))
+        tree_rotate_up(n);
+}
+
+static void tree_insert_before(struct timer_tree_node* pos, struct timer_tree_node* n) {
+    if (pos->left == NULL) {
+        tree_link(pos, &pos->left, n);
+        return;
+    }
+    pos = pos->left;
+    while (pos->right)
+        pos = pos->right;
+    tree_link(pos, &pos->right, n);
+}
+
+static void tree_insert_after(struct timer_tree_node* pos, struct timer_tree_node* n) {
+    if (pos->right == NULL) {
+        tree_link(pos, &pos->right, n);
+        return;
+    }
+    pos = pos->right;
+    while (pos->left)
+        pos = pos->left;
+    tree_link(pos, &pos->left, n);
+}
+
+static void tree_remove(struct timer_tree_node* n) {
+    // Rotate |n| down until it has at most one child.
+    while (n->left && n->right) {
+        if (tree_priority(n->left) > tree_priority(n->right)) {
+            tree_rotate_up(n->left);
+        } else {
+            tree_rotate_up(n->right);
+        }
+    }
+    tree_replace_child(n->parent, n, n->left ? n->left : n->right);
+    n->parent = NULL;
+    n->left = NULL;
+    n->right = NULL;
+}
+
+// Returns the first timer in |cpu|'s queue scheduled at or after |deadline|.
+static timer_t* queue_lower_bound(uint cpu, zx_time_t deadline) {
+    timer_t* found = NULL;
+    struct timer_tree_node* n = percpu[cpu].timer_tree.left;
+    while (n) {
+        timer_t* entry = tree_to_timer(n);
+        if (entry->scheduled_time >= deadline) {
+            found = entry;
+            n = n->left;
+        } else {
+            n = n->right;
+        }
+    }
+    return found;
+}
+
+static void queue_add_before(timer_t* entry, timer_t* timer) {
+    list_add_before(&entry->node, &timer->node);
+    tree_insert_before(&entry->tree, &timer->tree);
+}
+
+static void queue_add_after(timer_t* entry, timer_t* timer) {
+    list_add_after(&entry->node, &timer->node);
+    tree_insert_after(&entry->tree, &timer->tree);
+}
+
+static void queue_add_tail(uint cpu, timer_t* timer) {
+    timer_t* tail = list_peek_tail_type(&percpu[cpu].timer_queue, timer_t, node);
+    if (tail) {
+        queue_add_after(tail, timer);
+    } else {
+        list_add_tail(&percpu[cpu].timer_queue, &timer->node);
+        tree_link(&percpu[cpu].timer_tree, &percpu[cpu].timer_tree.left, &timer->tree);
+    }
+}
+
+static void queue_delete(timer_t* timer) {
+    list_delete(&timer->node);
+    tree_remove(&timer->tree);
+}
+
 static void insert_timer_in_queue(uint cpu, timer_t* timer,
                                   uint64_t early_slack, uint64_t late_slack) {
 
@@ -65,9 +212,19 @@ static void insert_timer_in_queue(uint cpu, timer_t* timer,
     // - Let |x| be the end of the list (not a timer)
     // - Let |(| and |)| the earliest_deadline and latest_deadline.
     //
-    timer_t* entry;
+    // Every timer before the last one scheduled earlier than |t| would be
+    // skipped by the walk below, so it starts there.
+    timer_t* entry = queue_lower_bound(cpu, timer->scheduled_time);
+    if (entry != NULL) {
+        timer_t* prev = list_prev_type(&percpu[cpu].timer_queue, &entry->node, timer_t, node);
+        if (prev != NULL)
+            entry = prev;
+    } else {
+        entry = list_peek_tail_type(&percpu[cpu].timer_queue, timer_t, node);
+    }
 
-    list_for_every_entry (&percpu[cpu].timer_queue, entry, timer_t, node) {
+    for (; entry != NULL;
+         entry = list_next_type(&percpu[cpu].timer_queue, &entry->node, timer_t, node)) {
         if (entry->scheduled_time > latest_deadline) {
             // New timer latest is earlier than the current timer.
             // Just add upfront as is, without slack.
@@ -75,7 +232,7 @@ static void insert_timer_in_queue(uint cpu, timer_t* timer,
             //   ---------t---)--e-------------------------------> time
             //
             timer->slack = 0ull;
-            list_add_before(&entry->node, &timer->node);
+            queue_add_before(entry, timer);
             return;
         }
 
@@ -87,7 +244,8 @@ static void insert_timer_in_queue(uint cpu, timer_t* timer,
             //
             timer->slack = entry->scheduled_time - timer->scheduled_time;
             timer->scheduled_time = entry->scheduled_time;
-            list_add_after(&entry->node, &timer->node);
+            queue_add_after(entry, timer);
+            kcounter_add(timer_coalesced_late_count, 1u);
             return;
         }
 
@@ -148,13 +306,14 @@ static void insert_timer_in_queue(uint cpu, timer_t* timer,
         //
         timer->slack = entry->scheduled_time - timer->scheduled_time;
         timer->scheduled_time = entry->scheduled_time;
-        list_add_after(&entry->node, &timer->node);
+        queue_add_after(entry, timer);
+        kcounter_add(timer_coalesced_early_count, 1u);
         return;
     }
 
     // Walked off the end of the list and there was no overlap.
     timer->slack = 0ull;
-    list_add_tail(&percpu[cpu].timer_queue, &timer->node);
+    queue_add_tail(cpu, timer);
 }
 
 void timer_set(timer_t* timer, zx_time_t deadline,
@@ -253,7 +412,7 @@ void timer_reset_oneshot_local(timer_t* timer, zx_time_t deadline, timer_callbac
 
     /* remove it from the queue if it was present */
     if (list_in_list(&timer->node))
-        list_delete(&timer->node);
+        queue_delete(timer);
 
     /* set up the structure */
     timer->scheduled_time = deadline;
@@ -312,7 +471,7 @@ bool timer_cancel(timer_t* timer) {
         timer_t* oldhead = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
 
         /* remove our timer from the queue */
-        list_delete(&timer->node);
+        queue_delete(timer);
 
         /* TODO(cpu): if  after removing |timer| there is one other single timer with
            the same scheduled_time and slack non-zero then it is possible to return
@@ -377,7 +536,7 @@ enum handler_return timer_tick(zx_time_t now) {
         DEBUG_ASSERT_MSG(timer && timer->magic == TIMER_MAGIC,
                          "ASSERT: timer failed magic check: timer %p, magic 0x%x\n",
                          timer, (uint)timer->magic);
-        list_delete(&timer->node);
+        queue_delete(timer);
 
         /* mark the timer busy */
         timer->active_cpu = cpu;
@@ -389,6 +548,7 @@ enum handler_return timer_tick(zx_time_t now) {
         LTRACEF("dequeued timer %p, scheduled %" PRIu64 "\n", timer, timer->scheduled_time);
 
         CPU_STATS_INC(timers);
+        kcounter_add(timer_fired_count, 1u);
 
         LTRACEF("timer %p firing callback %p, arg %p\n", timer, timer->callback, timer->arg);
         timer->callback(timer, now, timer->arg);
@@ -449,7 +609,7 @@ void timer_transition_off_cpu(uint old_cpu) {
     timer_t *entry = NULL, *tmp_entry = NULL;
     /* Move all timers from old_cpu to this cpu */
     list_for_every_entry_safe (&percpu[old_cpu].timer_queue, entry, tmp_entry, timer_t, node) {
-        list_delete(&entry->node);
+        queue_delete(entry);
         // We lost the original asymmetric slack information so when we combine them
         // with the other timer queue they are not coalesced again.
         // TODO(cpu): figure how important this case is.
@@ -485,6 +645,7 @@ void timer_queue_init(void) {
     timer_lock = SPIN_LOCK_INITIAL_VALUE;
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
         list_initialize(&percpu[i].timer_queue);
+        percpu[i].timer_tree = (struct timer_tree_node){NULL, NULL, NULL};
     }
 }
 
@@ -6,6 +6,7 @@
 
 #include <lib/counters.h>
 
+#include <assert.h>
 #include <string.h>
 
 #include <arch/ops.h>
@@ -16,8 +17,14 @@
 
 #include <lib/console.h>
 
-// The arena is allocated in kernel.ld, which see.
+#include <zircon/kcounters.h>
+
+// The arena is allocated in kernel.ld, which see.  It is preceded by the
+// table userspace reads the counter names from, and followed by the page
+// aligned end of the block.
 extern uint64_t kcounters_arena[];
+extern uint8_t kcounters_table[];
+extern uint8_t kcounters_end[];
 
 static size_t get_num_counters() {
     return kcountdesc_end - kcountdesc_begin;
@@ -57,6 +64,27 @@ static void counters_init(unsigned level) {
     for (size_t ix = 0; ix != SMP_MAX_CPUS; ++ix) {
         percpu[ix].counters = &kcounters_arena[ix * get_num_counters()];
     }
+
+    // Describe the arenas for userspace, in the room kernel.ld left.
+    auto header = reinterpret_cast<kcounters_header_t*>(kcounters_table);
+    auto descs = reinterpret_cast<kcounters_desc_t*>(header + 1);
+    ASSERT(reinterpret_cast<uint8_t*>(descs + get_num_counters()) <=
+           reinterpret_cast<uint8_t*>(kcounters_arena));
+
+    header->magic = KCOUNTERS_MAGIC;
+    header->num_counters = static_cast<uint32_t>(get_num_counters());
+    header->arena_offset = reinterpret_cast<uint8_t*>(kcounters_arena) - kcounters_table;
+    for (size_t ix = 0; ix != get_num_counters(); ++ix) {
+        strlcpy(descs[ix].name, kcountdesc_begin[ix].name, sizeof(descs[ix].name));
+    }
+}
+
+void kcounters_get_block(void** base, size_t* size) {
+    // Not known yet when counters_init() runs.
+    reinterpret_cast<kcounters_header_t*>(kcounters_table)->num_cpus = arch_max_num_cpus();
+
+    *base = kcounters_table;
+    *size = kcounters_end - kcounters_table;
 }
 
 static void dump_counter(const k_counter_desc* desc) {
@@ -15,11 +15,14 @@
 
 #include <debug.h>
 #include <err.h>
+#include <kernel/align.h>
 #include <kernel/mutex.h>
 #include <kernel/spinlock.h>
 #include <kernel/thread.h>
 #include <vm/vm.h>
+#include <lib/counters.h>
 #include <lib/heap.h>
+#include <lk/init.h>
 #include <platform.h>
 #include <trace.h>
 
@@ -113,6 +116,16 @@
 //   Exception: to avoid OS free/alloc churn when right on the edge, the heap
 //   will try to hold onto one entirely-free, non-large OS allocation instead of
 //   returning it to the OS. See cached_os_alloc.
+//
+// Per-cpu caches:
+//   Small allocations (up to CACHE_MAX_SIZE bytes) are served from per-cpu
+//   stacks of memory areas, one per bucket, so that the common case does not
+//   take the heap lock. As far as the rest of the heap is concerned a cached
+//   area is allocated. Empty stacks are refilled, and full stacks are drained,
+//   in batches of CACHE_BATCH areas under a single acquisition of the heap
+//   lock. cmpct_trim() drains all of the caches back into the heap. Since a
+//   cached area is not tagged as free, debug builds look for it in the caches
+//   to catch double frees.
 
 #if defined(DEBUG) || LK_DEBUGLEVEL > 2
 #define CMPCT_DEBUG
@@ -206,6 +219,9 @@ struct heap {
 static struct heap theheap;
 
 static ssize_t heap_grow(size_t len, free_t** bucket);
+static void cache_dump(bool panic_time);
+static void cache_drain_all(void);
+static size_t cache_bytes(void);
 
 static void lock(void) TA_ACQ(theheap.lock) {
     mutex_acquire(&theheap.lock);
@@ -247,12 +263,17 @@ void cmpct_dump(bool panic_time) TA_NO_THREAD_SAFETY_ANALYSIS {
     if (!panic_time) {
         unlock();
     }
+
+    cache_dump(panic_time);
 }
 
 void cmpct_get_info(size_t* size_bytes, size_t* free_bytes) {
+    // Areas parked in the per-cpu caches are free as far as the callers are
+    // concerned, even though the heap counts them as allocated.
+    size_t cached = cache_bytes();
     lock();
     *size_bytes = theheap.size;
-    *free_bytes = theheap.remaining;
+    *free_bytes = theheap.remaining + cached;
     unlock();
 }
 
@@ -311,6 +332,16 @@ static int size_to_index_freeing(size_t size) {
     return size_to_index_helper(size, &dummy, 0, 0);
 }
 
+// The usable size of the memory areas in the given bucket; the inverse of
+// size_to_index_helper().
+static size_t bucket_size(int bucket) {
+    if (bucket < 15) {
+        return (bucket + 1) * 8;
+    }
+    int row_column = bucket - 15 + 32;
+    return (8 + (row_column & 7)) << (row_column >> 3);
+}
+
 static inline header_t* tag_as_free(void* left) {
     return (header_t*)((uintptr_t)left | FREE_BIT);
 }
@@ -476,6 +507,274 @@ static void* create_allocation_header(
     return standalone + 1;
 }
 
+static void* large_alloc(size_t size);
+static void* alloc_locked(size_t size) TA_REQ(theheap.lock);
+static void free_locked(void* payload) TA_REQ(theheap.lock);
+
+// Allocations up to this size are served from the per-cpu caches.
+#define CACHE_MAX_SIZE 2048u
+// The number of buckets that have a per-cpu cache: all of them up to and
+// including the one for CACHE_MAX_SIZE (see size_to_index_helper()).
+#define CACHE_BUCKETS (15 + (11 - 7) * 8 + 1)
+// The number of memory areas each cpu can hold per bucket.
+#define CACHE_DEPTH 16
+// The number of memory areas moved between a cache and the heap at a time.
+#define CACHE_BATCH (CACHE_DEPTH / 2)
+
+typedef struct cache_stats {
+    size_t alloc_hits;
+    size_t alloc_misses;
+    size_t frees;
+    size_t drains;
+} cache_stats_t;
+
+typedef struct cpu_cache {
+    // Guards everything below. Only taken with interrupts disabled.
+    spin_lock_t lock;
+    int count[CACHE_BUCKETS];
+    // Stacks of allocated memory areas, hottest last. These are payload
+    // pointers, as returned by cmpct_alloc().
+    void* areas[CACHE_BUCKETS][CACHE_DEPTH];
+    cache_stats_t stats[CACHE_BUCKETS];
+} __CPU_ALIGN cpu_cache_t;
+
+static cpu_cache_t cpu_caches[SMP_MAX_CPUS];
+
+// Set once the per-cpu state and the kernel counters are up; until then
+// everything goes straight to the heap.
+static bool cache_enabled;
+
+KCOUNTER(heap_cache_alloc_hit, "kernel.heap.cache.alloc_hit");
+KCOUNTER(heap_cache_alloc_miss, "kernel.heap.cache.alloc_miss");
+KCOUNTER(heap_cache_free_hit, "kernel.heap.cache.free_hit");
+KCOUNTER(heap_cache_drain, "kernel.heap.cache.drain");
+
+static void cache_init(uint level) {
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        spin_lock_init(&cpu_caches[i].lock);
+    }
+    cache_enabled = true;
+}
+LK_INIT_HOOK(heap_cache, &cache_init, LK_INIT_LEVEL_VM);
+
+// Disables interrupts and locks the cache of the cpu we end up running on.
+// Interrupts stay disabled until cache_release(), so we can't migrate.
+static cpu_cache_t* cache_acquire(spin_lock_saved_state_t* state)
+    TA_NO_THREAD_SAFETY_ANALYSIS {
+    arch_interrupt_save(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    cpu_cache_t* cache = &cpu_caches[arch_curr_cpu_num()];
+    spin_lock(&cache->lock);
+    return cache;
+}
+
+static void cache_release(cpu_cache_t* cache, spin_lock_saved_state_t state)
+    TA_NO_THREAD_SAFETY_ANALYSIS {
+    spin_unlock(&cache->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+static void* cache_alloc(size_t size) {
+    size_t rounded_up;
+    size_to_index_allocating(size, &rounded_up);
+    // Index by the size actually handed out, so that the tiny sizes that get
+    // rounded up to the minimum area share a bucket with it.
+    int bucket = size_to_index_freeing(rounded_up);
+    DEBUG_ASSERT(bucket < CACHE_BUCKETS);
+
+    spin_lock_saved_state_t state;
+    cpu_cache_t* cache = cache_acquire(&state);
+    if (cache->count[bucket] > 0) {
+        void* result = cache->areas[bucket][--cache->count[bucket]];
+        cache->stats[bucket].alloc_hits++;
+        kcounter_add(heap_cache_alloc_hit, 1u);
+        cache_release(cache, state);
+#ifdef CMPCT_DEBUG
+        memset(result, ALLOC_FILL, size);
+#endif
+        return result;
+    }
+    cache->stats[bucket].alloc_misses++;
+    kcounter_add(heap_cache_alloc_miss, 1u);
+    cache_release(cache, state);
+
+    // The heap lock is a mutex, so the batch has to be carved out before
+    // taking the cache lock again.
+    void* batch[CACHE_BATCH];
+    int n = 0;
+    lock();
+    while (n < CACHE_BATCH) {
+        void* area = alloc_locked(rounded_up);
+        if (area == NULL) {
+            break;
+        }
+        batch[n++] = area;
+    }
+    unlock();
+    if (n == 0) {
+        return NULL;
+    }
+
+    // Keep the first area for the caller and stash the rest. We may have
+    // migrated to a cpu whose cache has filled up in the meantime, in which
+    // case the leftovers go straight back.
+    int i = 1;
+    cache = cache_acquire(&state);
+    for (; i < n && cache->count[bucket] < CACHE_DEPTH; i++) {
+        cache->areas[bucket][cache->count[bucket]++] = batch[i];
+    }
+    cache_release(cache, state);
+    if (i < n) {
+        lock();
+        for (; i < n; i++) {
+            free_locked(batch[i]);
+        }
+        unlock();
+    }
+    return batch[0];
+}
+
+#ifdef CMPCT_DEBUG
+// Returns true if any cpu's cache holds |payload| in |bucket|. A cached area
+// still looks allocated, so this is the only way to tell that freeing it
+// again is a double free.
+static bool cache_holds(int bucket, void* payload) {
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        cpu_cache_t* cache = &cpu_caches[cpu];
+        bool found = false;
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&cache->lock, state);
+        for (int i = 0; i < cache->count[bucket]; i++) {
+            if (cache->areas[bucket][i] == payload) {
+                found = true;
+                break;
+            }
+        }
+        spin_unlock_irqrestore(&cache->lock, state);
+        if (found) {
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+// Parks the allocated area |header| in the current cpu's cache, draining the
+// coldest half of the cache to the heap if it is full. Returns false if the
+// area is too large to be cached.
+static bool cache_free(header_t* header) {
+    int bucket = size_to_index_freeing(header->size - sizeof(header_t));
+    if (bucket >= CACHE_BUCKETS) {
+        return false;
+    }
+    void* payload = header + 1;
+#ifdef CMPCT_DEBUG
+    if (cache_holds(bucket, payload)) {
+        panic("cmpct_free: double free of cached area %p\n", payload);
+    }
+    memset(payload, FREE_FILL, header->size - sizeof(header_t));
+#endif
+
+    spin_lock_saved_state_t state;
+    cpu_cache_t* cache = cache_acquire(&state);
+    cache->stats[bucket].frees++;
+    kcounter_add(heap_cache_free_hit, 1u);
+    if (cache->count[bucket] < CACHE_DEPTH) {
+        cache->areas[bucket][cache->count[bucket]++] = payload;
+        cache_release(cache, state);
+        return true;
+    }
+
+    void* batch[CACHE_BATCH];
+    memcpy(batch, cache->areas[bucket], sizeof(batch));
+    memmove(cache->areas[bucket], cache->areas[bucket] + CACHE_BATCH,
+            (CACHE_DEPTH - CACHE_BATCH) * sizeof(void*));
+    cache->count[bucket] -= CACHE_BATCH;
+    cache->areas[bucket][cache->count[bucket]++] = payload;
+    cache->stats[bucket].drains++;
+    kcounter_add(heap_cache_drain, 1u);
+    cache_release(cache, state);
+
+    lock();
+    for (int i = 0; i < CACHE_BATCH; i++) {
+        free_locked(batch[i]);
+    }
+    unlock();
+    return true;
+}
+
+// Returns every area held by every cpu's cache to the heap.
+static void cache_drain_all(void) {
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        cpu_cache_t* cache = &cpu_caches[cpu];
+        for (int bucket = 0; bucket < CACHE_BUCKETS; bucket++) {
+            void* batch[CACHE_DEPTH];
+            spin_lock_saved_state_t state;
+            spin_lock_irqsave(&cache->lock, state);
+            int n = cache->count[bucket];
+            memcpy(batch, cache->areas[bucket], n * sizeof(void*));
+            cache->count[bucket] = 0;
+            spin_unlock_irqrestore(&cache->lock, state);
+
+            if (n > 0) {
+                lock();
+                for (int i = 0; i < n; i++) {
+                    free_locked(batch[i]);
+                }
+                unlock();
+            }
+        }
+    }
+}
+
+// The total size of the areas held by all of the caches, headers included,
+// to match theheap.remaining.
+static size_t cache_bytes(void) {
+    size_t total = 0;
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        cpu_cache_t* cache = &cpu_caches[cpu];
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&cache->lock, state);
+        for (int bucket = 0; bucket < CACHE_BUCKETS; bucket++) {
+            for (int i = 0; i < cache->count[bucket]; i++) {
+                total += ((header_t*)cache->areas[bucket][i] - 1)->size;
+            }
+        }
+        spin_unlock_irqrestore(&cache->lock, state);
+    }
+    return total;
+}
+
+static void cache_dump(bool panic_time) TA_NO_THREAD_SAFETY_ANALYSIS {
+    dprintf(INFO, "\tper-cpu caches:\n");
+    dprintf(INFO, "\t%6s %8s %12s %12s %12s %10s\n",
+            "size", "cached", "alloc hits", "alloc misses", "frees", "drains");
+    for (int bucket = 0; bucket < CACHE_BUCKETS; bucket++) {
+        cache_stats_t total = {};
+        size_t cached = 0;
+        for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            cpu_cache_t* cache = &cpu_caches[cpu];
+            spin_lock_saved_state_t state;
+            if (!panic_time) {
+                spin_lock_irqsave(&cache->lock, state);
+            }
+            cached += cache->count[bucket];
+            total.alloc_hits += cache->stats[bucket].alloc_hits;
+            total.alloc_misses += cache->stats[bucket].alloc_misses;
+            total.frees += cache->stats[bucket].frees;
+            total.drains += cache->stats[bucket].drains;
+            if (!panic_time) {
+                spin_unlock_irqrestore(&cache->lock, state);
+            }
+        }
+        if (total.alloc_misses + total.frees == 0) {
+            continue;
+        }
+        dprintf(INFO, "\t%6zu %8zu %12zu %12zu %12zu %10zu\n",
+                bucket_size(bucket), cached, total.alloc_hits, total.alloc_misses, total.frees,
+                total.drains);
+    }
+}
+
 static void FixLeftPointer(header_t* right, header_t* new_left) {
     int tag = (uintptr_t)right->left & 1;
     right->left = (header_t*)(((uintptr_t)new_left & ~1) | tag);
@@ -678,12 +977,34 @@ static void cmpct_test_buckets(void) {
     }
 }
 
+// The tests below look at the state of the free buckets, which the per-cpu
+// caches would hide, so they allocate and free straight from the heap. Other
+// cpus keep using the caches meanwhile.
+static void* test_alloc(size_t size) {
+    if (size + sizeof(header_t) > HEAP_LARGE_ALLOC_BYTES) {
+        return large_alloc(size);
+    }
+    lock();
+    void* result = alloc_locked(size);
+    unlock();
+    return result;
+}
+
+static void test_free(void* payload) {
+    if (payload == NULL) {
+        return;
+    }
+    lock();
+    free_locked(payload);
+    unlock();
+}
+
 static void cmpct_test_get_back_newly_freed_helper(size_t size) {
-    void* allocated = cmpct_alloc(size);
+    void* allocated = test_alloc(size);
     if (allocated == NULL) {
         return;
     }
-    char* allocated2 = cmpct_alloc(8);
+    char* allocated2 = test_alloc(8);
     char* expected_position = (char*)allocated + size;
     if (allocated2 < expected_position ||
         allocated2 > expected_position + 128) {
@@ -691,18 +1012,18 @@ static void cmpct_test_get_back_newly_freed_helper(size_t size) {
         // first allocation then the test may not work as expected (the memory
         // may be returned to the OS when we free the first allocation, and we
         // might not get it back).
-        cmpct_free(allocated);
-        cmpct_free(allocated2);
+        test_free(allocated);
+        test_free(allocated2);
         return;
     }
 
-    cmpct_free(allocated);
-    void* allocated3 = cmpct_alloc(size);
+    test_free(allocated);
+    void* allocated3 = test_alloc(size);
     // To avoid churn and fragmentation we would want to get the newly freed
     // memory back again when we allocate the same size shortly after.
     ASSERT(allocated3 == allocated);
-    cmpct_free(allocated2);
-    cmpct_free(allocated3);
+    test_free(allocated2);
+    test_free(allocated3);
 }
 
 static void cmpct_test_get_back_newly_freed(void) {
@@ -724,10 +1045,10 @@ static void cmpct_test_return_to_os(void) {
     size_t remaining = theheap.remaining;
     // This goes in a new OS allocation since the trim above removed any free
     // area big enough to contain it.
-    void* a = cmpct_alloc(5000);
-    void* b = cmpct_alloc(2500);
-    cmpct_free(a);
-    cmpct_free(b);
+    void* a = test_alloc(5000);
+    void* b = test_alloc(2500);
+    test_free(a);
+    test_free(b);
     // If things work as expected the new allocation is at the start of an OS
     // allocation.  There's just one sentinel and one header to the left of it.
     // It that's not the case then the allocation was met from some space in
@@ -851,6 +1172,10 @@ static void* large_alloc(size_t size) {
 }
 
 void cmpct_trim(void) {
+    // Give back whatever the per-cpu caches are holding first, so that it can
+    // be coalesced.
+    cache_drain_all();
+
     // Look at free list entries that are at least as large as one page plus a
     // header. They might be at the start or the end of a block, so we can trim
     // them and free the page(s).
@@ -943,26 +1268,13 @@ void cmpct_trim(void) {
     unlock();
 }
 
-void* cmpct_alloc(size_t size) {
-    if (size == 0u) {
-        return NULL;
-    }
-
-    // TODO(dbort): Look into the large vs. small threshold. A "small"
-    // allocation of 0x3ff000 and a "large" allocation of 0x400000 will both
-    // allocate 0x401000 bytes from the OS; seems like there should be a sharper
-    // distinction. The problem seems to be that growby is rounded up to a
-    // bucket size, then heap_grow adds 2*header_t and rounds up to a page.
-    if (size + sizeof(header_t) > HEAP_LARGE_ALLOC_BYTES) {
-        return large_alloc(size);
-    }
-
+// Allocates a non-large memory area from the free buckets.
+static void* alloc_locked(size_t size) TA_REQ(theheap.lock) {
     size_t rounded_up;
     int start_bucket = size_to_index_allocating(size, &rounded_up);
 
     rounded_up += sizeof(header_t);
 
-    lock();
     int bucket = find_nonempty_bucket(start_bucket);
     if (bucket == -1) {
         // Grow heap by at least 12% if we can.
@@ -973,7 +1285,6 @@ void* cmpct_alloc(size_t size) {
         // we succeed or get too small.
         while (heap_grow(growby, NULL) < 0) {
             if (growby <= rounded_up) {
-                unlock();
                 return NULL;
             }
             growby = MAX(growby >> 1, rounded_up);
@@ -1005,6 +1316,29 @@ void* cmpct_alloc(size_t size) {
     memset(((char*)result) + size, PADDING_FILL,
            rounded_up - size - sizeof(header_t));
 #endif
+    return result;
+}
+
+void* cmpct_alloc(size_t size) {
+    if (size == 0u) {
+        return NULL;
+    }
+
+    // TODO(dbort): Look into the large vs. small threshold. A "small"
+    // allocation of 0x3ff000 and a "large" allocation of 0x400000 will both
+    // allocate 0x401000 bytes from the OS; seems like there should be a sharper
+    // distinction. The problem seems to be that growby is rounded up to a
+    // bucket size, then heap_grow adds 2*header_t and rounds up to a page.
+    if (size + sizeof(header_t) > HEAP_LARGE_ALLOC_BYTES) {
+        return large_alloc(size);
+    }
+
+    if (size <= CACHE_MAX_SIZE && cache_enabled) {
+        return cache_alloc(size);
+    }
+
+    lock();
+    void* result = alloc_locked(size);
     unlock();
     return result;
 }
@@ -1039,14 +1373,11 @@ void* cmpct_memalign(size_t size, size_t alignment) {
     return payload;
 }
 
-void cmpct_free(void* payload) {
-    if (payload == NULL) {
-        return;
-    }
+// Returns a memory area to the free buckets, coalescing it with its
+// neighbors.
+static void free_locked(void* payload) TA_REQ(theheap.lock) {
     header_t* header = (header_t*)payload - 1;
-    DEBUG_ASSERT(!is_tagged_as_free(header)); // Double free!
     size_t size = header->size;
-    lock();
     header_t* left = header->left;
     if (left != NULL && is_tagged_as_free(left)) {
         // Coalesce with left free object.
@@ -1075,6 +1406,19 @@ void cmpct_free(void* payload) {
             free_memory(header, left, size);
         }
     }
+}
+
+void cmpct_free(void* payload) {
+    if (payload == NULL) {
+        return;
+    }
+    header_t* header = (header_t*)payload - 1;
+    DEBUG_ASSERT(!is_tagged_as_free(header)); // Double free!
+    if (cache_enabled && cache_free(header)) {
+        return;
+    }
+    lock();
+    free_locked(payload);
     unlock();
 }
 
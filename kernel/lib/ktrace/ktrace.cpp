@@ -6,18 +6,25 @@
 
 #include <debug.h>
 #include <err.h>
+#include <inttypes.h>
 #include <platform.h>
 #include <string.h>
 
 #include <arch/ops.h>
+#include <arch/spinlock.h>
 #include <arch/user_copy.h>
+#include <fbl/algorithm.h>
+#include <kernel/align.h>
 #include <kernel/cmdline.h>
+#include <kernel/mp.h>
 #include <vm/vm_aspace.h>
 #include <lib/ktrace.h>
 #include <lk/init.h>
 #include <zircon/thread_annotations.h>
 #include <object/thread_dispatcher.h>
 
+#include "ktrace_priv.h"
+
 #define ktrace_timestamp() current_ticks();
 #define ktrace_ticks_per_ms() (ticks_per_second() / 1000)
 
@@ -76,87 +83,266 @@ static void ktrace_report_probes(void) {
     }
 }
 
-typedef struct ktrace_state {
-    // where the next record will be written
-    int offset;
-
-    // mask of groups we allow, 0 == tracing disabled
-    int grpmask;
+static ktrace_state_t KTRACE_STATE;
 
-    // total size of the trace buffer
-    uint32_t bufsize;
+// Serializes readers and the control actions.
+static fbl::Mutex ktrace_lock;
+
+// The records between |tail| and |head| sit in at most two runs: the rest of
+// |tail|'s lap up to the skipped space, and the start of |head|'s lap.
+void ktrace_spans(const ktrace_state_t* ks, const ktrace_cpu_t* kc,
+                  uint64_t tail, uint64_t head, ktrace_span_t span[2]) {
+    uint32_t toff = (uint32_t)(tail % ks->cpusize);
+    if (tail / ks->cpusize == head / ks->cpusize) {
+        span[0] = { toff, (uint32_t)(head - tail) };
+        span[1] = { 0, 0 };
+    } else {
+        uint32_t wrap = (uint32_t)atomic_load_u64((volatile uint64_t*)&kc->wrap);
+        span[0] = { toff, wrap > toff ? wrap - toff : 0 };
+        span[1] = { 0, (uint32_t)(head % ks->cpusize) };
+    }
+}
 
-    // offset where tracing was stopped, 0 if tracing active
-    uint32_t marker;
+// Moves |tail| forward by |n| bytes of records, stepping over the skipped
+// space at the end of the lap if the move crosses it.
+uint64_t ktrace_advance(const ktrace_state_t* ks, uint64_t tail,
+                        const ktrace_span_t span[2], uint32_t n) {
+    if (n < span[0].len || span[1].len == 0) {
+        return tail + n;
+    }
+    return (tail / ks->cpusize + 1) * ks->cpusize + (n - span[0].len);
+}
 
-    // raw trace buffer
-    uint8_t* buffer;
-} ktrace_state_t;
+// Copies |len| bytes of |kc|'s records to |ptr|, starting |skip| bytes in.
+static zx_status_t ktrace_copy_spans(const ktrace_cpu_t* kc, const ktrace_span_t span[2],
+                                     uint32_t skip, uint8_t* ptr, uint32_t len) {
+    for (int i = 0; i < 2 && len > 0; i++) {
+        if (skip >= span[i].len) {
+            skip -= span[i].len;
+            continue;
+        }
+        uint32_t n = fbl::min(span[i].len - skip, len);
+        if (arch_copy_to_user(ptr, kc->buffer + span[i].off + skip, n) != ZX_OK) {
+            return ZX_ERR_INVALID_ARGS;
+        }
+        ptr += n;
+        len -= n;
+        skip = 0;
+    }
+    return ZX_OK;
+}
 
-static ktrace_state_t KTRACE_STATE;
+// Circular mode: the trace reads as the metadata followed by each cpu's
+// records in turn. The rings only stay still while tracing is stopped, so
+// that is the only time they can be read; the size can always be asked for,
+// but while tracing runs it is only a snapshot.
+static int ktrace_read_snapshot(ktrace_state_t* ks, uint8_t* ptr, uint32_t off, uint32_t len)
+    TA_REQ(ktrace_lock) {
+    if (ptr != nullptr && atomic_load(&ks->grpmask)) {
+        return ZX_ERR_BAD_STATE;
+    }
 
-int ktrace_read_user(void* ptr, uint32_t off, uint32_t len) {
-    ktrace_state_t* ks = &KTRACE_STATE;
+    uint32_t total = 0;
+    uint32_t done = 0;
+    ktrace_span_t span[2];
 
-    // Buffer size is limited by the marker if set,
-    // otherwise limited by offset (last written point).
-    // Offset can end up pointing past the end, so clip
-    // it to the actual buffer size to be safe.
-    uint32_t max;
-    if (ks->marker) {
-        max = ks->marker;
-    } else {
-        max = ks->offset;
-        if (max > ks->bufsize) {
-            max = ks->bufsize;
+    // the metadata is the first part of the trace
+    uint32_t hlen = sizeof(ks->header);
+    if (ptr != nullptr && off < hlen) {
+        uint32_t n = fbl::min(hlen - off, len);
+        if (arch_copy_to_user(ptr, (uint8_t*)ks->header + off, n) != ZX_OK) {
+            return ZX_ERR_INVALID_ARGS;
         }
+        done = n;
+    }
+    total = hlen;
+
+    for (uint32_t cpu = 0; cpu < ks->ncpus; cpu++) {
+        ktrace_cpu_t* kc = &ks->cpu[cpu];
+        // |tail| first: it never passes the |head| read after it
+        uint64_t tail = atomic_load_u64(&kc->tail);
+        ktrace_spans(ks, kc, tail, atomic_load_u64(&kc->head), span);
+        uint32_t clen = ktrace_span_len(span);
+        uint32_t pos = off + done;
+        if (ptr != nullptr && done < len && pos < total + clen) {
+            uint32_t n = fbl::min(total + clen - pos, len - done);
+            zx_status_t status = ktrace_copy_spans(kc, span, pos - total, ptr + done, n);
+            if (status != ZX_OK) {
+                return status;
+            }
+            done += n;
+        }
+        total += clen;
     }
 
     // null read is a query for trace buffer size
+    return ptr == nullptr ? (int)total : (int)done;
+}
+
+// Streaming mode: hands out the metadata and then the records of one cpu at
+// a time, each up to where that cpu had written when the reader reached it.
+// Whatever is read is gone, and the ring space goes back to the writer.
+static int ktrace_read_drain(ktrace_state_t* ks, uint8_t* ptr, uint32_t len)
+    TA_REQ(ktrace_lock) {
+    uint32_t hlen = sizeof(ks->header);
+    ktrace_span_t span[2];
+
+    // null read is a query for how much can be read right now
     if (ptr == nullptr) {
-        return max;
+        uint32_t avail = hlen - ks->header_pos;
+        for (uint32_t cpu = 0; cpu < ks->ncpus; cpu++) {
+            ktrace_cpu_t* kc = &ks->cpu[cpu];
+            ktrace_spans(ks, kc, kc->tail, atomic_load_u64(&kc->head), span);
+            avail += ktrace_span_len(span);
+        }
+        return avail;
     }
 
-    // constrain read to available buffer
-    if (off >= max) {
-        return 0;
+    uint32_t done = 0;
+    if (ks->header_pos < hlen) {
+        done = fbl::min(hlen - ks->header_pos, len);
+        if (arch_copy_to_user(ptr, (uint8_t*)ks->header + ks->header_pos, done) != ZX_OK) {
+            return ZX_ERR_INVALID_ARGS;
+        }
+        ks->header_pos += done;
     }
-    if (len > (max - off)) {
-        len = max - off;
+
+    // a cpu is finished with before moving on, so its records stay whole;
+    // stop once every ring has been found empty
+    for (uint32_t empty = 0; done < len && empty <= ks->ncpus;) {
+        ktrace_cpu_t* kc = &ks->cpu[ks->read_cpu];
+        uint64_t tail = kc->tail;
+        if (tail == ks->read_head) {
+            ks->read_cpu = (ks->read_cpu + 1) % ks->ncpus;
+            ks->read_head = atomic_load_u64(&ks->cpu[ks->read_cpu].head);
+            empty++;
+            continue;
+        }
+        empty = 0;
+
+        ktrace_spans(ks, kc, tail, ks->read_head, span);
+        uint32_t n = fbl::min(ktrace_span_len(span), len - done);
+        zx_status_t status = ktrace_copy_spans(kc, span, 0, ptr + done, n);
+        if (status != ZX_OK) {
+            return status;
+        }
+        atomic_store_u64(&kc->tail, ktrace_advance(ks, tail, span, n));
+        done += n;
     }
+    return done;
+}
 
-    if (arch_copy_to_user(ptr, ks->buffer + off, len) != ZX_OK) {
-        return ZX_ERR_INVALID_ARGS;
+int ktrace_read_user(void* ptr, uint32_t off, uint32_t len) {
+    ktrace_state_t* ks = &KTRACE_STATE;
+    if (ks->ncpus == 0) {
+        return ptr == nullptr ? 0 : ZX_ERR_BAD_STATE;
+    }
+
+    fbl::AutoLock lock(&ktrace_lock);
+    if (ks->mode == KTRACE_MODE_STREAMING) {
+        return ktrace_read_drain(ks, (uint8_t*)ptr, len);
     }
-    return len;
+    return ktrace_read_snapshot(ks, (uint8_t*)ptr, off, len);
+}
+
+static void ktrace_sync_task(void* context) {
+}
+
+// Waits for the writers that saw tracing enabled before |grpmask| was
+// cleared to publish their records. Writers run with interrupts disabled
+// from the time ktrace_reserve() checks |grpmask| until ktrace_commit(), so
+// once every other cpu has taken an interrupt none of them is left. The
+// calling thread is not in the write path.
+static void ktrace_quiesce(void) {
+    mp_sync_exec(MP_IPI_TARGET_ALL_BUT_LOCAL, 0, ktrace_sync_task, nullptr);
+}
+
+// Empties every ring. Only done while tracing is stopped and quiesced.
+static void ktrace_reset(ktrace_state_t* ks) TA_REQ(ktrace_lock) {
+    for (uint32_t cpu = 0; cpu < ks->ncpus; cpu++) {
+        ktrace_cpu_t* kc = &ks->cpu[cpu];
+        atomic_store_u64(&kc->tail, 0);
+        atomic_store_u64(&kc->wrap, 0);
+        atomic_store_u64(&kc->head, 0);
+        kc->dropped = 0;
+    }
+    ks->header_pos = 0;
+    ks->read_cpu = 0;
+    ks->read_head = 0;
+    ks->rewind_pending = false;
 }
 
 zx_status_t ktrace_control(uint32_t action, uint32_t options, void* ptr) {
     ktrace_state_t* ks = &KTRACE_STATE;
     switch (action) {
-    case KTRACE_ACTION_START:
+    case KTRACE_ACTION_START: {
+        fbl::AutoLock lock(&ktrace_lock);
+        if (ks->ncpus == 0) {
+            return ZX_ERR_BAD_STATE;
+        }
+        if (ks->rewind_pending) {
+            ktrace_reset(ks);
+        }
         options = KTRACE_GRP_TO_MASK(options);
-        ks->marker = 0;
         atomic_store(&ks->grpmask, options ? options : KTRACE_GRP_TO_MASK(KTRACE_GRP_ALL));
+        ktrace_report_syscalls(kt_syscall_info);
+        ktrace_report_probes();
         ktrace_report_live_processes();
         ktrace_report_live_threads();
         break;
+    }
     case KTRACE_ACTION_STOP: {
+        fbl::AutoLock lock(&ktrace_lock);
+        if (ks->mode == KTRACE_MODE_CIRCULAR && atomic_load(&ks->grpmask)) {
+            // the names reported at start are the oldest records in the
+            // rings and are the first to go once a ring wraps; report them
+            // again so the snapshot still labels every id it contains
+            ktrace_report_syscalls(kt_syscall_info);
+            ktrace_report_probes();
+            ktrace_report_live_processes();
+            ktrace_report_live_threads();
+        }
         atomic_store(&ks->grpmask, 0);
-        uint32_t n = ks->offset;
-        if (n > ks->bufsize) {
-            ks->marker = ks->bufsize;
+        // the rings must be still before a snapshot is read or they are reset
+        ktrace_quiesce();
+        uint64_t dropped = 0;
+        for (uint32_t cpu = 0; cpu < ks->ncpus; cpu++) {
+            dropped += ks->cpu[cpu].dropped;
+        }
+        if (dropped) {
+            dprintf(INFO, "ktrace: %" PRIu64 " records dropped\n", dropped);
+        }
+        break;
+    }
+    case KTRACE_ACTION_REWIND: {
+        fbl::AutoLock lock(&ktrace_lock);
+        if (atomic_load(&ks->grpmask)) {
+            // start over right away
+            int grpmask = atomic_swap(&ks->grpmask, 0);
+            ktrace_quiesce();
+            ktrace_reset(ks);
+            atomic_store(&ks->grpmask, grpmask);
+            ktrace_report_syscalls(kt_syscall_info);
+            ktrace_report_probes();
         } else {
-            ks->marker = n;
+            ks->rewind_pending = true;
         }
         break;
     }
-    case KTRACE_ACTION_REWIND:
-        // roll back to just after the metadata
-        atomic_store(&ks->offset, KTRACE_RECSIZE * 2);
-        ktrace_report_syscalls(kt_syscall_info);
-        ktrace_report_probes();
+    case KTRACE_ACTION_SET_MODE: {
+        if (options != KTRACE_MODE_CIRCULAR && options != KTRACE_MODE_STREAMING) {
+            return ZX_ERR_INVALID_ARGS;
+        }
+        fbl::AutoLock lock(&ktrace_lock);
+        if (atomic_load(&ks->grpmask)) {
+            return ZX_ERR_BAD_STATE;
+        }
+        if (ks->mode != options) {
+            ks->mode = options;
+            ktrace_reset(ks);
+        }
         break;
+    }
     case KTRACE_ACTION_NEW_PROBE: {
         fbl::AutoLock lock(&probe_list_lock);
         ktrace_probe_info_t* probe;
@@ -185,27 +371,51 @@ void ktrace_init(unsigned level) {
 
     uint32_t mb = cmdline_get_uint32("ktrace.bufsize", KTRACE_DEFAULT_BUFSIZE);
     uint32_t grpmask = cmdline_get_uint32("ktrace.grpmask", KTRACE_DEFAULT_GRPMASK);
+    const char* mode = cmdline_get("ktrace.mode");
 
     if (mb == 0) {
         dprintf(INFO, "ktrace: disabled\n");
         return;
     }
 
-    mb *= (1024*1024);
+    if (mode != nullptr && !strcmp(mode, "streaming")) {
+        ks->mode = KTRACE_MODE_STREAMING;
+    } else {
+        ks->mode = KTRACE_MODE_CIRCULAR;
+    }
+
+    // split the buffer evenly between the cpus, a whole number of pages each
+    uint32_t ncpus = arch_max_num_cpus();
+    size_t cpusize = ROUNDDOWN((size_t)mb * 1024 * 1024 / ncpus, PAGE_SIZE);
+    if (cpusize == 0) {
+        cpusize = PAGE_SIZE;
+    }
 
+    uint8_t* buffer;
     zx_status_t status;
     VmAspace* aspace = VmAspace::kernel_aspace();
-    if ((status = aspace->Alloc("ktrace", mb, (void**)&ks->buffer, 0, VmAspace::VMM_FLAG_COMMIT,
+    if ((status = aspace->Alloc("ktrace", cpusize * ncpus, (void**)&buffer, 0,
+                                VmAspace::VMM_FLAG_COMMIT,
                                 ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE)) < 0) {
         dprintf(INFO, "ktrace: cannot alloc buffer %d\n", status);
         return;
     }
 
-    // The last packet written can overhang the end of the buffer,
-    // so we reduce the reported size by the max size of a record
-    ks->bufsize = mb - 256;
+    for (uint32_t cpu = 0; cpu < ncpus; cpu++) {
+        ks->cpu[cpu].buffer = buffer + cpu * cpusize;
+    }
+    ks->cpusize = (uint32_t)cpusize;
+
+    dprintf(INFO, "ktrace: %u buffers at %p (%zu bytes each, %s)\n", ncpus, buffer, cpusize,
+            ks->mode == KTRACE_MODE_STREAMING ? "streaming" : "circular");
 
-    dprintf(INFO, "ktrace: buffer at %p (%u bytes)\n", ks->buffer, mb);
+    // metadata for the start of every trace
+    uint64_t n = ktrace_ticks_per_ms();
+    ks->header[0].tag = TAG_VERSION;
+    ks->header[0].a = KTRACE_VERSION;
+    ks->header[1].tag = TAG_TICKS_PER_MS;
+    ks->header[1].a = (uint32_t)n;
+    ks->header[1].b = (uint32_t)(n >> 32);
 
     // register all static probes
     {
@@ -217,20 +427,15 @@ void ktrace_init(unsigned level) {
         }
     }
 
-    // write metadata to the first two event slots
-    uint64_t n = ktrace_ticks_per_ms();
-    ktrace_rec_32b_t* rec = (ktrace_rec_32b_t*) ks->buffer;
-    rec[0].tag = TAG_VERSION;
-    rec[0].a = KTRACE_VERSION;
-    rec[1].tag = TAG_TICKS_PER_MS;
-    rec[1].a = (uint32_t)n;
-    rec[1].b = (uint32_t)(n >> 32);
-
     // enable tracing
-    atomic_store(&ks->offset, KTRACE_RECSIZE * 2);
+    {
+        fbl::AutoLock lock(&ktrace_lock);
+        ks->ncpus = ncpus;
+        ktrace_reset(ks);
+    }
+    atomic_store(&ks->grpmask, KTRACE_GRP_TO_MASK(grpmask));
     ktrace_report_syscalls(kt_syscall_info);
     ktrace_report_probes();
-    atomic_store(&ks->grpmask, KTRACE_GRP_TO_MASK(grpmask));
 
     // report names of existing threads
     ktrace_report_live_threads();
@@ -242,63 +447,138 @@ void ktrace_init(unsigned level) {
     ktrace_probe0("ktrace_ready");
 }
 
+// Drops the oldest records of a circular ring until |target|.
+void ktrace_discard(ktrace_state_t* ks, ktrace_cpu_t* kc, uint64_t target) {
+    uint64_t tail = kc->tail;
+    while (tail < target && tail < kc->head) {
+        uint32_t off = (uint32_t)(tail % ks->cpusize);
+        uint32_t len = KTRACE_LEN(*(uint32_t*)(kc->buffer + off));
+        // a zero tag marks the skipped space at the end of the lap
+        tail += len ? len : ks->cpusize - off;
+    }
+    atomic_store_u64(&kc->tail, tail);
+}
+
+// Claims |len| bytes in the current cpu's ring and returns where they are,
+// or nullptr if the record has to be dropped. In circular mode room is made
+// by dropping the oldest records. Interrupts must be disabled, which makes
+// this cpu the ring's only writer until ktrace_commit() publishes the record.
+// Tracing is checked for again here, with interrupts disabled, so that
+// ktrace_quiesce() can wait out every writer that gets past the check.
+uint8_t* ktrace_reserve(ktrace_state_t* ks, ktrace_cpu_t* kc, uint32_t len,
+                        uint64_t* next) {
+    if (kc->buffer == nullptr || !atomic_load(&ks->grpmask)) {
+        return nullptr;
+    }
+
+    uint64_t head = kc->head;
+    uint32_t off = (uint32_t)(head % ks->cpusize);
+    uint32_t skip = (off + len > ks->cpusize) ? ks->cpusize - off : 0;
+    *next = head + skip + len;
+
+    if (*next - atomic_load_u64(&kc->tail) > ks->cpusize) {
+        if (ks->mode == KTRACE_MODE_STREAMING) {
+            kc->dropped++;
+            return nullptr;
+        }
+        ktrace_discard(ks, kc, *next - ks->cpusize);
+    }
+
+    if (skip) {
+        *(uint32_t*)(kc->buffer + off) = 0;
+        atomic_store_u64(&kc->wrap, off);
+        off = 0;
+    }
+    return kc->buffer + off;
+}
+
+void ktrace_commit(ktrace_state_t* ks, ktrace_cpu_t* kc, uint64_t next) {
+    if (next % ks->cpusize == 0) {
+        // the record ended the lap exactly
+        atomic_store_u64(&kc->wrap, ks->cpusize);
+    }
+    atomic_store_u64(&kc->head, next);
+}
+
 void ktrace_tiny(uint32_t tag, uint32_t arg) {
     ktrace_state_t* ks = &KTRACE_STATE;
     if (tag & atomic_load(&ks->grpmask)) {
         tag = (tag & 0xFFFFFFF0) | 2;
-        int off;
-        if ((off = atomic_add(&ks->offset, KTRACE_HDRSIZE)) >= (int)ks->bufsize) {
-            // if we arrive at the end, stop
-            atomic_store(&ks->grpmask, 0);
-        } else {
-            ktrace_header_t* hdr = (ktrace_header_t*) (ks->buffer + off);
+
+        spin_lock_saved_state_t state;
+        arch_interrupt_save(&state, ARCH_DEFAULT_SPIN_LOCK_FLAG_INTERRUPTS);
+        ktrace_cpu_t* kc = &ks->cpu[arch_curr_cpu_num()];
+        uint64_t next;
+        ktrace_header_t* hdr = (ktrace_header_t*) ktrace_reserve(ks, kc, KTRACE_HDRSIZE, &next);
+        if (hdr != nullptr) {
             hdr->ts = ktrace_timestamp();
             hdr->tag = tag;
             hdr->tid = arg;
+            ktrace_commit(ks, kc, next);
         }
+        arch_interrupt_restore(state, ARCH_DEFAULT_SPIN_LOCK_FLAG_INTERRUPTS);
     }
 }
 
-void* ktrace_open(uint32_t tag) {
+void ktrace(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
     ktrace_state_t* ks = &KTRACE_STATE;
     if (!(tag & atomic_load(&ks->grpmask))) {
-        return nullptr;
+        return;
     }
 
-    int off;
-    if ((off = atomic_add(&ks->offset, KTRACE_LEN(tag))) >= (int)ks->bufsize) {
-        // if we arrive at the end, stop
-        atomic_store(&ks->grpmask, 0);
-        return nullptr;
+    // the record is filled in before it is published, so a reader
+    // draining the ring never sees it half written
+    uint32_t tid = (uint32_t)get_current_thread()->user_tid;
+    uint32_t len = KTRACE_LEN(tag);
+    if (len < KTRACE_HDRSIZE) {
+        return;
     }
 
-    ktrace_header_t* hdr = (ktrace_header_t*) (ks->buffer + off);
-    hdr->ts = ktrace_timestamp();
-    hdr->tag = tag;
-    hdr->tid = (uint32_t)get_current_thread()->user_tid;
-    return hdr + 1;
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, ARCH_DEFAULT_SPIN_LOCK_FLAG_INTERRUPTS);
+    ktrace_cpu_t* kc = &ks->cpu[arch_curr_cpu_num()];
+    uint64_t next;
+    ktrace_header_t* hdr = (ktrace_header_t*) ktrace_reserve(ks, kc, len, &next);
+    if (hdr != nullptr) {
+        hdr->ts = ktrace_timestamp();
+        hdr->tag = tag;
+        hdr->tid = tid;
+        // as many of the arguments as the record has room for
+        const uint32_t args[4] = { a, b, c, d };
+        uint32_t* data = (uint32_t*)(hdr + 1);
+        for (uint32_t i = 0; i < 4 && KTRACE_HDRSIZE + (i + 1) * 4 <= len; i++) {
+            data[i] = args[i];
+        }
+        ktrace_commit(ks, kc, next);
+    }
+    arch_interrupt_restore(state, ARCH_DEFAULT_SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
 static void ktrace_name_etc(uint32_t tag, uint32_t id, uint32_t arg, const char* name, bool always) {
     ktrace_state_t* ks = &KTRACE_STATE;
-    if ((tag & atomic_load(&ks->grpmask)) || always) {
+    int grpmask = atomic_load(&ks->grpmask);
+    // names are only dropped into a running trace; all of them are
+    // reported again when tracing starts, and when a circular trace stops
+    if (grpmask && ((tag & grpmask) || always)) {
         uint32_t len = static_cast<uint32_t>(strnlen(name, ZX_MAX_NAME_LEN - 1));
 
         // set size to: sizeof(hdr) + len + 1, round up to multiple of 8
         tag = (tag & 0xFFFFFFF0) | ((KTRACE_NAMESIZE + len + 1 + 7) >> 3);
 
-        int off;
-        if ((off = atomic_add(&ks->offset, KTRACE_LEN(tag))) >= (int)ks->bufsize) {
-            // if we arrive at the end, stop
-            atomic_store(&ks->grpmask, 0);
-        } else {
-            ktrace_rec_name_t* rec = (ktrace_rec_name_t*) (ks->buffer + off);
+        spin_lock_saved_state_t state;
+        arch_interrupt_save(&state, ARCH_DEFAULT_SPIN_LOCK_FLAG_INTERRUPTS);
+        ktrace_cpu_t* kc = &ks->cpu[arch_curr_cpu_num()];
+        uint64_t next;
+        ktrace_rec_name_t* rec = (ktrace_rec_name_t*) ktrace_reserve(ks, kc, KTRACE_LEN(tag), &next);
+        if (rec != nullptr) {
             rec->tag = tag;
             rec->id = id;
             rec->arg = arg;
             memcpy(rec->name, name, len);
             rec->name[len] = 0;
+            ktrace_commit(ks, kc, next);
         }
+        arch_interrupt_restore(state, ARCH_DEFAULT_SPIN_LOCK_FLAG_INTERRUPTS);
     }
 }
 
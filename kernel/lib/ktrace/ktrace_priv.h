@@ -0,0 +1,78 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <kernel/align.h>
+#include <lib/ktrace.h>
+#include <stdint.h>
+
+// Each cpu writes records into its own ring, so tracing never shares a cache
+// line between cpus. |head| and |tail| count bytes since the ring was last
+// reset and only ever grow; the position in |buffer| is the count modulo the
+// ring size. A record never straddles the end of the ring: the space left
+// there is skipped and starts with a zero tag.
+typedef struct ktrace_cpu {
+    // end of the last record written, only written by the owning cpu
+    uint64_t head;
+
+    // start of the oldest record not yet consumed
+    uint64_t tail;
+
+    // where the skipped space at the end of the lap before |head| starts
+    uint64_t wrap;
+
+    // records that did not fit in streaming mode
+    uint64_t dropped;
+
+    uint8_t* buffer;
+} __CPU_ALIGN ktrace_cpu_t;
+
+typedef struct ktrace_state {
+    // mask of groups we allow, 0 == tracing disabled
+    int grpmask;
+
+    // KTRACE_MODE_CIRCULAR or KTRACE_MODE_STREAMING
+    uint32_t mode;
+
+    // size of each cpu's ring and the number of rings
+    uint32_t cpusize;
+    uint32_t ncpus;
+
+    // the rings are emptied when tracing next starts, so the records
+    // of the last run can still be read after a rewind
+    bool rewind_pending;
+
+    // streaming mode: how far the reader has got through the metadata,
+    // which ring it is draining and up to where
+    uint32_t header_pos;
+    uint32_t read_cpu;
+    uint64_t read_head;
+
+    // version and timebase records, which begin every trace
+    ktrace_rec_32b_t header[2];
+
+    ktrace_cpu_t cpu[SMP_MAX_CPUS];
+} ktrace_state_t;
+
+// A run of bytes in a ring.
+typedef struct ktrace_span {
+    uint32_t off;
+    uint32_t len;
+} ktrace_span_t;
+
+// Ring arithmetic, shared with the unit tests. See ktrace.cpp.
+void ktrace_spans(const ktrace_state_t* ks, const ktrace_cpu_t* kc,
+                  uint64_t tail, uint64_t head, ktrace_span_t span[2]);
+uint64_t ktrace_advance(const ktrace_state_t* ks, uint64_t tail,
+                        const ktrace_span_t span[2], uint32_t n);
+void ktrace_discard(ktrace_state_t* ks, ktrace_cpu_t* kc, uint64_t target);
+uint8_t* ktrace_reserve(ktrace_state_t* ks, ktrace_cpu_t* kc, uint32_t len, uint64_t* next);
+void ktrace_commit(ktrace_state_t* ks, ktrace_cpu_t* kc, uint64_t next);
+
+static inline uint32_t ktrace_span_len(const ktrace_span_t span[2]) {
+    return span[0].len + span[1].len;
+}
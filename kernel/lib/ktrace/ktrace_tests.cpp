@@ -0,0 +1,187 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include "ktrace_priv.h"
+
+#include <fbl/algorithm.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/unique_ptr.h>
+#include <string.h>
+#include <unittest.h>
+
+namespace {
+
+// Small enough that a few records wrap it.
+constexpr uint32_t kRingSize = 256u;
+
+// A one-cpu trace writing into |buffer|. Record sizes of 24 bytes leave
+// skipped space at the end of each lap; 32 byte ones end the lap exactly.
+struct TestRing {
+    ktrace_state_t state;
+    uint8_t buffer[kRingSize];
+
+    explicit TestRing(uint32_t mode) {
+        memset(&state, 0, sizeof(state));
+        memset(buffer, 0xff, sizeof(buffer));
+        state.grpmask = KTRACE_GRP_TO_MASK(KTRACE_GRP_ALL);
+        state.mode = mode;
+        state.cpusize = kRingSize;
+        state.ncpus = 1;
+        state.cpu[0].buffer = buffer;
+    }
+
+    ktrace_cpu_t* cpu() { return &state.cpu[0]; }
+
+    // Writes a |size| byte record carrying |seq|. Returns false if it was
+    // dropped.
+    bool Write(uint32_t size, uint32_t seq) {
+        uint64_t next;
+        auto rec = reinterpret_cast<uint32_t*>(ktrace_reserve(&state, cpu(), size, &next));
+        if (rec == nullptr) {
+            return false;
+        }
+        rec[0] = KTRACE_TAG(0x801, KTRACE_GRP_PROBE, size);
+        rec[1] = seq;
+        ktrace_commit(&state, cpu(), next);
+        return true;
+    }
+};
+
+fbl::unique_ptr<TestRing> make_ring(uint32_t mode) {
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<TestRing> ring(new (&ac) TestRing(mode));
+    return ac.check() ? fbl::move(ring) : nullptr;
+}
+
+// Checks that the records between |tail| and |head| are whole and numbered
+// consecutively. Returns the number of the first in |*first|, if there is
+// one, and how many there are in |*count|.
+bool check_records(TestRing* ring, uint64_t tail, uint64_t head, uint32_t size,
+                   uint32_t* first, uint32_t* count) {
+    BEGIN_TEST;
+    ktrace_span_t span[2];
+    ktrace_spans(&ring->state, ring->cpu(), tail, head, span);
+    *count = 0;
+    for (int i = 0; i < 2; i++) {
+        EXPECT_EQ(0u, span[i].len % size, "span holds whole records");
+        EXPECT_LE(span[i].off + span[i].len, kRingSize, "span inside the ring");
+        for (uint32_t off = 0; off < span[i].len; off += size) {
+            auto rec = reinterpret_cast<const uint32_t*>(ring->buffer + span[i].off + off);
+            EXPECT_EQ(KTRACE_LEN(rec[0]), size, "record tag");
+            if (*count == 0) {
+                *first = rec[1];
+            }
+            EXPECT_EQ(*first + *count, rec[1], "records in order");
+            (*count)++;
+        }
+    }
+    EXPECT_EQ(*count * size, ktrace_span_len(span), "span length");
+    END_TEST;
+}
+
+// Circular mode: once the ring is full every record pushes out the oldest
+// ones, and the newest records stay readable in order across the wrap.
+bool circular_wrap(uint32_t size) {
+    BEGIN_TEST;
+    auto ring = make_ring(KTRACE_MODE_CIRCULAR);
+    REQUIRE_NONNULL(ring.get(), "");
+    const uint32_t per_lap = kRingSize / size;
+
+    for (uint32_t seq = 0; seq < 4 * per_lap; seq++) {
+        EXPECT_TRUE(ring->Write(size, seq), "circular mode never drops");
+        ktrace_cpu_t* kc = ring->cpu();
+        EXPECT_LE(kc->head - kc->tail, kRingSize, "");
+
+        uint32_t first = 0;
+        uint32_t count;
+        EXPECT_TRUE(check_records(ring.get(), kc->tail, kc->head, size, &first, &count), "");
+        EXPECT_EQ(seq + 1, first + count, "newest record kept");
+        // only as much is dropped as makes room, give or take the space
+        // skipped at the end of the lap
+        EXPECT_GE(count, fbl::min(seq + 1, per_lap - 1), "");
+    }
+    EXPECT_EQ(0u, ring->cpu()->dropped, "");
+    END_TEST;
+}
+
+// Streaming mode: records that do not fit are dropped, and draining part
+// of the ring, across the end of a lap, gives the space back in order.
+bool streaming_wrap(uint32_t size) {
+    BEGIN_TEST;
+    auto ring = make_ring(KTRACE_MODE_STREAMING);
+    REQUIRE_NONNULL(ring.get(), "");
+    ktrace_cpu_t* kc = ring->cpu();
+    const uint32_t per_lap = kRingSize / size;
+
+    uint32_t written = 0;
+    while (ring->Write(size, written)) {
+        written++;
+    }
+    EXPECT_EQ(per_lap, written, "ring fills up");
+    EXPECT_EQ(1u, kc->dropped, "");
+
+    uint32_t read = 0;
+    for (uint32_t round = 0; round < 4; round++) {
+        // take a bit more than half of what is there, which crosses the
+        // end of the lap from the second round on
+        ktrace_span_t span[2];
+        ktrace_spans(&ring->state, kc, kc->tail, kc->head, span);
+        uint32_t first;
+        uint32_t count;
+        EXPECT_TRUE(check_records(ring.get(), kc->tail, kc->head, size, &first, &count), "");
+        EXPECT_EQ(read, first, "");
+        EXPECT_EQ(written - read, count, "nothing lost");
+        uint32_t take = count / 2 + 1;
+        kc->tail = ktrace_advance(&ring->state, kc->tail, span, take * size);
+        read += take;
+        EXPECT_TRUE(check_records(ring.get(), kc->tail, kc->head, size, &first, &count), "");
+        EXPECT_EQ(read, first, "");
+        EXPECT_EQ(written - read, count, "rest still readable");
+
+        // the space taken is free again
+        uint32_t refilled = 0;
+        while (ring->Write(size, written)) {
+            written++;
+            refilled++;
+        }
+        EXPECT_GE(refilled, take - 1, "");
+        EXPECT_LE(refilled, take, "");
+    }
+
+    // drain everything
+    ktrace_span_t span[2];
+    ktrace_spans(&ring->state, kc, kc->tail, kc->head, span);
+    kc->tail = ktrace_advance(&ring->state, kc->tail, span, ktrace_span_len(span));
+    EXPECT_EQ(kc->head, kc->tail, "ring empty");
+    ktrace_spans(&ring->state, kc, kc->tail, kc->head, span);
+    EXPECT_EQ(0u, ktrace_span_len(span), "");
+    END_TEST;
+}
+
+bool circular_wrap_with_skip(void* context) {
+    return circular_wrap(24u);
+}
+
+bool circular_wrap_exact(void* context) {
+    return circular_wrap(32u);
+}
+
+bool streaming_wrap_with_skip(void* context) {
+    return streaming_wrap(24u);
+}
+
+bool streaming_wrap_exact(void* context) {
+    return streaming_wrap(32u);
+}
+
+}  // namespace
+
+UNITTEST_START_TESTCASE(ktrace_tests)
+UNITTEST("circular ring wraps with skipped space", circular_wrap_with_skip)
+UNITTEST("circular ring wraps at the end of a record", circular_wrap_exact)
+UNITTEST("streaming ring wraps with skipped space", streaming_wrap_with_skip)
+UNITTEST("streaming ring wraps at the end of a record", streaming_wrap_exact)
+UNITTEST_END_TESTCASE(ktrace_tests, "ktrace", "ktrace ring tests", nullptr, nullptr);
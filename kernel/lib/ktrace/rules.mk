@@ -9,6 +9,10 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 MODULE := $(LOCAL_DIR)
 
 MODULE_SRCS += \
-	$(LOCAL_DIR)/ktrace.cpp
+	$(LOCAL_DIR)/ktrace.cpp \
+	$(LOCAL_DIR)/ktrace_tests.cpp
+
+MODULE_DEPS += \
+	kernel/lib/unittest
 
 include make/module.mk
@@ -11,7 +11,7 @@
 // environments.  It must use only the basic types so that struct
 // layouts match exactly in both contexts.
 
-#define VDSO_CONSTANTS_SIZE (4 * 4 + 2 * 8)
+#define VDSO_CONSTANTS_SIZE (6 * 4 + 2 * 8)
 #define VDSO_CONSTANTS_ALIGN 8
 
 #ifndef __ASSEMBLER__
@@ -34,6 +34,14 @@ struct vdso_constants {
     // Number of bytes in an instruction cache line.
     uint32_t icache_line_size;
 
+    // Conversion factor for zx_ticks_get return values to ZX_CLOCK_MONOTONIC
+    // nanoseconds, as the l0, l32 and l64 words of a struct fp_32_64 (see
+    // <lib/fixed_point.h>).  All zero if the monotonic clock is not derived
+    // from the ticks alone, in which case zx_clock_get asks the kernel.
+    uint32_t ns_per_tick_l0;
+    uint32_t ns_per_tick_l32;
+    uint32_t ns_per_tick_l64;
+
     // Conversion factor for zx_ticks_get return values to seconds.
     uint64_t ticks_per_second;
 
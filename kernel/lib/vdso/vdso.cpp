@@ -10,6 +10,7 @@
 #include <fbl/alloc_checker.h>
 #include <fbl/type_support.h>
 #include <kernel/cmdline.h>
+#include <lib/fixed_point.h>
 #include <object/handle.h>
 #include <platform.h>
 #include <vm/pmm.h>
@@ -222,6 +223,14 @@ const VDso* VDso::Create() {
         "vDSO constants", vdso->vmo()->vmo(), VDSO_DATA_CONSTANTS);
     uint64_t per_second = ticks_per_second();
 
+    // Let zx_clock_get compute ZX_CLOCK_MONOTONIC from the ticks if the
+    // platform's clock is just a scaled tick count.
+    struct fp_32_64 ns_per_tick = {};
+    if (!platform_current_time_scale(&ns_per_tick) ||
+        cmdline_get_bool("vdso.clock_get_via_kernel", false)) {
+        ns_per_tick = {};
+    }
+
     // Initialize the constants that should be visible to the vDSO.
     // Rather than assigning each member individually, do this with
     // struct assignment and a compound literal so that the compiler
@@ -230,6 +239,9 @@ const VDso* VDso::Create() {
         arch_max_num_cpus(),
         arch_dcache_line_size(),
         arch_icache_line_size(),
+        ns_per_tick.l0,
+        ns_per_tick.l32,
+        ns_per_tick.l64,
         per_second,
         pmm_count_total_bytes(),
     };
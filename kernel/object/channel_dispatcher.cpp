@@ -13,6 +13,7 @@
 #include <trace.h>
 
 #include <kernel/event.h>
+#include <lib/counters.h>
 #include <platform.h>
 #include <object/handle.h>
 #include <object/message_packet.h>
@@ -29,6 +30,16 @@ using fbl::AutoLock;
 
 #define LOCAL_TRACE 0
 
+// kernel counters. The following counters never decrease.
+// counts the messages written to channels, and their bytes and handles.
+KCOUNTER(channel_msg_count, "kernel.channel.messages");
+KCOUNTER(channel_msg_bytes, "kernel.channel.bytes");
+KCOUNTER(channel_msg_handles, "kernel.channel.handles");
+// counts the messages handed straight to a thread waiting in zx_channel_call().
+KCOUNTER(channel_call_reply_count, "kernel.channel.call_reply");
+// counts the messages taken off channels by readers.
+KCOUNTER(channel_read_count, "kernel.channel.read");
+
 // static
 zx_status_t ChannelDispatcher::Create(fbl::RefPtr<Dispatcher>* dispatcher0,
                                       fbl::RefPtr<Dispatcher>* dispatcher1,
@@ -156,6 +167,7 @@ zx_status_t ChannelDispatcher::Read(uint32_t* msg_size,
 
     *msg = messages_.pop_front();
     message_count_--;
+    kcounter_add(channel_read_count, 1u);
 
     if (messages_.is_empty())
         UpdateState(ZX_CHANNEL_READABLE, 0u);
@@ -163,6 +175,36 @@ zx_status_t ChannelDispatcher::Read(uint32_t* msg_size,
     return rv;
 }
 
+zx_status_t ChannelDispatcher::ReadMany(zx_channel_msg_t* msgs, uint32_t num_msgs,
+                                        MessageList* out) {
+    canary_.Assert();
+
+    AutoLock lock(&lock_);
+
+    if (messages_.is_empty())
+        return other_ ? ZX_ERR_SHOULD_WAIT : ZX_ERR_PEER_CLOSED;
+
+    uint32_t count = 0;
+    for (; count != num_msgs && !messages_.is_empty(); ++count) {
+        zx_channel_msg_t& m = msgs[count];
+        m.actual_bytes = messages_.front().data_size();
+        m.actual_handles = messages_.front().num_handles();
+        if (m.actual_bytes > m.num_bytes || m.actual_handles > m.num_handles)
+            break;
+        out->push_back(messages_.pop_front());
+        message_count_--;
+    }
+
+    if (count == 0)
+        return ZX_ERR_BUFFER_TOO_SMALL;
+    kcounter_add(channel_read_count, count);
+
+    if (messages_.is_empty())
+        UpdateState(ZX_CHANNEL_READABLE, 0u);
+
+    return ZX_OK;
+}
+
 zx_status_t ChannelDispatcher::Write(fbl::unique_ptr<MessagePacket> msg) {
     canary_.Assert();
 
@@ -184,6 +226,29 @@ zx_status_t ChannelDispatcher::Write(fbl::unique_ptr<MessagePacket> msg) {
     return ZX_OK;
 }
 
+zx_status_t ChannelDispatcher::WriteMany(MessageList* msgs) {
+    canary_.Assert();
+
+    fbl::RefPtr<ChannelDispatcher> other;
+    {
+        AutoLock lock(&lock_);
+        if (!other_) {
+            // As in Write(), the caller puts the handles back into the
+            // process.
+            for (auto& msg : *msgs) {
+                msg.set_owns_handles(false);
+            }
+            return ZX_ERR_PEER_CLOSED;
+        }
+        other = other_;
+    }
+
+    if (other->WriteSelfMany(msgs) > 0)
+        thread_reschedule();
+
+    return ZX_OK;
+}
+
 zx_status_t ChannelDispatcher::Call(fbl::unique_ptr<MessagePacket> msg,
                                     zx_time_t deadline, bool* return_handles,
                                     fbl::unique_ptr<MessagePacket>* reply) {
@@ -264,6 +329,34 @@ int ChannelDispatcher::WriteSelf(fbl::unique_ptr<MessagePacket> msg) {
 
     AutoLock lock(&lock_);
 
+    bool queued = false;
+    int woken = DeliverLocked(fbl::move(msg), &queued);
+    if (queued)
+        UpdateState(0u, ZX_CHANNEL_READABLE);
+    return woken;
+}
+
+int ChannelDispatcher::WriteSelfMany(MessageList* msgs) {
+    canary_.Assert();
+
+    AutoLock lock(&lock_);
+
+    bool queued = false;
+    int woken = 0;
+    while (!msgs->is_empty()) {
+        woken += DeliverLocked(msgs->pop_front(), &queued);
+    }
+    // Observers are only told about the batch as a whole.
+    if (queued)
+        UpdateState(0u, ZX_CHANNEL_READABLE);
+    return woken;
+}
+
+int ChannelDispatcher::DeliverLocked(fbl::unique_ptr<MessagePacket> msg, bool* queued) {
+    kcounter_add(channel_msg_count, 1u);
+    kcounter_add(channel_msg_bytes, msg->data_size());
+    kcounter_add(channel_msg_handles, msg->num_handles());
+
     if (!waiters_.is_empty()) {
         // If the far side is waiting for replies to messages
         // send via "call", see if this message has a matching
@@ -274,6 +367,7 @@ int ChannelDispatcher::WriteSelf(fbl::unique_ptr<MessagePacket> msg) {
             // Remove waiter from list.
             if (waiter.get_txid() == txid) {
                 waiters_.erase(waiter);
+                kcounter_add(channel_call_reply_count, 1u);
                 // we return how many threads have been woken up, or zero.
                 return waiter.Deliver(fbl::move(msg));
             }
@@ -281,8 +375,7 @@ int ChannelDispatcher::WriteSelf(fbl::unique_ptr<MessagePacket> msg) {
     }
     messages_.push_back(fbl::move(msg));
     message_count_++;
-
-    UpdateState(0u, ZX_CHANNEL_READABLE);
+    *queued = true;
     return 0;
 }
 
@@ -7,6 +7,7 @@
 #include <object/futex_context.h>
 
 #include <assert.h>
+#include <lib/counters.h>
 #include <lib/user_copy/user_ptr.h>
 #include <fbl/auto_lock.h>
 #include <object/thread_dispatcher.h>
@@ -17,6 +18,52 @@ using fbl::AutoLock;
 
 #define LOCAL_TRACE 0
 
+// kernel counters. The following counters never decrease.
+// counts the threads that blocked in FutexWait(), and those that gave up on
+// their deadline.
+KCOUNTER(futex_wait_count, "kernel.futex.wait");
+KCOUNTER(futex_wait_timeout_count, "kernel.futex.wait.timeout");
+// counts the calls to FutexWake() and FutexRequeue() that found waiters.
+KCOUNTER(futex_wake_count, "kernel.futex.wake");
+KCOUNTER(futex_requeue_count, "kernel.futex.requeue");
+
+namespace {
+
+// Holds the locks of one or two shards. They are taken in address order,
+// so that requeues between the same futexes in opposite directions cannot
+// deadlock.
+class ShardPairLock {
+public:
+    ShardPairLock(fbl::Mutex* a, fbl::Mutex* b) TA_NO_THREAD_SAFETY_ANALYSIS
+        : first_(a < b ? a : b), second_(a == b ? nullptr : (a < b ? b : a)) {
+        first_->Acquire();
+        if (second_)
+            second_->Acquire();
+    }
+
+    ~ShardPairLock() { release(); }
+
+    void release() TA_NO_THREAD_SAFETY_ANALYSIS {
+        if (second_) {
+            second_->Release();
+            second_ = nullptr;
+        }
+        if (first_) {
+            first_->Release();
+            first_ = nullptr;
+        }
+    }
+
+private:
+    ShardPairLock(const ShardPairLock&) = delete;
+    ShardPairLock& operator=(const ShardPairLock&) = delete;
+
+    fbl::Mutex* first_;
+    fbl::Mutex* second_;
+};
+
+}  // namespace
+
 FutexContext::FutexContext() {
     LTRACE_ENTRY;
 }
@@ -26,10 +73,21 @@ FutexContext::~FutexContext() {
 
     // All of the threads should have removed themselves from wait queues
     // by the time the process has exited.
-    DEBUG_ASSERT(futex_table_.is_empty());
+    for (auto& shard : shards_) {
+        AutoLock lock(&shard.lock);
+        DEBUG_ASSERT(shard.futex_table.is_empty());
+    }
+}
+
+FutexContext::Shard* FutexContext::ShardFor(uintptr_t futex_key) {
+    // Futexes are often laid out at a regular stride, one per object or
+    // cache line, so mix the whole address into the shard index.
+    uint64_t hash = static_cast<uint64_t>(futex_key >> 2) * 0x9E3779B97F4A7C15ull;
+    return &shards_[hash >> (64 - kShardBits)];
 }
 
-zx_status_t FutexContext::FutexWait(user_in_ptr<const int> value_ptr, int current_value, zx_time_t deadline) {
+zx_status_t FutexContext::FutexWait(user_in_ptr<const int> value_ptr, int current_value, zx_time_t deadline,
+                                    ThreadDispatcher* pi_owner) {
     LTRACE_ENTRY;
 
     uintptr_t futex_key = reinterpret_cast<uintptr_t>(value_ptr.get());
@@ -37,6 +95,7 @@ zx_status_t FutexContext::FutexWait(user_in_ptr<const int> value_ptr, int curren
         return ZX_ERR_INVALID_ARGS;
 
     FutexNode* node;
+    Shard* shard = ShardFor(futex_key);
 
     // FutexWait() checks that the address value_ptr still contains
     // current_value, and if so it sleeps awaiting a FutexWake() on value_ptr.
@@ -44,16 +103,16 @@ zx_status_t FutexContext::FutexWait(user_in_ptr<const int> value_ptr, int curren
     // If a FutexWake() operation could occur between them, a userland mutex
     // operation built on top of futexes would have a race condition that
     // could miss wakeups.
-    lock_.Acquire();
+    shard->lock.Acquire();
 
     int value;
     zx_status_t result = value_ptr.copy_from_user(&value);
     if (result != ZX_OK) {
-        lock_.Release();
+        shard->lock.Release();
         return result;
     }
     if (value != current_value) {
-        lock_.Release();
+        shard->lock.Release();
         return ZX_ERR_BAD_STATE;
     }
 
@@ -62,10 +121,19 @@ zx_status_t FutexContext::FutexWait(user_in_ptr<const int> value_ptr, int curren
     node->set_hash_key(futex_key);
     node->SetAsSingletonList();
 
-    QueueNodesLocked(node);
+    QueueNodesLocked(shard, node);
+    kcounter_add(futex_wait_count, 1u);
+
+    if (pi_owner)
+        pi_owner->InheritPriorityFromCurrent();
+
+    // Block current thread.  This releases the shard's lock and does not
+    // reacquire it.
+    result = node->BlockThread(&shard->lock, deadline);
+
+    if (pi_owner)
+        thread_inherit_priority_end();
 
-    // Block current thread.  This releases lock_ and does not reacquire it.
-    result = node->BlockThread(&lock_, deadline);
     if (result == ZX_OK) {
         DEBUG_ASSERT(!node->IsInQueue());
         // All the work necessary for removing us from the hash table was done by FutexWake()
@@ -78,8 +146,9 @@ zx_status_t FutexContext::FutexWait(user_in_ptr<const int> value_ptr, int curren
     //
     // We need to ensure that the thread's node is removed from the wait
     // queue, because FutexWake() probably didn't do that.
-    AutoLock lock(&lock_);
-    if (UnqueueNodeLocked(node)) {
+    if (UnqueueNode(node)) {
+        if (result == ZX_ERR_TIMED_OUT)
+            kcounter_add(futex_wait_timeout_count, 1u);
         return result;
     }
     // The current thread was not found on the wait queue.  This means
@@ -114,14 +183,16 @@ zx_status_t FutexContext::FutexWake(user_in_ptr<const int> value_ptr,
     if (futex_key % sizeof(int))
         return ZX_ERR_INVALID_ARGS;
 
-    AutoLock lock(&lock_);
+    Shard* shard = ShardFor(futex_key);
+    AutoLock lock(&shard->lock);
 
-    FutexNode* node = futex_table_.erase(futex_key);
+    FutexNode* node = shard->futex_table.erase(futex_key);
     if (!node) {
         // nothing blocked on this futex if we can't find it
         return ZX_OK;
     }
     DEBUG_ASSERT(node->GetKey() == futex_key);
+    kcounter_add(futex_wake_count, 1u);
 
     bool any_woken = false;
     FutexNode* remaining_waiters =
@@ -129,7 +200,7 @@ zx_status_t FutexContext::FutexWake(user_in_ptr<const int> value_ptr,
 
     if (remaining_waiters) {
         DEBUG_ASSERT(remaining_waiters->GetKey() == futex_key);
-        futex_table_.insert(remaining_waiters);
+        shard->futex_table.insert(remaining_waiters);
     }
 
     if (any_woken) {
@@ -140,34 +211,43 @@ zx_status_t FutexContext::FutexWake(user_in_ptr<const int> value_ptr,
     return ZX_OK;
 }
 
+// The locks of both shards are held throughout, which the thread safety
+// analysis cannot follow through ShardPairLock.
 zx_status_t FutexContext::FutexRequeue(user_in_ptr<const int> wake_ptr, uint32_t wake_count, int current_value,
-                                       user_in_ptr<const int> requeue_ptr, uint32_t requeue_count) {
+                                       user_in_ptr<const int> requeue_ptr, uint32_t requeue_count)
+    TA_NO_THREAD_SAFETY_ANALYSIS {
     LTRACE_ENTRY;
 
     if ((requeue_ptr.get() == nullptr) && requeue_count)
         return ZX_ERR_INVALID_ARGS;
 
-    AutoLock lock(&lock_);
+    uintptr_t wake_key = reinterpret_cast<uintptr_t>(wake_ptr.get());
+    uintptr_t requeue_key = reinterpret_cast<uintptr_t>(requeue_ptr.get());
+
+    // Moving waiters between futexes in different shards needs both
+    // shards locked, so that neither futex's waiters can be seen half moved.
+    Shard* wake_shard = ShardFor(wake_key);
+    Shard* requeue_shard = requeue_count ? ShardFor(requeue_key) : wake_shard;
+    ShardPairLock lock(&wake_shard->lock, &requeue_shard->lock);
 
     int value;
     zx_status_t result = wake_ptr.copy_from_user(&value);
     if (result != ZX_OK) return result;
     if (value != current_value) return ZX_ERR_BAD_STATE;
 
-    uintptr_t wake_key = reinterpret_cast<uintptr_t>(wake_ptr.get());
-    uintptr_t requeue_key = reinterpret_cast<uintptr_t>(requeue_ptr.get());
     if (wake_key == requeue_key) return ZX_ERR_INVALID_ARGS;
     if (wake_key % sizeof(int) || requeue_key % sizeof(int))
         return ZX_ERR_INVALID_ARGS;
 
     // This must happen before RemoveFromHead() calls set_hash_key() on
-    // nodes below, because operations on futex_table_ look at the GetKey
+    // nodes below, because operations on futex_table look at the GetKey
     // field of the list head nodes for wake_key and requeue_key.
-    FutexNode* node = futex_table_.erase(wake_key);
+    FutexNode* node = wake_shard->futex_table.erase(wake_key);
     if (!node) {
         // nothing blocked on this futex if we can't find it
         return ZX_OK;
     }
+    kcounter_add(futex_requeue_count, 1u);
 
     bool any_woken = false;
     if (wake_count > 0) {
@@ -184,14 +264,14 @@ zx_status_t FutexContext::FutexRequeue(user_in_ptr<const int> wake_ptr, uint32_t
 
             // now requeue our nodes to requeue_ptr mutex
             DEBUG_ASSERT(requeue_head->GetKey() == requeue_key);
-            QueueNodesLocked(requeue_head);
+            QueueNodesLocked(requeue_shard, requeue_head);
         }
     }
 
     // add any remaining nodes back to wake_key futex
     if (node != nullptr) {
         DEBUG_ASSERT(node->GetKey() == wake_key);
-        futex_table_.insert(node);
+        wake_shard->futex_table.insert(node);
     }
 
     if (any_woken) {
@@ -202,38 +282,48 @@ zx_status_t FutexContext::FutexRequeue(user_in_ptr<const int> wake_ptr, uint32_t
     return ZX_OK;
 }
 
-void FutexContext::QueueNodesLocked(FutexNode* head) {
-    DEBUG_ASSERT(lock_.IsHeld());
+void FutexContext::QueueNodesLocked(Shard* shard, FutexNode* head) {
+    DEBUG_ASSERT(shard->lock.IsHeld());
 
-    FutexNode::HashTable::iterator iter;
+    FutexNode::ShardHashTable::iterator iter;
 
     // Attempt to insert this FutexNode into the hash table.  If the insert
     // succeeds, then the current thread is first to block on this futex and we
     // are finished.  If the insert fails, then there is already a thread
     // waiting on this futex.  Add ourselves to that thread's list.
-    if (!futex_table_.insert_or_find(head, &iter))
+    if (!shard->futex_table.insert_or_find(head, &iter))
         iter->AppendList(head);
 }
 
 // This attempts to unqueue a thread (which may or may not be waiting on a
 // futex), given its FutexNode.  This returns whether the FutexNode was
 // found and removed from a futex wait queue.
-bool FutexContext::UnqueueNodeLocked(FutexNode* node) {
-    DEBUG_ASSERT(lock_.IsHeld());
-
-    if (!node->IsInQueue())
-        return false;
-
+bool FutexContext::UnqueueNode(FutexNode* node) {
     // Note: When UnqueueNode() is called from FutexWait(), it might be
     // tempting to reuse the futex key that was passed to FutexWait().
     // However, that could be out of date if the thread was requeued by
     // FutexRequeue(), so we need to re-get the hash table key here.
-    uintptr_t futex_key = node->GetKey();
-
-    FutexNode* old_head = futex_table_.erase(futex_key);
-    DEBUG_ASSERT(old_head);
-    FutexNode* new_head = FutexNode::RemoveNodeFromList(old_head, node);
-    if (new_head)
-        futex_table_.insert(new_head);
-    return true;
+    //
+    // The key can still change until the shard it names is locked:
+    // FutexRequeue() holds the locks of both the old and the new key's
+    // shards while changing it, so once the key names the shard we hold,
+    // it stays put.
+    while (true) {
+        Shard* shard = ShardFor(node->GetKey());
+        AutoLock lock(&shard->lock);
+        if (ShardFor(node->GetKey()) != shard)
+            continue;
+
+        if (!node->IsInQueue())
+            return false;
+
+        uintptr_t futex_key = node->GetKey();
+
+        FutexNode* old_head = shard->futex_table.erase(futex_key);
+        DEBUG_ASSERT(old_head);
+        FutexNode* new_head = FutexNode::RemoveNodeFromList(old_head, node);
+        if (new_head)
+            shard->futex_table.insert(new_head);
+        return true;
+    }
 }
@@ -6,8 +6,10 @@
 
 #include <object/handle.h>
 
+#include <arch/ops.h>
 #include <object/dispatcher.h>
 #include <fbl/arena.h>
+#include <fbl/atomic.h>
 #include <fbl/auto_lock.h>
 #include <fbl/mutex.h>
 #include <pow2.h>
@@ -46,6 +48,14 @@ static_assert(((3 << 30) ^ kHandleGenerationMask ^ kHandleIndexMask) ==
                   0xffffffffu,
               "Masks do not agree");
 
+// Per-cpu count of ReadGuard entries and exits; odd while a guard is held on
+// that cpu. Each counter is only written by its own cpu, with interrupts
+// disabled, and is read by WaitForReaders().
+struct alignas(MAX_CACHE_LINE) ReaderSeq {
+    fbl::atomic<uint64_t> seq;
+};
+ReaderSeq reader_seq[SMP_MAX_CPUS];
+
 }  // namespace
 
 fbl::Mutex Handle::mutex_;
@@ -166,7 +176,38 @@ void Handle::TearDown() TA_EXCL(mutex_) {
     DEBUG_ASSERT(process_id() == 0);
 }
 
+Handle::ReadGuard::ReadGuard() {
+    arch_interrupt_save(&irq_state_, SPIN_LOCK_FLAG_INTERRUPTS);
+    cpu_ = arch_curr_cpu_num();
+    reader_seq[cpu_].seq.fetch_add(1u, fbl::memory_order_relaxed);
+    // Orders the increment before the reader's loads of the handle. Pairs
+    // with the fence in WaitForReaders().
+    fbl::atomic_thread_fence(fbl::memory_order_seq_cst);
+}
+
+Handle::ReadGuard::~ReadGuard() {
+    reader_seq[cpu_].seq.fetch_add(1u, fbl::memory_order_release);
+    arch_interrupt_restore(irq_state_, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+void Handle::WaitForReaders() {
+    // The caller has already made the handle unreachable by clearing its
+    // process id. A guard entered after this fence will see that.
+    fbl::atomic_thread_fence(fbl::memory_order_seq_cst);
+    for (cpu_num_t cpu = 0; cpu < arch_max_num_cpus(); ++cpu) {
+        uint64_t seq = reader_seq[cpu].seq.load(fbl::memory_order_acquire);
+        if ((seq & 1u) == 0u)
+            continue;
+        // Guards run with interrupts off, so this is never more than a few
+        // instructions' wait.
+        while (reader_seq[cpu].seq.load(fbl::memory_order_acquire) == seq)
+            arch_spinloop_pause();
+    }
+}
+
 void Handle::Delete() {
+    WaitForReaders();
+
     fbl::RefPtr<Dispatcher> disp = dispatcher();
 
     if (disp->has_state_tracker())
@@ -188,13 +229,12 @@ void Handle::Delete() {
     // gets destroyed here.
 }
 
+// The arena bounds do not change after Init(), so this does not take
+// |mutex_|; lookups from every process would otherwise serialize on it.
 Handle* Handle::FromU32(uint32_t value) TA_NO_THREAD_SAFETY_ANALYSIS {
     Handle* handle = IndexToHandle(value & kHandleIndexMask);
-    {
-        AutoLock lock(&mutex_);
-        if (unlikely(!arena_.in_range(handle)))
-            return nullptr;
-    }
+    if (unlikely(!arena_.in_range(handle)))
+        return nullptr;
     return likely(handle->base_value() == value) ? handle : nullptr;
 }
 
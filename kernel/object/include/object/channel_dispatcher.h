@@ -23,6 +23,8 @@ class ChannelDispatcher final : public Dispatcher {
 public:
     class MessageWaiter;
 
+    using MessageList = fbl::DoublyLinkedList<fbl::unique_ptr<MessagePacket>>;
+
     static zx_status_t Create(fbl::RefPtr<Dispatcher>* dispatcher0,
                               fbl::RefPtr<Dispatcher>* dispatcher1, zx_rights_t* rights);
 
@@ -45,8 +47,23 @@ public:
                      fbl::unique_ptr<MessagePacket>* msg,
                      bool may_disard);
 
+    // Read up to |num_msgs| messages from this endpoint's message queue, in
+    // order, under a single acquisition of the lock. Each message is taken
+    // only if it fits the capacity given by the |num_bytes| and |num_handles|
+    // of the corresponding entry of |msgs|, whose |actual_bytes| and
+    // |actual_handles| are set to the message's size. Reading stops at the
+    // first message that doesn't fit, which is left queued. The messages
+    // taken are appended to |out|. Returns ZX_ERR_BUFFER_TOO_SMALL if the
+    // first message doesn't fit.
+    zx_status_t ReadMany(zx_channel_msg_t* msgs, uint32_t num_msgs, MessageList* out);
+
     // Write to the opposing endpoint's message queue.
     zx_status_t Write(fbl::unique_ptr<MessagePacket> msg);
+
+    // Write all of |msgs|, in order, to the opposing endpoint's message
+    // queue, updating its signals once. On ZX_ERR_PEER_CLOSED, |msgs| is left
+    // untouched except that the packets no longer own their handles.
+    zx_status_t WriteMany(MessageList* msgs);
     zx_status_t Call(fbl::unique_ptr<MessagePacket> msg,
                      zx_time_t deadline, bool* return_handles,
                      fbl::unique_ptr<MessagePacket>* reply);
@@ -93,7 +110,6 @@ public:
     };
 
 private:
-    using MessageList = fbl::DoublyLinkedList<fbl::unique_ptr<MessagePacket>>;
     using WaiterList = fbl::DoublyLinkedList<MessageWaiter*>;
 
     void RemoveWaiter(MessageWaiter* waiter);
@@ -101,6 +117,10 @@ private:
     ChannelDispatcher();
     void Init(fbl::RefPtr<ChannelDispatcher> other);
     int WriteSelf(fbl::unique_ptr<MessagePacket> msg);
+    int WriteSelfMany(MessageList* msgs);
+    // Hands |msg| to a Call waiting for its txid, or else queues it and sets
+    // |*queued|. Returns the number of threads woken up.
+    int DeliverLocked(fbl::unique_ptr<MessagePacket> msg, bool* queued) TA_REQ(lock_);
     zx_status_t UserSignalSelf(uint32_t clear_mask, uint32_t set_mask);
     void OnPeerZeroHandles();
 
@@ -11,9 +11,12 @@
 #include <fbl/mutex.h>
 #include <object/futex_node.h>
 
+class ThreadDispatcher;
+
 // FutexContext is a class that encapsulates support for futex operations.
 // FutexContext uses a hash table keyed on the futex address (a pointer to integer in userspace)
-// to contain all active futexes.
+// to contain all active futexes. The table is split into shards, each with its own lock, so
+// that threads using unrelated futexes rarely contend.
 // A futex is considered active if there is one or more threads blocked on the futex.
 // After no threads are left blocked on a futex it is removed from the hash table.
 // The value in the futex hash table is the FutexNode object associated with the head
@@ -33,7 +36,10 @@ public:
     // Otherwise it will block the current thread until the |deadline| passes,
     // or until the thread is woken by a FutexWake or FutexRequeue operation
     // on the same |value_ptr| futex.
-    zx_status_t FutexWait(user_in_ptr<const int> value_ptr, int current_value, zx_time_t deadline);
+    // If |pi_owner| is not null, it is the thread holding the futex, which
+    // inherits the current thread's priority for as long as it blocks.
+    zx_status_t FutexWait(user_in_ptr<const int> value_ptr, int current_value, zx_time_t deadline,
+                          ThreadDispatcher* pi_owner = nullptr);
 
     // FutexWake will wake up to |count| number of threads blocked on the |value_ptr| futex.
     zx_status_t FutexWake(user_in_ptr<const int> value_ptr, uint32_t count);
@@ -51,14 +57,24 @@ private:
     FutexContext(const FutexContext&) = delete;
     FutexContext& operator=(const FutexContext&) = delete;
 
-    void QueueNodesLocked(FutexNode* head) TA_REQ(lock_);
+    static constexpr size_t kShardBits = 5u;
+    static constexpr size_t kNumShards = 1u << kShardBits;
+
+    struct Shard {
+        // protects futex_table
+        fbl::Mutex lock;
+
+        // Hash table for the futexes of this shard.
+        // Key is futex address, value is the FutexNode for the head of futex's blocked thread list.
+        FutexNode::ShardHashTable futex_table TA_GUARDED(lock);
+    };
+
+    // Returns the shard that holds the futex at |futex_key|.
+    Shard* ShardFor(uintptr_t futex_key);
 
-    bool UnqueueNodeLocked(FutexNode* node) TA_REQ(lock_);
+    void QueueNodesLocked(Shard* shard, FutexNode* head) TA_REQ(shard->lock);
 
-    // protects futex_table_
-    fbl::Mutex lock_;
+    bool UnqueueNode(FutexNode* node);
 
-    // Hash table for futexes in this context.
-    // Key is futex address, value is the FutexNode for the head of futex's blocked thread list.
-    FutexNode::HashTable futex_table_ TA_GUARDED(lock_);
+    Shard shards_[kNumShards];
 };
@@ -18,6 +18,9 @@
 class FutexNode : public fbl::SinglyLinkedListable<FutexNode*> {
 public:
     using HashTable = fbl::HashTable<uintptr_t, FutexNode*>;
+    // FutexContext keeps many of these, so they are kept small.
+    using ShardHashTable = fbl::HashTable<uintptr_t, FutexNode*,
+                                          fbl::SinglyLinkedList<FutexNode*>, size_t, 7>;
 
     FutexNode();
     ~FutexNode();
@@ -62,7 +65,8 @@ private:
 
     // hash_key_ contains the futex address.  This field has two roles:
     //  * It is used by FutexWait() to determine which queue to remove the
-    //    thread from when a wait operation times out.
+    //    thread from when a wait operation times out, and which shard's
+    //    lock to take to do so.
     //  * Additionally, when this FutexNode is the head of a futex wait
     //    queue, this field is used by the HashTable (because it uses
     //    intrusive SinglyLinkedLists).
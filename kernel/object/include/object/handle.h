@@ -12,6 +12,7 @@
 #include <fbl/macros.h>
 #include <fbl/mutex.h>
 #include <fbl/ref_ptr.h>
+#include <kernel/spinlock.h>
 #include <stdint.h>
 #include <zircon/types.h>
 
@@ -116,6 +117,27 @@ public:
     // Maps an integer obtained by Handle::base_value() back to a Handle.
     static Handle* FromU32(uint32_t value);
 
+    // While a ReadGuard is held, a Handle returned by FromU32() that still
+    // has the expected process_id() will not be torn down, so its
+    // dispatcher() and rights() can be read without the owning process's
+    // handle_table_lock_. Delete() waits for every guard that might have
+    // seen the handle.
+    //
+    // Interrupts are disabled while the guard is held, so it must only be
+    // used around a few loads and reference count increments. Guards do
+    // not nest.
+    class ReadGuard {
+    public:
+        ReadGuard();
+        ~ReadGuard();
+
+    private:
+        DISALLOW_COPY_ASSIGN_AND_MOVE(ReadGuard);
+
+        spin_lock_saved_state_t irq_state_;
+        cpu_num_t cpu_;
+    };
+
     // Get the number of outstanding handles for a given dispatcher.
     static uint32_t Count(const fbl::RefPtr<const Dispatcher>&);
 
@@ -153,6 +175,9 @@ private:
     void TearDown() TA_EXCL(mutex_);
     void Delete();
 
+    // Waits until no ReadGuard that was held before the call is still held.
+    static void WaitForReaders();
+
     // Only HandleOwner is allowed to call Delete.
     friend class HandleOwner;
 
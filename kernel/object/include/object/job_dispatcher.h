@@ -15,6 +15,7 @@
 
 #include <zircon/types.h>
 #include <fbl/array.h>
+#include <fbl/atomic.h>
 #include <fbl/auto_lock.h>
 #include <fbl/canary.h>
 #include <fbl/intrusive_double_list.h>
@@ -131,6 +132,29 @@ public:
     bool ResetExceptionPort(bool quietly);
     fbl::RefPtr<ExceptionPort> exception_port();
 
+    // The most kernel memory that the channel messages written by processes
+    // directly in one job may occupy while they are queued.
+    static constexpr size_t kMaxChannelMsgBytes = 256u * 1024u * 1024u;
+
+    // Accounting for the channel messages written by processes in this job
+    // and still queued. |bytes| is the kernel memory backing a message; see
+    // MessagePacket::memory_size(). Returns false, charging nothing, if the
+    // message would take the job over kMaxChannelMsgBytes.
+    bool ChargeChannelMessage(size_t bytes) {
+        if (channel_msg_bytes_.fetch_add(bytes) + bytes > kMaxChannelMsgBytes) {
+            channel_msg_bytes_.fetch_sub(bytes);
+            return false;
+        }
+        channel_msgs_.fetch_add(1u);
+        return true;
+    }
+    void UnchargeChannelMessage(size_t bytes) {
+        channel_msgs_.fetch_sub(1u);
+        channel_msg_bytes_.fetch_sub(bytes);
+    }
+    size_t channel_msgs() const { return channel_msgs_.load(); }
+    size_t channel_msg_bytes() const { return channel_msg_bytes_.load(); }
+
 private:
     enum class State {
         READY,
@@ -163,6 +187,9 @@ private:
     const fbl::RefPtr<JobDispatcher> parent_;
     const uint32_t max_height_;
 
+    fbl::atomic<size_t> channel_msgs_{0u};
+    fbl::atomic<size_t> channel_msg_bytes_{0u};
+
     fbl::DoublyLinkedListNodeState<JobDispatcher*> dll_job_raw_;
     fbl::SinglyLinkedListNodeState<fbl::RefPtr<JobDispatcher>> dll_job_;
 
@@ -10,7 +10,10 @@
 
 #include <lib/user_copy/user_ptr.h>
 #include <zircon/types.h>
+#include <fbl/arena.h>
 #include <fbl/intrusive_double_list.h>
+#include <fbl/mutex.h>
+#include <fbl/ref_ptr.h>
 #include <fbl/unique_ptr.h>
 
 constexpr uint32_t kMaxMessageSize = 65536u;
@@ -21,6 +24,10 @@ static_assert(ZX_CHANNEL_MAX_MSG_BYTES == kMaxMessageSize, "");
 static_assert(ZX_CHANNEL_MAX_MSG_HANDLES == kMaxMessageHandles, "");
 
 class Handle;
+class JobDispatcher;
+class VmObject;
+struct MessageBuffer;
+struct MessagePacketSlot;
 
 class MessagePacket : public fbl::DoublyLinkedListable<fbl::unique_ptr<MessagePacket>> {
 public:
@@ -34,13 +41,22 @@ public:
                               uint32_t num_handles,
                               fbl::unique_ptr<MessagePacket>* msg);
 
+    // Creates a message packet whose data is not copied but loaned: it
+    // refers to |data_size| bytes of |vmo| starting at |offset|, which are
+    // only read when the message is read. The range is committed and pinned
+    // for the life of the packet. The handles array is as above.
+    static zx_status_t CreateLoaned(fbl::RefPtr<VmObject> vmo, uint64_t offset,
+                                    uint32_t data_size, uint32_t num_handles,
+                                    fbl::unique_ptr<MessagePacket>* msg);
+
+    // Sets up the pools that packets and their buffers are allocated from.
+    static void Init();
+
     uint32_t data_size() const { return data_size_; }
 
     // Copies the packet's |data_size()| bytes to |buf|.
     // Returns an error if |buf| points to a bad user address.
-    zx_status_t CopyDataTo(user_out_ptr<void> buf) const {
-        return buf.copy_array_to_user(data(), data_size_);
-    }
+    zx_status_t CopyDataTo(user_out_ptr<void> buf) const;
 
     uint32_t num_handles() const { return num_handles_; }
     Handle* const* handles() const { return handles_; }
@@ -48,37 +64,79 @@ public:
 
     void set_owns_handles(bool own_handles) { owns_handles_ = own_handles; }
 
+    // Charges the memory used by this packet to |job| until the packet is
+    // destroyed. Fails with ZX_ERR_NO_MEMORY, charging nothing, if that would
+    // take |job| over its limit for queued messages.
+    zx_status_t ChargeTo(fbl::RefPtr<JobDispatcher> job);
+
+    // The number of bytes of kernel memory this packet occupies.
+    size_t memory_size() const;
+
     // zx_channel_call treats the leading bytes of the payload as
     // a transaction id of type zx_txid_t.
     zx_txid_t get_txid() const {
         if (data_size_ < sizeof(zx_txid_t)) {
             return 0;
+        } else if (vmo_) {
+            return loaned_txid_;
         } else {
             return *(reinterpret_cast<const zx_txid_t*>(data()));
         }
     }
 
 private:
-    MessagePacket(uint32_t data_size, uint32_t num_handles, Handle** handles);
+    // Messages whose handles and data fit in this many bytes are stored
+    // inline in the packet; larger ones use a chain of MessageBuffers.
+    static constexpr size_t kInlineSize = 256u;
+
+    MessagePacket(uint32_t data_size, uint32_t num_handles);
     ~MessagePacket();
 
     // Allocates a new packet that can hold the specified amount of
-    // data/handles.
-    static zx_status_t NewPacket(uint32_t data_size, uint32_t num_handles,
+    // handles and, unless |loaned|, data.
+    static zx_status_t NewPacket(uint32_t data_size, uint32_t num_handles, bool loaned,
                                  fbl::unique_ptr<MessagePacket>* msg);
 
-    // Create() uses malloc(), so we must delete using free().
-    static void operator delete(void* ptr) {
-        free(ptr);
-    }
+    // Takes a packet slot and a chain of |num_buffers| buffers from the
+    // current cpu's cache, refilling it from the arenas if needed.
+    static zx_status_t AllocStorage(size_t num_buffers, MessagePacketSlot** slot,
+                                    MessageBuffer** buffers);
+
+    // Returns the slots and buffers in the given chains to the current cpu's
+    // cache, spilling to the arenas when it is full.
+    static void Recycle(MessagePacketSlot* slots, size_t slot_count,
+                        MessageBuffer* buffers, size_t buffer_count);
+
+    // Packets come from arena_, so they must be returned to it, along with
+    // their buffers.
+    static void operator delete(void* ptr);
     friend class fbl::unique_ptr<MessagePacket>;
 
-    // Handles and data are stored in the same buffer: num_handles_ Handle*
-    // entries first, then the data buffer.
+    // Calls |func(char* segment, size_t offset, size_t len)| for each
+    // contiguous run of the packet's data, in order, stopping early if it
+    // returns an error.
+    template <typename F>
+    zx_status_t ForEachDataSegment(F func) const;
+
+    // Handles and data are stored in the same storage, either inline_ or the
+    // first buffer of the chain: num_handles_ Handle* entries first, then the
+    // start of the data. Data that doesn't fit continues in the following
+    // buffers.
     void* data() const { return static_cast<void*>(handles_ + num_handles_); }
 
-    Handle** const handles_;
+    MessageBuffer* buffers_ = nullptr;
+    Handle** handles_;
+    fbl::RefPtr<JobDispatcher> job_;
+    // For loaned packets, where the data lives instead of in this packet.
+    fbl::RefPtr<VmObject> vmo_;
+    uint64_t vmo_offset_ = 0;
+    zx_txid_t loaned_txid_ = 0;
     const uint32_t data_size_;
     const uint16_t num_handles_;
     bool owns_handles_;
+    alignas(Handle*) char inline_[kInlineSize];
+
+    static fbl::Mutex mutex_;
+    static fbl::Arena TA_GUARDED(mutex_) arena_;
+    static fbl::Arena TA_GUARDED(mutex_) buffer_arena_;
 };
@@ -12,6 +12,7 @@
 
 #include <zircon/syscalls/port.h>
 #include <zircon/types.h>
+#include <fbl/atomic.h>
 #include <fbl/canary.h>
 #include <fbl/intrusive_double_list.h>
 #include <fbl/mutex.h>
@@ -87,10 +88,22 @@ struct PortAllocator {
 };
 
 struct PortPacket final : public fbl::DoublyLinkedListable<PortPacket*> {
+    // Set in |state| while the packet is queued. For signal packets the low
+    // bits hold the signals observed since it was queued.
+    static constexpr uint64_t kQueued = 1ull << 63;
+    // Set in |state| by PortDispatcher::CanReap() when the packet's observer
+    // is gone while the packet is still queued; whoever takes the packet off
+    // the queue then deletes |observer|.
+    static constexpr uint64_t kObserverGone = 1ull << 62;
+
     zx_port_packet_t packet;
     const void* const handle;
+    // Only valid once kObserverGone is set in |state|.
     PortObserver* observer;
     PortAllocator* const allocator;
+    // Link in the port's incoming stack, see PortDispatcher::Queue().
+    PortPacket* next_incoming;
+    fbl::atomic<uint64_t> state;
 
     PortPacket(const void* handle, PortAllocator* allocator);
     PortPacket(const PortPacket&) = delete;
@@ -151,9 +164,15 @@ public:
     zx_status_t Queue(PortPacket* port_packet, zx_signals_t observed, uint64_t count);
     zx_status_t QueueUser(const zx_port_packet_t& packet);
     zx_status_t Dequeue(zx_time_t deadline, zx_port_packet_t* packet);
+    // Like Dequeue(), but once a packet is available takes up to |count|
+    // packets under one acquisition of the lock. The number taken is
+    // returned in |*actual|.
+    zx_status_t DequeueMany(zx_time_t deadline, zx_port_packet_t* packets, size_t count,
+                            size_t* actual);
 
     // Decides who is going to destroy the observer. If it returns |true| it
     // is the duty of the caller. If it is false it is the duty of the port.
+    // Never takes |lock_|.
     bool CanReap(PortObserver* observer, PortPacket* port_packet);
 
     // Called under the handle table lock.
@@ -177,10 +196,28 @@ private:
     // Called by ExceptionPort.
     void UnlinkExceptionPort(ExceptionPort* eport);
 
+    // Takes up to |count| queued packets, copying them to |packets| if that
+    // is not null. Returns the number taken.
+    size_t TakeQueued(zx_port_packet_t* packets, size_t count);
+
+    // Moves the packets pushed on |incoming_| to the end of |packets_|.
+    void DrainIncomingLocked() TA_REQ(lock_);
+
+    // Removes the first queued packet, copying it to |out_packet| if that is
+    // not null. Returns false if there is none.
+    bool DequeueOneLocked(zx_port_packet_t* out_packet) TA_REQ(lock_);
+
     fbl::Canary<fbl::magic("PORT")> canary_;
+    // Producers never take |lock_|: Queue() pushes onto |incoming_| and only
+    // posts |sema_| when |waiters_| says someone may be asleep on it, and
+    // CanReap() hands a queued packet's observer over through its |state|.
+    // The lock serializes the consumers, which move |incoming_| to
+    // |packets_|, and cancellation.
     fbl::Mutex lock_;
     Semaphore sema_;
-    bool zero_handles_ TA_GUARDED(lock_);
+    fbl::atomic<bool> zero_handles_;
+    fbl::atomic<uintptr_t> incoming_;  // PortPacket*
+    fbl::atomic<uint32_t> waiters_;
     fbl::DoublyLinkedList<PortPacket*> packets_ TA_GUARDED(lock_);
     fbl::DoublyLinkedList<fbl::RefPtr<ExceptionPort>> eports_ TA_GUARDED(lock_);
 };
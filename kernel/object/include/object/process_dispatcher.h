@@ -266,6 +266,11 @@ private:
     ProcessDispatcher& operator=(const ProcessDispatcher&) = delete;
 
 
+    // Like GetHandleLocked(), but for use under a Handle::ReadGuard rather
+    // than |handle_table_lock_|. Does not apply the ZX_POL_BAD_HANDLE
+    // policy; callers retry under the lock when this returns nullptr.
+    Handle* GetHandleUnlocked(zx_handle_t handle_value) const;
+
     zx_status_t GetDispatcherInternal(zx_handle_t handle_value, fbl::RefPtr<Dispatcher>* dispatcher,
                                       zx_rights_t* rights);
 
@@ -306,7 +311,8 @@ private:
     // our address space
     fbl::RefPtr<VmAspace> aspace_;
 
-    // our list of handles
+    // our list of handles. Lookups by value do not take the lock, see
+    // Handle::ReadGuard; it serializes changes and enumeration.
     mutable fbl::Mutex handle_table_lock_; // protects |handles_|.
     fbl::DoublyLinkedList<Handle*> handles_ TA_GUARDED(handle_table_lock_);
 
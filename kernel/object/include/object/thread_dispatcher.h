@@ -112,6 +112,10 @@ public:
     void get_name(char out_name[ZX_MAX_NAME_LEN]) const final;
     uint64_t runtime_ns() const { return thread_runtime(&thread_); }
 
+    // Makes this thread run at no less than the current thread's priority
+    // until the current thread calls thread_inherit_priority_end().
+    void InheritPriorityFromCurrent() { thread_inherit_priority_begin(&thread_); }
+
     zx_status_t SetExceptionPort(fbl::RefPtr<ExceptionPort> eport);
     // Returns true if a port had been set.
     bool ResetExceptionPort(bool quietly);
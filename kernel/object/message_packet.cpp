@@ -6,15 +6,249 @@
 
 #include <object/message_packet.h>
 
+#include <arch/ops.h>
 #include <err.h>
+#include <kernel/align.h>
+#include <kernel/spinlock.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
-#include <zxcpp/new.h>
+#include <fbl/algorithm.h>
+#include <fbl/auto_lock.h>
 #include <object/handle.h>
+#include <object/job_dispatcher.h>
+#include <vm/vm.h>
+#include <vm/vm_object.h>
+#include <zxcpp/new.h>
+
+using fbl::AutoLock;
+
+// A page-sized piece of the storage of a message that doesn't fit inline in
+// its MessagePacket. The buffers of a packet are chained through |next|.
+struct MessageBuffer {
+    static constexpr size_t kDataSize = PAGE_SIZE - sizeof(MessageBuffer*);
+
+    MessageBuffer* next;
+    char data[kDataSize];
+};
+static_assert(sizeof(MessageBuffer) == PAGE_SIZE, "");
+
+namespace {
+
+// The maximum number of packets that can be queued, in all channels, at once.
+// This only bounds the arena's address space reservation; the real limit is
+// the per-job one enforced by JobDispatcher::ChargeChannelMessage().
+constexpr size_t kMaxMessagePacketCount = 1024 * 1024u;
+
+// The maximum number of buffers backing the large messages queued, in all
+// channels, at once. As above, a backstop behind the per-job limit.
+constexpr size_t kMaxMessageBufferCount = 1024 * 1024u;
+
+// The first buffer of a chain must be able to hold all the handles and the
+// transaction id.
+static_assert(kMaxMessageHandles * sizeof(Handle*) + sizeof(zx_txid_t) <=
+                  MessageBuffer::kDataSize,
+              "");
+
+// Packets and buffers are allocated and freed through a small per-cpu cache
+// of each, refilled from and drained to the arenas in batches, so the common
+// case never takes MessagePacket::mutex_.
+constexpr size_t kCacheMax = 64u;
+constexpr size_t kCacheBatch = 16u;
+
+struct MessagePacketCache {
+    SpinLock lock;
+    // protected by lock, with interrupts disabled
+    MessagePacketSlot* slots = nullptr;
+    size_t slot_count = 0u;
+    MessageBuffer* buffers = nullptr;
+    size_t buffer_count = 0u;
+} __CPU_ALIGN;
+
+MessagePacketCache pcpu_cache[SMP_MAX_CPUS];
+
+// Disables interrupts and locks the cache of the cpu we end up running on.
+// Interrupts stay disabled until cache_release(), so we can't migrate.
+MessagePacketCache* cache_acquire(spin_lock_saved_state_t* state) TA_NO_THREAD_SAFETY_ANALYSIS {
+    arch_interrupt_save(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    MessagePacketCache* cache = &pcpu_cache[arch_curr_cpu_num()];
+    cache->lock.Acquire();
+    return cache;
+}
+
+void cache_release(MessagePacketCache* cache, spin_lock_saved_state_t state)
+    TA_NO_THREAD_SAFETY_ANALYSIS {
+    cache->lock.Release();
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+// Detaches the first |count| buffers of the chain at |*list| and returns
+// them as a chain of their own. |*list| must hold at least |count| buffers.
+MessageBuffer* take_buffers(MessageBuffer** list, size_t count) {
+    if (count == 0u) {
+        return nullptr;
+    }
+    MessageBuffer* head = *list;
+    MessageBuffer* tail = head;
+    for (size_t ix = 1; ix != count; ++ix) {
+        tail = tail->next;
+    }
+    *list = tail->next;
+    tail->next = nullptr;
+    return head;
+}
+
+}  // namespace
+
+// The arena slot a packet lives in. The destructor leaves the packet's
+// buffer chain in |buffers|, outside of the destroyed object, so that
+// operator delete can return the packet and its buffers together.
+struct MessagePacketSlot {
+    union {
+        MessageBuffer* buffers;
+        // Links the slot into a per-cpu cache while it is free.
+        MessagePacketSlot* next;
+    };
+    alignas(MessagePacket) char packet[sizeof(MessagePacket)];
+
+    static MessagePacketSlot* FromPacket(void* packet) {
+        return reinterpret_cast<MessagePacketSlot*>(
+            static_cast<char*>(packet) - offsetof(MessagePacketSlot, packet));
+    }
+};
+
+fbl::Mutex MessagePacket::mutex_;
+fbl::Arena MessagePacket::arena_;
+fbl::Arena MessagePacket::buffer_arena_;
 
 // static
-zx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles,
+void MessagePacket::Init() TA_NO_THREAD_SAFETY_ANALYSIS {
+    arena_.Init("message-packets", sizeof(MessagePacketSlot), kMaxMessagePacketCount);
+    buffer_arena_.Init("message-buffers", sizeof(MessageBuffer), kMaxMessageBufferCount);
+}
+
+// static
+zx_status_t MessagePacket::AllocStorage(size_t num_buffers, MessagePacketSlot** slot,
+                                        MessageBuffer** buffers) {
+    spin_lock_saved_state_t state;
+    MessagePacketCache* cache = cache_acquire(&state);
+    if (cache->slot_count > 0u && cache->buffer_count >= num_buffers) {
+        *slot = cache->slots;
+        cache->slots = (*slot)->next;
+        cache->slot_count--;
+        *buffers = take_buffers(&cache->buffers, num_buffers);
+        cache->buffer_count -= num_buffers;
+        cache_release(cache, state);
+        return ZX_OK;
+    }
+    cache_release(cache, state);
+
+    // Pull what we need plus a batch of each out of the arenas in one go.
+    MessagePacketSlot* slots = nullptr;
+    size_t slot_count = 0u;
+    MessageBuffer* chain = nullptr;
+    size_t buffer_count = 0u;
+    {
+        AutoLock lock(&mutex_);
+        while (slot_count != 1u + kCacheBatch) {
+            auto s = static_cast<MessagePacketSlot*>(arena_.Alloc());
+            if (s == nullptr) {
+                break;
+            }
+            s->next = slots;
+            slots = s;
+            slot_count++;
+        }
+        while (buffer_count != num_buffers + kCacheBatch) {
+            auto buffer = static_cast<MessageBuffer*>(buffer_arena_.Alloc());
+            if (buffer == nullptr) {
+                break;
+            }
+            buffer->next = chain;
+            chain = buffer;
+            buffer_count++;
+        }
+    }
+    if (slot_count == 0u || buffer_count < num_buffers) {
+        Recycle(slots, slot_count, chain, buffer_count);
+        return ZX_ERR_NO_MEMORY;
+    }
+
+    *slot = slots;
+    slots = slots->next;
+    *buffers = take_buffers(&chain, num_buffers);
+    Recycle(slots, slot_count - 1u, chain, buffer_count - num_buffers);
+    return ZX_OK;
+}
+
+// static
+void MessagePacket::Recycle(MessagePacketSlot* slots, size_t slot_count,
+                            MessageBuffer* buffers, size_t buffer_count) {
+    if (slot_count == 0u && buffer_count == 0u) {
+        return;
+    }
+
+    // Whatever doesn't fit in the cache, plus a batch to make room for the
+    // next frees, goes back to the arenas.
+    MessagePacketSlot* spill_slots = nullptr;
+    MessageBuffer* spill_buffers = nullptr;
+
+    spin_lock_saved_state_t state;
+    MessagePacketCache* cache = cache_acquire(&state);
+    while (slots != nullptr) {
+        MessagePacketSlot* s = slots;
+        slots = s->next;
+        if (cache->slot_count == kCacheMax) {
+            for (size_t ix = 0; ix != kCacheBatch; ++ix) {
+                MessagePacketSlot* spilled = cache->slots;
+                cache->slots = spilled->next;
+                spilled->next = spill_slots;
+                spill_slots = spilled;
+            }
+            cache->slot_count -= kCacheBatch;
+        }
+        s->next = cache->slots;
+        cache->slots = s;
+        cache->slot_count++;
+    }
+    while (buffers != nullptr) {
+        MessageBuffer* buffer = buffers;
+        buffers = buffer->next;
+        if (cache->buffer_count == kCacheMax) {
+            MessageBuffer* spilled = take_buffers(&cache->buffers, kCacheBatch);
+            cache->buffer_count -= kCacheBatch;
+            // Splice the spilled batch in front of what we already have.
+            MessageBuffer* tail = spilled;
+            while (tail->next != nullptr) {
+                tail = tail->next;
+            }
+            tail->next = spill_buffers;
+            spill_buffers = spilled;
+        }
+        buffer->next = cache->buffers;
+        cache->buffers = buffer;
+        cache->buffer_count++;
+    }
+    cache_release(cache, state);
+
+    if (spill_slots != nullptr || spill_buffers != nullptr) {
+        AutoLock lock(&mutex_);
+        while (spill_slots != nullptr) {
+            MessagePacketSlot* next = spill_slots->next;
+            arena_.Free(spill_slots);
+            spill_slots = next;
+        }
+        while (spill_buffers != nullptr) {
+            MessageBuffer* next = spill_buffers->next;
+            buffer_arena_.Free(spill_buffers);
+            spill_buffers = next;
+        }
+    }
+}
+
+// static
+zx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles, bool loaned,
                                      fbl::unique_ptr<MessagePacket>* msg) {
     // Although the API uses uint32_t, we pack the handle count into a smaller
     // field internally. Make sure it fits.
@@ -23,38 +257,63 @@ zx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles,
         return ZX_ERR_OUT_OF_RANGE;
     }
 
-    // Allocate space for the MessagePacket object followed by num_handles
-    // Handle*s followed by data_size bytes.
-    // TODO(dbort): Use mbuf-style memory for data_size, ideally allocating from
-    // somewhere other than the heap. Lets us better track and isolate channel
-    // memory usage.
-    char* ptr = static_cast<char*>(malloc(sizeof(MessagePacket) +
-                                          num_handles * sizeof(Handle*) +
-                                          data_size));
-    if (ptr == nullptr) {
-        return ZX_ERR_NO_MEMORY;
+    const size_t size = num_handles * sizeof(Handle*) + (loaned ? 0u : data_size);
+    const size_t num_buffers = (size <= kInlineSize)
+                                   ? 0u
+                                   : fbl::round_up(size, MessageBuffer::kDataSize) /
+                                         MessageBuffer::kDataSize;
+
+    MessagePacketSlot* slot;
+    MessageBuffer* buffers;
+    zx_status_t status = AllocStorage(num_buffers, &slot, &buffers);
+    if (status != ZX_OK) {
+        return status;
     }
 
     // The storage space for the Handle*s is not initialized because
     // the only creators of MessagePackets (sys_channel_write and
     // _call, and userboot) fill that array immediately after creation
     // of the object.
-    msg->reset(new (ptr) MessagePacket(
-        data_size, num_handles,
-        reinterpret_cast<Handle**>(ptr + sizeof(MessagePacket))));
+    MessagePacket* packet = new (slot->packet) MessagePacket(data_size, num_handles);
+    if (buffers != nullptr) {
+        packet->buffers_ = buffers;
+        packet->handles_ = reinterpret_cast<Handle**>(buffers->data);
+    }
+    msg->reset(packet);
     return ZX_OK;
 }
 
+template <typename F>
+zx_status_t MessagePacket::ForEachDataSegment(F func) const {
+    const size_t first_size =
+        buffers_ ? MessageBuffer::kDataSize : kInlineSize;
+    size_t len = fbl::min<size_t>(data_size_, first_size - num_handles_ * sizeof(Handle*));
+    zx_status_t status = func(static_cast<char*>(data()), 0u, len);
+
+    size_t offset = len;
+    for (MessageBuffer* buffer = buffers_ ? buffers_->next : nullptr;
+         status == ZX_OK && offset < data_size_; buffer = buffer->next) {
+        DEBUG_ASSERT(buffer != nullptr);
+        len = fbl::min<size_t>(data_size_ - offset, MessageBuffer::kDataSize);
+        status = func(buffer->data, offset, len);
+        offset += len;
+    }
+    return status;
+}
+
 // static
 zx_status_t MessagePacket::Create(user_in_ptr<const void> data, uint32_t data_size,
                                   uint32_t num_handles,
                                   fbl::unique_ptr<MessagePacket>* msg) {
-    zx_status_t status = NewPacket(data_size, num_handles, msg);
+    zx_status_t status = NewPacket(data_size, num_handles, false, msg);
     if (status != ZX_OK) {
         return status;
     }
     if (data_size > 0u) {
-        if (data.copy_array_from_user((*msg)->data(), data_size) != ZX_OK) {
+        status = (*msg)->ForEachDataSegment([&data](char* segment, size_t offset, size_t len) {
+            return data.byte_offset(offset).copy_array_from_user(segment, len);
+        });
+        if (status != ZX_OK) {
             msg->reset();
             return ZX_ERR_INVALID_ARGS;
         }
@@ -66,16 +325,100 @@ zx_status_t MessagePacket::Create(user_in_ptr<const void> data, uint32_t data_si
 zx_status_t MessagePacket::Create(const void* data, uint32_t data_size,
                                   uint32_t num_handles,
                                   fbl::unique_ptr<MessagePacket>* msg) {
-    zx_status_t status = NewPacket(data_size, num_handles, msg);
+    zx_status_t status = NewPacket(data_size, num_handles, false, msg);
     if (status != ZX_OK) {
         return status;
     }
     if (data_size > 0u) {
-        memcpy((*msg)->data(), data, data_size);
+        (*msg)->ForEachDataSegment([data](char* segment, size_t offset, size_t len) {
+            memcpy(segment, static_cast<const char*>(data) + offset, len);
+            return ZX_OK;
+        });
+    }
+    return ZX_OK;
+}
+
+// static
+zx_status_t MessagePacket::CreateLoaned(fbl::RefPtr<VmObject> vmo, uint64_t offset,
+                                        uint32_t data_size, uint32_t num_handles,
+                                        fbl::unique_ptr<MessagePacket>* msg) {
+    // Commit and pin the loaned range until the packet is destroyed, so
+    // that the sender cannot decommit it or shrink the VMO before the
+    // message is read.
+    zx_status_t status = vmo->CommitRange(offset, data_size, nullptr);
+    if (status != ZX_OK) {
+        return status;
+    }
+    status = vmo->Pin(offset, data_size);
+    if (status == ZX_ERR_NOT_FOUND) {
+        // the sender decommitted part of the range in the meantime
+        return ZX_ERR_BAD_STATE;
+    } else if (status != ZX_OK) {
+        return status;
+    }
+
+    // Snapshot the transaction id now, so that the channel does not have to
+    // touch the VMO under its lock.
+    zx_txid_t txid = 0;
+    if (data_size >= sizeof(zx_txid_t)) {
+        status = vmo->Read(&txid, offset, sizeof(txid), nullptr);
+    }
+    if (status == ZX_OK) {
+        status = NewPacket(data_size, num_handles, true, msg);
+    }
+    if (status != ZX_OK) {
+        vmo->Unpin(offset, data_size);
+        return status;
+    }
+    (*msg)->vmo_ = fbl::move(vmo);
+    (*msg)->vmo_offset_ = offset;
+    (*msg)->loaned_txid_ = txid;
+    return ZX_OK;
+}
+
+zx_status_t MessagePacket::CopyDataTo(user_out_ptr<void> buf) const {
+    if (vmo_) {
+        // ReadUser() holds the VMO's lock while copying, so fault in the
+        // destination first in case it is backed by the same VMO.
+        // TODO(ZX-730): Same workaround as sys_process_read_memory().
+        const uint8_t byte = 0;
+        auto out = buf.reinterpret<uint8_t>();
+        for (size_t offset = 0; offset < data_size_; offset += PAGE_SIZE) {
+            zx_status_t status = out.copy_array_to_user(&byte, 1, offset);
+            if (status != ZX_OK) {
+                return status;
+            }
+        }
+        zx_status_t status = out.copy_array_to_user(&byte, 1, data_size_ - 1);
+        if (status != ZX_OK) {
+            return status;
+        }
+        return vmo_->ReadUser(buf, vmo_offset_, data_size_, nullptr);
+    }
+    return ForEachDataSegment([&buf](char* segment, size_t offset, size_t len) {
+        return buf.byte_offset(offset).copy_array_to_user(segment, len);
+    });
+}
+
+zx_status_t MessagePacket::ChargeTo(fbl::RefPtr<JobDispatcher> job) {
+    DEBUG_ASSERT(!job_);
+    if (job) {
+        if (!job->ChargeChannelMessage(memory_size())) {
+            return ZX_ERR_NO_MEMORY;
+        }
+        job_ = fbl::move(job);
     }
     return ZX_OK;
 }
 
+size_t MessagePacket::memory_size() const {
+    size_t size = sizeof(MessagePacket);
+    for (MessageBuffer* buffer = buffers_; buffer != nullptr; buffer = buffer->next) {
+        size += sizeof(MessageBuffer);
+    }
+    return size;
+}
+
 MessagePacket::~MessagePacket() {
     if (owns_handles_) {
         for (size_t ix = 0; ix != num_handles_; ++ix) {
@@ -83,11 +426,32 @@ MessagePacket::~MessagePacket() {
             HandleOwner ho(handles_[ix]);
         }
     }
+    if (job_) {
+        job_->UnchargeChannelMessage(memory_size());
+    }
+    if (vmo_) {
+        vmo_->Unpin(vmo_offset_, data_size_);
+    }
+    // operator delete returns the buffers along with the packet.
+    MessagePacketSlot::FromPacket(this)->buffers = buffers_;
+}
+
+// static
+void MessagePacket::operator delete(void* ptr) {
+    MessagePacketSlot* slot = MessagePacketSlot::FromPacket(ptr);
+    MessageBuffer* buffers = slot->buffers;
+    // |next| shares storage with |buffers|; unlink the slot before Recycle()
+    // walks it as a chain of slots.
+    slot->next = nullptr;
+    size_t buffer_count = 0u;
+    for (MessageBuffer* buffer = buffers; buffer != nullptr; buffer = buffer->next) {
+        buffer_count++;
+    }
+    Recycle(slot, 1u, buffers, buffer_count);
 }
 
-MessagePacket::MessagePacket(uint32_t data_size,
-                             uint32_t num_handles, Handle** handles)
-    : handles_(handles), data_size_(data_size),
+MessagePacket::MessagePacket(uint32_t data_size, uint32_t num_handles)
+    : handles_(reinterpret_cast<Handle**>(inline_)), data_size_(data_size),
       // NewPacket ensures that num_handles fits in 16 bits.
       num_handles_(static_cast<uint16_t>(num_handles)), owns_handles_(false) {
 }
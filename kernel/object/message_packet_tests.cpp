@@ -0,0 +1,62 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <object/message_packet.h>
+
+#include <fbl/unique_ptr.h>
+#include <string.h>
+#include <unittest.h>
+
+namespace {
+
+// Bigger than a packet's inline storage, so it needs a chain of buffers.
+constexpr uint32_t kLargeSize = 3 * PAGE_SIZE;
+constexpr size_t kSmallCount = 64u;
+
+bool create_packet(uint32_t size, zx_txid_t txid, fbl::unique_ptr<MessagePacket>* msg) {
+    BEGIN_TEST;
+    static uint8_t data[kLargeSize];
+    memset(data, static_cast<int>(txid), size);
+    memcpy(data, &txid, sizeof(txid));
+    REQUIRE_EQ(ZX_OK, MessagePacket::Create(data, size, 0u, msg), "");
+    EXPECT_EQ(txid, (*msg)->get_txid(), "");
+    END_TEST;
+}
+
+// Freeing a packet with buffers has to give the packet and each buffer back
+// to the right cache: packets allocated afterwards must not share storage
+// with each other or with the buffers of a live packet.
+bool alloc_after_free_large(void* context) {
+    BEGIN_TEST;
+    for (zx_txid_t round = 0; round < 4; round++) {
+        fbl::unique_ptr<MessagePacket> large;
+        REQUIRE_TRUE(create_packet(kLargeSize, 0x100 + round, &large), "");
+        large.reset();
+
+        REQUIRE_TRUE(create_packet(kLargeSize, 0x200 + round, &large), "");
+        fbl::unique_ptr<MessagePacket> small[kSmallCount];
+        for (size_t ix = 0; ix < kSmallCount; ix++) {
+            REQUIRE_TRUE(create_packet(sizeof(zx_txid_t), static_cast<zx_txid_t>(ix), &small[ix]),
+                        "");
+        }
+
+        EXPECT_EQ(0x200 + round, large->get_txid(), "large packet intact");
+        EXPECT_EQ(kLargeSize, large->data_size(), "");
+        for (size_t ix = 0; ix < kSmallCount; ix++) {
+            EXPECT_EQ(static_cast<zx_txid_t>(ix), small[ix]->get_txid(), "small packet intact");
+            for (size_t jx = 0; jx < ix; jx++) {
+                EXPECT_NE(small[ix].get(), small[jx].get(), "packets are distinct");
+            }
+        }
+    }
+    END_TEST;
+}
+
+} // namespace
+
+UNITTEST_START_TESTCASE(message_packet_tests)
+UNITTEST("allocate packets after freeing a large one", alloc_after_free_large)
+UNITTEST_END_TESTCASE(message_packet_tests, "msgpacket", "MessagePacket tests", nullptr, nullptr);
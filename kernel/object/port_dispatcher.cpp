@@ -8,6 +8,7 @@
 
 #include <assert.h>
 #include <err.h>
+#include <lib/counters.h>
 #include <platform.h>
 #include <pow2.h>
 
@@ -23,6 +24,15 @@
 
 using fbl::AutoLock;
 
+// kernel counters. The following counters never decrease.
+// counts the packets queued on ports, and the signal packets that were
+// already queued and just had their signals updated.
+KCOUNTER(port_queue_count, "kernel.port.queue");
+KCOUNTER(port_queue_coalesced_count, "kernel.port.queue.coalesced");
+// counts the packets dequeued, and the times a dequeuer had to wait.
+KCOUNTER(port_dequeue_count, "kernel.port.dequeue");
+KCOUNTER(port_dequeue_wait_count, "kernel.port.dequeue.wait");
+
 static_assert(sizeof(zx_packet_signal_t) == sizeof(zx_packet_user_t),
               "size of zx_packet_signal_t must match zx_packet_user_t");
 static_assert(sizeof(zx_packet_exception_t) == sizeof(zx_packet_user_t),
@@ -73,7 +83,8 @@ void ArenaPortAllocator::Free(PortPacket* port_packet) {
 }
 
 PortPacket::PortPacket(const void* handle, PortAllocator* allocator)
-    : packet{}, handle(handle), observer(nullptr), allocator(allocator) {
+    : packet{}, handle(handle), observer(nullptr), allocator(allocator),
+      next_incoming(nullptr), state(0u) {
     // Note that packet is initialized to zeros.
     if (handle) {
         // Currently |handle| is only valid if the packets are not ephemeral
@@ -178,11 +189,12 @@ zx_status_t PortDispatcher::Create(uint32_t options, fbl::RefPtr<Dispatcher>* di
 }
 
 PortDispatcher::PortDispatcher(uint32_t /*options*/)
-    : zero_handles_(false) {
+    : zero_handles_(false), incoming_(0u), waiters_(0u) {
 }
 
 PortDispatcher::~PortDispatcher() {
-    DEBUG_ASSERT(zero_handles_);
+    DEBUG_ASSERT(zero_handles_.load());
+    DEBUG_ASSERT(incoming_.load() == 0u);
 }
 
 void PortDispatcher::on_zero_handles() {
@@ -190,7 +202,7 @@ void PortDispatcher::on_zero_handles() {
 
     {
         AutoLock al(&lock_);
-        zero_handles_ = true;
+        zero_handles_.store(true);
 
         // Unlink and unbind exception ports.
         while (!eports_.is_empty()) {
@@ -224,77 +236,169 @@ zx_status_t PortDispatcher::QueueUser(const zx_port_packet_t& packet) {
 zx_status_t PortDispatcher::Queue(PortPacket* port_packet, zx_signals_t observed, uint64_t count) {
     canary_.Assert();
 
-    int wake_count = 0;
-    {
-        AutoLock al(&lock_);
-        if (zero_handles_)
-            return ZX_ERR_BAD_STATE;
-
-        if (observed) {
-            if (port_packet->InContainer()) {
-                port_packet->packet.signal.observed |= observed;
-                // |count| is deliberately left as is.
-                return ZX_OK;
-            }
-            port_packet->packet.signal.observed = observed;
-            port_packet->packet.signal.count = count;
+    if (zero_handles_.load())
+        return ZX_ERR_BAD_STATE;
+
+    if (observed) {
+        // A signal packet is only queued by its observer, under the state
+        // lock of the watched object, but can be dequeued at any time. While
+        // it is queued new signals are just added to its |state|, where the
+        // dequeuer picks them up.
+        uint64_t state = port_packet->state.load(fbl::memory_order_relaxed);
+        uint64_t new_state;
+        do {
+            new_state = (state & PortPacket::kQueued) ? (state | observed)
+                                                      : (PortPacket::kQueued | observed);
+        } while (!port_packet->state.compare_exchange_weak(&state, new_state,
+                                                           fbl::memory_order_seq_cst,
+                                                           fbl::memory_order_relaxed));
+        if (state & PortPacket::kQueued) {
+            // |count| is deliberately left as is.
+            kcounter_add(port_queue_coalesced_count, 1u);
+            return ZX_OK;
         }
+        port_packet->packet.signal.count = count;
+    } else {
+        port_packet->state.store(PortPacket::kQueued);
+    }
+
+    kcounter_add(port_queue_count, 1u);
 
-        packets_.push_back(port_packet);
-        wake_count = sema_.Post();
+    uintptr_t head = incoming_.load(fbl::memory_order_relaxed);
+    do {
+        port_packet->next_incoming = reinterpret_cast<PortPacket*>(head);
+    } while (!incoming_.compare_exchange_weak(&head, reinterpret_cast<uintptr_t>(port_packet),
+                                              fbl::memory_order_seq_cst,
+                                              fbl::memory_order_relaxed));
+
+    // on_zero_handles() flushes the queue after setting |zero_handles_|.
+    // If that flush could have missed this packet, flush it here.
+    if (zero_handles_.load()) {
+        AutoLock al(&lock_);
+        while (DequeueOneLocked(nullptr)) {}
+        return ZX_OK;
     }
 
-    if (wake_count)
+    // A waiter bumps |waiters_| before its last look at the queue, so if it
+    // is zero here any waiter to come will find this packet.
+    if (waiters_.load() != 0u && sema_.Post())
         thread_reschedule();
 
     return ZX_OK;
 }
 
 zx_status_t PortDispatcher::Dequeue(zx_time_t deadline, zx_port_packet_t* out_packet) {
+    size_t actual;
+    return DequeueMany(deadline, out_packet, 1u, &actual);
+}
+
+zx_status_t PortDispatcher::DequeueMany(zx_time_t deadline, zx_port_packet_t* packets,
+                                        size_t count, size_t* actual) {
     canary_.Assert();
+    DEBUG_ASSERT(count > 0u);
 
     while (true) {
-        {
-            AutoLock al(&lock_);
-
-            PortPacket* port_packet = packets_.pop_front();
-            if (port_packet == nullptr)
-                goto wait;
-
-            if (out_packet != nullptr)
-                *out_packet = port_packet->packet;
-
-            PortObserver* observer = port_packet->observer;
-
-            if (observer) {
-                // Deleting the observer under the lock is fine because
-                // the reference that holds to this PortDispatcher is by
-                // construction not the last one. We need to do this under
-                // the lock because another thread can call CanReap().
-                delete observer;
-            } else if (port_packet->is_ephemeral()) {
-                port_packet->Free();
+        size_t n = TakeQueued(packets, count);
+        if (n == 0u) {
+            waiters_.fetch_add(1u);
+            n = TakeQueued(packets, count);
+            if (n == 0u) {
+                // Posts are not matched one to one with packets, so this
+                // can wake up to find the queue empty, or already drained
+                // by another thread, and go back to sleep.
+                kcounter_add(port_dequeue_wait_count, 1u);
+                zx_status_t st = sema_.Wait(deadline, nullptr);
+                waiters_.fetch_sub(1u);
+                if (st != ZX_OK)
+                    return st;
+                continue;
             }
+            waiters_.fetch_sub(1u);
         }
-
+        kcounter_add(port_dequeue_count, n);
+        *actual = n;
         return ZX_OK;
+    }
+}
+
+size_t PortDispatcher::TakeQueued(zx_port_packet_t* packets, size_t count) {
+    AutoLock al(&lock_);
+    size_t n = 0;
+    while (n < count && DequeueOneLocked(packets ? &packets[n] : nullptr))
+        ++n;
+    return n;
+}
+
+void PortDispatcher::DrainIncomingLocked() {
+    PortPacket* stack = reinterpret_cast<PortPacket*>(incoming_.exchange(0u));
 
-wait:
-        zx_status_t st = sema_.Wait(deadline, nullptr);
-        if (st != ZX_OK)
-            return st;
+    // The stack is newest first, reverse it to keep the queue in order.
+    PortPacket* fifo = nullptr;
+    while (stack != nullptr) {
+        PortPacket* next = stack->next_incoming;
+        stack->next_incoming = fifo;
+        fifo = stack;
+        stack = next;
+    }
+    while (fifo != nullptr) {
+        PortPacket* next = fifo->next_incoming;
+        fifo->next_incoming = nullptr;
+        packets_.push_back(fifo);
+        fifo = next;
     }
 }
 
+bool PortDispatcher::DequeueOneLocked(zx_port_packet_t* out_packet) {
+    if (packets_.is_empty())
+        DrainIncomingLocked();
+
+    PortPacket* port_packet = packets_.pop_front();
+    if (port_packet == nullptr)
+        return false;
+
+    if (out_packet != nullptr)
+        *out_packet = port_packet->packet;
+
+    if (port_packet->is_ephemeral()) {
+        port_packet->state.store(0u);
+        port_packet->Free();
+        return true;
+    }
+
+    // Once |state| is cleared a live observer can queue the packet again,
+    // or a departing one can delete it in CanReap(), so it must not be
+    // touched past this point unless its observer handed it over.
+    uint64_t state = port_packet->state.exchange(0u);
+    DEBUG_ASSERT(state & PortPacket::kQueued);
+    zx_signals_t observed = static_cast<zx_signals_t>(state);
+    if (observed && out_packet != nullptr)
+        out_packet->signal.observed = observed;
+
+    if (state & PortPacket::kObserverGone) {
+        // Deleting the observer here is fine because the reference
+        // that holds to this PortDispatcher is by construction not
+        // the last one.
+        delete port_packet->observer;
+    }
+    return true;
+}
+
 bool PortDispatcher::CanReap(PortObserver* observer, PortPacket* port_packet) {
     canary_.Assert();
 
-    AutoLock al(&lock_);
-    if (!port_packet->InContainer())
-        return true;
-    // The destruction will happen when the packet is dequeued or in CancelQueued()
-    DEBUG_ASSERT(port_packet->observer == nullptr);
+    // The observer is already detached from its object, so nothing can
+    // queue the packet again; only a dequeue or CancelQueued() can race
+    // with us, and they clear |state| with a single exchange. If the packet
+    // is still queued when the flag lands, the destruction happens there.
     port_packet->observer = observer;
+    uint64_t state = port_packet->state.load(fbl::memory_order_relaxed);
+    do {
+        if (!(state & PortPacket::kQueued))
+            return true;
+    } while (!port_packet->state.compare_exchange_weak(&state,
+                                                       state | PortPacket::kObserverGone,
+                                                       fbl::memory_order_seq_cst,
+                                                       fbl::memory_order_relaxed));
     return false;
 }
 
@@ -334,6 +438,7 @@ bool PortDispatcher::CancelQueued(const void* handle, uint64_t key) {
     canary_.Assert();
 
     AutoLock al(&lock_);
+    DrainIncomingLocked();
 
     // This loop can take a while if there are many items.
     // In practice, the number of pending signal packets is
@@ -341,19 +446,11 @@ bool PortDispatcher::CancelQueued(const void* handle, uint64_t key) {
     // objects plus the number of pending user-queued
     // packets.
     //
-    // There are two strategies to deal with too much
-    // looping here if that is seen in practice.
-    //
-    // 1. Swap the |packets_| list for an empty list and
-    //    release the lock. New arriving packets are
-    //    added to the empty list while the loop happens.
-    //    Readers will be blocked but the watched objects
-    //    will be fully operational. Once processing
-    //    is done the lists are appended.
-    //
-    // 2. Segregate user packets from signal packets
-    //    and deliver them in order via timestamps or
-    //    a side structure.
+    // Only readers are held up by it: new packets keep
+    // arriving on |incoming_| while the loop happens. If
+    // that is still too much in practice, segregate user
+    // packets from signal packets and deliver them in
+    // order via timestamps or a side structure.
 
     bool packet_removed = false;
 
@@ -365,7 +462,9 @@ bool PortDispatcher::CancelQueued(const void* handle, uint64_t key) {
 
         if ((it->handle == handle) && (it->key() == key)) {
             auto to_remove = it++;
-            delete packets_.erase(to_remove)->observer;
+            PortPacket* port_packet = packets_.erase(to_remove);
+            if (port_packet->state.exchange(0u) & PortPacket::kObserverGone)
+                delete port_packet->observer;
             packet_removed = true;
         } else {
             ++it;
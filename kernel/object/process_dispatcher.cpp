@@ -420,7 +420,21 @@ void ProcessDispatcher::UndoRemoveHandleLocked(zx_handle_t handle_value) {
     AddHandleLocked(HandleOwner(handle));
 }
 
+Handle* ProcessDispatcher::GetHandleUnlocked(zx_handle_t handle_value) const {
+    auto handle = map_value_to_handle(handle_value, handle_rand_);
+    if (likely(handle && handle->process_id() == get_koid()))
+        return handle;
+    return nullptr;
+}
+
 zx_koid_t ProcessDispatcher::GetKoidForHandle(zx_handle_t handle_value) {
+    {
+        Handle::ReadGuard guard;
+        Handle* handle = GetHandleUnlocked(handle_value);
+        if (likely(handle))
+            return handle->dispatcher()->get_koid();
+    }
+
     AutoLock lock(&handle_table_lock_);
     Handle* handle = GetHandleLocked(handle_value);
     if (!handle)
@@ -431,21 +445,35 @@ zx_koid_t ProcessDispatcher::GetKoidForHandle(zx_handle_t handle_value) {
 zx_status_t ProcessDispatcher::GetDispatcherInternal(zx_handle_t handle_value,
                                                      fbl::RefPtr<Dispatcher>* dispatcher,
                                                      zx_rights_t* rights) {
-    AutoLock lock(&handle_table_lock_);
-    Handle* handle = GetHandleLocked(handle_value);
-    if (!handle)
-        return ZX_ERR_BAD_HANDLE;
-
-    *dispatcher = handle->dispatcher();
-    if (rights)
-        *rights = handle->rights();
-    return ZX_OK;
+    return GetDispatcherWithRightsInternal(handle_value, 0u, dispatcher, rights);
 }
 
 zx_status_t ProcessDispatcher::GetDispatcherWithRightsInternal(zx_handle_t handle_value,
                                                                zx_rights_t desired_rights,
                                                                fbl::RefPtr<Dispatcher>* dispatcher_out,
                                                                zx_rights_t* out_rights) {
+    // Fast path: the reference is taken with interrupts disabled, so it
+    // goes into a local which is only released after the guard is.
+    fbl::RefPtr<Dispatcher> dispatcher;
+    zx_rights_t rights = 0u;
+    {
+        Handle::ReadGuard guard;
+        Handle* handle = GetHandleUnlocked(handle_value);
+        if (likely(handle)) {
+            rights = handle->rights();
+            if (likely((rights & desired_rights) == desired_rights))
+                dispatcher = handle->dispatcher();
+        }
+    }
+    if (likely(dispatcher)) {
+        *dispatcher_out = fbl::move(dispatcher);
+        if (out_rights)
+            *out_rights = rights;
+        return ZX_OK;
+    }
+
+    // The handle was not found or lacks the rights. Look again under the
+    // lock, which also applies the bad handle policy.
     AutoLock lock(&handle_table_lock_);
     Handle* handle = GetHandleLocked(handle_value);
     if (!handle)
@@ -504,6 +532,11 @@ zx_status_t ProcessDispatcher::GetStats(zx_info_task_stats_t* stats) {
     stats->mem_private_bytes = usage.private_pages * PAGE_SIZE;
     stats->mem_shared_bytes = usage.shared_pages * PAGE_SIZE;
     stats->mem_scaled_shared_bytes = usage.scaled_shared_bytes;
+
+    VmAspace::vm_fault_stats_t fault_stats;
+    aspace_->GetFaultStats(&fault_stats);
+    stats->page_faults = fault_stats.faults;
+    stats->page_fault_around_pages = fault_stats.fault_around_pages;
     return ZX_OK;
 }
 
@@ -759,6 +792,12 @@ const char* StateToString(ProcessDispatcher::State state) {
 }
 
 bool ProcessDispatcher::IsHandleValid(zx_handle_t handle_value) {
+    {
+        Handle::ReadGuard guard;
+        if (likely(GetHandleUnlocked(handle_value) != nullptr))
+            return true;
+    }
+
     AutoLock lock(&handle_table_lock_);
     return (GetHandleLocked(handle_value) != nullptr);
 }
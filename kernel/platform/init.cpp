@@ -20,6 +20,10 @@ __WEAK void platform_init_mmu_mappings() {
 __WEAK void platform_early_init() {
 }
 
+__WEAK bool platform_current_time_scale(struct fp_32_64* ns_per_tick) {
+    return false;
+}
+
 __WEAK void platform_init() {
 }
 
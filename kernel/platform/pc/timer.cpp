@@ -173,6 +173,14 @@ uint64_t current_ticks(void) {
     return rdtsc();
 }
 
+bool platform_current_time_scale(struct fp_32_64* ns_per_tick) {
+    // Only the invariant TSC is both the wall clock and what rdtsc returns.
+    if (wall_clock != CLOCK_TSC)
+        return false;
+    *ns_per_tick = ns_per_tsc;
+    return true;
+}
+
 zx_time_t ticks_to_nanos(uint64_t ticks) {
     return u64_mul_u64_fp32_64(ticks, ns_per_tsc);
 }
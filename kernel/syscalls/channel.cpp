@@ -12,8 +12,12 @@
 
 #include <object/channel_dispatcher.h>
 #include <object/handle.h>
+#include <object/job_dispatcher.h>
 #include <object/message_packet.h>
 #include <object/process_dispatcher.h>
+#include <vm/vm_address_region.h>
+#include <vm/vm_aspace.h>
+#include <vm/vm_object.h>
 #include <zircon/syscalls/policy.h>
 #include <zircon/types.h>
 
@@ -129,6 +133,66 @@ zx_status_t sys_channel_read(zx_handle_t handle_value, uint32_t options,
     return result;
 }
 
+zx_status_t sys_channel_read_many(zx_handle_t handle_value, uint32_t options,
+                                  user_inout_ptr<zx_channel_msg_t> user_msgs, uint32_t num_msgs,
+                                  user_out_ptr<uint32_t> actual_msgs) {
+    LTRACEF("handle %x msgs %p num_msgs %u options 0x%x\n",
+            handle_value, user_msgs.get(), num_msgs, options);
+
+    if (options)
+        return ZX_ERR_NOT_SUPPORTED;
+    if (num_msgs == 0u || num_msgs > ZX_CHANNEL_MANY_MAX_MSGS)
+        return ZX_ERR_OUT_OF_RANGE;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    fbl::RefPtr<ChannelDispatcher> channel;
+    zx_status_t result = up->GetDispatcherWithRights(handle_value, ZX_RIGHT_READ, &channel);
+    if (result != ZX_OK)
+        return result;
+
+    zx_channel_msg_t msgs[ZX_CHANNEL_MANY_MAX_MSGS];
+    if (user_msgs.copy_array_from_user(msgs, num_msgs) != ZX_OK)
+        return ZX_ERR_INVALID_ARGS;
+    for (uint32_t i = 0; i != num_msgs; ++i) {
+        msgs[i].actual_bytes = 0u;
+        msgs[i].actual_handles = 0u;
+    }
+
+    ChannelDispatcher::MessageList list;
+    result = channel->ReadMany(msgs, num_msgs, &list);
+    if (result != ZX_OK && result != ZX_ERR_BUFFER_TOO_SMALL)
+        return result;
+
+    uint32_t count = static_cast<uint32_t>(list.size_slow());
+
+    // Report the sizes of the messages read and of the one that stopped the
+    // batch, if any. This happens before any handle is installed, so that a
+    // fault here leaves nothing behind in the handle table.
+    if (user_msgs.copy_array_to_user(msgs, num_msgs) != ZX_OK)
+        return ZX_ERR_INVALID_ARGS;
+    if (actual_msgs) {
+        zx_status_t status = actual_msgs.copy_to_user(count);
+        if (status != ZX_OK)
+            return status;
+    }
+
+    uint32_t i = 0;
+    for (auto& msg : list) {
+        const zx_channel_msg_t& m = msgs[i++];
+        if (m.actual_bytes > 0u) {
+            if (msg.CopyDataTo(make_user_out_ptr(m.bytes)) != ZX_OK)
+                result = ZX_ERR_INVALID_ARGS;
+        }
+        if (m.actual_handles > 0u) {
+            msg_get_handles(up, &msg, make_user_out_ptr(m.handles), m.actual_handles);
+        }
+        ktrace(TAG_CHANNEL_READ, (uint32_t)channel->get_koid(), m.actual_bytes,
+               m.actual_handles, 0);
+    }
+    return result;
+}
+
 static zx_status_t channel_read_out(ProcessDispatcher* up,
                                     fbl::unique_ptr<MessagePacket> reply,
                                     zx_channel_call_args_t* args,
@@ -236,13 +300,53 @@ static zx_status_t msg_put_handles(ProcessDispatcher* up, MessagePacket* msg, zx
     return ZX_OK;
 }
 
+// Creates a packet that loans the |num_bytes| bytes at |bytes| from the VMO
+// that backs them in |up|'s address space, rather than copying them.
+static zx_status_t msg_loan_bytes(ProcessDispatcher* up, user_in_ptr<const void> bytes,
+                                  uint32_t num_bytes, uint32_t num_handles,
+                                  fbl::unique_ptr<MessagePacket>* msg) {
+    const vaddr_t vaddr = reinterpret_cast<vaddr_t>(bytes.get());
+    if (!IS_PAGE_ALIGNED(vaddr))
+        return ZX_ERR_INVALID_ARGS;
+
+    auto region = up->aspace()->FindRegion(vaddr);
+    if (!region)
+        return ZX_ERR_INVALID_ARGS;
+    auto mapping = region->as_vm_mapping();
+    if (!mapping)
+        return ZX_ERR_INVALID_ARGS;
+
+    // The whole range must come from this one mapping.
+    const size_t mapping_offset = vaddr - mapping->base();
+    if (mapping->size() - mapping_offset < num_bytes)
+        return ZX_ERR_INVALID_ARGS;
+    // Loaned pages stay pinned until the message is read, which stops the
+    // VMO's owner from decommitting them and uses up pins that zx_bti_pin()
+    // also needs. Only allow that with a writable mapping, which required
+    // ZX_RIGHT_WRITE on the VMO to create.
+    const uint mmu_flags = mapping->arch_mmu_flags();
+    if (!(mmu_flags & ARCH_MMU_FLAG_PERM_READ) || !(mmu_flags & ARCH_MMU_FLAG_PERM_WRITE))
+        return ZX_ERR_ACCESS_DENIED;
+
+    // The mapping may be unmapped concurrently, which resets its VMO.
+    auto vmo = mapping->vmo();
+    if (!vmo)
+        return ZX_ERR_BAD_STATE;
+    if (!vmo->is_paged())
+        return ZX_ERR_NOT_SUPPORTED;
+
+    return MessagePacket::CreateLoaned(fbl::move(vmo),
+                                       mapping->object_offset() + mapping_offset,
+                                       num_bytes, num_handles, msg);
+}
+
 zx_status_t sys_channel_write(zx_handle_t handle_value, uint32_t options,
                               user_in_ptr<const void> user_bytes, uint32_t num_bytes,
                               user_in_ptr<const zx_handle_t> user_handles, uint32_t num_handles) {
     LTRACEF("handle %x bytes %p num_bytes %u handles %p num_handles %u options 0x%x\n",
             handle_value, user_bytes.get(), num_bytes, user_handles.get(), num_handles, options);
 
-    if (options)
+    if (options & ~ZX_CHANNEL_WRITE_LOAN)
         return ZX_ERR_INVALID_ARGS;
 
     auto up = ProcessDispatcher::GetCurrent();
@@ -254,7 +358,14 @@ zx_status_t sys_channel_write(zx_handle_t handle_value, uint32_t options,
 
 
     fbl::unique_ptr<MessagePacket> msg;
-    result = MessagePacket::Create(user_bytes, num_bytes, num_handles, &msg);
+    if ((options & ZX_CHANNEL_WRITE_LOAN) && num_bytes > 0u) {
+        result = msg_loan_bytes(up, user_bytes, num_bytes, num_handles, &msg);
+    } else {
+        result = MessagePacket::Create(user_bytes, num_bytes, num_handles, &msg);
+    }
+    if (result != ZX_OK)
+        return result;
+    result = msg->ChargeTo(up->job());
     if (result != ZX_OK)
         return result;
 
@@ -280,6 +391,82 @@ zx_status_t sys_channel_write(zx_handle_t handle_value, uint32_t options,
     return ZX_OK;
 }
 
+// Puts the handles of the packets in |msgs|, which were taken from |up| by
+// msg_put_handles(), back into |up|.
+static void msgs_undo_put_handles(ProcessDispatcher* up, ChannelDispatcher::MessageList* msgs) {
+    AutoLock lock(up->handle_table_lock());
+    for (auto& msg : *msgs) {
+        msg.set_owns_handles(false);
+        for (uint32_t ix = 0; ix != msg.num_handles(); ++ix) {
+            up->UndoRemoveHandleLocked(up->MapHandleToValue(msg.handles()[ix]));
+        }
+    }
+}
+
+zx_status_t sys_channel_write_many(zx_handle_t handle_value, uint32_t options,
+                                   user_in_ptr<const zx_channel_msg_t> user_msgs,
+                                   uint32_t num_msgs) {
+    LTRACEF("handle %x msgs %p num_msgs %u options 0x%x\n",
+            handle_value, user_msgs.get(), num_msgs, options);
+
+    if (options & ~ZX_CHANNEL_WRITE_LOAN)
+        return ZX_ERR_INVALID_ARGS;
+    if (num_msgs == 0u || num_msgs > ZX_CHANNEL_MANY_MAX_MSGS)
+        return ZX_ERR_OUT_OF_RANGE;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    fbl::RefPtr<ChannelDispatcher> channel;
+    zx_status_t result = up->GetDispatcherWithRights(handle_value, ZX_RIGHT_WRITE, &channel);
+    if (result != ZX_OK)
+        return result;
+
+    zx_channel_msg_t msgs[ZX_CHANNEL_MANY_MAX_MSGS];
+    if (user_msgs.copy_array_from_user(msgs, num_msgs) != ZX_OK)
+        return ZX_ERR_INVALID_ARGS;
+
+    // Build every packet before writing any, so that the batch is written
+    // either completely or not at all.
+    ChannelDispatcher::MessageList list;
+    zx_handle_t handles[kMaxMessageHandles];
+    for (uint32_t i = 0; i != num_msgs; ++i) {
+        const zx_channel_msg_t& m = msgs[i];
+        auto bytes = make_user_in_ptr(static_cast<const void*>(m.bytes));
+        fbl::unique_ptr<MessagePacket> msg;
+        if ((options & ZX_CHANNEL_WRITE_LOAN) && m.num_bytes > 0u) {
+            result = msg_loan_bytes(up, bytes, m.num_bytes, m.num_handles, &msg);
+        } else {
+            result = MessagePacket::Create(bytes, m.num_bytes, m.num_handles, &msg);
+        }
+        if (result == ZX_OK) {
+            result = msg->ChargeTo(up->job());
+        }
+        if (result == ZX_OK && m.num_handles > 0u) {
+            result = msg_put_handles(up, msg.get(), handles,
+                                     make_user_in_ptr(static_cast<const zx_handle_t*>(m.handles)),
+                                     m.num_handles, static_cast<Dispatcher*>(channel.get()));
+        }
+        if (result != ZX_OK) {
+            msgs_undo_put_handles(up, &list);
+            return result;
+        }
+        list.push_back(fbl::move(msg));
+    }
+
+    result = channel->WriteMany(&list);
+    if (result != ZX_OK) {
+        // Write failed, put back the handles into this process.
+        msgs_undo_put_handles(up, &list);
+        return result;
+    }
+
+    for (uint32_t i = 0; i != num_msgs; ++i) {
+        ktrace(TAG_CHANNEL_WRITE, (uint32_t)channel->get_koid(), msgs[i].num_bytes,
+               msgs[i].num_handles, 0);
+    }
+    return ZX_OK;
+}
+
 zx_status_t sys_channel_call_noretry(zx_handle_t handle_value, uint32_t options,
                                      zx_time_t deadline,
                                      user_in_ptr<const zx_channel_call_args_t> user_args,
@@ -312,6 +499,9 @@ zx_status_t sys_channel_call_noretry(zx_handle_t handle_value, uint32_t options,
                                    num_bytes, num_handles, &msg);
     if (result != ZX_OK)
         return result;
+    result = msg->ChargeTo(up->job());
+    if (result != ZX_OK)
+        return result;
 
     zx_handle_t handles[kMaxMessageHandles];
     if (num_handles > 0u) {
@@ -13,6 +13,7 @@
 #include <trace.h>
 
 #include <lib/console.h>
+#include <lib/counters.h>
 #include <lib/user_copy/user_ptr.h>
 #include <lib/ktrace.h>
 #include <lib/mtrace.h>
@@ -20,8 +21,13 @@
 #include <object/handle.h>
 #include <object/process_dispatcher.h>
 #include <object/resources.h>
+#include <object/vm_object_dispatcher.h>
 
 #include <platform/debug.h>
+#include <vm/vm_object_paged.h>
+
+#include <fbl/auto_lock.h>
+#include <fbl/mutex.h>
 
 #include <zircon/syscalls/debug.h>
 
@@ -144,14 +150,9 @@ zx_status_t sys_ktrace_write(zx_handle_t handle, uint32_t event_id, uint32_t arg
         return ZX_ERR_INVALID_ARGS;
     }
 
-    uint32_t* args = static_cast<uint32_t*>(ktrace_open(TAG_PROBE_24(event_id)));
-    if (!args) {
-        //  There is not a single reason for failure. Assume it reached the end.
-        return ZX_ERR_UNAVAILABLE;
-    }
-
-    args[0] = arg0;
-    args[1] = arg1;
+    // Like any other record, this one is dropped if tracing is stopped
+    // or a streaming buffer is full.
+    ktrace(TAG_PROBE_24(event_id), arg0, arg1, 0, 0);
     return ZX_OK;
 }
 
@@ -166,3 +167,44 @@ zx_status_t sys_mtrace_control(zx_handle_t handle,
 
     return mtrace_control(kind, action, options, ptr, size);
 }
+
+// All the handles share one dispatcher over the counters in the kernel
+// image, made the first time it is asked for.
+static fbl::Mutex kcounters_lock;
+static fbl::RefPtr<VmObjectDispatcher> kcounters_vmo TA_GUARDED(kcounters_lock);
+static zx_rights_t kcounters_rights TA_GUARDED(kcounters_lock);
+
+zx_status_t sys_kcounters_get_vmo(zx_handle_t handle, user_out_handle* out) {
+    // TODO(ZX-971): finer grained validation
+    zx_status_t status;
+    if ((status = validate_resource(handle, ZX_RSRC_KIND_ROOT)) < 0) {
+        return status;
+    }
+
+    fbl::AutoLock lock(&kcounters_lock);
+    if (!kcounters_vmo) {
+        void* base;
+        size_t size;
+        kcounters_get_block(&base, &size);
+
+        fbl::RefPtr<VmObject> vmo;
+        status = VmObjectPaged::CreateFromROData(base, size, &vmo);
+        if (status != ZX_OK) {
+            return status;
+        }
+
+        fbl::RefPtr<Dispatcher> dispatcher;
+        status = VmObjectDispatcher::Create(fbl::move(vmo), &dispatcher, &kcounters_rights);
+        if (status != ZX_OK) {
+            return status;
+        }
+        static const char kName[] = "kcounters";
+        dispatcher->set_name(kName, sizeof(kName));
+
+        // The kernel keeps writing the counters; userspace only gets to look.
+        kcounters_rights &= ~(ZX_RIGHT_WRITE | ZX_RIGHT_EXECUTE);
+        kcounters_vmo = DownCastDispatcher<VmObjectDispatcher>(&dispatcher);
+    }
+
+    return out->make(kcounters_vmo, kcounters_rights);
+}
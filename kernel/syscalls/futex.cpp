@@ -7,6 +7,7 @@
 #include <trace.h>
 
 #include <object/process_dispatcher.h>
+#include <object/thread_dispatcher.h>
 #include <zircon/types.h>
 
 #include "priv.h"
@@ -20,6 +21,26 @@ zx_status_t sys_futex_wait(user_in_ptr<const zx_futex_t> value_ptr, int current_
         value_ptr, current_value, deadline);
 }
 
+zx_status_t sys_futex_wait_pi(user_in_ptr<const zx_futex_t> value_ptr, int current_value,
+                             zx_handle_t owner, zx_time_t deadline) {
+    LTRACEF("futex %p current %d owner %x\n", value_ptr.get(), current_value, owner);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    fbl::RefPtr<ThreadDispatcher> thread;
+    zx_status_t status = up->GetDispatcher(owner, &thread);
+    if (status != ZX_OK)
+        return status;
+
+    // Futexes are private to a process, so their owners are too.
+    if (thread->process() != up)
+        return ZX_ERR_ACCESS_DENIED;
+    if (thread.get() == ThreadDispatcher::GetCurrent())
+        return ZX_ERR_INVALID_ARGS;
+
+    return up->futex_context()->FutexWait(value_ptr, current_value, deadline, thread.get());
+}
+
 zx_status_t sys_futex_wake(user_in_ptr<const zx_futex_t> value_ptr, uint32_t count) {
     LTRACEF("futex %p count %" PRIu32 "\n", value_ptr.get(), count);
 
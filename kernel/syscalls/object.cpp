@@ -298,6 +298,19 @@ zx_status_t sys_object_get_info(zx_handle_t handle, uint32_t topic,
             return single_record_result(
                 _buffer, buffer_size, _actual, _avail, &info, sizeof(info));
         }
+        case ZX_INFO_JOB_STATS: {
+            fbl::RefPtr<JobDispatcher> job;
+            auto error = up->GetDispatcherWithRights(handle, ZX_RIGHT_READ, &job);
+            if (error < 0)
+                return error;
+
+            zx_info_job_stats_t info = {};
+            info.channel_msgs = job->channel_msgs();
+            info.channel_msg_bytes = job->channel_msg_bytes();
+
+            return single_record_result(
+                _buffer, buffer_size, _actual, _avail, &info, sizeof(info));
+        }
         case ZX_INFO_TASK_STATS: {
             // TODO(ZX-458): Handle forward/backward compatibility issues
             // with changes to the struct.
@@ -510,6 +523,12 @@ zx_status_t sys_object_get_info(zx_handle_t handle, uint32_t topic,
             // All other VM_PAGE_STATE_* counts get lumped into other_bytes.
             stats.other_bytes = other_bytes;
 
+            pmm_zero_pool_stats_t zero_pool;
+            pmm_get_zero_pool_stats(&zero_pool);
+            stats.free_zeroed_bytes = zero_pool.count * PAGE_SIZE;
+            stats.zero_pool_hits = zero_pool.hits;
+            stats.zero_pool_misses = zero_pool.misses;
+
             return single_record_result(
                 _buffer, buffer_size, _actual, _avail, &stats, sizeof(stats));
         }
@@ -256,6 +256,23 @@ zx_status_t sys_thread_set_priority(int32_t prio) {
 #endif
 }
 
+zx_status_t sys_thread_set_deadline(zx_duration_t capacity, zx_duration_t deadline,
+                                    zx_duration_t period) {
+    LTRACEF("capacity %" PRIu64 " deadline %" PRIu64 " period %" PRIu64 "\n",
+            capacity, deadline, period);
+
+#if THREAD_SET_PRIORITY_EXPERIMENT
+    // Deadline threads run ahead of every thread scheduled by priority, so
+    // this is gated by the same experiment as zx_thread_set_priority.
+    if (!thread_set_priority_allowed)
+        return ZX_ERR_NOT_SUPPORTED;
+
+    return thread_set_deadline(capacity, deadline, period);
+#else
+    return ZX_ERR_NOT_SUPPORTED;
+#endif
+}
+
 zx_status_t sys_task_suspend(zx_handle_t task_handle) {
     LTRACE_ENTRY;
 
@@ -9,7 +9,14 @@
 
 #include <arch/ops.h>
 #include <err.h>
+#include <fbl/algorithm.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/atomic.h>
+#include <fbl/unique_ptr.h>
 #include <inttypes.h>
+#include <arch/mp.h>
+#include <kernel/cpu.h>
+#include <kernel/event.h>
 #include <kernel/mp.h>
 #include <kernel/mutex.h>
 #include <kernel/spinlock.h>
@@ -20,6 +27,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <vm/pmm.h>
+#include <vm/vm_aspace.h>
 
 const size_t BUFSIZE = (8 * 1024 * 1024);
 const size_t ITER = (1UL * 1024 * 1024 * 1024 / BUFSIZE); // enough iterations to have to copy/set 1GB of memory
@@ -235,6 +244,198 @@ __NO_INLINE static void bench_mutex() {
     printf("%" PRIu64 " cycles to acquire/release uncontended mutex %u times (%" PRIu64 " cycles per)\n", c, count, c / count);
 }
 
+static int unmap_helper_thread(void* arg) {
+    auto stop = static_cast<fbl::atomic<bool>*>(arg);
+    while (!stop->load()) {
+        __asm__ volatile("");
+    }
+    return 0;
+}
+
+// Measure the latency of unmapping a range of pages from an address space as
+// a function of the size of the range and of the number of other cpus that
+// are currently running in the address space, and so need to take part in
+// the TLB shootdown.
+__NO_INLINE static void bench_unmap() {
+    static const size_t kSizes[] = {1, 16, 256, 4096};
+    static const uint kIterations = 16;
+    const size_t max_pages = kSizes[fbl::count_of(kSizes) - 1];
+
+    fbl::RefPtr<VmAspace> aspace = VmAspace::Create(VmAspace::TYPE_USER, "bench_unmap");
+    if (!aspace) {
+        printf("failed to create aspace\n");
+        return;
+    }
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<paddr_t[]> pa(new (&ac) paddr_t[max_pages]);
+    if (!ac.check()) {
+        printf("failed to allocate page address array\n");
+        aspace->Destroy();
+        return;
+    }
+
+    list_node pages = LIST_INITIAL_VALUE(pages);
+    if (pmm_alloc_pages(max_pages, 0, &pages) != max_pages) {
+        printf("failed to allocate pages\n");
+        pmm_free(&pages);
+        aspace->Destroy();
+        return;
+    }
+    size_t i = 0;
+    vm_page_t* p;
+    list_for_every_entry (&pages, p, vm_page_t, free.node) {
+        pa[i++] = vm_page_to_paddr(p);
+    }
+
+    const vaddr_t va = aspace->base() + 16 * MB;
+    const uint mmu_flags = ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE |
+                           ARCH_MMU_FLAG_PERM_USER;
+
+    // Run the benchmark itself on the current cpu, and add helper threads
+    // spinning in the aspace on the other cpus one at a time.
+    thread_t* self = get_current_thread();
+    cpu_mask_t old_affinity = self->cpu_affinity;
+    cpu_num_t bench_cpu = arch_curr_cpu_num();
+    thread_set_cpu_affinity(self, cpu_num_to_mask(bench_cpu));
+
+    fbl::atomic<bool> stop(false);
+    thread_t* helpers[SMP_MAX_CPUS] = {};
+    uint helper_count = 0;
+    for (cpu_num_t cpu = 0; cpu <= SMP_MAX_CPUS; cpu++) {
+        if (cpu == SMP_MAX_CPUS || (cpu != bench_cpu && mp_is_cpu_online(cpu))) {
+            // Give any newly created helper a chance to switch into the aspace.
+            thread_sleep_relative(ZX_MSEC(10));
+
+            for (size_t size : kSizes) {
+                uint64_t cycles = 0;
+                zx_time_t t = 0;
+                for (uint iter = 0; iter < kIterations; iter++) {
+                    aspace->arch_aspace().Map(va, pa.get(), size, mmu_flags, nullptr);
+
+                    zx_time_t start = current_time();
+                    uint64_t c = arch_cycle_count();
+                    aspace->arch_aspace().Unmap(va, size, nullptr);
+                    cycles += arch_cycle_count() - c;
+                    t += current_time() - start;
+                }
+                printf("unmap %4zu pages with %2u other cpus active: "
+                       "%" PRIu64 " cycles, %" PRIi64 " ns per unmap\n",
+                       size, helper_count, cycles / kIterations, t / kIterations);
+            }
+        }
+        if (cpu == SMP_MAX_CPUS || cpu == bench_cpu || !mp_is_cpu_online(cpu)) {
+            continue;
+        }
+
+        thread_t* t = thread_create("unmap helper", unmap_helper_thread, &stop,
+                                    DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        if (!t) {
+            break;
+        }
+        aspace->AttachToThread(t);
+        thread_set_cpu_affinity(t, cpu_num_to_mask(cpu));
+        thread_resume(t);
+        helpers[helper_count++] = t;
+    }
+
+    stop.store(true);
+    for (uint j = 0; j < helper_count; j++) {
+        thread_join(helpers[j], nullptr, ZX_TIME_INFINITE);
+    }
+    thread_set_cpu_affinity(self, old_affinity);
+
+    aspace->Destroy();
+    pmm_free(&pages);
+}
+
+struct ping_pong_state {
+    event_t ping;
+    event_t pong;
+    uint iterations;
+};
+
+static cpu_mask_t first_cpu(cpu_mask_t mask) {
+    return mask ? cpu_num_to_mask(lowest_cpu_set(mask)) : 0;
+}
+
+static int ping_pong_thread(void* arg) {
+    auto state = static_cast<ping_pong_state*>(arg);
+    for (uint i = 0; i < state->iterations; i++) {
+        event_wait(&state->ping);
+        event_signal(&state->pong, true);
+    }
+    return 0;
+}
+
+// Measure the wakeup round trip between two threads, first with the
+// threads placed by the scheduler and then with them pinned to cpus at
+// increasing topology distance. With kernel.sched.wakeup=cache or waker the
+// unpinned case should be close to the nearest pinned one.
+__NO_INLINE static void bench_ping_pong() {
+    static const uint kIterations = 10000;
+
+    thread_t* self = get_current_thread();
+    const cpu_mask_t old_affinity = self->cpu_affinity;
+    const cpu_num_t cpu = arch_curr_cpu_num();
+    const cpu_mask_t active = mp_get_active_mask();
+    const cpu_mask_t self_mask = cpu_num_to_mask(cpu);
+    const cpu_mask_t smt = arch_cpu_smt_siblings(cpu) & active & ~self_mask;
+    const cpu_mask_t package = arch_cpu_package_siblings(cpu) & active &
+                               ~(smt | self_mask);
+    const cpu_mask_t remote = active & ~(arch_cpu_package_siblings(cpu) | self_mask);
+
+    const struct {
+        const char* name;
+        cpu_mask_t self_affinity;
+        cpu_mask_t peer_affinity;
+    } cases[] = {
+        {"unpinned", old_affinity, CPU_MASK_ALL},
+        {"same cpu", self_mask, self_mask},
+        {"smt sibling", self_mask, first_cpu(smt)},
+        {"same package", self_mask, first_cpu(package)},
+        {"other package", self_mask, first_cpu(remote)},
+    };
+
+    for (const auto& c : cases) {
+        // Skip the topology levels this machine does not have.
+        if (c.peer_affinity == 0) {
+            continue;
+        }
+
+        ping_pong_state state;
+        event_init(&state.ping, false, EVENT_FLAG_AUTOUNSIGNAL);
+        event_init(&state.pong, false, EVENT_FLAG_AUTOUNSIGNAL);
+        state.iterations = kIterations;
+
+        thread_set_cpu_affinity(self, c.self_affinity);
+        thread_t* t = thread_create("ping pong", ping_pong_thread, &state,
+                                    DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        if (!t) {
+            break;
+        }
+        thread_set_cpu_affinity(t, c.peer_affinity);
+        thread_resume(t);
+
+        zx_time_t start = current_time();
+        for (uint i = 0; i < kIterations; i++) {
+            event_signal(&state.ping, true);
+            event_wait(&state.pong);
+        }
+        zx_duration_t elapsed = current_time() - start;
+        cpu_num_t peer_cpu = t->last_cpu;
+
+        thread_join(t, nullptr, ZX_TIME_INFINITE);
+        event_destroy(&state.ping);
+        event_destroy(&state.pong);
+
+        printf("ping pong %-13s (cpu %u <-> %u): %" PRIu64 " ns per round trip\n",
+               c.name, arch_curr_cpu_num(), peer_cpu, elapsed / kIterations);
+    }
+
+    thread_set_cpu_affinity(self, old_affinity);
+}
+
 void benchmarks() {
     bench_set_overhead();
     bench_memcpy();
@@ -251,4 +452,7 @@ void benchmarks() {
 
     bench_spinlock();
     bench_mutex();
+
+    bench_unmap();
+    bench_ping_pong();
 }
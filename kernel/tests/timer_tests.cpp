@@ -10,6 +10,7 @@
 #include <inttypes.h>
 #include <malloc.h>
 #include <platform.h>
+#include <rand.h>
 #include <stdio.h>
 
 #include <kernel/event.h>
@@ -188,10 +189,65 @@ static void timer_far_deadline(void) {
     event_destroy(&event);
 }
 
+static void timer_stress_cb(timer_t* timer, zx_time_t now, void* arg) {
+    int* timer_count = (int*)arg;
+    atomic_add(timer_count, 1);
+}
+
+// Sets |count| timers with overlapping slack on one cpu, cancels every other
+// one and waits for the rest to fire. Reports the average time per set and
+// cancel, which should stay flat as |count| grows.
+static void timer_stress(int count) {
+    timer_t* timers = (timer_t*)malloc(sizeof(timer_t) * count);
+    if (timers == NULL) {
+        printf("failed to allocate %d timers\n", count);
+        return;
+    }
+
+    printf("setting %d timers\n", count);
+    thread_set_cpu_affinity(get_current_thread(), cpu_num_to_mask(arch_curr_cpu_num()));
+
+    int timer_count = 0;
+    zx_time_t base = current_time() + ZX_MSEC(200);
+    zx_time_t start = current_time();
+    for (int ix = 0; ix != count; ++ix) {
+        timer_init(&timers[ix]);
+        zx_time_t deadline = base + ZX_USEC(rand() % 100000);
+        enum slack_mode mode = (enum slack_mode)(ix % 3);
+        timer_set(&timers[ix], deadline, mode, ZX_USEC(rand() % 50),
+                  timer_stress_cb, &timer_count);
+    }
+    zx_duration_t set_time = current_time() - start;
+
+    int canceled = 0;
+    start = current_time();
+    for (int ix = 0; ix < count; ix += 2) {
+        if (timer_cancel(&timers[ix]))
+            canceled++;
+    }
+    zx_duration_t cancel_time = current_time() - start;
+
+    printf("%" PRIu64 " ns per set, %" PRIu64 " ns per cancel\n",
+           set_time / count, cancel_time / ((count + 1) / 2));
+
+    // Wait for the remaining timers to fire.
+    while (atomic_load(&timer_count) + canceled != count) {
+        thread_sleep(current_time() + ZX_MSEC(10));
+    }
+    printf("%d timers fired, %d canceled\n", timer_count, canceled);
+
+    // Make sure no callback is still running before freeing the timers.
+    for (int ix = 1; ix < count; ix += 2)
+        timer_cancel(&timers[ix]);
+    thread_set_cpu_affinity(get_current_thread(), CPU_MASK_ALL);
+    free(timers);
+}
+
 void timer_tests(void) {
     timer_test_coalescing_center();
     timer_test_coalescing_late();
     timer_test_coalescing_early();
     timer_test_all_cpus();
     timer_far_deadline();
+    timer_stress(100000);
 }
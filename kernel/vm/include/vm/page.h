@@ -17,6 +17,8 @@ class VmObject;
 #define VM_PAGE_OBJECT_PIN_COUNT_BITS 5
 #define VM_PAGE_OBJECT_MAX_PIN_COUNT ((1ul << VM_PAGE_OBJECT_PIN_COUNT_BITS) - 1)
 
+#define VM_PAGE_ORDER_NONE (0xff)
+
 // core per page structure
 typedef struct vm_page {
     struct {
@@ -29,6 +31,9 @@ typedef struct vm_page {
         struct {
             // in allocated/just freed state, use a linked list to hold the page in a queue
             struct list_node node;
+            // while in the FREE state, the buddy order of the free block this page
+            // heads, or VM_PAGE_ORDER_NONE if the page is inside a larger block
+            uint8_t order;
         } free;
         struct {
             // attached to a vm object
@@ -45,6 +50,9 @@ typedef struct vm_page {
     };
 } vm_page_t;
 
+// vm_page flags
+#define VM_PAGE_FLAG_ZEROED (0x1) // page contents are known to be zero
+
 // pmm will maintain pages of this size
 #define VM_PAGE_STRUCT_SIZE (sizeof(vm_page_t))
 static_assert(sizeof(vm_page_t) == 32, "");
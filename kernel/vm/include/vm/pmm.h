@@ -31,6 +31,10 @@ zx_status_t pmm_add_arena(const pmm_arena_info_t* arena) __NONNULL((1));
 // flags for allocation routines below
 #define PMM_ALLOC_FLAG_ANY (0x0)  // no restrictions on which arena to allocate from
 #define PMM_ALLOC_FLAG_KMAP (0x1) // allocate only from arenas marked KMAP
+#define PMM_ALLOC_FLAG_ZEROED (0x2) // prefer pages that are already zeroed; such pages
+                                    // are returned with VM_PAGE_FLAG_ZEROED set
+#define PMM_ALLOC_FLAG_NO_DRAIN (0x4) // fail rather than draining the per-cpu caches and
+                                      // zero pool back into the arenas
 
 // Allocate count pages of physical memory, adding to the tail of the passed list.
 // The list must be initialized.
@@ -68,6 +72,18 @@ size_t pmm_count_total_bytes(void);
 // |state_count|. Does not zero out the entries first.
 void pmm_count_total_states(size_t state_count[_VM_PAGE_STATE_COUNT]);
 
+// Statistics for the pool of pre-zeroed free pages.
+typedef struct pmm_zero_pool_stats {
+    // Pages currently in the pool.
+    size_t count;
+    // PMM_ALLOC_FLAG_ZEROED pages that were served out of the pool.
+    uint64_t hits;
+    // PMM_ALLOC_FLAG_ZEROED pages that the pool could not supply.
+    uint64_t misses;
+} pmm_zero_pool_stats_t;
+
+void pmm_get_zero_pool_stats(pmm_zero_pool_stats_t* stats) __NONNULL((1));
+
 // Allocate a run of pages out of the kernel area and return the pointer in kernel space.
 // If the optional list is passed, append the allocate page structures to the tail of the list.
 // If the optional physical address pointer is passed, return the address.
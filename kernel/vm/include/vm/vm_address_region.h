@@ -42,6 +42,9 @@
 // with execute permissions.  When on a VmMapping, controls whether or not the
 // mapping can gain this permission.
 #define VMAR_FLAG_CAN_MAP_EXECUTE (1 << 6)
+// On a VmMapping, back faults with physically contiguous large pages where the
+// mapping and the object are suitably aligned and memory is available.
+#define VMAR_FLAG_LARGE_PAGES (1 << 7)
 
 #define VMAR_CAN_RWX_FLAGS (VMAR_FLAG_CAN_MAP_READ |  \
                             VMAR_FLAG_CAN_MAP_WRITE | \
@@ -470,6 +473,16 @@ private:
     // Version of AllocatedPages() that does not acquire the aspace lock
     size_t AllocatedPagesLocked() const override;
 
+    // Helper for PageFault() on VMAR_FLAG_LARGE_PAGES mappings.  Tries to map the
+    // large page containing |va|, returning an error if the caller should fall back
+    // to faulting in a single page.  Must be called with object_->lock() held.
+    zx_status_t PageFaultLargeLocked(vaddr_t va, uint pf_flags);
+
+    // Helper for PageFault() that maps pages of the object that are already
+    // present in a window around |va|, so that touching them does not take
+    // another fault.  Must be called with object_->lock() held.
+    void FaultAroundLocked(vaddr_t va, uint pf_flags);
+
     void Activate() override;
 
     // Version of Activate that does not take the object_ lock.
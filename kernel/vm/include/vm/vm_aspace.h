@@ -112,6 +112,18 @@ public:
 
     size_t AllocatedPages() const;
 
+    // Page fault counts for the address space.
+    struct vm_fault_stats_t {
+        // Faults taken in the address space, including ones that failed.
+        size_t faults;
+
+        // Pages mapped by fault-around on behalf of neighbouring faults, each
+        // of which would otherwise have been a separate fault.
+        size_t fault_around_pages;
+    };
+
+    void GetFaultStats(vm_fault_stats_t* stats) const;
+
     // Convenience method for traversing the tree of VMARs to find the deepest
     // VMAR in the tree that includes *va*.
     fbl::RefPtr<VmAddressRegionOrMapping> FindRegion(vaddr_t va);
@@ -190,6 +202,10 @@ private:
 
     mutable mutex_t lock_ = MUTEX_INITIAL_VALUE(lock_);
 
+    // fault statistics, guarded by lock_
+    size_t faults_ = 0;
+    size_t fault_around_pages_ = 0;
+
     // root of virtual address space
     // Access to this reference is guarded by lock_.
     fbl::RefPtr<VmAddressRegion> root_vmar_;
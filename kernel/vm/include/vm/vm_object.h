@@ -167,6 +167,7 @@ public:
     // TODO: If more types of clones appear, replace this with a method that
     // returns an enum rather than adding a new method for each clone type.
     bool is_cow_clone() const;
+    bool is_cow_clone_locked() const TA_REQ(lock_) { return parent_ != nullptr; }
 
     // get a pointer to the page structure and/or physical address at the specified offset.
     // valid flags are VMM_PF_FLAG_*
@@ -175,6 +176,16 @@ public:
         return ZX_ERR_NOT_SUPPORTED;
     }
 
+    // get the physical address of a LARGE_PAGE_SIZE aligned, physically contiguous run
+    // of pages backing the LARGE_PAGE_SIZE aligned |offset|, committing one if the
+    // range is empty and a write fault was requested.  Returns ZX_ERR_NOT_FOUND if
+    // the range cannot be backed by a large page, in which case the caller should
+    // fall back to GetPageLocked().
+    virtual zx_status_t GetLargePageLocked(uint64_t offset, uint pf_flags, paddr_t* pa)
+        TA_REQ(lock_) {
+        return ZX_ERR_NOT_SUPPORTED;
+    }
+
     fbl::Mutex* lock() TA_RET_CAP(lock_) { return &lock_; }
     fbl::Mutex& lock_ref() TA_RET_CAP(lock_) { return lock_; }
 
@@ -7,12 +7,20 @@
 
 #include <vm/pmm.h>
 
+#include <arch/ops.h>
 #include <assert.h>
 #include <err.h>
 #include <inttypes.h>
+#include <kernel/align.h>
+#include <kernel/auto_lock.h>
+#include <kernel/cmdline.h>
+#include <kernel/event.h>
 #include <kernel/mp.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
 #include <kernel/timer.h>
 #include <lib/console.h>
+#include <lib/counters.h>
 #include <lk/init.h>
 #include <platform.h>
 #include <pow2.h>
@@ -26,6 +34,7 @@
 #include "pmm_arena.h"
 #include "vm_priv.h"
 
+#include <fbl/algorithm.h>
 #include <fbl/auto_lock.h>
 #include <fbl/intrusive_double_list.h>
 #include <fbl/mutex.h>
@@ -42,6 +51,70 @@ static fbl::Mutex arena_lock;
 static fbl::DoublyLinkedList<PmmArena*> arena_list TA_GUARDED(arena_lock);
 static size_t arena_cumulative_size TA_GUARDED(arena_lock);
 
+// Per-cpu free page caches in front of the arenas.
+//
+// Single page allocations and frees are satisfied out of the current cpu's
+// cache, which is refilled from and drained to the arenas in batches, so the
+// common case never takes arena_lock. As far as the arenas are concerned the
+// pages in a cache are allocated (VM_PAGE_STATE_ALLOC), which keeps them out
+// of the way of AllocSpecific and AllocContiguous; callers that need specific
+// or contiguous pages drain the caches when the arenas come up short.
+static const size_t kPcpuCacheMax = 64;
+static const size_t kPcpuCacheBatch = 32;
+
+struct pmm_pcpu_cache {
+    SpinLock lock;
+    // protected by lock, with interrupts disabled
+    list_node free_list = LIST_INITIAL_VALUE(free_list);
+    size_t count = 0;
+} __CPU_ALIGN;
+
+static pmm_pcpu_cache pcpu_cache[SMP_MAX_CPUS];
+
+// Set once the kernel counters are up; until then everything goes straight
+// to the arenas.
+static bool pcpu_cache_enabled;
+
+KCOUNTER(pmm_pcpu_alloc_hit, "kernel.pmm.pcpu_cache.alloc_hit");
+KCOUNTER(pmm_pcpu_alloc_miss, "kernel.pmm.pcpu_cache.alloc_miss");
+KCOUNTER(pmm_pcpu_free_hit, "kernel.pmm.pcpu_cache.free_hit");
+KCOUNTER(pmm_pcpu_refill, "kernel.pmm.pcpu_cache.refill");
+KCOUNTER(pmm_pcpu_drain, "kernel.pmm.pcpu_cache.drain");
+
+static void pmm_pcpu_cache_init(uint level) {
+#if !PMM_ENABLE_FREE_FILL
+    // Cached pages bypass the arena fill checks, so only cache when those
+    // are compiled out.
+    pcpu_cache_enabled = true;
+#endif
+}
+LK_INIT_HOOK(pmm_pcpu_cache, &pmm_pcpu_cache_init, LK_INIT_LEVEL_VM);
+
+// Pool of free pages that a low priority background thread has already
+// zeroed, handed out to PMM_ALLOC_FLAG_ZEROED allocations so page faults
+// don't have to pay for the memset. Like the per-cpu caches, pages in the
+// pool look allocated to the arenas.
+static const size_t kZeroPoolBatch = 32;
+static const uint32_t kZeroPoolDefaultMB = 4;
+
+static SpinLock zero_pool_lock;
+static list_node zero_pool_list TA_GUARDED(zero_pool_lock) = LIST_INITIAL_VALUE(zero_pool_list);
+static size_t zero_pool_count TA_GUARDED(zero_pool_lock);
+static uint64_t zero_pool_hits TA_GUARDED(zero_pool_lock);
+static uint64_t zero_pool_misses TA_GUARDED(zero_pool_lock);
+
+// Number of pages the zeroing thread tries to keep in the pool; set once at
+// init, zero if the pool is disabled.
+static size_t zero_pool_target;
+
+// Signaled when the pool drops below half of its target.
+static event_t zero_pool_event =
+    EVENT_INITIAL_VALUE(zero_pool_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+KCOUNTER(pmm_zero_pool_hit, "kernel.pmm.zero_pool.hit");
+KCOUNTER(pmm_zero_pool_miss, "kernel.pmm.zero_pool.miss");
+KCOUNTER(pmm_zero_pool_zeroed, "kernel.pmm.zero_pool.zeroed");
+
 #if PMM_ENABLE_FREE_FILL
 static void pmm_enforce_fill(uint level) {
     for (auto& a : arena_list) {
@@ -119,7 +192,285 @@ done_add:
     return ZX_OK;
 }
 
-vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+// Returns true if |page| may be parked in a per-cpu cache. Only pages from
+// KMAP arenas are cached, so that cached pages satisfy any allocation flags.
+// No lock needed, since the arena list is only modified during early boot.
+static bool pmm_page_is_cacheable(const vm_page_t* page) TA_NO_THREAD_SAFETY_ANALYSIS {
+    for (const auto& a : arena_list) {
+        if (a.page_belongs_to_arena(page)) {
+            return (a.flags() & PMM_ARENA_FLAG_KMAP) != 0;
+        }
+    }
+    return false;
+}
+
+// Disables interrupts and locks the cache of the cpu we end up running on.
+// Interrupts stay disabled until pcpu_cache_release(), so we can't migrate.
+static pmm_pcpu_cache* pcpu_cache_acquire(spin_lock_saved_state_t* state)
+    TA_NO_THREAD_SAFETY_ANALYSIS {
+    arch_interrupt_save(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    pmm_pcpu_cache* cache = &pcpu_cache[arch_curr_cpu_num()];
+    cache->lock.Acquire();
+    return cache;
+}
+
+static void pcpu_cache_release(pmm_pcpu_cache* cache, spin_lock_saved_state_t state)
+    TA_NO_THREAD_SAFETY_ANALYSIS {
+    cache->lock.Release();
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+// Moves up to |count| pages from the cold end of |cache| to |list|.
+// Returns the number of pages moved.
+static size_t pcpu_cache_take_tail(pmm_pcpu_cache* cache, size_t count, list_node* list) {
+    size_t moved = 0;
+    while (moved < count) {
+        vm_page_t* page = list_remove_tail_type(&cache->free_list, vm_page_t, free.node);
+        if (!page)
+            break;
+        list_add_tail(list, &page->free.node);
+        moved++;
+    }
+    DEBUG_ASSERT(cache->count >= moved);
+    cache->count -= moved;
+    return moved;
+}
+
+static size_t pmm_alloc_pages_locked(size_t count, uint alloc_flags, list_node* list)
+    TA_REQ(arena_lock) {
+    /* walk the arenas in order, allocating as many pages as we can from each */
+    size_t allocated = 0;
+    for (auto& a : arena_list) {
+        DEBUG_ASSERT(count > allocated);
+
+        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
+        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
+            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
+                continue;
+        }
+
+        // ask the arena to allocate some pages
+        allocated += a.AllocPages(count - allocated, list);
+        DEBUG_ASSERT(allocated <= count);
+        if (allocated == count)
+            break;
+    }
+
+    return allocated;
+}
+
+static size_t pmm_count_free_pages_locked() TA_REQ(arena_lock) {
+    size_t free = 0u;
+    for (const auto& a : arena_list) {
+        free += a.free_count();
+    }
+    return free;
+}
+
+static size_t pmm_free_locked(list_node* list) TA_REQ(arena_lock) {
+    size_t count = 0;
+    while (!list_is_empty(list)) {
+        vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
+
+        DEBUG_ASSERT_MSG(!page_is_free(page), "page %p state %u\n", page, page->state);
+
+        page->flags &= ~VM_PAGE_FLAG_ZEROED;
+
+        /* see which arena this page belongs to and add it */
+        for (auto& a : arena_list) {
+            if (a.FreePage(page) >= 0) {
+                count++;
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+// Takes a page out of the current cpu's cache, refilling the cache from the
+// arenas in a batch if it is empty. Returns nullptr if no cacheable pages
+// are left in the arenas.
+static vm_page_t* pcpu_cache_alloc_page() {
+    spin_lock_saved_state_t state;
+    pmm_pcpu_cache* cache = pcpu_cache_acquire(&state);
+    vm_page_t* page = list_remove_head_type(&cache->free_list, vm_page_t, free.node);
+    if (page) {
+        cache->count--;
+        kcounter_add(pmm_pcpu_alloc_hit, 1);
+        pcpu_cache_release(cache, state);
+        return page;
+    }
+    kcounter_add(pmm_pcpu_alloc_miss, 1);
+    pcpu_cache_release(cache, state);
+
+    // arena_lock is a mutex, so the batch has to be pulled out of the arenas
+    // before taking the cache lock again.
+    list_node batch = LIST_INITIAL_VALUE(batch);
+    {
+        AutoLock al(&arena_lock);
+        if (pmm_alloc_pages_locked(kPcpuCacheBatch, PMM_ALLOC_FLAG_KMAP, &batch) == 0)
+            return nullptr;
+    }
+    page = list_remove_head_type(&batch, vm_page_t, free.node);
+
+    // We may have migrated, or someone else may have refilled the cache in
+    // the meantime; whatever doesn't fit goes back to the arenas.
+    cache = pcpu_cache_acquire(&state);
+    kcounter_add(pmm_pcpu_refill, 1);
+    while (cache->count < kPcpuCacheMax) {
+        vm_page_t* p = list_remove_head_type(&batch, vm_page_t, free.node);
+        if (!p)
+            break;
+        list_add_tail(&cache->free_list, &p->free.node);
+        cache->count++;
+    }
+    pcpu_cache_release(cache, state);
+
+    if (!list_is_empty(&batch)) {
+        AutoLock al(&arena_lock);
+        pmm_free_locked(&batch);
+    }
+
+    return page;
+}
+
+// Returns every page parked in the per-cpu caches and the zero pool to the
+// arenas. Used when an allocation needs specific or contiguous pages that may
+// be parked, or when the arenas themselves run dry. Returns the number of
+// pages returned.
+static size_t pmm_drain_parked_pages() {
+    list_node drained = LIST_INITIAL_VALUE(drained);
+    size_t count = 0;
+    for (auto& cache : pcpu_cache) {
+        AutoSpinLockIrqSave guard(&cache.lock);
+        size_t moved = pcpu_cache_take_tail(&cache, cache.count, &drained);
+        if (moved > 0)
+            kcounter_add(pmm_pcpu_drain, 1);
+        count += moved;
+    }
+    {
+        AutoSpinLockIrqSave guard(&zero_pool_lock);
+        list_node* node;
+        while ((node = list_remove_head(&zero_pool_list)) != nullptr) {
+            list_add_tail(&drained, node);
+        }
+        count += zero_pool_count;
+        zero_pool_count = 0;
+    }
+
+    if (!list_is_empty(&drained)) {
+        AutoLock al(&arena_lock);
+        pmm_free_locked(&drained);
+    }
+    return count;
+}
+
+// Returns the number of free pages parked outside of the arenas.
+static size_t pmm_count_parked_pages() TA_NO_THREAD_SAFETY_ANALYSIS {
+    // Racy reads, only used for statistics.
+    size_t count = zero_pool_count;
+    for (auto& cache : pcpu_cache) {
+        count += cache.count;
+    }
+    return count;
+}
+
+// Takes up to |count| already zeroed pages out of the zero pool and appends
+// them to |list|. Returns the number of pages taken.
+static size_t zero_pool_alloc(size_t count, list_node* list) {
+    size_t taken = 0;
+    bool low;
+    {
+        AutoSpinLockIrqSave guard(&zero_pool_lock);
+        while (taken < count) {
+            vm_page_t* page = list_remove_head_type(&zero_pool_list, vm_page_t, free.node);
+            if (!page)
+                break;
+            DEBUG_ASSERT(page->flags & VM_PAGE_FLAG_ZEROED);
+            list_add_tail(list, &page->free.node);
+            taken++;
+        }
+        zero_pool_count -= taken;
+        zero_pool_hits += taken;
+        zero_pool_misses += count - taken;
+        low = zero_pool_count < zero_pool_target / 2;
+    }
+
+    kcounter_add(pmm_zero_pool_hit, taken);
+    kcounter_add(pmm_zero_pool_miss, count - taken);
+    if (low)
+        event_signal(&zero_pool_event, false);
+    return taken;
+}
+
+static int zero_pool_thread(void*) {
+    for (;;) {
+        event_wait(&zero_pool_event);
+
+        for (;;) {
+            size_t want;
+            {
+                AutoSpinLockIrqSave guard(&zero_pool_lock);
+                if (zero_pool_count >= zero_pool_target)
+                    break;
+                want = fbl::min(kZeroPoolBatch, zero_pool_target - zero_pool_count);
+            }
+
+            list_node batch = LIST_INITIAL_VALUE(batch);
+            size_t count;
+            {
+                AutoLock al(&arena_lock);
+                // Don't hoard pages when the rest of the system is short.
+                if (pmm_count_free_pages_locked() < zero_pool_target * 4)
+                    break;
+                count = pmm_alloc_pages_locked(want, PMM_ALLOC_FLAG_KMAP, &batch);
+            }
+            if (count == 0)
+                break;
+
+            vm_page_t* page;
+            list_for_every_entry (&batch, page, vm_page_t, free.node) {
+                arch_zero_page(paddr_to_physmap(vm_page_to_paddr(page)));
+                page->flags |= VM_PAGE_FLAG_ZEROED;
+            }
+            kcounter_add(pmm_zero_pool_zeroed, count);
+
+            AutoSpinLockIrqSave guard(&zero_pool_lock);
+            while ((page = list_remove_head_type(&batch, vm_page_t, free.node)) != nullptr) {
+                list_add_tail(&zero_pool_list, &page->free.node);
+            }
+            zero_pool_count += count;
+        }
+    }
+    return 0;
+}
+
+static void pmm_zero_pool_init(uint level) {
+    uint32_t mb = cmdline_get_uint32("kernel.pmm.zero-pool-mb", kZeroPoolDefaultMB);
+    zero_pool_target = static_cast<size_t>(mb) * MB / PAGE_SIZE;
+    if (zero_pool_target == 0)
+        return;
+
+    thread_t* t = thread_create("pmm zero pool", zero_pool_thread, nullptr,
+                                LOWEST_PRIORITY + 1, DEFAULT_STACK_SIZE);
+    if (!t) {
+        printf("PMM: failed to create zero pool thread\n");
+        zero_pool_target = 0;
+        return;
+    }
+    thread_detach_and_resume(t);
+    event_signal(&zero_pool_event, false);
+}
+LK_INIT_HOOK(pmm_zero_pool, &pmm_zero_pool_init, LK_INIT_LEVEL_THREADING);
+
+void pmm_get_zero_pool_stats(pmm_zero_pool_stats_t* stats) {
+    AutoSpinLockIrqSave guard(&zero_pool_lock);
+    stats->count = zero_pool_count;
+    stats->hits = zero_pool_hits;
+    stats->misses = zero_pool_misses;
+}
+
+static vm_page_t* pmm_alloc_page_from_arenas(uint alloc_flags, paddr_t* pa) {
     AutoLock al(&arena_lock);
 
     /* walk the arenas in order until we find one with a free page */
@@ -136,10 +487,33 @@ vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
             return page;
     }
 
-    LTRACEF("failed to allocate page\n");
     return nullptr;
 }
 
+vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+    vm_page_t* page = nullptr;
+    if ((alloc_flags & PMM_ALLOC_FLAG_ZEROED) && zero_pool_target > 0) {
+        list_node list = LIST_INITIAL_VALUE(list);
+        if (zero_pool_alloc(1, &list) == 1)
+            page = list_remove_head_type(&list, vm_page_t, free.node);
+    }
+    if (!page && pcpu_cache_enabled)
+        page = pcpu_cache_alloc_page();
+    if (page) {
+        if (pa)
+            *pa = vm_page_to_paddr(page);
+        return page;
+    }
+
+    page = pmm_alloc_page_from_arenas(alloc_flags, pa);
+    if (!page && pmm_drain_parked_pages() > 0)
+        page = pmm_alloc_page_from_arenas(alloc_flags, pa);
+
+    if (!page)
+        LTRACEF("failed to allocate page\n");
+    return page;
+}
+
 size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
     LTRACEF("count %zu\n", count);
 
@@ -149,24 +523,40 @@ size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
     if (count == 0)
         return 0;
 
-    AutoLock al(&arena_lock);
-
-    /* walk the arenas in order, allocating as many pages as we can from each */
     size_t allocated = 0;
-    for (auto& a : arena_list) {
-        DEBUG_ASSERT(count > allocated);
+    if ((alloc_flags & PMM_ALLOC_FLAG_ZEROED) && zero_pool_target > 0) {
+        allocated = zero_pool_alloc(count, list);
+        if (allocated == count)
+            return allocated;
+    }
 
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
-                continue;
+    // Small requests are served out of the local cache next; cached pages
+    // come from KMAP arenas and so satisfy any flags.
+    if (pcpu_cache_enabled && count - allocated <= kPcpuCacheBatch) {
+        spin_lock_saved_state_t state;
+        pmm_pcpu_cache* cache = pcpu_cache_acquire(&state);
+        while (allocated < count) {
+            vm_page_t* page = list_remove_head_type(&cache->free_list, vm_page_t, free.node);
+            if (!page)
+                break;
+            cache->count--;
+            list_add_tail(list, &page->free.node);
+            allocated++;
         }
+        kcounter_add(allocated == count ? pmm_pcpu_alloc_hit : pmm_pcpu_alloc_miss, 1);
+        pcpu_cache_release(cache, state);
 
-        // ask the arena to allocate some pages
-        allocated += a.AllocPages(count - allocated, list);
-        DEBUG_ASSERT(allocated <= count);
         if (allocated == count)
-            break;
+            return allocated;
+    }
+
+    {
+        AutoLock al(&arena_lock);
+        allocated += pmm_alloc_pages_locked(count - allocated, alloc_flags, list);
+    }
+    if (allocated < count && pmm_drain_parked_pages() > 0) {
+        AutoLock al(&arena_lock);
+        allocated += pmm_alloc_pages_locked(count - allocated, alloc_flags, list);
     }
 
     return allocated;
@@ -181,6 +571,9 @@ size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
 
     address = ROUNDDOWN(address, PAGE_SIZE);
 
+    // Any of the pages could be parked outside of the arenas.
+    pmm_drain_parked_pages();
+
     AutoLock al(&arena_lock);
 
     /* walk through the arenas, looking to see if the physical page belongs to it */
@@ -204,6 +597,27 @@ size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
     return allocated;
 }
 
+static size_t pmm_alloc_contiguous_helper(size_t count, uint alloc_flags, uint8_t alignment_log2,
+                                          paddr_t* pa, struct list_node* list) {
+    AutoLock al(&arena_lock);
+
+    for (auto& a : arena_list) {
+        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
+        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
+            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
+                continue;
+        }
+
+        size_t allocated = a.AllocContiguous(count, alignment_log2, pa, list);
+        if (allocated > 0) {
+            DEBUG_ASSERT(allocated == count);
+            return allocated;
+        }
+    }
+
+    return 0;
+}
+
 size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_log2, paddr_t* pa,
                             struct list_node* list) {
     LTRACEF("count %zu, align %u\n", count, alignment_log2);
@@ -223,24 +637,16 @@ size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_lo
         return 1;
     }
 
-    AutoLock al(&arena_lock);
-
-    for (auto& a : arena_list) {
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
-                continue;
-        }
-
-        size_t allocated = a.AllocContiguous(count, alignment_log2, pa, list);
-        if (allocated > 0) {
-            DEBUG_ASSERT(allocated == count);
-            return allocated;
-        }
+    size_t allocated = pmm_alloc_contiguous_helper(count, alloc_flags, alignment_log2, pa, list);
+    if (allocated == 0 && !(alloc_flags & PMM_ALLOC_FLAG_NO_DRAIN) &&
+        pmm_drain_parked_pages() > 0) {
+        // The run may have been broken up by parked pages.
+        allocated = pmm_alloc_contiguous_helper(count, alloc_flags, alignment_log2, pa, list);
     }
 
-    LTRACEF("couldn't find run\n");
-    return 0;
+    if (allocated == 0)
+        LTRACEF("couldn't find run\n");
+    return allocated;
 }
 
 /* physically allocate a run from arenas marked as KMAP */
@@ -317,24 +723,52 @@ size_t pmm_free(struct list_node* list) {
 
     DEBUG_ASSERT(list);
 
-    AutoLock al(&arena_lock);
+    size_t count = 0;
+    list_node spill = LIST_INITIAL_VALUE(spill);
+    list_node drained = LIST_INITIAL_VALUE(drained);
+    if (pcpu_cache_enabled) {
+        spin_lock_saved_state_t state;
+        pmm_pcpu_cache* cache = pcpu_cache_acquire(&state);
+        while (!list_is_empty(list)) {
+            vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
 
-    uint count = 0;
-    while (!list_is_empty(list)) {
-        vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
+            DEBUG_ASSERT_MSG(!page_is_free(page), "page %p state %u\n", page, page->state);
 
-        DEBUG_ASSERT_MSG(!page_is_free(page), "page %p state %u\n", page, page->state);
+            if (!pmm_page_is_cacheable(page)) {
+                list_add_tail(&spill, &page->free.node);
+                continue;
+            }
 
-        /* see which arena this page belongs to and add it */
-        for (auto& a : arena_list) {
-            if (a.FreePage(page) >= 0) {
-                count++;
-                break;
+            // When the cache is full, push its coldest batch back to the arenas
+            // so the next run of frees also hits.
+            if (cache->count >= kPcpuCacheMax) {
+                pcpu_cache_take_tail(cache, kPcpuCacheBatch, &drained);
+                kcounter_add(pmm_pcpu_drain, 1);
             }
+
+            DEBUG_ASSERT(page->state != VM_PAGE_STATE_OBJECT || page->object.pin_count == 0);
+            page->state = VM_PAGE_STATE_ALLOC;
+            page->flags &= ~VM_PAGE_FLAG_ZEROED;
+            list_add_head(&cache->free_list, &page->free.node);
+            cache->count++;
+            count++;
+            kcounter_add(pmm_pcpu_free_hit, 1);
+        }
+        pcpu_cache_release(cache, state);
+
+        if (list_is_empty(&spill) && list_is_empty(&drained)) {
+            LTRACEF("returning count %zu\n", count);
+            return count;
         }
+        list = &spill;
     }
 
-    LTRACEF("returning count %u\n", count);
+    AutoLock al(&arena_lock);
+
+    count += pmm_free_locked(list);
+    pmm_free_locked(&drained);
+
+    LTRACEF("returning count %zu\n", count);
 
     return count;
 }
@@ -348,21 +782,13 @@ size_t pmm_free_page(vm_page_t* page) {
     return pmm_free(&list);
 }
 
-static size_t pmm_count_free_pages_locked() TA_REQ(arena_lock) {
-    size_t free = 0u;
-    for (const auto& a : arena_list) {
-        free += a.free_count();
-    }
-    return free;
-}
-
 size_t pmm_count_free_pages() {
     AutoLock al(&arena_lock);
-    return pmm_count_free_pages_locked();
+    return pmm_count_free_pages_locked() + pmm_count_parked_pages();
 }
 
 static void pmm_dump_free() TA_REQ(arena_lock) {
-    auto megabytes_free = pmm_count_free_pages_locked() / 256u;
+    auto megabytes_free = (pmm_count_free_pages_locked() + pmm_count_parked_pages()) / 256u;
     printf(" %zu free MBs\n", megabytes_free);
 }
 
@@ -382,6 +808,12 @@ void pmm_count_total_states(size_t state_count[_VM_PAGE_STATE_COUNT]) {
     for (auto& a : arena_list) {
         a.CountStates(state_count);
     }
+
+    // Pages parked in the per-cpu caches and the zero pool look allocated to
+    // the arenas. Their counts are sampled without the locks, so clamp.
+    size_t cached = fbl::min(pmm_count_parked_pages(), state_count[VM_PAGE_STATE_ALLOC]);
+    state_count[VM_PAGE_STATE_ALLOC] -= cached;
+    state_count[VM_PAGE_STATE_FREE] += cached;
 }
 
 static void pmm_dump_timer(timer_t* t, zx_time_t now, void*) TA_REQ(arena_lock) {
@@ -402,6 +834,15 @@ static void arena_dump(bool is_panic) TA_NO_THREAD_SAFETY_ANALYSIS {
     }
 }
 
+static void arena_dump_fragmentation() {
+    AutoLock al(&arena_lock);
+    for (auto& a : arena_list) {
+        a.DumpFragmentation();
+    }
+    printf("%zu free pages parked in per-cpu caches and the zero pool\n",
+           pmm_count_parked_pages());
+}
+
 static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
     bool is_panic = flags & CMD_FLAG_PANIC;
 
@@ -412,6 +853,7 @@ static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
         printf("usage:\n");
         printf("%s arenas\n", argv[0].str);
         if (!is_panic) {
+            printf("%s frag\n", argv[0].str);
             printf("%s alloc <count>\n", argv[0].str);
             printf("%s alloc_range <address> <count>\n", argv[0].str);
             printf("%s alloc_kpages <count>\n", argv[0].str);
@@ -431,6 +873,8 @@ static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
         // No other operations will work during a panic.
         printf("Only the \"arenas\" command is available during a panic.\n");
         goto usage;
+    } else if (!strcmp(argv[1].str, "frag")) {
+        arena_dump_fragmentation();
     } else if (!strcmp(argv[1].str, "free")) {
         static bool show_mem = false;
         static timer_t timer;
@@ -8,7 +8,9 @@
 #include "vm_priv.h"
 
 #include <err.h>
+#include <fbl/algorithm.h>
 #include <inttypes.h>
+#include <pow2.h>
 #include <pretty/sizes.h>
 #include <string.h>
 #include <trace.h>
@@ -23,9 +25,10 @@
 void PmmArena::EnforceFill() {
     DEBUG_ASSERT(!enforce_fill_);
 
-    vm_page_t* page;
-    list_for_every_entry (&free_list_, page, vm_page_t, free.node) {
-        FreeFill(page);
+    for (size_t i = 0; i < page_count(); i++) {
+        if (page_is_free(&page_array_[i])) {
+            FreeFill(&page_array_[i]);
+        }
     }
 
     enforce_fill_ = true;
@@ -87,7 +90,11 @@ zx_status_t PmmArena::Init(const pmm_arena_info_t* info) {
 
     DEBUG_ASSERT(array_start_index < page_count && array_end_index <= page_count);
 
-    /* add all pages that aren't part of the page array to the free list */
+    for (auto& list : free_lists_) {
+        list_initialize(&list);
+    }
+
+    /* add all pages that aren't part of the page array to the free lists */
     /* pages part of the free array go to the WIRED state */
     for (size_t i = 0; i < page_count; i++) {
         auto& p = page_array_[i];
@@ -96,29 +103,132 @@ zx_status_t PmmArena::Init(const pmm_arena_info_t* info) {
             p.state = VM_PAGE_STATE_WIRED;
         } else {
             p.state = VM_PAGE_STATE_FREE;
-            list_add_tail(&free_list_, &p.free.node);
+            p.free.order = VM_PAGE_ORDER_NONE;
             free_count_++;
         }
     }
+    FreeRange(0, array_start_index);
+    FreeRange(array_end_index, page_count);
 
     return ZX_OK;
 }
 
-vm_page_t* PmmArena::AllocPage(paddr_t* pa) {
-    vm_page_t* page = list_remove_head_type(&free_list_, vm_page_t, free.node);
-    if (!page)
+// Links the block of 2^|order| free pages starting at |index| into its order list.
+void PmmArena::AddFreeBlock(size_t index, uint order) {
+    DEBUG_ASSERT(order <= kMaxOrder);
+    DEBUG_ASSERT((pfn(index) & ((1ul << order) - 1)) == 0);
+    DEBUG_ASSERT(index + (1ul << order) <= page_count());
+
+    vm_page_t* page = &page_array_[index];
+    DEBUG_ASSERT(page_is_free(page));
+    page->free.order = static_cast<uint8_t>(order);
+    list_add_head(&free_lists_[order], &page->free.node);
+}
+
+// Returns a block of 2^|order| pages to the order lists, merging it with its
+// buddy for as long as the buddy is a free block of the same order. All pages
+// of the block must already be FREE with VM_PAGE_ORDER_NONE.
+void PmmArena::FreeBlock(size_t index, uint order) {
+    const uint64_t base_pfn = pfn(0);
+    while (order < kMaxOrder) {
+        uint64_t buddy_pfn = pfn(index) ^ (1ul << order);
+        if (buddy_pfn < base_pfn)
+            break;
+        size_t buddy = buddy_pfn - base_pfn;
+        if (buddy + (1ul << order) > page_count())
+            break;
+
+        vm_page_t* b = &page_array_[buddy];
+        if (!page_is_free(b) || b->free.order != order)
+            break;
+
+        list_delete(&b->free.node);
+        b->free.order = VM_PAGE_ORDER_NONE;
+        index = fbl::min(index, buddy);
+        order++;
+    }
+    AddFreeBlock(index, order);
+}
+
+// Frees the page range [start, end) as the largest aligned blocks that fit.
+void PmmArena::FreeRange(size_t start, size_t end) {
+    while (start < end) {
+        uint order = 0;
+        while (order < kMaxOrder &&
+               (pfn(start) & ((2ul << order) - 1)) == 0 &&
+               start + (2ul << order) <= end) {
+            order++;
+        }
+        FreeBlock(start, order);
+        start += 1ul << order;
+    }
+}
+
+// Takes a block of exactly 2^|order| pages off the order lists, splitting a
+// larger block if needed. The pages are left FREE; callers mark them allocated.
+vm_page_t* PmmArena::AllocBlock(uint order) {
+    uint o = order;
+    while (o <= kMaxOrder && list_is_empty(&free_lists_[o])) {
+        o++;
+    }
+    if (o > kMaxOrder)
         return nullptr;
 
-    DEBUG_ASSERT(free_count_ > 0);
+    vm_page_t* head = list_remove_head_type(&free_lists_[o], vm_page_t, free.node);
+    head->free.order = VM_PAGE_ORDER_NONE;
+    size_t index = page_index(head);
 
-    free_count_--;
+    // hand the upper halves back until we're down to the requested size
+    while (o > order) {
+        o--;
+        AddFreeBlock(index + (1ul << o), o);
+    }
 
-    DEBUG_ASSERT(page_is_free(page));
+    return head;
+}
 
-    page->state = VM_PAGE_STATE_ALLOC;
+void PmmArena::MarkAllocated(size_t index, size_t count) {
+    for (size_t i = index; i < index + count; i++) {
+        vm_page_t* p = &page_array_[i];
+        DEBUG_ASSERT(page_is_free(p));
+        DEBUG_ASSERT(p->free.order == VM_PAGE_ORDER_NONE);
+
+        p->state = VM_PAGE_STATE_ALLOC;
 #if PMM_ENABLE_FREE_FILL
-    CheckFreeFill(page);
+        CheckFreeFill(p);
 #endif
+    }
+
+    DEBUG_ASSERT(free_count_ >= count);
+    free_count_ -= count;
+}
+
+// Finds the free block that contains the free page at |index|. The head of
+// that block is the page at |index| aligned down to the block size, so just
+// try every order.
+bool PmmArena::FindFreeBlock(size_t index, size_t* head, uint* order) const {
+    const uint64_t base_pfn = pfn(0);
+    for (uint o = 0; o <= kMaxOrder; o++) {
+        uint64_t head_pfn = pfn(index) & ~((1ul << o) - 1);
+        if (head_pfn < base_pfn)
+            break;
+
+        const vm_page_t* p = &page_array_[head_pfn - base_pfn];
+        if (page_is_free(p) && p->free.order == o) {
+            *head = head_pfn - base_pfn;
+            *order = o;
+            return true;
+        }
+    }
+    return false;
+}
+
+vm_page_t* PmmArena::AllocPage(paddr_t* pa) {
+    vm_page_t* page = AllocBlock(0);
+    if (!page)
+        return nullptr;
+
+    MarkAllocated(page_index(page), 1);
 
     if (pa) {
         /* compute the physical address of the page based on its offset into the arena */
@@ -145,13 +255,31 @@ vm_page_t* PmmArena::AllocSpecific(paddr_t pa) {
         return nullptr;
     }
 
-    list_delete(&page->free.node);
-
-    page->state = VM_PAGE_STATE_ALLOC;
+    size_t head;
+    uint order;
+    bool found = FindFreeBlock(index, &head, &order);
+    DEBUG_ASSERT(found);
+    if (!found)
+        return nullptr;
 
-    DEBUG_ASSERT(free_count_ > 0);
+    // carve the page out of its block, handing back the halves that don't
+    // contain it
+    vm_page_t* head_page = &page_array_[head];
+    list_delete(&head_page->free.node);
+    head_page->free.order = VM_PAGE_ORDER_NONE;
+    while (order > 0) {
+        order--;
+        size_t half = 1ul << order;
+        if (index >= head + half) {
+            AddFreeBlock(head, order);
+            head += half;
+        } else {
+            AddFreeBlock(head + half, order);
+        }
+    }
+    DEBUG_ASSERT(head == index);
 
-    free_count_--;
+    MarkAllocated(index, 1);
 
     return page;
 }
@@ -160,22 +288,13 @@ size_t PmmArena::AllocPages(size_t count, list_node* list) {
     size_t allocated = 0;
 
     while (allocated < count) {
-        vm_page_t* page = list_remove_head_type(&free_list_, vm_page_t, free.node);
+        vm_page_t* page = AllocBlock(0);
         if (!page)
             return allocated;
 
         LTRACEF("allocating page %p, pa %#" PRIxPTR "\n", page, page_address_from_arena(page));
 
-        DEBUG_ASSERT(free_count_ > 0);
-
-        free_count_--;
-
-        DEBUG_ASSERT(page_is_free(page));
-#if PMM_ENABLE_FREE_FILL
-        CheckFreeFill(page);
-#endif
-
-        page->state = VM_PAGE_STATE_ALLOC;
+        MarkAllocated(page_index(page), 1);
         list_add_tail(list, &page->free.node);
 
         allocated++;
@@ -185,8 +304,36 @@ size_t PmmArena::AllocPages(size_t count, list_node* list) {
 }
 
 size_t PmmArena::AllocContiguous(size_t count, uint8_t alignment_log2, paddr_t* pa, struct list_node* list) {
-    /* walk the list starting at alignment boundaries.
-     * calculate the starting offset into this arena, based on the
+    /* buddy blocks are naturally aligned in physical address space, so a block
+     * of the larger of the run size and the alignment satisfies both.
+     */
+    uint order = fbl::max(log2_ulong_ceil(count), static_cast<uint>(alignment_log2 - PAGE_SIZE_SHIFT));
+    if (order <= kMaxOrder) {
+        vm_page_t* head = AllocBlock(order);
+        if (head) {
+            size_t start = page_index(head);
+            LTRACEF("found block of order %u at pn %zu\n", order, start);
+
+            // give back the tail of the block we don't need
+            MarkAllocated(start, count);
+            FreeRange(start + count, start + (1ul << order));
+
+            if (list) {
+                for (size_t i = start; i < start + count; i++) {
+                    list_add_tail(list, &page_array_[i].free.node);
+                }
+            }
+
+            if (pa)
+                *pa = base() + start * PAGE_SIZE;
+
+            return count;
+        }
+    }
+
+    /* Runs bigger than the largest block, or runs that straddle block
+     * boundaries, need a linear walk of the arena at alignment boundaries.
+     * Calculate the starting offset into this arena, based on the
      * base address of the arena to handle the case where the arena
      * is not aligned on the same boundary requested.
      */
@@ -219,22 +366,10 @@ retry:
         /* we found a run */
         LTRACEF("found run from pn %" PRIuPTR " to %" PRIuPTR "\n", start, start + count);
 
-        /* remove the pages from the run out of the free list */
+        /* carve the pages of the run out of their free blocks */
         for (paddr_t i = start; i < start + count; i++) {
-            p = &page_array_[i];
-            DEBUG_ASSERT(page_is_free(p));
-            DEBUG_ASSERT(list_in_list(&p->free.node));
-
-            list_delete(&p->free.node);
-            p->state = VM_PAGE_STATE_ALLOC;
-
-            DEBUG_ASSERT(free_count_ > 0);
-
-            free_count_--;
-
-#if PMM_ENABLE_FREE_FILL
-            CheckFreeFill(p);
-#endif
+            p = AllocSpecific(base() + i * PAGE_SIZE);
+            DEBUG_ASSERT(p);
 
             if (list)
                 list_add_tail(list, &p->free.node);
@@ -261,8 +396,9 @@ zx_status_t PmmArena::FreePage(vm_page_t* page) {
 #endif
 
     page->state = VM_PAGE_STATE_FREE;
+    page->free.order = VM_PAGE_ORDER_NONE;
 
-    list_add_head(&free_list_, &page->free.node);
+    FreeBlock(page_index(page), 0);
     free_count_++;
     return ZX_OK;
 }
@@ -319,3 +455,24 @@ void PmmArena::Dump(bool dump_pages, bool dump_free_ranges) {
         }
     }
 }
+
+void PmmArena::DumpFragmentation() {
+    printf("arena %p: name '%s' free_count %zu\n", this, name(), free_count_);
+
+    size_t blocks[kMaxOrder + 1];
+    for (uint o = 0; o <= kMaxOrder; o++) {
+        blocks[o] = list_length(&free_lists_[o]);
+    }
+
+    // The unusable index for an order is the fraction of free memory sitting
+    // in blocks too small to satisfy an allocation of that order.
+    printf("\t%5s %10s %10s %9s\n", "order", "size", "blocks", "unusable");
+    size_t smaller_pages = 0;
+    for (uint o = 0; o <= kMaxOrder; o++) {
+        char pbuf[16];
+        size_t unusable_pct = free_count_ ? (smaller_pages * 100) / free_count_ : 0;
+        printf("\t%5u %10s %10zu %8zu%%\n", o,
+               format_size(pbuf, sizeof(pbuf), (1ul << o) * PAGE_SIZE), blocks[o], unusable_pct);
+        smaller_pages += blocks[o] << o;
+    }
+}
@@ -15,8 +15,17 @@
 #define PMM_ENABLE_FREE_FILL 0
 #define PMM_FREE_FILL_BYTE 0x42
 
+// Free pages are kept in buddy order lists: every free page belongs to exactly
+// one free block of 2^order pages, aligned to its size in physical address
+// space, and only the head page of each block is linked into
+// free_lists_[order]. Freed blocks are merged with their buddy whenever it is
+// free too, which keeps single page and aligned contiguous allocations
+// O(log n) regardless of fragmentation.
 class PmmArena : public fbl::DoublyLinkedListable<PmmArena*> {
 public:
+    // Largest block tracked by the order lists: 2^kMaxOrder pages.
+    static constexpr uint kMaxOrder = 10;
+
     constexpr PmmArena() = default;
     ~PmmArena() = default;
 
@@ -31,6 +40,10 @@ public:
 
     void Dump(bool dump_pages, bool dump_free_ranges);
 
+    // Prints the number of free blocks of every order, and for every order the
+    // fraction of free memory that is unusable for an allocation of that size.
+    void DumpFragmentation();
+
     // accessors
     const pmm_arena_info_t& info() const { return info_; }
     const char* name() const { return info_.name; }
@@ -80,11 +93,23 @@ private:
     void CheckFreeFill(vm_page_t* page);
 #endif
 
+    size_t page_count() const { return info_.size / PAGE_SIZE; }
+    size_t page_index(const vm_page_t* page) const { return page - page_array_; }
+    uint64_t pfn(size_t index) const { return info_.base / PAGE_SIZE + index; }
+
+    // buddy order list maintenance
+    void AddFreeBlock(size_t index, uint order);
+    void FreeBlock(size_t index, uint order);
+    void FreeRange(size_t start, size_t end);
+    vm_page_t* AllocBlock(uint order);
+    void MarkAllocated(size_t index, size_t count);
+    bool FindFreeBlock(size_t index, size_t* head, uint* order) const;
+
     pmm_arena_info_t info_ = {};
     vm_page_t* page_array_ = nullptr;
 
     size_t free_count_ = 0;
-    list_node free_list_ = LIST_INITIAL_VALUE(free_list_);
+    list_node free_lists_[kMaxOrder + 1] = {};
 
 #if PMM_ENABLE_FREE_FILL
     bool enforce_fill_ = false;
@@ -236,7 +236,8 @@ zx_status_t VmAddressRegion::CreateVmMapping(size_t mapping_offset, size_t size,
     LTRACEF("%p %#zx %#zx %x\n", this, mapping_offset, size, vmar_flags);
 
     // Check that only allowed flags have been set
-    if (vmar_flags & ~(VMAR_FLAG_SPECIFIC | VMAR_FLAG_SPECIFIC_OVERWRITE | VMAR_CAN_RWX_FLAGS)) {
+    if (vmar_flags & ~(VMAR_FLAG_SPECIFIC | VMAR_FLAG_SPECIFIC_OVERWRITE | VMAR_CAN_RWX_FLAGS |
+                       VMAR_FLAG_LARGE_PAGES)) {
         return ZX_ERR_INVALID_ARGS;
     }
 
@@ -267,10 +268,21 @@ zx_status_t VmAddressRegion::CreateVmMapping(size_t mapping_offset, size_t size,
         vmar_flags |= VMAR_FLAG_CAN_MAP_EXECUTE;
     }
 
+    // Large page mappings only pay off if the virtual base lines up with the
+    // object offset on a large page boundary, so prefer an aligned spot for
+    // them. If no aligned spot is free, fall back to the requested alignment.
     fbl::RefPtr<VmAddressRegionOrMapping> res;
-    zx_status_t status =
-        CreateSubVmarInternal(mapping_offset, size, align_pow2, vmar_flags, fbl::move(vmo),
-                              vmo_offset, arch_mmu_flags, name, &res);
+    zx_status_t status = ZX_ERR_NO_MEMORY;
+    const bool is_specific = vmar_flags & (VMAR_FLAG_SPECIFIC | VMAR_FLAG_SPECIFIC_OVERWRITE);
+    if ((vmar_flags & VMAR_FLAG_LARGE_PAGES) && !is_specific && size >= LARGE_PAGE_SIZE &&
+        align_pow2 < LARGE_PAGE_SIZE_SHIFT && IS_ALIGNED(vmo_offset, LARGE_PAGE_SIZE)) {
+        status = CreateSubVmarInternal(mapping_offset, size, LARGE_PAGE_SIZE_SHIFT, vmar_flags,
+                                       vmo, vmo_offset, arch_mmu_flags, name, &res);
+    }
+    if (status == ZX_ERR_NO_MEMORY) {
+        status = CreateSubVmarInternal(mapping_offset, size, align_pow2, vmar_flags,
+                                       fbl::move(vmo), vmo_offset, arch_mmu_flags, name, &res);
+    }
     if (status != ZX_OK) {
         return status;
     }
@@ -549,9 +549,19 @@ zx_status_t VmAspace::PageFault(vaddr_t va, uint flags) {
     // the region out from underneath it
     AutoLock a(&lock_);
 
+    faults_++;
     return root_vmar_->PageFault(va, flags);
 }
 
+void VmAspace::GetFaultStats(vm_fault_stats_t* stats) const {
+    canary_.Assert();
+    DEBUG_ASSERT(stats);
+
+    AutoLock a(&lock_);
+    stats->faults = faults_;
+    stats->fault_around_pages = fault_around_pages_;
+}
+
 void VmAspace::Dump(bool verbose) const {
     canary_.Assert();
     printf("as %p [%#" PRIxPTR " %#" PRIxPTR "] sz %#zx fl %#x ref %d '%s'\n", this,
@@ -559,6 +569,8 @@ void VmAspace::Dump(bool verbose) const {
 
     AutoLock a(&lock_);
 
+    printf("  faults %zu fault-around pages %zu\n", faults_, fault_around_pages_);
+
     if (verbose)
         root_vmar_->Dump(1, verbose);
 }
@@ -9,10 +9,14 @@
 #include "vm_priv.h"
 #include <assert.h>
 #include <err.h>
+#include <fbl/algorithm.h>
 #include <fbl/alloc_checker.h>
 #include <fbl/auto_call.h>
 #include <fbl/auto_lock.h>
 #include <inttypes.h>
+#include <kernel/cmdline.h>
+#include <lib/counters.h>
+#include <lk/init.h>
 #include <safeint/safe_math.h>
 #include <trace.h>
 #include <vm/fault.h>
@@ -25,6 +29,38 @@ using fbl::AutoLock;
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
+// Page faults taken by VmMapping::PageFault(), by access type.
+KCOUNTER(vm_fault_read, "kernel.vm.fault.read");
+KCOUNTER(vm_fault_write, "kernel.vm.fault.write");
+KCOUNTER(vm_fault_instruction, "kernel.vm.fault.instruction");
+// ...and by how they were resolved.
+KCOUNTER(vm_fault_denied, "kernel.vm.fault.denied");
+KCOUNTER(vm_fault_large_page, "kernel.vm.fault.large_page");
+KCOUNTER(vm_fault_map, "kernel.vm.fault.map");
+KCOUNTER(vm_fault_protect, "kernel.vm.fault.protect");
+KCOUNTER(vm_fault_replace, "kernel.vm.fault.replace");
+KCOUNTER(vm_fault_spurious, "kernel.vm.fault.spurious");
+// Pages mapped by fault-around in addition to the faulting one.
+KCOUNTER(vm_fault_around_pages, "kernel.vm.fault.around_pages");
+
+namespace {
+
+// Number of pages around a faulting page (including it) that PageFault() will
+// map if they are already present in the object.  Zero or one disables
+// fault-around.
+constexpr uint32_t kFaultAroundDefaultPages = 16;
+constexpr uint32_t kFaultAroundMaxPages = 256;
+uint32_t fault_around_pages = kFaultAroundDefaultPages;
+
+void fault_around_init(uint level) {
+    uint32_t pages = cmdline_get_uint32("kernel.vm.fault-around-pages", kFaultAroundDefaultPages);
+    fault_around_pages = fbl::min(pages, kFaultAroundMaxPages);
+}
+
+} // namespace
+
+LK_INIT_HOOK(vm_fault_around, fault_around_init, LK_INIT_LEVEL_VM);
+
 VmMapping::VmMapping(VmAddressRegion& parent, vaddr_t base, size_t size, uint32_t vmar_flags,
                      fbl::RefPtr<VmObject> vmo, uint64_t vmo_offset, uint arch_mmu_flags)
     : VmAddressRegionOrMapping(base, size, vmar_flags,
@@ -391,6 +427,7 @@ namespace {
 class VmMappingCoalescer {
 public:
     VmMappingCoalescer(VmMapping* mapping, vaddr_t base);
+    VmMappingCoalescer(VmMapping* mapping, vaddr_t base, uint mmu_flags);
     ~VmMappingCoalescer();
 
     // Add a page to the mapping run.  If this fails, the VmMappingCoalescer is
@@ -424,13 +461,17 @@ private:
 
     VmMapping* mapping_;
     vaddr_t base_;
+    uint mmu_flags_;
     paddr_t phys_[16];
     size_t count_;
     bool aborted_;
 };
 
 VmMappingCoalescer::VmMappingCoalescer(VmMapping* mapping, vaddr_t base)
-    : mapping_(mapping), base_(base), count_(0), aborted_(false) { }
+    : VmMappingCoalescer(mapping, base, mapping->arch_mmu_flags()) { }
+
+VmMappingCoalescer::VmMappingCoalescer(VmMapping* mapping, vaddr_t base, uint mmu_flags)
+    : mapping_(mapping), base_(base), mmu_flags_(mmu_flags), count_(0), aborted_(false) { }
 
 VmMappingCoalescer::~VmMappingCoalescer() {
     // Make sure we've flushed or aborted
@@ -442,7 +483,7 @@ zx_status_t VmMappingCoalescer::Flush() {
         return ZX_OK;
     }
 
-    uint flags = mapping_->arch_mmu_flags();
+    uint flags = mmu_flags_;
     if (flags & ARCH_MMU_FLAG_PERM_RWX_MASK) {
         size_t mapped;
         zx_status_t ret = mapping_->aspace()->arch_aspace().Map(base_, phys_, count_, flags,
@@ -609,25 +650,37 @@ zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
             this, va, vmo_offset, pf_flags,
             vmm_pf_flags_to_string(pf_flags, pf_string));
 
+    if (pf_flags & VMM_PF_FLAG_INSTRUCTION) {
+        kcounter_add(vm_fault_instruction, 1u);
+    } else if (pf_flags & VMM_PF_FLAG_WRITE) {
+        kcounter_add(vm_fault_write, 1u);
+    } else {
+        kcounter_add(vm_fault_read, 1u);
+    }
+
     // make sure we have permission to continue
     if ((pf_flags & VMM_PF_FLAG_USER) && !(arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_USER)) {
         // user page fault on non user mapped region
         LTRACEF("permission failure: user fault on non user region\n");
+        kcounter_add(vm_fault_denied, 1u);
         return ZX_ERR_ACCESS_DENIED;
     }
     if ((pf_flags & VMM_PF_FLAG_WRITE) && !(arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_WRITE)) {
         // write to a non-writeable region
         LTRACEF("permission failure: write fault on non-writable region\n");
+        kcounter_add(vm_fault_denied, 1u);
         return ZX_ERR_ACCESS_DENIED;
     }
     if (!(pf_flags & VMM_PF_FLAG_WRITE) && !(arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_READ)) {
         // read to a non-readable region
         LTRACEF("permission failure: read fault on non-readable region\n");
+        kcounter_add(vm_fault_denied, 1u);
         return ZX_ERR_ACCESS_DENIED;
     }
     if ((pf_flags & VMM_PF_FLAG_INSTRUCTION) && !(arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_EXECUTE)) {
         // instruction fetch from a no execute region
         LTRACEF("permission failure: execute fault on no execute region\n");
+        kcounter_add(vm_fault_denied, 1u);
         return ZX_ERR_ACCESS_DENIED;
     }
 
@@ -642,6 +695,11 @@ zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     currently_faulting_ = true;
     auto ac = fbl::MakeAutoCall([&]() { currently_faulting_ = false; });
 
+    if ((flags_ & VMAR_FLAG_LARGE_PAGES) && PageFaultLargeLocked(va, pf_flags) == ZX_OK) {
+        kcounter_add(vm_fault_large_page, 1u);
+        return ZX_OK;
+    }
+
     // fault in or grab an existing page
     paddr_t new_pa;
     vm_page_t* page;
@@ -673,8 +731,10 @@ zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
             // page was already mapped, are the permissions compatible?
             // test that the page is already mapped with either the region's mmu flags
             // or the flags that we're about to try to switch it to, which may be read-only
-            if (page_flags == arch_mmu_flags_ || page_flags == mmu_flags)
+            if (page_flags == arch_mmu_flags_ || page_flags == mmu_flags) {
+                kcounter_add(vm_fault_spurious, 1u);
                 return ZX_OK;
+            }
 
             // assert that we're not accidentally marking the zero page writable
             DEBUG_ASSERT((pa != vm_get_zero_page_paddr()) || !(mmu_flags & ARCH_MMU_FLAG_PERM_WRITE));
@@ -685,6 +745,7 @@ zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
                 TRACEF("failed to modify permissions on existing mapping\n");
                 return ZX_ERR_NO_MEMORY;
             }
+            kcounter_add(vm_fault_protect, 1u);
         } else {
             // some other page is mapped there already
             LTRACEF("thread %s faulted on va %#" PRIxPTR ", different page was present\n",
@@ -708,6 +769,7 @@ zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
                 return ZX_ERR_NO_MEMORY;
             }
             DEBUG_ASSERT(mapped == 1);
+            kcounter_add(vm_fault_replace, 1u);
 
             return ZX_OK;
         }
@@ -726,8 +788,11 @@ zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
             return ZX_ERR_NO_MEMORY;
         }
         DEBUG_ASSERT(mapped == 1);
+        kcounter_add(vm_fault_map, 1u);
     }
 
+    FaultAroundLocked(va, pf_flags);
+
 // TODO: figure out what to do with this
 #if ARCH_ARM64
     if (pf_flags & VMM_PF_FLAG_GUEST) {
@@ -739,6 +804,130 @@ zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     return ZX_OK;
 }
 
+// Thread safety analysis is disabled for the same object_->lock() aliasing
+// reason as ActivateLocked() below.
+void VmMapping::FaultAroundLocked(vaddr_t va, uint pf_flags) TA_NO_THREAD_SAFETY_ANALYSIS {
+    DEBUG_ASSERT(object_->lock()->IsHeld());
+
+    if (fault_around_pages <= 1) {
+        return;
+    }
+
+    // map the window of the mapping that |va| falls in
+    const size_t window = fault_around_pages * PAGE_SIZE;
+    const vaddr_t start = va - (va - base_) % window;
+    const vaddr_t end = start + fbl::min(window, base_ + size_ - start);
+
+    // Pages owned by the object can be mapped with the mapping's full permissions,
+    // but pages a clone sees through to its parent must stay read-only so that a
+    // write still faults and gets its own copy.
+    uint mmu_flags = arch_mmu_flags_;
+    if (object_->is_cow_clone_locked()) {
+        mmu_flags &= ~ARCH_MMU_FLAG_PERM_WRITE;
+    }
+
+    size_t mapped = 0;
+    VmMappingCoalescer coalescer(this, start, mmu_flags);
+    for (vaddr_t cur = start; cur < end; cur += PAGE_SIZE) {
+        if (cur == va) {
+            continue;
+        }
+
+        // only map pages that are already present, never fault new ones in
+        paddr_t pa;
+        uint64_t vmo_offset = cur - base_ + object_offset_;
+        if (object_->GetPageLocked(vmo_offset, 0, nullptr, nullptr, &pa) != ZX_OK) {
+            continue;
+        }
+        paddr_t mapped_pa;
+        uint page_flags;
+        if (aspace_->arch_aspace().Query(cur, &mapped_pa, &page_flags) == ZX_OK) {
+            continue;
+        }
+
+        if (coalescer.Append(cur, pa) != ZX_OK) {
+            return;
+        }
+#if ARCH_ARM64
+        if (!(pf_flags & VMM_PF_FLAG_GUEST) && (mmu_flags & ARCH_MMU_FLAG_PERM_EXECUTE)) {
+            // the cache sync below needs the page mapped
+            if (coalescer.Flush() != ZX_OK) {
+                return;
+            }
+            arch_sync_cache_range(cur, PAGE_SIZE);
+        }
+#endif
+        mapped++;
+    }
+    if (coalescer.Flush() != ZX_OK) {
+        return;
+    }
+
+    LTRACEF("mapped %zu pages around va %#" PRIxPTR "\n", mapped, va);
+    aspace_->fault_around_pages_ += mapped;
+    kcounter_add(vm_fault_around_pages, mapped);
+}
+
+zx_status_t VmMapping::PageFaultLargeLocked(vaddr_t va, uint pf_flags) TA_NO_THREAD_SAFETY_ANALYSIS {
+    DEBUG_ASSERT(object_->lock()->IsHeld());
+
+    // the large page has to fit entirely within this mapping, and the mapping and
+    // object have to agree on where large page boundaries fall
+    const vaddr_t large_va = ROUNDDOWN(va, LARGE_PAGE_SIZE);
+    if (large_va < base_ || base_ + size_ - large_va < LARGE_PAGE_SIZE) {
+        return ZX_ERR_NOT_FOUND;
+    }
+    const uint64_t vmo_offset = large_va - base_ + object_offset_;
+    if (!IS_ALIGNED(vmo_offset, LARGE_PAGE_SIZE)) {
+        return ZX_ERR_NOT_FOUND;
+    }
+    // executable mappings would need per-page cache maintenance on some arches
+    if (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_EXECUTE) {
+        return ZX_ERR_NOT_FOUND;
+    }
+
+    paddr_t large_pa;
+    zx_status_t status = object_->GetLargePageLocked(vmo_offset, pf_flags, &large_pa);
+    if (status != ZX_OK) {
+        return status;
+    }
+
+    uint mmu_flags = arch_mmu_flags_;
+    if (!(pf_flags & VMM_PF_FLAG_WRITE)) {
+        mmu_flags &= ~ARCH_MMU_FLAG_PERM_WRITE;
+    }
+
+    // another thread may have beaten us to it
+    uint page_flags;
+    paddr_t pa;
+    if (aspace_->arch_aspace().Query(va, &pa, &page_flags) >= 0 &&
+        pa == large_pa + (va - large_va) &&
+        (page_flags == arch_mmu_flags_ || page_flags == mmu_flags)) {
+        return ZX_OK;
+    }
+
+    // replace whatever small pages are mapped over the range (typically the zero
+    // page from earlier read faults) with a single large mapping
+    const size_t count = LARGE_PAGE_SIZE / PAGE_SIZE;
+    status = aspace_->arch_aspace().Unmap(large_va, count, nullptr);
+    if (status < 0) {
+        TRACEF("failed to remove old mappings before mapping large page\n");
+        return ZX_ERR_NO_MEMORY;
+    }
+
+    LTRACEF("mapping large page pa %#" PRIxPTR " to va %#" PRIxPTR "\n", large_pa, large_va);
+
+    size_t mapped;
+    status = aspace_->arch_aspace().MapContiguous(large_va, large_pa, count, mmu_flags, &mapped);
+    if (status < 0) {
+        TRACEF("failed to map large page\n");
+        return ZX_ERR_NO_MEMORY;
+    }
+    DEBUG_ASSERT(mapped == count);
+
+    return ZX_OK;
+}
+
 // We disable thread safety analysis here because one of the common uses of this
 // function is for splitting one mapping object into several that will be backed
 // by the same VmObject.  In that case, object_->lock() gets aliased across all
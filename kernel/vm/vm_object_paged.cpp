@@ -15,6 +15,7 @@
 #include <fbl/auto_lock.h>
 #include <inttypes.h>
 #include <lib/console.h>
+#include <lib/counters.h>
 #include <safeint/safe_math.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,6 +30,13 @@ using fbl::AutoLock;
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
+KCOUNTER(vm_large_page_committed, "kernel.vm.large_page.committed");
+KCOUNTER(vm_large_page_alloc_failed, "kernel.vm.large_page.alloc_failed");
+// Pages committed by GetPageLocked(), split by how they were produced.
+KCOUNTER(vm_page_cow_copy, "kernel.vm.page.cow_copy");
+KCOUNTER(vm_page_zero_fill, "kernel.vm.page.zero_fill");
+KCOUNTER(vm_page_zero_shared, "kernel.vm.page.zero_shared");
+
 namespace {
 
 void ZeroPage(paddr_t pa) {
@@ -43,6 +51,15 @@ void ZeroPage(vm_page_t* p) {
     ZeroPage(pa);
 }
 
+// Zeroes the page unless the pmm handed it out already zeroed.
+void ZeroPageIfNeeded(vm_page_t* p, paddr_t pa) {
+    if (p->flags & VM_PAGE_FLAG_ZEROED) {
+        p->flags &= ~VM_PAGE_FLAG_ZEROED;
+        return;
+    }
+    ZeroPage(pa);
+}
+
 void InitializeVmPage(vm_page_t* p) {
     DEBUG_ASSERT(p->state == VM_PAGE_STATE_ALLOC);
     p->state = VM_PAGE_STATE_OBJECT;
@@ -330,6 +347,7 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
             }
 
             InitializeVmPage(p_clone);
+            p_clone->flags &= ~VM_PAGE_FLAG_ZEROED;
 
             // do a direct copy of the two pages
             const void* src = paddr_to_physmap(pa);
@@ -338,6 +356,7 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
             DEBUG_ASSERT(src && dst);
 
             memcpy(dst, src, PAGE_SIZE);
+            kcounter_add(vm_page_cow_copy, 1u);
 
             // add the new page and return it
             status = AddPageLocked(p_clone, offset);
@@ -363,6 +382,7 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
     // return the single global zero page
     if ((pf_flags & VMM_PF_FLAG_WRITE) == 0) {
         LTRACEF("returning the zero page\n");
+        kcounter_add(vm_page_zero_shared, 1u);
         if (page_out)
             *page_out = vm_get_zero_page();
         if (pa_out)
@@ -378,7 +398,7 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
         }
     }
     if (!p) {
-        p = pmm_alloc_page(pmm_alloc_flags_, &pa);
+        p = pmm_alloc_page(pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED, &pa);
     }
     if (!p) {
         return ZX_ERR_NO_MEMORY;
@@ -386,8 +406,8 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
 
     InitializeVmPage(p);
 
-    // TODO: remove once pmm returns zeroed pages
-    ZeroPage(pa);
+    ZeroPageIfNeeded(p, pa);
+    kcounter_add(vm_page_zero_fill, 1u);
 
     zx_status_t status = AddPageLocked(p, offset);
     DEBUG_ASSERT(status == ZX_OK);
@@ -405,6 +425,85 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
     return ZX_OK;
 }
 
+zx_status_t VmObjectPaged::GetLargePageLocked(uint64_t offset, uint pf_flags, paddr_t* pa_out) {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+    DEBUG_ASSERT(IS_ALIGNED(offset, LARGE_PAGE_SIZE));
+
+    // Clones share pages with their parent one at a time, so only plain
+    // anonymous objects are backed by large pages.
+    if (parent_)
+        return ZX_ERR_NOT_FOUND;
+    if (offset >= size_ || size_ - offset < LARGE_PAGE_SIZE)
+        return ZX_ERR_OUT_OF_RANGE;
+
+    const uint64_t end = offset + LARGE_PAGE_SIZE;
+
+    // see if the range is already backed by an aligned contiguous run, or is entirely empty
+    paddr_t base_pa = 0;
+    size_t present = 0;
+    bool contiguous = true;
+    for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
+        vm_page_t* p = page_list_.GetPage(o);
+        if (!p) {
+            contiguous = false;
+            continue;
+        }
+        paddr_t pa = vm_page_to_paddr(p);
+        if (present == 0) {
+            base_pa = pa - (o - offset);
+            contiguous = contiguous && IS_ALIGNED(base_pa, LARGE_PAGE_SIZE);
+        } else if (pa != base_pa + (o - offset)) {
+            contiguous = false;
+        }
+        present++;
+    }
+
+    if (present == LARGE_PAGE_SIZE / PAGE_SIZE && contiguous) {
+        *pa_out = base_pa;
+        return ZX_OK;
+    }
+
+    // only commit a new run on a write fault into an empty range; anything else
+    // is served a page at a time
+    if (present != 0 || !(pf_flags & VMM_PF_FLAG_WRITE) || !(pf_flags & VMM_PF_FLAG_FAULT_MASK))
+        return ZX_ERR_NOT_FOUND;
+
+    list_node page_list;
+    list_initialize(&page_list);
+
+    paddr_t pa;
+    size_t count = LARGE_PAGE_SIZE / PAGE_SIZE;
+    size_t allocated = pmm_alloc_contiguous(count, pmm_alloc_flags_ | PMM_ALLOC_FLAG_NO_DRAIN,
+                                            LARGE_PAGE_SIZE_SHIFT, &pa, &page_list);
+    if (allocated < count) {
+        LTRACEF("no large page available at offset %#" PRIx64 "\n", offset);
+        pmm_free(&page_list);
+        kcounter_add(vm_large_page_alloc_failed, 1u);
+        return ZX_ERR_NOT_FOUND;
+    }
+
+    for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
+        vm_page_t* p = list_remove_head_type(&page_list, vm_page_t, free.node);
+        DEBUG_ASSERT(p);
+
+        InitializeVmPage(p);
+        ZeroPageIfNeeded(p, vm_page_to_paddr(p));
+
+        zx_status_t status = AddPageLocked(p, o);
+        DEBUG_ASSERT(status == ZX_OK);
+    }
+
+    // other mappings may have the zero page mapped over this range
+    RangeChangeUpdateLocked(offset, LARGE_PAGE_SIZE);
+
+    kcounter_add(vm_large_page_committed, 1u);
+    LTRACEF("committed large page at offset %#" PRIx64 ", pa %#" PRIxPTR "\n", offset, pa);
+
+    *pa_out = pa;
+    return ZX_OK;
+}
+
 zx_status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* committed) {
     canary_.Assert();
     LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
@@ -451,7 +550,7 @@ zx_status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t*
     list_node page_list;
     list_initialize(&page_list);
 
-    size_t allocated = pmm_alloc_pages(count, pmm_alloc_flags_, &page_list);
+    size_t allocated = pmm_alloc_pages(count, pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED, &page_list);
     if (allocated < count) {
         LTRACEF("failed to allocate enough pages (asked for %zu, got %zu)\n", count, allocated);
         pmm_free(&page_list);
@@ -751,6 +850,13 @@ zx_status_t VmObjectPaged::ResizeLocked(uint64_t s) {
         uint64_t end = ROUNDUP_PAGE_SIZE(size_);
         uint64_t page_aligned_len = end - start;
 
+        // a pinned range has to stay within the object, so that it can be
+        // unpinned, even if only part of its last page is cut off
+        uint64_t cut_start = ROUNDDOWN(s, PAGE_SIZE);
+        if (cut_start < end && AnyPagesPinnedLocked(cut_start, end - cut_start)) {
+            return ZX_ERR_BAD_STATE;
+        }
+
         // we're only worried about whole pages to be removed
         if (page_aligned_len > 0) {
             if (AnyPagesPinnedLocked(start, page_aligned_len)) {
@@ -8,7 +8,13 @@
 #include <err.h>
 #include <fbl/alloc_checker.h>
 #include <fbl/array.h>
+#include <inttypes.h>
+#include <kernel/cmdline.h>
+#include <kernel/percpu.h>
+#include <lib/counters.h>
+#include <string.h>
 #include <unittest.h>
+#include <vm/physmap.h>
 #include <vm/vm.h>
 #include <vm/vm_address_region.h>
 #include <vm/vm_aspace.h>
@@ -19,6 +25,20 @@
 
 static const uint kArchRwFlags = ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE;
 
+// Returns the value of the kcounter called |name|, summed over all cpus.
+static uint64_t kcounter_total(const char* name) {
+    for (const k_counter_desc* desc = kcountdesc_begin; desc != kcountdesc_end; ++desc) {
+        if (!strcmp(desc->name, name)) {
+            uint64_t total = 0;
+            for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+                total += percpu[cpu].counters[kcounter_index(desc)];
+            }
+            return total;
+        }
+    }
+    return 0;
+}
+
 // Allocates a single page, translates it to a vm_page_t and frees it.
 static bool pmm_smoke_test(void* context) {
     BEGIN_TEST;
@@ -36,6 +56,60 @@ static bool pmm_smoke_test(void* context) {
     END_TEST;
 }
 
+// Allocates and frees single pages, enough to cycle them through the per-cpu
+// caches and back into the arenas.
+static bool pmm_single_page_churn_test(void* context) {
+    BEGIN_TEST;
+    list_node list = LIST_INITIAL_VALUE(list);
+
+    static const size_t alloc_count = 256;
+
+    for (size_t i = 0; i < alloc_count; i++) {
+        vm_page_t* page = pmm_alloc_page(0, nullptr);
+        EXPECT_NE(nullptr, page, "pmm_alloc single page");
+        if (!page)
+            break;
+        list_add_tail(&list, &page->free.node);
+    }
+    EXPECT_EQ(alloc_count, list_length(&list), "pmm_alloc single page count");
+
+    size_t freed = 0;
+    vm_page_t* page;
+    while ((page = list_remove_head_type(&list, vm_page_t, free.node)) != nullptr) {
+        freed += pmm_free_page(page);
+    }
+    EXPECT_EQ(alloc_count, freed, "pmm_free_page count");
+    END_TEST;
+}
+
+// Allocates pages asking for zeroed memory and checks that any page handed
+// back as already zeroed really is.
+static bool pmm_zeroed_alloc_test(void* context) {
+    BEGIN_TEST;
+    list_node list = LIST_INITIAL_VALUE(list);
+
+    static const size_t alloc_count = 16;
+
+    auto count = pmm_alloc_pages(alloc_count, PMM_ALLOC_FLAG_ZEROED, &list);
+    EXPECT_EQ(alloc_count, count, "pmm_alloc_pages zeroed count");
+
+    vm_page_t* page;
+    list_for_every_entry (&list, page, vm_page_t, free.node) {
+        if (!(page->flags & VM_PAGE_FLAG_ZEROED))
+            continue;
+        auto ptr = static_cast<const uint8_t*>(paddr_to_physmap(vm_page_to_paddr(page)));
+        bool all_zero = true;
+        for (size_t i = 0; i < PAGE_SIZE; i++) {
+            all_zero &= (ptr[i] == 0);
+        }
+        EXPECT_TRUE(all_zero, "zeroed page has non-zero contents");
+    }
+
+    auto ret = pmm_free(&list);
+    EXPECT_EQ(alloc_count, ret, "pmm_free on a list of zeroed pages");
+    END_TEST;
+}
+
 // Allocates a bunch of pages then frees them.
 static bool pmm_large_alloc_test(void* context) {
     BEGIN_TEST;
@@ -53,6 +127,35 @@ static bool pmm_large_alloc_test(void* context) {
     END_TEST;
 }
 
+// Allocates aligned contiguous runs of various sizes and checks that they
+// are physically contiguous and correctly aligned.
+static bool pmm_alloc_contiguous_aligned_test(void* context) {
+    BEGIN_TEST;
+
+    static const size_t counts[] = {1, 3, 16, 100, 512};
+    static const uint8_t aligns[] = {PAGE_SIZE_SHIFT, 16, 21};
+    for (size_t count : counts) {
+        for (uint8_t align : aligns) {
+            list_node list = LIST_INITIAL_VALUE(list);
+            paddr_t pa;
+            size_t ret = pmm_alloc_contiguous(count, 0, align, &pa, &list);
+            EXPECT_EQ(count, ret, "pmm_alloc_contiguous count");
+            if (ret != count)
+                continue;
+            EXPECT_EQ(0u, pa & ((1ul << align) - 1), "pmm_alloc_contiguous alignment");
+
+            paddr_t expected = pa;
+            vm_page_t* page;
+            list_for_every_entry (&list, page, vm_page_t, free.node) {
+                EXPECT_EQ(expected, vm_page_to_paddr(page), "pmm_alloc_contiguous run");
+                expected += PAGE_SIZE;
+            }
+            EXPECT_EQ(count, pmm_free(&list), "pmm_free contiguous run");
+        }
+    }
+    END_TEST;
+}
+
 // Allocates too many pages and makes sure it fails nicely.
 static bool pmm_oversized_alloc_test(void* context) {
     BEGIN_TEST;
@@ -537,6 +640,181 @@ static bool vmo_demand_paged_map_test(void* context) {
     END_TEST;
 }
 
+// Creates a committed vm object, maps it without populating the mapping, then
+// checks that a fault maps the neighbouring pages as well.
+static bool vmo_fault_around_test(void* context) {
+    BEGIN_TEST;
+    if (cmdline_get_uint32("kernel.vm.fault-around-pages", 2u) <= 1u) {
+        unittest_printf("fault-around disabled on the command line, skipping\n");
+        END_TEST;
+    }
+
+    static const size_t alloc_size = PAGE_SIZE * 16;
+    fbl::RefPtr<VmObject> vmo;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &vmo);
+    REQUIRE_EQ(status, ZX_OK, "vmobject creation\n");
+    REQUIRE_TRUE(vmo, "vmobject creation\n");
+
+    uint64_t committed;
+    status = vmo->CommitRange(0, alloc_size, &committed);
+    REQUIRE_EQ(status, ZX_OK, "committing vm object\n");
+
+    auto ka = VmAspace::kernel_aspace();
+    fbl::RefPtr<VmMapping> mapping;
+    status = ka->RootVmar()->CreateVmMapping(0, alloc_size, 0, 0, vmo, 0, kArchRwFlags,
+                                             "test", &mapping);
+    REQUIRE_EQ(status, ZX_OK, "mapping object");
+
+    VmAspace::vm_fault_stats_t before;
+    ka->GetFaultStats(&before);
+
+    // touch the first page
+    auto ptr = reinterpret_cast<volatile uint8_t*>(mapping->base());
+    ptr[0] = 0x5a;
+
+    VmAspace::vm_fault_stats_t after;
+    ka->GetFaultStats(&after);
+    EXPECT_LE(before.faults + 1, after.faults, "first touch faulted");
+
+    // every page is present, so fault-around maps the second page too
+    EXPECT_LT(before.fault_around_pages, after.fault_around_pages, "fault-around mapped pages");
+    paddr_t pa;
+    uint flags;
+    EXPECT_EQ(ZX_OK, ka->arch_aspace().Query(mapping->base() + PAGE_SIZE, &pa, &flags),
+              "neighbouring page mapped");
+
+    EXPECT_EQ(ZX_OK, mapping->Destroy(), "unmapping object");
+    END_TEST;
+}
+
+// Creates a vm object, maps it with large pages enabled, demand faults it in,
+// then decommits a page out of the middle of a large page.
+static bool vmo_large_page_map_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = LARGE_PAGE_SIZE * 2;
+    fbl::RefPtr<VmObject> vmo;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &vmo);
+    REQUIRE_EQ(status, ZX_OK, "vmobject creation\n");
+    REQUIRE_TRUE(vmo, "vmobject creation\n");
+
+    auto ka = VmAspace::kernel_aspace();
+    fbl::RefPtr<VmMapping> mapping;
+    status = ka->RootVmar()->CreateVmMapping(0, alloc_size, 0, VMAR_FLAG_LARGE_PAGES, vmo, 0,
+                                             kArchRwFlags, "test", &mapping);
+    REQUIRE_EQ(status, ZX_OK, "mapping object");
+    EXPECT_TRUE(IS_ALIGNED(mapping->base(), LARGE_PAGE_SIZE), "mapping is large page aligned");
+
+    // fill each large page with its own pattern and test. The allocation
+    // gives up quietly when physical memory is too fragmented for a large
+    // page, so only the faults that did get one can be checked as such.
+    auto lookup_fn = [](void* context, size_t offset, size_t index, paddr_t pa) {
+        *static_cast<paddr_t*>(context) = pa;
+        return ZX_OK;
+    };
+    auto bytes = reinterpret_cast<uint8_t*>(mapping->base());
+    for (uint64_t off = 0; off < alloc_size; off += LARGE_PAGE_SIZE) {
+        const uint64_t committed = kcounter_total("kernel.vm.large_page.committed");
+        const uint64_t failed = kcounter_total("kernel.vm.large_page.alloc_failed");
+        if (!fill_and_test(bytes + off, LARGE_PAGE_SIZE))
+            all_ok = false;
+        if (kcounter_total("kernel.vm.large_page.committed") == committed) {
+            EXPECT_LT(failed, kcounter_total("kernel.vm.large_page.alloc_failed"),
+                      "fault tried to use a large page");
+            unittest_printf("no contiguous large page available at offset %#" PRIx64
+                            ", skipping checks\n", off);
+            continue;
+        }
+
+        // the large page is a physically contiguous, aligned run
+        paddr_t pa;
+        paddr_t last_pa;
+        EXPECT_EQ(ZX_OK, vmo->Lookup(off, PAGE_SIZE, 0, lookup_fn, &pa), "lookup first page");
+        EXPECT_EQ(ZX_OK, vmo->Lookup(off + LARGE_PAGE_SIZE - PAGE_SIZE, PAGE_SIZE, 0,
+                                     lookup_fn, &last_pa),
+                  "lookup last page");
+        EXPECT_TRUE(IS_ALIGNED(pa, LARGE_PAGE_SIZE), "large page is aligned");
+        EXPECT_EQ(pa + LARGE_PAGE_SIZE - PAGE_SIZE, last_pa, "large page is contiguous");
+    }
+
+    // punch a hole in the first large page; the rest of it has to stay intact
+    uint64_t decommitted;
+    status = vmo->DecommitRange(LARGE_PAGE_SIZE / 2, PAGE_SIZE, &decommitted);
+    EXPECT_EQ(ZX_OK, status, "decommit");
+    EXPECT_EQ(static_cast<uint64_t>(PAGE_SIZE), decommitted, "decommit");
+
+    EXPECT_TRUE(test_region((uintptr_t)bytes, bytes, LARGE_PAGE_SIZE / 2), "head intact");
+    EXPECT_EQ(0u, bytes[LARGE_PAGE_SIZE / 2], "decommitted page reads zero");
+    EXPECT_TRUE(test_region((uintptr_t)(bytes + LARGE_PAGE_SIZE), bytes + LARGE_PAGE_SIZE,
+                            LARGE_PAGE_SIZE),
+                "second large page intact");
+
+    EXPECT_EQ(ZX_OK, mapping->Destroy(), "unmapping object");
+    END_TEST;
+}
+
+// Creates a vm object, maps it with large pages enabled and faults it in, then
+// protects and unmaps parts of the first large page. Only those parts may change.
+static bool vmo_large_page_protect_unmap_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = LARGE_PAGE_SIZE * 2;
+    fbl::RefPtr<VmObject> vmo;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &vmo);
+    REQUIRE_EQ(status, ZX_OK, "vmobject creation\n");
+    REQUIRE_TRUE(vmo, "vmobject creation\n");
+
+    auto ka = VmAspace::kernel_aspace();
+    fbl::RefPtr<VmMapping> mapping;
+    status = ka->RootVmar()->CreateVmMapping(0, alloc_size, 0, VMAR_FLAG_LARGE_PAGES, vmo, 0,
+                                             kArchRwFlags, "test", &mapping);
+    REQUIRE_EQ(status, ZX_OK, "mapping object");
+
+    // give each page its own pattern, so that they can be checked one by one
+    const vaddr_t base = mapping->base();
+    auto bytes = reinterpret_cast<uint8_t*>(base);
+    for (size_t off = 0; off < alloc_size; off += PAGE_SIZE) {
+        fill_region(base + off, bytes + off, PAGE_SIZE);
+    }
+
+    auto query_flags = [&](vaddr_t va, uint* flags) {
+        paddr_t pa;
+        return ka->arch_aspace().Query(va, &pa, flags);
+    };
+
+    // make the second quarter of the first large page read-only
+    const vaddr_t ro_base = base + LARGE_PAGE_SIZE / 4;
+    const size_t ro_size = LARGE_PAGE_SIZE / 4;
+    status = ka->RootVmar()->Protect(ro_base, ro_size, ARCH_MMU_FLAG_PERM_READ);
+    EXPECT_EQ(ZX_OK, status, "protect part of a large page");
+
+    uint flags;
+    EXPECT_EQ(ZX_OK, query_flags(ro_base, &flags), "query protected page");
+    EXPECT_FALSE(flags & ARCH_MMU_FLAG_PERM_WRITE, "protected page is read-only");
+    EXPECT_EQ(ZX_OK, query_flags(ro_base + ro_size - PAGE_SIZE, &flags), "query protected page");
+    EXPECT_FALSE(flags & ARCH_MMU_FLAG_PERM_WRITE, "protected page is read-only");
+    EXPECT_EQ(ZX_OK, query_flags(ro_base - PAGE_SIZE, &flags), "query page before");
+    EXPECT_TRUE(flags & ARCH_MMU_FLAG_PERM_WRITE, "page before is still writable");
+    EXPECT_EQ(ZX_OK, query_flags(ro_base + ro_size, &flags), "query page after");
+    EXPECT_TRUE(flags & ARCH_MMU_FLAG_PERM_WRITE, "page after is still writable");
+
+    // unmap a single page out of the last quarter of the first large page
+    const vaddr_t hole = base + LARGE_PAGE_SIZE * 3 / 4;
+    status = ka->RootVmar()->Unmap(hole, PAGE_SIZE);
+    EXPECT_EQ(ZX_OK, status, "unmap part of a large page");
+    EXPECT_EQ(ZX_ERR_NOT_FOUND, query_flags(hole, &flags), "unmapped page is gone");
+    EXPECT_EQ(ZX_OK, query_flags(hole - PAGE_SIZE, &flags), "page before the hole is mapped");
+    EXPECT_EQ(ZX_OK, query_flags(hole + PAGE_SIZE, &flags), "page after the hole is mapped");
+
+    for (size_t off = 0; off < alloc_size; off += PAGE_SIZE) {
+        if (base + off != hole && !test_region(base + off, bytes + off, PAGE_SIZE)) {
+            unittest_printf("page at offset %#zx is corrupt\n", off);
+            all_ok = false;
+        }
+    }
+
+    EXPECT_EQ(ZX_OK, ka->RootVmar()->Unmap(base, alloc_size), "unmapping object");
+    END_TEST;
+}
+
 // Creates a vm object, maps it, drops ref before unmapping.
 static bool vmo_dropped_ref_test(void* context) {
     BEGIN_TEST;
@@ -969,7 +1247,10 @@ static bool arch_noncontiguous_map(void* context) {
 
 UNITTEST_START_TESTCASE(vm_tests)
 VM_UNITTEST(pmm_smoke_test)
+VM_UNITTEST(pmm_single_page_churn_test)
+VM_UNITTEST(pmm_zeroed_alloc_test)
 VM_UNITTEST(pmm_large_alloc_test)
+VM_UNITTEST(pmm_alloc_contiguous_aligned_test)
 VM_UNITTEST(pmm_oversized_alloc_test)
 VM_UNITTEST(vmm_alloc_smoke_test)
 VM_UNITTEST(vmm_alloc_contiguous_smoke_test)
@@ -988,6 +1269,9 @@ VM_UNITTEST(vmo_odd_size_commit_test)
 VM_UNITTEST(vmo_contiguous_commit_test)
 VM_UNITTEST(vmo_precommitted_map_test)
 VM_UNITTEST(vmo_demand_paged_map_test)
+VM_UNITTEST(vmo_large_page_map_test)
+VM_UNITTEST(vmo_large_page_protect_unmap_test)
+VM_UNITTEST(vmo_fault_around_test)
 VM_UNITTEST(vmo_dropped_ref_test)
 VM_UNITTEST(vmo_remap_test)
 VM_UNITTEST(vmo_double_remap_test)
@@ -29,7 +29,7 @@ static zx_status_t ktrace_read(void* ctx, void* buf, size_t count, zx_off_t off,
 static zx_off_t ktrace_get_size(void* ctx) {
     uint32_t size;
     zx_status_t status = zx_ktrace_read(get_root_resource(), NULL, 0, 0, &size);
-    return status != ZX_OK ? (zx_off_t)status : (zx_off_t)size;
+    return status != ZX_OK ? 0u : (zx_off_t)size;
 }
 
 static zx_status_t ktrace_ioctl(void* ctx, uint32_t op,
@@ -72,6 +72,13 @@ static zx_status_t ktrace_ioctl(void* ctx, uint32_t op,
         uint32_t group_mask = *(uint32_t *)cmd;
         return zx_ktrace_control(get_root_resource(), KTRACE_ACTION_START, group_mask, NULL);
     }
+    case IOCTL_KTRACE_SET_MODE: {
+        if (cmdlen != sizeof(uint32_t)) {
+            return ZX_ERR_INVALID_ARGS;
+        }
+        uint32_t mode = *(uint32_t *)cmd;
+        return zx_ktrace_control(get_root_resource(), KTRACE_ACTION_SET_MODE, mode, NULL);
+    }
     case IOCTL_KTRACE_STOP: {
         zx_ktrace_control(get_root_resource(), KTRACE_ACTION_STOP, 0, NULL);
         zx_ktrace_control(get_root_resource(), KTRACE_ACTION_REWIND, 0, NULL);
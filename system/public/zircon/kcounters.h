@@ -0,0 +1,46 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+#include <zircon/compiler.h>
+
+__BEGIN_CDECLS
+
+// Layout of the read-only VMO returned by zx_kcounters_get_vmo().
+//
+// The VMO starts with a kcounters_header_t, followed by |num_counters|
+// kcounters_desc_t, sorted by name. The per-cpu arenas start at
+// |arena_offset|: the value of counter |i| on cpu |c| is the uint64_t at
+// index (c * num_counters + i). Only the first |num_cpus| arenas are ever
+// written. The kernel updates the arenas in place, so each read sees the
+// current counts.
+
+// clang-format off
+
+#define KCOUNTERS_MAGIC         0x53544e434b4e5a00ull  // "\0ZNKCNTS"
+#define KCOUNTERS_NAME_LEN      56
+
+// clang-format on
+
+typedef struct kcounters_header {
+    uint64_t magic;
+    uint32_t num_counters;
+    uint32_t num_cpus;
+    uint64_t arena_offset;
+    uint64_t reserved[5];
+} kcounters_header_t;
+
+typedef struct kcounters_desc {
+    char name[KCOUNTERS_NAME_LEN];
+    uint64_t reserved;
+} kcounters_desc_t;
+
+// kernel.ld reserves room for the header and descriptors on this basis.
+static_assert(sizeof(kcounters_header_t) == 64, "kcounters_header_t is not 64 bytes");
+static_assert(sizeof(kcounters_desc_t) == 64, "kcounters_desc_t is not 64 bytes");
+
+__END_CDECLS
@@ -88,5 +88,14 @@ enum {
 #define KTRACE_ACTION_STOP      2 // options ignored
 #define KTRACE_ACTION_REWIND    3 // options ignored
 #define KTRACE_ACTION_NEW_PROBE 4 // options ignored, ptr = name
+#define KTRACE_ACTION_SET_MODE  5 // options = KTRACE_MODE_*, only while stopped
+
+// Buffering modes. Each cpu records into its own ring buffer.
+// Circular: the oldest records are overwritten when a ring fills, and the
+// trace can be read at any offset once tracing is stopped.
+// Streaming: records are dropped when a ring fills, and each read consumes
+// what it returns, so the trace can be drained while tracing runs.
+#define KTRACE_MODE_CIRCULAR    0
+#define KTRACE_MODE_STREAMING   1
 
 __END_CDECLS
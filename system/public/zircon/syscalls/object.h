@@ -31,6 +31,7 @@ typedef enum {
     ZX_INFO_KMEM_STATS                 = 17, // zx_info_kmem_stats_t[1]
     ZX_INFO_RESOURCE                   = 18, // zx_info_resource_t[1]
     ZX_INFO_HANDLE_COUNT               = 19, // zx_info_handle_count_t[1]
+    ZX_INFO_JOB_STATS                  = 20, // zx_info_job_stats_t[1]
     ZX_INFO_LAST
 } zx_object_info_topic_t;
 
@@ -149,6 +150,13 @@ typedef struct zx_info_task_stats {
     //
     // This number is strictly smaller than mem_shared_bytes.
     size_t mem_scaled_shared_bytes;
+
+    // The number of page faults taken in the task's address space.
+    size_t page_faults;
+
+    // The number of pages mapped ahead of being touched because a
+    // neighbouring page faulted. Each of these saved a page fault.
+    size_t page_fault_around_pages;
 } zx_info_task_stats_t;
 
 typedef struct zx_info_vmar {
@@ -342,6 +350,15 @@ typedef struct zx_info_kmem_stats {
 
     // Non-free memory that isn't accounted for in any other field.
     uint64_t other_bytes;
+
+    // The portion of |free_bytes| that has already been zeroed and is held
+    // in reserve for page faults.
+    uint64_t free_zeroed_bytes;
+
+    // The number of page allocations that wanted a zeroed page and got one
+    // from the pre-zeroed pool, and the number that had to zero on demand.
+    uint64_t zero_pool_hits;
+    uint64_t zero_pool_misses;
 } zx_info_kmem_stats_t;
 
 typedef struct zx_info_resource {
@@ -354,6 +371,16 @@ typedef struct zx_info_resource {
     uint64_t high;
 } zx_info_resource_t;
 
+// Statistics about the kernel resources charged to a job.
+typedef struct zx_info_job_stats {
+    // The number of channel messages written by processes directly in the
+    // job that have not been read yet.
+    size_t channel_msgs;
+
+    // The amount of kernel memory backing those messages.
+    size_t channel_msg_bytes;
+} zx_info_job_stats_t;
+
 #define ZX_INFO_CPU_STATS_FLAG_ONLINE       (1u<<0)
 
 // Object properties.
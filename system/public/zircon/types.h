@@ -170,6 +170,22 @@ typedef struct {
     uint32_t rd_num_handles;
 } zx_channel_call_args_t;
 
+// One message of a zx_channel_read_many() or zx_channel_write_many() batch.
+typedef struct {
+    // For writes, the message's data and handles. For reads, the buffers to
+    // receive them into, and their capacities.
+    void* bytes;
+    zx_handle_t* handles;
+    uint32_t num_bytes;
+    uint32_t num_handles;
+    // For reads, set to the size of the message. Unused for writes.
+    uint32_t actual_bytes;
+    uint32_t actual_handles;
+} zx_channel_msg_t;
+
+// Maximum number of packets returned by one zx_port_wait_many().
+#define ZX_PORT_WAIT_MANY_MAX_PACKETS 16
+
 // Maximum number of wait items allowed for zx_object_wait_many()
 // TODO(ZX-1349) Re-lower this.
 #define ZX_WAIT_MANY_MAX_ITEMS 16
@@ -241,6 +257,7 @@ typedef uint32_t zx_rights_t;
 #define ZX_VM_FLAG_CAN_MAP_WRITE      (1u << 8)
 #define ZX_VM_FLAG_CAN_MAP_EXECUTE    (1u << 9)
 #define ZX_VM_FLAG_MAP_RANGE          (1u << 10)
+#define ZX_VM_FLAG_LARGE_PAGES        (1u << 11)
 
 // clock ids
 #define ZX_CLOCK_MONOTONIC        (0u)
@@ -283,9 +300,13 @@ typedef uint64_t zx_off_t;
 
 // Channel options and limits.
 #define ZX_CHANNEL_READ_MAY_DISCARD         1u
+#define ZX_CHANNEL_WRITE_LOAN               1u
 
 #define ZX_CHANNEL_MAX_MSG_BYTES            65536u
 #define ZX_CHANNEL_MAX_MSG_HANDLES          64u
+// Maximum number of messages moved by one zx_channel_read_many() or
+// zx_channel_write_many().
+#define ZX_CHANNEL_MANY_MAX_MSGS            32u
 
 // Socket options and limits.
 // These options can be passed to zx_socket_write()
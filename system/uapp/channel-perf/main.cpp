@@ -6,11 +6,13 @@
 #include <errno.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include <zircon/compiler.h>
+#include <zircon/process.h>
 #include <zircon/syscalls.h>
 #include <fbl/algorithm.h>
 #include <fbl/unique_ptr.h>
@@ -32,8 +34,25 @@ struct TestArgs {
     uint32_t size;
     uint32_t handles;
     uint32_t queue;
+    bool loan;
 };
 
+// Maps a page-aligned buffer of at least |size| bytes, as required by
+// ZX_CHANNEL_WRITE_LOAN.
+uint8_t* map_buffer(uint32_t size, size_t* mapped_size) {
+    const size_t page_size = PAGE_SIZE;
+    *mapped_size = fbl::round_up(static_cast<size_t>(size ? size : 1u), page_size);
+    zx_handle_t vmo;
+    __UNUSED zx_status_t status = zx_vmo_create(*mapped_size, 0u, &vmo);
+    assert(status == ZX_OK);
+    uintptr_t addr;
+    status = zx_vmar_map(zx_vmar_root_self(), 0u, vmo, 0u, *mapped_size,
+                         ZX_VM_FLAG_PERM_READ | ZX_VM_FLAG_PERM_WRITE, &addr);
+    assert(status == ZX_OK);
+    zx_handle_close(vmo);
+    return reinterpret_cast<uint8_t*>(addr);
+}
+
 void do_test(uint32_t duration, const TestArgs& test_args) {
     __UNUSED zx_status_t status;
 
@@ -48,13 +67,17 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     zx_handle_t event;
     assert(zx_event_create(0u, &event) == ZX_OK);
 
-    // Storage space for our messages' stuff.
-    fbl::unique_ptr<uint8_t[]> data;
-    if (test_args.size) {
-        data.reset(new uint8_t[test_args.size]);
-        for (uint32_t i = 0; i < test_args.size; i++)
-            data[i] = static_cast<uint8_t>(i);
-    }
+    const uint32_t write_options = test_args.loan ? ZX_CHANNEL_WRITE_LOAN : 0u;
+
+    // Storage space for our messages' stuff. Messages are read into a
+    // separate buffer, so that loaned pages are not written to while they
+    // are in flight.
+    size_t data_size;
+    uint8_t* data = map_buffer(test_args.size, &data_size);
+    for (uint32_t i = 0; i < test_args.size; i++)
+        data[i] = static_cast<uint8_t>(i);
+    size_t read_data_size;
+    uint8_t* read_data = map_buffer(test_args.size, &read_data_size);
     fbl::unique_ptr<zx_handle_t[]> handles;
     if (test_args.handles)
         handles.reset(new zx_handle_t[test_args.handles]);
@@ -62,7 +85,7 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     // Pre-queue |test_args.queue| messages (there'll always be this many messages in the queue).
     for (uint32_t i = 0; i < test_args.queue; i++) {
         duplicate_handles(test_args.handles, event, handles.get());
-        status = zx_channel_write(mp[0], 0u, data.get(), test_args.size,
+        status = zx_channel_write(mp[0], write_options, data, test_args.size,
                                   handles.get(), test_args.handles);
         assert(status == ZX_OK);
     }
@@ -76,13 +99,13 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     for (;;) {
         big_its++;
         for (uint32_t i = 0; i < big_it_size; i++) {
-            status = zx_channel_write(mp[0], 0, data.get(), test_args.size,
+            status = zx_channel_write(mp[0], write_options, data, test_args.size,
                                       handles.get(), test_args.handles);
             assert(status == ZX_OK);
 
             uint32_t r_size = test_args.size;
             uint32_t r_handles = test_args.handles;
-            status = zx_channel_read(mp[1], 0u, data.get(), handles.get(), r_size,
+            status = zx_channel_read(mp[1], 0u, read_data, handles.get(), r_size,
                                      r_handles, &r_size, &r_handles);
             assert(status == ZX_OK);
             assert(r_size == test_args.size);
@@ -104,12 +127,18 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     assert(status == ZX_OK);
     status = zx_handle_close(mp[1]);
     assert(status == ZX_OK);
+    status = zx_vmar_unmap(zx_vmar_root_self(), reinterpret_cast<uintptr_t>(data), data_size);
+    assert(status == ZX_OK);
+    status = zx_vmar_unmap(zx_vmar_root_self(), reinterpret_cast<uintptr_t>(read_data),
+                           read_data_size);
+    assert(status == ZX_OK);
 
     double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
     double its_per_second = static_cast<double>(big_its) * big_it_size / real_duration;
-    printf("write/read %" PRIu32 " bytes, %" PRIu32 " handles (%" PRIu32 " pre-queued): "
-               "%.0f iterations/second\n",
-           test_args.size, test_args.handles, test_args.queue, its_per_second);
+    printf("write%s/read %" PRIu32 " bytes, %" PRIu32 " handles (%" PRIu32 " pre-queued): "
+               "%.0f iterations/second, %.1f MB/second\n",
+           test_args.loan ? " (loan)" : "", test_args.size, test_args.handles, test_args.queue,
+           its_per_second, its_per_second * test_args.size / (1024.0 * 1024.0));
 }
 
 }  // namespace
@@ -121,25 +150,29 @@ int main(int argc, char** argv) {
         "Options:\n"
         "  -h    show help (this)\n"
         "  -o    run single test (default)\n"
-        "  -s    run suite (ignores -S/-H/-Q)\n"
+        "  -s    run suite (ignores -S/-H/-Q/-L)\n"
+        "  -c    run copy vs. loan suite by message size (ignores -S/-H/-Q/-L)\n"
         "  -n N  set test repetition count to N (default: 1)\n"
         "  -d N  set test duration to N seconds (default: 5)\n"
         "  -S N  set message size to N bytes (default: 10)\n"
         "  -H N  set message handle count to N handles (default: 0)\n"
-        "  -Q N  set message pre-queue count to N messages (default: 0)\n";
+        "  -Q N  set message pre-queue count to N messages (default: 0)\n"
+        "  -L    write with ZX_CHANNEL_WRITE_LOAN instead of copying\n";
 
     bool run_suite = false;  // -o/-s
+    bool run_loan_suite = false;  // -c
     uint32_t duration = 5;   // -d
     uint32_t repeats = 1;    // -n
     // Ignored when running a suite:
     TestArgs test_args = {
         10,                  // -S (size)
         0,                   // -H (handles)
-        0                    // -Q (queue)
+        0,                   // -Q (queue)
+        false                // -L (loan)
     };
 
     int opt;
-    while ((opt = getopt(argc, argv, "+hosn:d:S:H:Q:")) != -1) {
+    while ((opt = getopt(argc, argv, "+hoscLn:d:S:H:Q:")) != -1) {
         // Our option values are always unsigned numbers.
         uint32_t value = 0;
         if (optarg) {
@@ -157,9 +190,18 @@ int main(int argc, char** argv) {
                 return EXIT_SUCCESS;
             case 'o':
                 run_suite = false;
+                run_loan_suite = false;
                 break;
             case 's':
                 run_suite = true;
+                run_loan_suite = false;
+                break;
+            case 'c':
+                run_suite = false;
+                run_loan_suite = true;
+                break;
+            case 'L':
+                test_args.loan = true;
                 break;
             case 'n':
                 assert(optarg);
@@ -199,24 +241,32 @@ int main(int argc, char** argv) {
 
         if (run_suite) {
             static constexpr TestArgs suite[] = {
-                {10, 0, 0},
-                {100, 0, 0},
-                {1000, 0, 0},
-                {10, 1, 0},
-                {100, 1, 0},
-                {1000, 1, 0},
-                {10, 2, 0},
-                {100, 2, 0},
-                {1000, 2, 0},
-                {10, 5, 0},
-                {100, 5, 0},
-                {1000, 5, 0},
-                {10, 0, 1},
-                {100, 0, 1},
-                {1000, 0, 1},
+                {10, 0, 0, false},
+                {100, 0, 0, false},
+                {1000, 0, 0, false},
+                {10, 1, 0, false},
+                {100, 1, 0, false},
+                {1000, 1, 0, false},
+                {10, 2, 0, false},
+                {100, 2, 0, false},
+                {1000, 2, 0, false},
+                {10, 5, 0, false},
+                {100, 5, 0, false},
+                {1000, 5, 0, false},
+                {10, 0, 1, false},
+                {100, 0, 1, false},
+                {1000, 0, 1, false},
             };
             for (size_t i = 0; i < fbl::count_of(suite); i++)
                 do_test(duration, suite[i]);
+        } else if (run_loan_suite) {
+            static constexpr uint32_t sizes[] = {
+                4096, 8192, 16384, 32768, 65536,
+            };
+            for (size_t i = 0; i < fbl::count_of(sizes); i++) {
+                do_test(duration, TestArgs{sizes[i], 0, 0, false});
+                do_test(duration, TestArgs{sizes[i], 0, 0, true});
+            }
         } else {
             do_test(duration, test_args);
         }
@@ -0,0 +1,164 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <kcounter/kcounter.h>
+#include <zircon/status.h>
+#include <zircon/syscalls.h>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "resources.h"
+
+static bool matches(const char* name, int num_prefixes, char** prefixes) {
+    if (num_prefixes == 0) {
+        return true;
+    }
+    for (int i = 0; i < num_prefixes; i++) {
+        if (strncmp(name, prefixes[i], strlen(prefixes[i])) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void print_help(FILE* f) {
+    fprintf(f, "Usage: kcounter [options] [prefix...]\n");
+    fprintf(f, "Prints the kernel counters whose names start with one of the\n");
+    fprintf(f, "prefixes, or all of them. With -d or -n, keeps printing the\n");
+    fprintf(f, "counters that changed, with their rate per second.\n");
+    fprintf(f, "Options:\n");
+    fprintf(f, " -a              Also print counters that did not change\n");
+    fprintf(f, " -d <delay>      Delay in seconds (default 1 second)\n");
+    fprintf(f, " -n <times>      Run this many times and then exit\n");
+}
+
+int main(int argc, char** argv) {
+    bool all = false;
+    bool repeat = false;
+    zx_duration_t delay = ZX_SEC(1);
+    int num_loops = -1;
+
+    int c;
+    while ((c = getopt(argc, argv, "ad:hn:")) > 0) {
+        switch (c) {
+            case 'a':
+                all = true;
+                break;
+            case 'd':
+                delay = ZX_SEC(atoi(optarg));
+                if (delay == 0) {
+                    fprintf(stderr, "Bad -d value '%s'\n", optarg);
+                    print_help(stderr);
+                    return 1;
+                }
+                repeat = true;
+                break;
+            case 'n':
+                num_loops = atoi(optarg);
+                if (num_loops == 0) {
+                    fprintf(stderr, "Bad -n value '%s'\n", optarg);
+                    print_help(stderr);
+                    return 1;
+                }
+                repeat = true;
+                break;
+            case 'h':
+                print_help(stdout);
+                return 0;
+            default:
+                fprintf(stderr, "Unknown option\n");
+                print_help(stderr);
+                return 1;
+        }
+    }
+    int num_prefixes = argc - optind;
+    char** prefixes = argv + optind;
+
+    zx_handle_t root_resource;
+    zx_status_t ret = get_root_resource(&root_resource);
+    if (ret != ZX_OK) {
+        return ret;
+    }
+
+    kcounter_view_t view;
+    ret = kcounter_view_open(root_resource, &view);
+    zx_handle_close(root_resource);
+    if (ret != ZX_OK) {
+        fprintf(stderr, "ERROR: Cannot map kernel counters: %s (%d)\n",
+                zx_status_get_string(ret), ret);
+        return ret;
+    }
+
+    size_t count = kcounter_count(&view);
+    uint64_t* last = calloc(count, sizeof(*last));
+    if (last == NULL) {
+        kcounter_view_close(&view);
+        return ZX_ERR_NO_MEMORY;
+    }
+
+    // The first pass shows the totals.
+    zx_time_t last_time = zx_clock_get(ZX_CLOCK_MONOTONIC);
+    for (size_t i = 0; i < count; i++) {
+        last[i] = kcounter_value(&view, i);
+        const char* name = kcounter_name(&view, i);
+        if (matches(name, num_prefixes, prefixes) && (all || last[i] != 0)) {
+            printf("%-48s %16" PRIu64 "\n", name, last[i]);
+        }
+    }
+
+    if (repeat) {
+        // set stdin to non blocking so we can intercept ctrl-c.
+        // TODO: remove once ctrl-c works in the shell
+        fcntl(STDIN_FILENO, F_SETFL, O_NONBLOCK);
+    }
+
+    // Later passes show what changed since the one before.
+    while (repeat) {
+        if (num_loops > 0) {
+            if (--num_loops == 0) {
+                break;
+            }
+        } else {
+            // TODO: replace once ctrl-c works in the shell
+            char ch;
+            while (read(STDIN_FILENO, &ch, 1) > 0) {
+                if (ch == 0x3) {
+                    repeat = false;
+                }
+            }
+            if (!repeat) {
+                break;
+            }
+        }
+
+        zx_nanosleep(zx_deadline_after(delay));
+
+        zx_time_t now = zx_clock_get(ZX_CLOCK_MONOTONIC);
+        zx_duration_t elapsed = now - last_time;
+        last_time = now;
+
+        printf("\n%-48s %16s %12s\n", "counter", "value", "per second");
+        for (size_t i = 0; i < count; i++) {
+            uint64_t value = kcounter_value(&view, i);
+            uint64_t delta = value - last[i];
+            last[i] = value;
+            const char* name = kcounter_name(&view, i);
+            if (matches(name, num_prefixes, prefixes) && (all || delta != 0)) {
+                printf("%-48s %16" PRIu64 " %12" PRIu64 "\n",
+                       name, value, delta * ZX_SEC(1) / elapsed);
+            }
+        }
+    }
+
+    free(last);
+    kcounter_view_close(&view);
+    return 0;
+}
@@ -203,6 +203,28 @@ MODULE_STATIC_LIBS := \
 include make/module.mk
 
 
+MODULE := $(LOCAL_DIR).kcounter
+
+MODULE_TYPE := userapp
+
+MODULE_SRCS += \
+    $(LOCAL_DIR)/kcounter.c \
+    $(LOCAL_DIR)/resources.c
+
+MODULE_NAME := kcounter
+MODULE_GROUP := core
+
+MODULE_LIBS := \
+    system/ulib/fdio \
+    system/ulib/zircon \
+    system/ulib/c
+
+MODULE_STATIC_LIBS := \
+    system/ulib/kcounter
+
+include make/module.mk
+
+
 MODULE := $(LOCAL_DIR).threads
 
 MODULE_TYPE := userapp
@@ -5,11 +5,52 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <zircon/syscalls.h>
 
 #define TRIALS 10000
 #define BINS 32
 
+// How much to draw when comparing throughput, and in what size pieces.
+#define BENCH_BYTES (16 * 1024 * 1024)
+#define BENCH_CHUNK ZX_CPRNG_DRAW_MAX_LEN
+
+static void print_throughput(const char* what, zx_time_t start, size_t chunk) {
+    zx_duration_t elapsed = zx_clock_get(ZX_CLOCK_MONOTONIC) - start;
+    printf("%-20s %4zu byte draws: %" PRIu64 " MB/s, %" PRIu64 " ns per draw\n",
+           what, chunk, (uint64_t)BENCH_BYTES * 1000 / (elapsed ? elapsed : 1),
+           elapsed / (BENCH_BYTES / chunk));
+}
+
+// Compare drawing straight from the kernel with the userspace generator in libc.
+static int benchmark(void) {
+    static uint8_t buf[BENCH_CHUNK];
+    static const size_t chunks[] = { 4, 32, BENCH_CHUNK };
+
+    for (unsigned int i = 0; i < sizeof(chunks) / sizeof(chunks[0]); ++i) {
+        size_t chunk = chunks[i];
+
+        zx_time_t start = zx_clock_get(ZX_CLOCK_MONOTONIC);
+        for (size_t done = 0; done < BENCH_BYTES; done += chunk) {
+            size_t sz = 0;
+            zx_cprng_draw(buf, chunk, &sz);
+            if (sz != chunk) {
+                printf("zx_cprng_draw had unexpected return: %zu\n", sz);
+                return 1;
+            }
+        }
+        print_throughput("zx_cprng_draw", start, chunk);
+
+        start = zx_clock_get(ZX_CLOCK_MONOTONIC);
+        for (size_t done = 0; done < BENCH_BYTES; done += chunk) {
+            arc4random_buf(buf, chunk);
+        }
+        print_throughput("arc4random_buf", start, chunk);
+    }
+
+    return 0;
+}
+
 int main(int argc, char** argv) {
     static uint8_t buf[32];
     uint64_t values[BINS] = { 0 };
@@ -41,5 +82,5 @@ int main(int argc, char** argv) {
         printf("bin %u: %" PRIu64 "\n", i, values[i]);
     }
 
-    return 0;
+    return benchmark();
 }
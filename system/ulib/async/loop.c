@@ -19,6 +19,10 @@
 // The port wait key associated with the dispatcher's control messages.
 #define KEY_CONTROL (0u)
 
+// The most port packets taken by one wait when the loop runs on a single
+// thread.
+#define PACKET_BATCH_SIZE (16u)
+
 static zx_status_t async_loop_begin_wait(async_t* async, async_wait_t* wait);
 static zx_status_t async_loop_cancel_wait(async_t* async, async_wait_t* wait);
 static zx_status_t async_loop_post_task(async_t* async, async_task_t* task);
@@ -53,9 +57,19 @@ typedef struct async_loop {
     list_node_t task_list; // pending tasks, earliest deadline first
     list_node_t due_list; // due tasks, earliest deadline first
     list_node_t thread_list; // earliest created thread first
+
+    // Packets taken from the port by a batched wait but not dispatched yet,
+    // also guarded by |lock|.
+    zx_port_packet_t pending[PACKET_BATCH_SIZE];
+    uint32_t pending_head; // index of the oldest pending packet
+    uint32_t pending_count;
 } async_loop_t;
 
 static zx_status_t async_loop_run_once(async_loop_t* loop, zx_time_t deadline);
+static zx_status_t async_loop_wait_packet(async_loop_t* loop, zx_time_t deadline,
+                                          zx_port_packet_t* packet);
+static bool async_loop_take_pending_locked(async_loop_t* loop, zx_port_packet_t* packet);
+static bool async_loop_cancel_pending_locked(async_loop_t* loop, uint64_t key);
 static zx_status_t async_loop_dispatch_wait(async_loop_t* loop, async_wait_t* wait,
                                             zx_status_t status, const zx_packet_signal_t* signal);
 static zx_status_t async_loop_dispatch_tasks(async_loop_t* loop);
@@ -220,7 +234,7 @@ static zx_status_t async_loop_run_once(async_loop_t* loop, zx_time_t deadline) {
         return ZX_ERR_CANCELED;
 
     zx_port_packet_t packet;
-    zx_status_t status = zx_port_wait(loop->port, deadline, &packet, 0);
+    zx_status_t status = async_loop_wait_packet(loop, deadline, &packet);
     if (status != ZX_OK)
         return status;
 
@@ -252,6 +266,71 @@ static zx_status_t async_loop_run_once(async_loop_t* loop, zx_time_t deadline) {
     return ZX_ERR_INTERNAL;
 }
 
+// Gets the next packet to dispatch, from the ones left over by an earlier
+// batched wait if there are any.
+static zx_status_t async_loop_wait_packet(async_loop_t* loop, zx_time_t deadline,
+                                          zx_port_packet_t* packet) {
+    mtx_lock(&loop->lock);
+    bool taken = async_loop_take_pending_locked(loop, packet);
+    mtx_unlock(&loop->lock);
+    if (taken)
+        return ZX_OK;
+
+    // With several threads, take one packet at a time so that the others
+    // get their share of the work.  A single thread takes all it can, so the
+    // cost of the wait is spread over every packet that arrived meanwhile.
+    // Only one thread can be here in that mode at once, and it only gets
+    // here once |pending| is empty, so the batch always fits.
+    if (atomic_load_explicit(&loop->active_threads, memory_order_acquire) > 1u)
+        return zx_port_wait(loop->port, deadline, packet, 0);
+
+    zx_port_packet_t packets[PACKET_BATCH_SIZE];
+    size_t count = 0u;
+    zx_status_t status = zx_port_wait_many(loop->port, deadline, packets,
+                                           PACKET_BATCH_SIZE, &count);
+    if (status != ZX_OK)
+        return status;
+
+    *packet = packets[0];
+    if (count > 1u) {
+        mtx_lock(&loop->lock);
+        for (size_t i = 1u; i < count; i++) {
+            ZX_DEBUG_ASSERT(loop->pending_count < PACKET_BATCH_SIZE);
+            uint32_t tail = (loop->pending_head + loop->pending_count) % PACKET_BATCH_SIZE;
+            loop->pending[tail] = packets[i];
+            loop->pending_count++;
+        }
+        mtx_unlock(&loop->lock);
+    }
+    return ZX_OK;
+}
+
+static bool async_loop_take_pending_locked(async_loop_t* loop, zx_port_packet_t* packet) {
+    if (loop->pending_count == 0u)
+        return false;
+    *packet = loop->pending[loop->pending_head];
+    loop->pending_head = (loop->pending_head + 1u) % PACKET_BATCH_SIZE;
+    loop->pending_count--;
+    return true;
+}
+
+// Drops the pending packets with |key|, as zx_port_cancel() would have done
+// had they still been queued in the port. Returns true if there were any.
+static bool async_loop_cancel_pending_locked(async_loop_t* loop, uint64_t key) {
+    uint32_t kept = 0u;
+    for (uint32_t i = 0u; i < loop->pending_count; i++) {
+        const zx_port_packet_t* packet =
+            &loop->pending[(loop->pending_head + i) % PACKET_BATCH_SIZE];
+        if (packet->key != key) {
+            loop->pending[(loop->pending_head + kept) % PACKET_BATCH_SIZE] = *packet;
+            kept++;
+        }
+    }
+    bool canceled = kept != loop->pending_count;
+    loop->pending_count = kept;
+    return canceled;
+}
+
 static zx_status_t async_loop_dispatch_wait(async_loop_t* loop, async_wait_t* wait,
                                             zx_status_t status, const zx_packet_signal_t* signal) {
     async_loop_invoke_prologue(loop);
@@ -458,11 +537,13 @@ static zx_status_t async_loop_cancel_wait(async_t* async, async_wait_t* wait) {
     // invoked again past this point.
     zx_status_t status = zx_port_cancel(loop->port, wait->object,
                                         (uintptr_t)wait);
-    if (status == ZX_OK && (wait->flags & ASYNC_FLAG_HANDLE_SHUTDOWN)) {
-        mtx_lock(&loop->lock);
+    mtx_lock(&loop->lock);
+    // The wait's packet may already have been taken by a batched wait.
+    if (async_loop_cancel_pending_locked(loop, (uintptr_t)wait))
+        status = ZX_OK;
+    if (status == ZX_OK && (wait->flags & ASYNC_FLAG_HANDLE_SHUTDOWN))
         list_delete(wait_to_node(wait));
-        mtx_unlock(&loop->lock);
-    }
+    mtx_unlock(&loop->lock);
     return status;
 }
 
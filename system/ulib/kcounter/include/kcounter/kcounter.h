@@ -0,0 +1,49 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Reading the kernel's counters, as exported by zx_kcounters_get_vmo().
+
+#pragma once
+
+#include <zircon/compiler.h>
+#include <zircon/kcounters.h>
+#include <zircon/types.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+__BEGIN_CDECLS
+
+// A read-only mapping of the kernel counters. The values read through it
+// are always current.
+typedef struct kcounter_view {
+    const kcounters_header_t* header;
+    const kcounters_desc_t* descs;
+    const volatile uint64_t* arena;
+    uintptr_t mapping;
+    size_t mapping_size;
+} kcounter_view_t;
+
+// Maps the kernel counters into this process. |root_resource| must be the
+// root resource; the caller keeps ownership of it.
+zx_status_t kcounter_view_open(zx_handle_t root_resource, kcounter_view_t* view);
+
+// Unmaps the counters.
+void kcounter_view_close(kcounter_view_t* view);
+
+// Returns the number of counters.
+size_t kcounter_count(const kcounter_view_t* view);
+
+// Returns the name of counter |index|, like "kernel.thread.create".
+const char* kcounter_name(const kcounter_view_t* view, size_t index);
+
+// Returns the value of counter |index|, summed over all cpus.
+uint64_t kcounter_value(const kcounter_view_t* view, size_t index);
+
+// Finds the counter called |name|. The counters are sorted by name.
+// Returns false if there is none.
+bool kcounter_find(const kcounter_view_t* view, const char* name, size_t* index);
+
+__END_CDECLS
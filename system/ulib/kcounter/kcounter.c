@@ -0,0 +1,94 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <kcounter/kcounter.h>
+
+#include <string.h>
+
+#include <zircon/process.h>
+#include <zircon/syscalls.h>
+
+zx_status_t kcounter_view_open(zx_handle_t root_resource, kcounter_view_t* view) {
+    zx_handle_t vmo;
+    zx_status_t status = zx_kcounters_get_vmo(root_resource, &vmo);
+    if (status != ZX_OK) {
+        return status;
+    }
+
+    uint64_t size;
+    status = zx_vmo_get_size(vmo, &size);
+    if (status != ZX_OK) {
+        zx_handle_close(vmo);
+        return status;
+    }
+
+    uintptr_t addr;
+    status = zx_vmar_map(zx_vmar_root_self(), 0, vmo, 0, size, ZX_VM_FLAG_PERM_READ, &addr);
+    zx_handle_close(vmo);
+    if (status != ZX_OK) {
+        return status;
+    }
+
+    const kcounters_header_t* header = (const kcounters_header_t*)addr;
+    if (size < sizeof(*header) || header->magic != KCOUNTERS_MAGIC ||
+        header->arena_offset > size ||
+        (header->num_counters != 0 &&
+         (size - header->arena_offset) / sizeof(uint64_t) / header->num_counters <
+             header->num_cpus)) {
+        zx_vmar_unmap(zx_vmar_root_self(), addr, size);
+        return ZX_ERR_NOT_SUPPORTED;
+    }
+
+    view->header = header;
+    view->descs = (const kcounters_desc_t*)(header + 1);
+    view->arena = (const volatile uint64_t*)(addr + header->arena_offset);
+    view->mapping = addr;
+    view->mapping_size = size;
+    return ZX_OK;
+}
+
+void kcounter_view_close(kcounter_view_t* view) {
+    if (view->mapping != 0) {
+        zx_vmar_unmap(zx_vmar_root_self(), view->mapping, view->mapping_size);
+    }
+    memset(view, 0, sizeof(*view));
+}
+
+size_t kcounter_count(const kcounter_view_t* view) {
+    return view->header->num_counters;
+}
+
+const char* kcounter_name(const kcounter_view_t* view, size_t index) {
+    return view->descs[index].name;
+}
+
+uint64_t kcounter_value(const kcounter_view_t* view, size_t index) {
+    // Each cpu's count is read separately, so the sum is only
+    // an approximation while the counter is moving.
+    size_t num_counters = view->header->num_counters;
+    uint64_t sum = 0;
+    for (size_t cpu = 0; cpu < view->header->num_cpus; ++cpu) {
+        sum += view->arena[cpu * num_counters + index];
+    }
+    return sum;
+}
+
+bool kcounter_find(const kcounter_view_t* view, const char* name, size_t* index) {
+    size_t lo = 0;
+    size_t hi = view->header->num_counters;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strncmp(view->descs[mid].name, name, KCOUNTERS_NAME_LEN);
+        if (cmp == 0) {
+            *index = mid;
+            return true;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,25 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <zircon/syscalls.h>
+
+#include <lib/fixed_point.h>
+#include "private.h"
+
+zx_time_t _zx_clock_get(uint32_t clock_id) {
+    if (clock_id == ZX_CLOCK_MONOTONIC) {
+        // The kernel publishes the scale it uses itself, so this agrees
+        // exactly with the deadlines it checks.
+        const struct fp_32_64 ns_per_tick = {
+            DATA_CONSTANTS.ns_per_tick_l0,
+            DATA_CONSTANTS.ns_per_tick_l32,
+            DATA_CONSTANTS.ns_per_tick_l64,
+        };
+        if (ns_per_tick.l0 | ns_per_tick.l32 | ns_per_tick.l64)
+            return u64_mul_u64_fp32_64(VDSO_zx_ticks_get(), ns_per_tick);
+    }
+    return SYSCALL_zx_clock_get_via_kernel(clock_id);
+}
+
+VDSO_INTERFACE_FUNCTION(zx_clock_get);
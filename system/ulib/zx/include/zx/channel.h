@@ -43,6 +43,16 @@ public:
                                 num_handles);
     }
 
+    zx_status_t read_many(uint32_t flags, zx_channel_msg_t* msgs, uint32_t num_msgs,
+                          uint32_t* actual_msgs) const {
+        return zx_channel_read_many(get(), flags, msgs, num_msgs, actual_msgs);
+    }
+
+    zx_status_t write_many(uint32_t flags, const zx_channel_msg_t* msgs,
+                           uint32_t num_msgs) const {
+        return zx_channel_write_many(get(), flags, msgs, num_msgs);
+    }
+
     zx_status_t call(uint32_t flags, zx::time deadline,
                      const zx_channel_call_args_t* args,
                      uint32_t* actual_bytes, uint32_t* actual_handles,
@@ -0,0 +1,111 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unittest/unittest.h>
+
+bool arc4random_buf_fills() {
+    BEGIN_TEST;
+
+    uint8_t a[64] = {};
+    uint8_t b[64] = {};
+    arc4random_buf(a, sizeof(a));
+    arc4random_buf(b, sizeof(b));
+
+    uint8_t zero[64] = {};
+    EXPECT_NE(memcmp(a, zero, sizeof(a)), 0);
+    EXPECT_NE(memcmp(a, b, sizeof(a)), 0);
+
+    END_TEST;
+}
+
+bool arc4random_buf_large() {
+    BEGIN_TEST;
+
+    // Larger than the generator's internal buffer and its reseed interval,
+    // so this crosses both refills and a reseed.
+    const size_t size = 4 * 1024 * 1024;
+    uint8_t* buf = static_cast<uint8_t*>(malloc(size));
+    ASSERT_NONNULL(buf);
+    memset(buf, 0, size);
+
+    arc4random_buf(buf, size);
+
+    // Every 4KB page should have been written to.
+    uint8_t zero[4096] = {};
+    for (size_t off = 0; off < size; off += sizeof(zero)) {
+        EXPECT_NE(memcmp(buf + off, zero, sizeof(zero)), 0);
+    }
+
+    free(buf);
+
+    END_TEST;
+}
+
+bool arc4random_uniform_bounded() {
+    BEGIN_TEST;
+
+    EXPECT_EQ(arc4random_uniform(0), 0u);
+    EXPECT_EQ(arc4random_uniform(1), 0u);
+
+    const uint32_t bounds[] = { 2, 3, 10, 1000, 0x80000001u, UINT32_MAX };
+    for (uint32_t bound : bounds) {
+        for (int i = 0; i < 1000; ++i) {
+            EXPECT_LT(arc4random_uniform(bound), bound);
+        }
+    }
+
+    // With 1000 draws out of 10 values, every value should show up.
+    bool seen[10] = {};
+    for (int i = 0; i < 1000; ++i) {
+        seen[arc4random_uniform(10)] = true;
+    }
+    for (bool s : seen) {
+        EXPECT_TRUE(s);
+    }
+
+    END_TEST;
+}
+
+static void* draw_thread(void* arg) {
+    arc4random_buf(arg, 32);
+    return nullptr;
+}
+
+bool arc4random_threads_differ() {
+    BEGIN_TEST;
+
+    // Each thread keeps its own generator, so the streams must not repeat.
+    uint8_t a[32] = {};
+    uint8_t b[32] = {};
+    pthread_t ta, tb;
+    ASSERT_EQ(pthread_create(&ta, nullptr, draw_thread, a), 0);
+    ASSERT_EQ(pthread_create(&tb, nullptr, draw_thread, b), 0);
+    ASSERT_EQ(pthread_join(ta, nullptr), 0);
+    ASSERT_EQ(pthread_join(tb, nullptr), 0);
+
+    uint8_t mine[32];
+    arc4random_buf(mine, sizeof(mine));
+
+    EXPECT_NE(memcmp(a, b, sizeof(a)), 0);
+    EXPECT_NE(memcmp(a, mine, sizeof(a)), 0);
+    EXPECT_NE(memcmp(b, mine, sizeof(b)), 0);
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(arc4random_tests)
+RUN_TEST(arc4random_buf_fills);
+RUN_TEST(arc4random_buf_large);
+RUN_TEST(arc4random_uniform_bounded);
+RUN_TEST(arc4random_threads_differ);
+END_TEST_CASE(arc4random_tests)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <assert.h>
+#include <limits.h>
 #include <zircon/compiler.h>
 #include <zircon/syscalls.h>
 #include <zircon/syscalls/object.h>
@@ -10,6 +11,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <threads.h>
 #include <unistd.h>
 
@@ -884,6 +886,132 @@ static bool channel_disallow_write_to_self(void) {
     END_TEST;
 }
 
+static bool channel_write_loan(void) {
+    BEGIN_TEST;
+    zx_handle_t channel[2];
+    ASSERT_EQ(zx_channel_create(0, &channel[0], &channel[1]), ZX_OK, "");
+
+    const size_t size = 4u * PAGE_SIZE;
+    zx_handle_t vmo;
+    ASSERT_EQ(zx_vmo_create(size, 0u, &vmo), ZX_OK, "");
+    uintptr_t addr;
+    ASSERT_EQ(zx_vmar_map(zx_vmar_root_self(), 0u, vmo, 0u, size,
+                          ZX_VM_FLAG_PERM_READ | ZX_VM_FLAG_PERM_WRITE, &addr), ZX_OK, "");
+    uint8_t* data = (uint8_t*)addr;
+    for (size_t i = 0; i < size; i++)
+        data[i] = (uint8_t)(i * 7);
+
+    // The message must start on a page boundary and fit in one mapping.
+    ASSERT_EQ(zx_channel_write(channel[0], ZX_CHANNEL_WRITE_LOAN, data + 1, 16u, NULL, 0u),
+              ZX_ERR_INVALID_ARGS, "unaligned loan");
+    ASSERT_EQ(zx_channel_write(channel[0], ZX_CHANNEL_WRITE_LOAN, data + PAGE_SIZE,
+                               (uint32_t)size, NULL, 0u),
+              ZX_ERR_INVALID_ARGS, "loan past the mapping");
+
+    // Loaning pins the pages, so a read-only mapping is not enough.
+    uintptr_t ro_addr;
+    ASSERT_EQ(zx_vmar_map(zx_vmar_root_self(), 0u, vmo, 0u, PAGE_SIZE,
+                          ZX_VM_FLAG_PERM_READ, &ro_addr), ZX_OK, "");
+    EXPECT_EQ(zx_channel_write(channel[0], ZX_CHANNEL_WRITE_LOAN, (void*)ro_addr, 16u, NULL, 0u),
+              ZX_ERR_ACCESS_DENIED, "loan from read-only mapping");
+    ASSERT_EQ(zx_vmar_unmap(zx_vmar_root_self(), ro_addr, PAGE_SIZE), ZX_OK, "");
+
+    // A loaned message reads back like a copied one, including a length
+    // that is not a multiple of the page size.
+    const uint32_t msg_size = (uint32_t)(3u * PAGE_SIZE + 100u);
+    ASSERT_EQ(zx_channel_write(channel[0], ZX_CHANNEL_WRITE_LOAN, data, msg_size, NULL, 0u),
+              ZX_OK, "");
+
+    // The loaned pages cannot be taken away before the message is read.
+    EXPECT_EQ(zx_vmo_op_range(vmo, ZX_VMO_OP_DECOMMIT, 0u, PAGE_SIZE, NULL, 0u),
+              ZX_ERR_BAD_STATE, "decommit loaned page");
+    EXPECT_EQ(zx_vmo_set_size(vmo, PAGE_SIZE), ZX_ERR_BAD_STATE, "shrink loaned vmo");
+
+    uint8_t* read_data = malloc(msg_size);
+    ASSERT_NONNULL(read_data, "");
+    uint32_t actual = 0u;
+    ASSERT_EQ(zx_channel_read(channel[1], 0u, read_data, NULL, msg_size, 0u, &actual, NULL),
+              ZX_OK, "");
+    ASSERT_EQ(actual, msg_size, "");
+    ASSERT_EQ(memcmp(read_data, data, msg_size), 0, "loaned data mismatch");
+
+    // Reading the message returns the pages to the sender.
+    EXPECT_EQ(zx_vmo_op_range(vmo, ZX_VMO_OP_DECOMMIT, 0u, PAGE_SIZE, NULL, 0u),
+              ZX_OK, "decommit after read");
+
+    free(read_data);
+    ASSERT_EQ(zx_vmar_unmap(zx_vmar_root_self(), addr, size), ZX_OK, "");
+    zx_handle_close(vmo);
+    zx_handle_close(channel[0]);
+    zx_handle_close(channel[1]);
+    END_TEST;
+}
+
+static bool channel_read_write_many(void) {
+    BEGIN_TEST;
+    zx_handle_t channel[2];
+    ASSERT_EQ(zx_channel_create(0, &channel[0], &channel[1]), ZX_OK, "");
+
+    zx_handle_t event;
+    ASSERT_EQ(zx_event_create(0u, &event), ZX_OK, "");
+
+    char out[3][8] = {"one", "two", "three"};
+    zx_channel_msg_t wr[3] = {
+        {out[0], NULL, 4u, 0u, 0u, 0u},
+        {out[1], &event, 4u, 1u, 0u, 0u},
+        {out[2], NULL, 6u, 0u, 0u, 0u},
+    };
+
+    // A bad handle in any message fails the whole batch.
+    zx_handle_t bad = ZX_HANDLE_INVALID;
+    wr[2].handles = &bad;
+    wr[2].num_handles = 1u;
+    ASSERT_EQ(zx_channel_write_many(channel[0], 0u, wr, 3u), ZX_ERR_BAD_HANDLE, "");
+    ASSERT_EQ(zx_channel_read(channel[1], 0u, NULL, NULL, 0u, 0u, NULL, NULL),
+              ZX_ERR_SHOULD_WAIT, "partial batch written");
+    ASSERT_EQ(zx_object_signal(event, 0u, ZX_USER_SIGNAL_0), ZX_OK, "handle lost");
+    wr[2].handles = NULL;
+    wr[2].num_handles = 0u;
+
+    ASSERT_EQ(zx_channel_write_many(channel[0], 0u, wr, 3u), ZX_OK, "");
+
+    // The second slot is too small for its message, so only the first is
+    // read, and the size of the second is reported.
+    char in[3][8];
+    zx_handle_t in_handle = ZX_HANDLE_INVALID;
+    zx_channel_msg_t rd[3] = {
+        {in[0], NULL, 8u, 0u, 0u, 0u},
+        {in[1], &in_handle, 2u, 1u, 0u, 0u},
+        {in[2], NULL, 8u, 0u, 0u, 0u},
+    };
+    uint32_t actual = 0u;
+    ASSERT_EQ(zx_channel_read_many(channel[1], 0u, rd, 3u, &actual), ZX_OK, "");
+    ASSERT_EQ(actual, 1u, "");
+    ASSERT_EQ(rd[0].actual_bytes, 4u, "");
+    ASSERT_EQ(memcmp(in[0], "one", 4u), 0, "");
+    ASSERT_EQ(rd[1].actual_bytes, 4u, "");
+    ASSERT_EQ(rd[1].actual_handles, 1u, "");
+
+    rd[1].num_bytes = 8u;
+    ASSERT_EQ(zx_channel_read_many(channel[1], 0u, &rd[1], 2u, &actual), ZX_OK, "");
+    ASSERT_EQ(actual, 2u, "");
+    ASSERT_EQ(memcmp(in[1], "two", 4u), 0, "");
+    ASSERT_NE(in_handle, ZX_HANDLE_INVALID, "");
+    ASSERT_EQ(rd[2].actual_bytes, 6u, "");
+    ASSERT_EQ(memcmp(in[2], "three", 6u), 0, "");
+
+    // The batch drained the channel, so it is no longer readable.
+    zx_signals_t pending = 0u;
+    ASSERT_EQ(zx_object_wait_one(channel[1], ZX_CHANNEL_READABLE, 0u, &pending),
+              ZX_ERR_TIMED_OUT, "");
+    ASSERT_EQ(zx_channel_read_many(channel[1], 0u, rd, 3u, &actual), ZX_ERR_SHOULD_WAIT, "");
+
+    zx_handle_close(in_handle);
+    zx_handle_close(channel[0]);
+    zx_handle_close(channel[1]);
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(channel_tests)
 RUN_TEST(channel_test)
 RUN_TEST(channel_read_error_test)
@@ -897,6 +1025,8 @@ RUN_TEST(channel_call2)
 RUN_TEST(bad_channel_call_finish)
 RUN_TEST(channel_nest)
 RUN_TEST(channel_disallow_write_to_self)
+RUN_TEST(channel_write_loan)
+RUN_TEST(channel_read_write_many)
 END_TEST_CASE(channel_tests)
 
 #ifndef BUILD_COMBINED_TESTS
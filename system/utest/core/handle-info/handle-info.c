@@ -2,8 +2,10 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <threads.h>
 
 #include <zircon/process.h>
 #include <zircon/syscalls.h>
@@ -144,10 +146,62 @@ static bool handle_rights_test(void) {
     END_TEST;
 }
 
+#define LOOKUP_THREADS 8
+#define LOOKUP_HANDLES 16
+
+static volatile zx_handle_t lookup_handles[LOOKUP_HANDLES];
+static atomic_int lookup_done;
+
+// Looks the shared handles up while the main thread replaces them.
+static int lookup_thread(void* arg) {
+    int* errors = arg;
+    for (uint32_t i = 0; !atomic_load(&lookup_done); ++i) {
+        zx_handle_t h = lookup_handles[i % LOOKUP_HANDLES];
+        zx_status_t status = zx_object_signal(h, 0u, ZX_USER_SIGNAL_0);
+        if (status != ZX_OK && status != ZX_ERR_BAD_HANDLE)
+            ++*errors;
+    }
+    return 0;
+}
+
+static bool handle_concurrent_lookup_test(void) {
+    BEGIN_TEST;
+
+    for (int i = 0; i < LOOKUP_HANDLES; ++i)
+        ASSERT_EQ(zx_event_create(0u, (zx_handle_t*)&lookup_handles[i]), ZX_OK, "");
+
+    thrd_t threads[LOOKUP_THREADS];
+    int errors[LOOKUP_THREADS] = {};
+    atomic_store(&lookup_done, 0);
+    for (int i = 0; i < LOOKUP_THREADS; ++i)
+        ASSERT_EQ(thrd_create(&threads[i], lookup_thread, &errors[i]), thrd_success, "");
+
+    // Lookups race with the handles being closed and their slots reused.
+    for (int round = 0; round < 10000; ++round) {
+        int i = round % LOOKUP_HANDLES;
+        zx_handle_t old = lookup_handles[i];
+        zx_handle_t h;
+        ASSERT_EQ(zx_event_create(0u, &h), ZX_OK, "");
+        lookup_handles[i] = h;
+        ASSERT_EQ(zx_handle_close(old), ZX_OK, "");
+    }
+
+    atomic_store(&lookup_done, 1);
+    for (int i = 0; i < LOOKUP_THREADS; ++i) {
+        ASSERT_EQ(thrd_join(threads[i], NULL), thrd_success, "");
+        EXPECT_EQ(errors[i], 0, "unexpected lookup status");
+    }
+    for (int i = 0; i < LOOKUP_HANDLES; ++i)
+        EXPECT_EQ(zx_handle_close(lookup_handles[i]), ZX_OK, "");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(handle_info_tests)
 RUN_TEST(handle_info_test)
 RUN_TEST(handle_related_koid_test)
 RUN_TEST(handle_rights_test)
+RUN_TEST(handle_concurrent_lookup_test)
 END_TEST_CASE(handle_info_tests)
 
 #ifndef BUILD_COMBINED_TESTS
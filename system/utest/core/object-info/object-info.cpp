@@ -893,6 +893,44 @@ bool handle_count_valid() {
     return true;
 }
 
+bool job_stats_counts_channel_messages() {
+    BEGIN_TEST;
+    // Messages are charged to the job of the writer.
+    zx_handle_t job = zx_job_default();
+    if (job == ZX_HANDLE_INVALID) {
+        unittest_printf("no default job; skipping\n");
+        END_TEST;
+    }
+    zx_info_job_stats_t before;
+    ASSERT_EQ(zx_object_get_info(job, ZX_INFO_JOB_STATS, &before, sizeof(before),
+                                 nullptr, nullptr), ZX_OK);
+
+    // One small message is stored inline; the large one needs several
+    // buffers.
+    zx_handle_t ch[2];
+    ASSERT_EQ(zx_channel_create(0u, &ch[0], &ch[1]), ZX_OK);
+    static char data[ZX_CHANNEL_MAX_MSG_BYTES];
+    ASSERT_EQ(zx_channel_write(ch[0], 0u, data, 16u, nullptr, 0u), ZX_OK);
+    ASSERT_EQ(zx_channel_write(ch[0], 0u, data, sizeof(data), nullptr, 0u), ZX_OK);
+
+    // Other processes in the job may have messages in flight too, so only
+    // look for at least the growth caused by this test.
+    zx_info_job_stats_t during;
+    ASSERT_EQ(zx_object_get_info(job, ZX_INFO_JOB_STATS, &during, sizeof(during),
+                                 nullptr, nullptr), ZX_OK);
+    EXPECT_GE(during.channel_msgs, before.channel_msgs + 2u);
+    EXPECT_GE(during.channel_msg_bytes, before.channel_msg_bytes + sizeof(data));
+
+    // Closing the channel frees the queued messages and un-charges them.
+    zx_handle_close(ch[1]);
+    zx_handle_close(ch[0]);
+    zx_info_job_stats_t after;
+    ASSERT_EQ(zx_object_get_info(job, ZX_INFO_JOB_STATS, &after, sizeof(after),
+                                 nullptr, nullptr), ZX_OK);
+    EXPECT_LT(after.channel_msg_bytes, during.channel_msg_bytes);
+    END_TEST;
+}
+
 } // namespace
 
 // Tests that should pass for any topic. Use the wrappers below instead of
@@ -961,6 +999,11 @@ RUN_TEST((wrong_handle_type_fails<ZX_INFO_JOB_CHILDREN, zx_koid_t, zx_thread_sel
 RUN_TEST((missing_rights_fails<ZX_INFO_JOB_CHILDREN, zx_koid_t, get_test_job,
                                ZX_RIGHT_ENUMERATE>));
 
+RUN_TEST(job_stats_counts_channel_messages);
+RUN_SINGLE_ENTRY_TESTS(ZX_INFO_JOB_STATS, zx_info_job_stats_t, get_test_job);
+RUN_TEST((wrong_handle_type_fails<ZX_INFO_JOB_STATS, zx_info_job_stats_t, get_test_process>));
+RUN_TEST((wrong_handle_type_fails<ZX_INFO_JOB_STATS, zx_info_job_stats_t, zx_thread_self>));
+
 // Basic tests for all other topics.
 
 RUN_SINGLE_ENTRY_TESTS(ZX_INFO_HANDLE_BASIC, zx_info_handle_basic_t, get_test_job);
@@ -139,6 +139,41 @@ static bool wait_count_invalid_test() {
     END_TEST;
 }
 
+static bool wait_many_test(void) {
+    BEGIN_TEST;
+    zx_handle_t port;
+    ASSERT_EQ(zx_port_create(0, &port), ZX_OK);
+
+    zx_port_packet_t out[ZX_PORT_WAIT_MANY_MAX_PACKETS] = {};
+    size_t actual = 0u;
+    EXPECT_EQ(zx_port_wait_many(port, 0u, out, 0u, &actual), ZX_ERR_OUT_OF_RANGE);
+    EXPECT_EQ(zx_port_wait_many(port, 0u, out, ZX_PORT_WAIT_MANY_MAX_PACKETS + 1u, &actual),
+              ZX_ERR_OUT_OF_RANGE);
+    EXPECT_EQ(zx_port_wait_many(port, zx_deadline_after(ZX_MSEC(1)), out, 4u, &actual),
+              ZX_ERR_TIMED_OUT);
+
+    for (uint64_t key = 0u; key < 6u; ++key) {
+        zx_port_packet_t in = {key, ZX_PKT_TYPE_USER, 0, {{}}};
+        ASSERT_EQ(zx_port_queue(port, &in, 0u), ZX_OK);
+    }
+
+    // Packets come back in FIFO order, at most |count| at a time.
+    ASSERT_EQ(zx_port_wait_many(port, ZX_TIME_INFINITE, out, 4u, &actual), ZX_OK);
+    ASSERT_EQ(actual, 4u);
+    for (size_t i = 0u; i < actual; ++i)
+        EXPECT_EQ(out[i].key, i);
+
+    ASSERT_EQ(zx_port_wait_many(port, ZX_TIME_INFINITE, out, 4u, &actual), ZX_OK);
+    ASSERT_EQ(actual, 2u);
+    EXPECT_EQ(out[0].key, 4u);
+    EXPECT_EQ(out[1].key, 5u);
+
+    EXPECT_EQ(zx_port_wait_many(port, 0u, out, 4u, &actual), ZX_ERR_TIMED_OUT);
+
+    EXPECT_EQ(zx_handle_close(port), ZX_OK);
+    END_TEST;
+}
+
 static bool queue_and_close_test(void) {
     BEGIN_TEST;
     zx_status_t status;
@@ -650,6 +685,134 @@ static bool threads_event_repeat() {
     return threads_event(ZX_WAIT_ASYNC_REPEATING);
 }
 
+static constexpr uint64_t kProducerPackets = 1000u;
+
+static int port_producer_thread(void* arg) {
+    auto ctx = reinterpret_cast<test_context*>(arg);
+    for (uint64_t ix = 0; ix != kProducerPackets; ++ix) {
+        zx_port_packet_t in = {ctx->count, ZX_PKT_TYPE_USER, 0, {{}}};
+        in.user.u64[0] = ix;
+        auto st = zx_port_queue(ctx->port, &in, 0u);
+        if (st != ZX_OK)
+            return st;
+    }
+    return 0;
+}
+
+static bool threads_queue_test() {
+    BEGIN_TEST;
+
+    zx_handle_t port;
+    EXPECT_EQ(zx_port_create(0, &port), ZX_OK);
+
+    // Many threads queue into one port at once. Every packet must come
+    // out exactly once, and each thread's packets in the order it queued
+    // them.
+    thrd_t threads[8];
+    test_context ctx[8];
+    for (size_t ix = 0; ix != fbl::count_of(threads); ++ix) {
+        // |count| is the producer's key here.
+        ctx[ix] = { port, static_cast<uint32_t>(ix) };
+        EXPECT_EQ(thrd_create(&threads[ix], port_producer_thread, &ctx[ix]),
+                  thrd_success);
+    }
+
+    uint64_t next[8] = {};
+    for (uint64_t received = 0;
+         received != fbl::count_of(threads) * kProducerPackets; ++received) {
+        zx_port_packet_t out = {};
+        ASSERT_EQ(zx_port_wait(port, ZX_TIME_INFINITE, &out, 0u), ZX_OK);
+        ASSERT_LT(out.key, fbl::count_of(next));
+        EXPECT_EQ(out.user.u64[0], next[out.key]);
+        next[out.key] = out.user.u64[0] + 1u;
+    }
+
+    for (size_t ix = 0; ix != fbl::count_of(threads); ++ix) {
+        int res;
+        EXPECT_EQ(thrd_join(threads[ix], &res), thrd_success);
+        EXPECT_EQ(res, 0);
+        EXPECT_EQ(next[ix], kProducerPackets);
+    }
+
+    zx_port_packet_t out = {};
+    EXPECT_EQ(zx_port_wait(port, 0u, &out, 0u), ZX_ERR_TIMED_OUT);
+    EXPECT_EQ(zx_handle_close(port), ZX_OK);
+
+    END_TEST;
+}
+
+
+static constexpr uint32_t kToggleRounds = 10000u;
+
+static int event_toggle_thread(void* arg) {
+    auto ev = *reinterpret_cast<zx_handle_t*>(arg);
+    for (uint32_t ix = 0; ix != kToggleRounds; ++ix) {
+        auto st = zx_object_signal(ev, 0u, ZX_USER_SIGNAL_0);
+        if (st == ZX_OK)
+            st = zx_object_signal(ev, ZX_USER_SIGNAL_0, 0u);
+        if (st != ZX_OK)
+            return st;
+    }
+    // Raised last and left up; the reader must see it.
+    return zx_object_signal(ev, 0u, ZX_USER_SIGNAL_1);
+}
+
+static bool threads_signal_dequeue(uint32_t wait_mode) {
+    BEGIN_TEST;
+
+    zx_handle_t port;
+    zx_handle_t ev;
+    EXPECT_EQ(zx_port_create(0, &port), ZX_OK);
+    EXPECT_EQ(zx_event_create(0u, &ev), ZX_OK);
+
+    // One thread keeps raising a signal, so that it is either queued anew
+    // or merged into the packet still in the queue, while this thread
+    // dequeues. In the one-shot case the signaling thread also hands the
+    // observer to the port while we take the packet.
+    const zx_signals_t signals = ZX_USER_SIGNAL_0 | ZX_USER_SIGNAL_1;
+    EXPECT_EQ(zx_object_wait_async(ev, port, 7u, signals, wait_mode), ZX_OK);
+
+    thrd_t thread;
+    EXPECT_EQ(thrd_create(&thread, event_toggle_thread, &ev), thrd_success);
+
+    uint32_t packets = 0u;
+    while (true) {
+        zx_port_packet_t out = {};
+        ASSERT_EQ(zx_port_wait(port, ZX_TIME_INFINITE, &out, 0u), ZX_OK);
+        ++packets;
+        EXPECT_EQ(out.key, 7u);
+        EXPECT_EQ(out.signal.trigger, signals);
+        EXPECT_NE(out.signal.observed & signals, 0u);
+        if (out.signal.observed & ZX_USER_SIGNAL_1)
+            break;
+        if (wait_mode == ZX_WAIT_ASYNC_ONCE) {
+            ASSERT_EQ(zx_object_wait_async(ev, port, 7u, signals, wait_mode), ZX_OK);
+        }
+    }
+    // Every packet needs a raised signal of its own.
+    EXPECT_LE(packets, kToggleRounds + 1u);
+
+    int res;
+    EXPECT_EQ(thrd_join(thread, &res), thrd_success);
+    EXPECT_EQ(res, 0);
+
+    // Nothing was raised after the last signal, so nothing is left.
+    zx_port_packet_t out = {};
+    EXPECT_EQ(zx_port_wait(port, 0u, &out, 0u), ZX_ERR_TIMED_OUT);
+
+    EXPECT_EQ(zx_handle_close(port), ZX_OK);
+    EXPECT_EQ(zx_handle_close(ev), ZX_OK);
+
+    END_TEST;
+}
+
+static bool threads_signal_dequeue_once() {
+    return threads_signal_dequeue(ZX_WAIT_ASYNC_ONCE);
+}
+
+static bool threads_signal_dequeue_repeat() {
+    return threads_signal_dequeue(ZX_WAIT_ASYNC_REPEATING);
+}
 
 static constexpr uint32_t kStressCount = 20000u;
 static constexpr uint64_t kSleeps[] = { 0, 10, 2, 0, 15, 0};
@@ -746,6 +909,7 @@ RUN_TEST(wait_count_valid_test<0u>)
 RUN_TEST(wait_count_valid_test<1u>)
 RUN_TEST(wait_count_invalid_test<2u>)
 RUN_TEST(wait_count_invalid_test<23u>)
+RUN_TEST(wait_many_test)
 RUN_TEST(queue_and_close_test)
 RUN_TEST(async_wait_channel_test)
 RUN_TEST(async_wait_event_test_single)
@@ -765,6 +929,9 @@ RUN_TEST(cancel_event_key_once_after)
 RUN_TEST(cancel_event_key_repeat_after)
 RUN_TEST(threads_event_once)
 RUN_TEST(threads_event_repeat)
+RUN_TEST(threads_queue_test)
+RUN_TEST(threads_signal_dequeue_once)
+RUN_TEST(threads_signal_dequeue_repeat)
 RUN_TEST_LARGE(cancel_stress)
 END_TEST_CASE(port_tests)
 
@@ -7,6 +7,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -320,12 +321,60 @@ static bool pthread_getstack_other_thread_explicit_size() {
     END_TEST;
 }
 
+static pthread_mutex_t pi_mutex;
+static int pi_counter = 0;
+
+static void* pi_mutex_thread(void* arg) {
+    for (int i = 0; i < 1000; ++i) {
+        pthread_mutex_lock(&pi_mutex);
+        int value = pi_counter;
+        sched_yield();
+        pi_counter = value + 1;
+        pthread_mutex_unlock(&pi_mutex);
+    }
+    return nullptr;
+}
+
+static bool pthread_mutex_prio_inherit() {
+    BEGIN_TEST;
+
+    pthread_mutexattr_t attr;
+    ASSERT_EQ(pthread_mutexattr_init(&attr), 0);
+    int protocol = -1;
+    ASSERT_EQ(pthread_mutexattr_getprotocol(&attr, &protocol), 0);
+    EXPECT_EQ(protocol, PTHREAD_PRIO_NONE);
+    EXPECT_EQ(pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_PROTECT), ENOTSUP);
+    EXPECT_EQ(pthread_mutexattr_setprotocol(&attr, 1234), EINVAL);
+    ASSERT_EQ(pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT), 0);
+    ASSERT_EQ(pthread_mutexattr_getprotocol(&attr, &protocol), 0);
+    EXPECT_EQ(protocol, PTHREAD_PRIO_INHERIT);
+
+    // The contended paths wait with zx_futex_wait_pi() on the owner.
+    ASSERT_EQ(pthread_mutex_init(&pi_mutex, &attr), 0);
+    pthread_t threads[4];
+    for (auto& thread : threads)
+        ASSERT_EQ(pthread_create(&thread, nullptr, pi_mutex_thread, nullptr), 0);
+    for (auto& thread : threads)
+        ASSERT_EQ(pthread_join(thread, nullptr), 0);
+    EXPECT_EQ(pi_counter, 4000);
+
+    EXPECT_EQ(pthread_mutex_trylock(&pi_mutex), 0);
+    EXPECT_EQ(pthread_mutex_trylock(&pi_mutex), EBUSY);
+    EXPECT_EQ(pthread_mutex_unlock(&pi_mutex), 0);
+
+    EXPECT_EQ(pthread_mutex_destroy(&pi_mutex), 0);
+    EXPECT_EQ(pthread_mutexattr_destroy(&attr), 0);
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(pthread_tests)
 RUN_TEST(pthread_test)
 RUN_TEST(pthread_self_main_thread_test)
 RUN_TEST(pthread_big_stack_size)
 RUN_TEST(pthread_getstack_main_thread)
 RUN_TEST(pthread_getstack_other_thread)
+RUN_TEST(pthread_mutex_prio_inherit)
 END_TEST_CASE(pthread_tests)
 
 #ifndef BUILD_COMBINED_TESTS
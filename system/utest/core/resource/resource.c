@@ -2,6 +2,8 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <zircon/kcounters.h>
+#include <zircon/process.h>
 #include <zircon/types.h>
 #include <zircon/syscalls.h>
 #include <zircon/syscalls/object.h>
@@ -9,6 +11,7 @@
 #include <zircon/syscalls/resource.h>
 #include <unittest/unittest.h>
 #include <stdio.h>
+#include <string.h>
 
 extern zx_handle_t get_root_resource(void);
 
@@ -54,6 +57,64 @@ static bool test_resource_actions(void) {
     END_TEST;
 }
 
+static bool test_kcounters_vmo(void) {
+    BEGIN_TEST;
+
+    zx_handle_t rrh = get_root_resource();
+    ASSERT_NE(rrh, ZX_HANDLE_INVALID, "no root resource handle");
+
+    zx_handle_t vmo;
+    ASSERT_EQ(zx_kcounters_get_vmo(rrh, &vmo), ZX_OK, "");
+
+    // userspace can look but not touch
+    zx_info_handle_basic_t info;
+    ASSERT_EQ(zx_object_get_info(vmo, ZX_INFO_HANDLE_BASIC, &info, sizeof(info), NULL, NULL),
+              ZX_OK, "");
+    EXPECT_EQ(info.rights & ZX_RIGHT_WRITE, 0u, "");
+    uint64_t zero = 0;
+    size_t actual;
+    EXPECT_EQ(zx_vmo_write(vmo, &zero, 0, sizeof(zero), &actual), ZX_ERR_ACCESS_DENIED, "");
+
+    uint64_t size;
+    ASSERT_EQ(zx_vmo_get_size(vmo, &size), ZX_OK, "");
+    uintptr_t addr;
+    ASSERT_EQ(zx_vmar_map(zx_vmar_root_self(), 0, vmo, 0, size, ZX_VM_FLAG_PERM_READ, &addr),
+              ZX_OK, "");
+    zx_handle_close(vmo);
+
+    const kcounters_header_t* header = (const kcounters_header_t*)addr;
+    EXPECT_EQ(header->magic, KCOUNTERS_MAGIC, "");
+    EXPECT_GT(header->num_counters, 0u, "");
+    EXPECT_GT(header->num_cpus, 0u, "");
+    EXPECT_LE(header->arena_offset +
+                  header->num_cpus * header->num_counters * sizeof(uint64_t),
+              size, "");
+
+    // this process has created threads, so that counter cannot be zero
+    const kcounters_desc_t* descs = (const kcounters_desc_t*)(header + 1);
+    const uint64_t* arena = (const uint64_t*)(addr + header->arena_offset);
+    bool found = false;
+    for (uint32_t i = 0; i < header->num_counters; i++) {
+        if (i > 0) {
+            EXPECT_LT(strcmp(descs[i - 1].name, descs[i].name), 0, "not sorted");
+        }
+        if (strcmp(descs[i].name, "kernel.thread.create") == 0) {
+            uint64_t sum = 0;
+            for (uint32_t cpu = 0; cpu < header->num_cpus; cpu++) {
+                sum += arena[cpu * header->num_counters + i];
+            }
+            EXPECT_GT(sum, 0u, "");
+            found = true;
+        }
+    }
+    EXPECT_TRUE(found, "kernel.thread.create not found");
+
+    ASSERT_EQ(zx_vmar_unmap(zx_vmar_root_self(), addr, size), ZX_OK, "");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(resource_tests)
 RUN_TEST(test_resource_actions);
+RUN_TEST(test_kcounters_vmo);
 END_TEST_CASE(resource_tests)
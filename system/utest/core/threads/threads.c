@@ -1037,6 +1037,50 @@ static bool test_writing_arm_flags_register(void) {
     END_TEST;
 }
 
+static bool test_set_deadline(void) {
+    BEGIN_TEST;
+
+    // The deadline class is only available with thread.set.priority.allowed.
+    if (zx_thread_set_deadline(0, 0, 0) == ZX_ERR_NOT_SUPPORTED) {
+        unittest_printf("deadline scheduling not enabled; skipping\n");
+        END_TEST;
+    }
+
+    // The capacity must fit in the deadline, which must fit in the period.
+    EXPECT_EQ(zx_thread_set_deadline(ZX_MSEC(2), ZX_MSEC(1), ZX_MSEC(10)),
+              ZX_ERR_INVALID_ARGS, "");
+    EXPECT_EQ(zx_thread_set_deadline(ZX_MSEC(1), ZX_MSEC(20), ZX_MSEC(10)),
+              ZX_ERR_INVALID_ARGS, "");
+    EXPECT_EQ(zx_thread_set_deadline(ZX_USEC(1), ZX_USEC(10), ZX_USEC(10)),
+              ZX_ERR_INVALID_ARGS, "");
+
+    // No cpu hands out all of its time.
+    EXPECT_EQ(zx_thread_set_deadline(ZX_MSEC(10), ZX_MSEC(10), ZX_MSEC(10)),
+              ZX_ERR_NO_RESOURCES, "");
+
+    zx_info_thread_stats_t before;
+    ASSERT_EQ(zx_object_get_info(zx_thread_self(), ZX_INFO_THREAD_STATS,
+                                 &before, sizeof(before), NULL, NULL), ZX_OK, "");
+
+    // Spin for a while with 1ms of every 10ms: a throttled thread does not
+    // run at all, so it should get about a tenth of the time that passes.
+    ASSERT_EQ(zx_thread_set_deadline(ZX_MSEC(1), ZX_MSEC(5), ZX_MSEC(10)), ZX_OK, "");
+    zx_time_t start = zx_clock_get(ZX_CLOCK_MONOTONIC);
+    zx_time_t now;
+    do {
+        now = zx_clock_get(ZX_CLOCK_MONOTONIC);
+    } while (now - start < ZX_MSEC(100));
+    ASSERT_EQ(zx_thread_set_deadline(0, 0, 0), ZX_OK, "");
+
+    zx_info_thread_stats_t after;
+    ASSERT_EQ(zx_object_get_info(zx_thread_self(), ZX_INFO_THREAD_STATS,
+                                 &after, sizeof(after), NULL, NULL), ZX_OK, "");
+    EXPECT_LT(after.total_runtime - before.total_runtime, (now - start) / 2,
+              "deadline thread ran past its budget");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(threads_tests)
 RUN_TEST(test_basics)
 RUN_TEST(test_detach)
@@ -1061,6 +1105,7 @@ RUN_TEST(test_reading_register_state)
 RUN_TEST(test_writing_register_state)
 RUN_TEST(test_noncanonical_rip_address)
 RUN_TEST(test_writing_arm_flags_register)
+RUN_TEST(test_set_deadline)
 END_TEST_CASE(threads_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -25,8 +25,30 @@ static bool elapsed_time_using_ticks(void) {
     END_TEST;
 }
 
+// The vDSO may compute the monotonic clock itself; it has to agree with the
+// clock the kernel checks deadlines against.
+static bool monotonic_clock_agrees_with_kernel(void) {
+    BEGIN_TEST;
+
+    zx_time_t last = zx_clock_get(ZX_CLOCK_MONOTONIC);
+    for (int i = 0; i < 1000; i++) {
+        zx_time_t now = zx_clock_get(ZX_CLOCK_MONOTONIC);
+        ASSERT_GE(now, last, "Monotonic clock went backwards");
+        last = now;
+    }
+
+    for (int i = 0; i < 10; i++) {
+        zx_time_t deadline = zx_deadline_after(ZX_USEC(100));
+        ASSERT_EQ(zx_nanosleep(deadline), ZX_OK, "");
+        ASSERT_GE(zx_clock_get(ZX_CLOCK_MONOTONIC), deadline, "Woke before the deadline");
+    }
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(ticks_tests)
 RUN_TEST(elapsed_time_using_ticks)
+RUN_TEST(monotonic_clock_agrees_with_kernel)
 END_TEST_CASE(ticks_tests)
 
 #ifndef BUILD_COMBINED_TESTS
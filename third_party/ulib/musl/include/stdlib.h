@@ -125,6 +125,8 @@ void lcong48(unsigned short[7]);
 #endif
 
 #if defined(_GNU_SOURCE) || defined(_BSD_SOURCE)
+#define __NEED_uint32_t
+#include <bits/alltypes.h>
 #include <alloca.h>
 char* mktemp(char*);
 int mkstemps(char*, int);
@@ -132,6 +134,9 @@ int mkostemps(char*, int, int);
 void* valloc(size_t);
 void* memalign(size_t, size_t);
 int clearenv(void);
+uint32_t arc4random(void);
+void arc4random_buf(void*, size_t);
+uint32_t arc4random_uniform(uint32_t);
 #define WCOREDUMP(s) ((s)&0x80)
 #define WIFCONTINUED(s) ((s) == 0xffff)
 #endif
@@ -173,6 +173,8 @@ _Noreturn void __pthread_exit(void* result) {
 
     __dl_thread_cleanup();
 
+    __arc4random_thread_cleanup();
+
     // After this point the sanitizer runtime will tear down its state,
     // so we cannot run any more sanitized code.
     finish_exit(self);
@@ -22,7 +22,8 @@ int __pthread_mutex_trylock_owner(pthread_mutex_t* m) {
 }
 
 int pthread_mutex_trylock(pthread_mutex_t* m) {
-    if ((m->_m_type & PTHREAD_MUTEX_MASK) == PTHREAD_MUTEX_NORMAL)
+    if ((m->_m_type & (PTHREAD_MUTEX_MASK | PTHREAD_MUTEX_PRIO_INHERIT_BIT)) ==
+        PTHREAD_MUTEX_NORMAL)
         return a_cas_shim(&m->_m_lock, 0, EBUSY) & EBUSY;
     return __pthread_mutex_trylock_owner(m);
 }
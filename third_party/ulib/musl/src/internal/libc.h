@@ -53,6 +53,7 @@ void __funcs_on_quick_exit(void) ATTR_LIBC_VISIBILITY;
 void __libc_exit_fini(void) ATTR_LIBC_VISIBILITY;
 
 void __dl_thread_cleanup(void) ATTR_LIBC_VISIBILITY;
+void __arc4random_thread_cleanup(void) ATTR_LIBC_VISIBILITY;
 
 void __tls_run_dtors(void) ATTR_LIBC_VISIBILITY;
 
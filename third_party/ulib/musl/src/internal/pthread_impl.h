@@ -66,6 +66,7 @@ struct pthread {
     locale_t locale;
     char* dlerror_buf;
     int dlerror_flag;
+    struct __arc4random_state* arc4random_state;
 
 #ifdef TLS_ABOVE_TP
     // These must be the very last members.
@@ -125,6 +126,9 @@ static inline struct pthread* tp_to_pthread(void* tp) {
 // The bit used in the recursive and errorchecking cases, which track thread owners.
 #define PTHREAD_MUTEX_OWNED_LOCK_BIT 0x80000000
 #define PTHREAD_MUTEX_OWNED_LOCK_MASK 0x7fffffff
+// Set in the type of mutexes with the PTHREAD_PRIO_INHERIT protocol. These
+// always track their owner, even when of type PTHREAD_MUTEX_NORMAL.
+#define PTHREAD_MUTEX_PRIO_INHERIT_BIT 8
 
 extern void* __pthread_tsd_main[];
 extern volatile size_t __pthread_tsd_size;
@@ -165,6 +169,10 @@ int __pthread_key_delete(tss_t k) ATTR_LIBC_VISIBILITY;
 // This is guaranteed to only return 0, EINVAL, or ETIMEDOUT.
 int __timedwait(atomic_int*, int, clockid_t, const struct timespec*)
     ATTR_LIBC_VISIBILITY;
+// Like __timedwait, but lends the caller's priority to |owner|, the thread
+// holding the futex, while waiting.
+int __timedwait_pi(atomic_int*, int, zx_handle_t owner, clockid_t, const struct timespec*)
+    ATTR_LIBC_VISIBILITY;
 
 // Loading a library can introduce more thread_local variables. Thread
 // allocation bases bookkeeping decisions based on the current state
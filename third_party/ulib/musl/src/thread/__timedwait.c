@@ -3,9 +3,9 @@
 #include <zircon/syscalls.h>
 #include <time.h>
 
-int __timedwait(atomic_int* futex, int val, clockid_t clk, const struct timespec* at) {
+static int deadline_for(clockid_t clk, const struct timespec* at, zx_time_t* deadline) {
     struct timespec to;
-    zx_time_t deadline = ZX_TIME_INFINITE;
+    *deadline = ZX_TIME_INFINITE;
 
     if (at) {
         if (at->tv_nsec >= ZX_SEC(1))
@@ -19,8 +19,16 @@ int __timedwait(atomic_int* futex, int val, clockid_t clk, const struct timespec
         }
         if (to.tv_sec < 0)
             return ETIMEDOUT;
-        deadline = _zx_deadline_after(ZX_SEC(to.tv_sec) + to.tv_nsec);
+        *deadline = _zx_deadline_after(ZX_SEC(to.tv_sec) + to.tv_nsec);
     }
+    return 0;
+}
+
+int __timedwait(atomic_int* futex, int val, clockid_t clk, const struct timespec* at) {
+    zx_time_t deadline;
+    int r = deadline_for(clk, at, &deadline);
+    if (r)
+        return r;
 
     // zx_futex_wait will return ZX_ERR_BAD_STATE if someone modifying *addr
     // races with this call. But this is indistinguishable from
@@ -37,3 +45,35 @@ int __timedwait(atomic_int* futex, int val, clockid_t clk, const struct timespec
         __builtin_trap();
     }
 }
+
+int __timedwait_pi(atomic_int* futex, int val, zx_handle_t owner, clockid_t clk,
+                   const struct timespec* at) {
+    zx_time_t deadline;
+    int r = deadline_for(clk, at, &deadline);
+    if (r)
+        return r;
+
+    // A thread can't lend priority to itself, and the kernel rejects that
+    // with ZX_ERR_INVALID_ARGS. Relocking a normal mutex we already hold
+    // has to deadlock instead, so wait like any other futex.
+    if (owner == (zx_handle_t)__thread_get_tid())
+        return __timedwait(futex, val, clk, at);
+
+    switch (_zx_futex_wait_pi(futex, val, owner, deadline)) {
+    case ZX_OK:
+    case ZX_ERR_BAD_STATE:
+        return 0;
+    case ZX_ERR_TIMED_OUT:
+        return ETIMEDOUT;
+    case ZX_ERR_BAD_HANDLE:
+    case ZX_ERR_WRONG_TYPE:
+    case ZX_ERR_ACCESS_DENIED:
+        // The futex no longer names a live thread of ours, say because its
+        // owner exited while holding it. There is nobody to lend priority
+        // to, so just wait.
+        return __timedwait(futex, val, clk, at);
+    case ZX_ERR_INVALID_ARGS:
+    default:
+        __builtin_trap();
+    }
+}
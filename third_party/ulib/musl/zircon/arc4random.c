@@ -0,0 +1,217 @@
+#include "libc.h"
+#include "pthread_impl.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zircon/syscalls.h>
+
+// A ChaCha20 keystream generator per thread, keyed from the kernel.  Each
+// refill of the buffer immediately rekeys the generator from the start of
+// the new keystream, so a later compromise of the state does not reveal
+// output that was already handed out.  After RESEED_BYTES bytes of output
+// the generator is keyed from the kernel again.
+
+#define KEY_SIZE 32
+#define IV_SIZE 8
+#define BLOCK_SIZE 64
+#define BUFFER_SIZE (16 * BLOCK_SIZE)
+#define RESEED_BYTES (1600 * 1000)
+
+// Bigger requests than this for the kernel are split up.
+#define MAX_DRAW 256
+static_assert(MAX_DRAW <= ZX_CPRNG_DRAW_MAX_LEN, "");
+
+struct __arc4random_state {
+    uint32_t input[16];
+    // The unused keystream is the last |have| bytes of |buf|.
+    uint8_t buf[BUFFER_SIZE];
+    size_t have;
+    // Bytes that may be handed out before reseeding from the kernel.
+    size_t count;
+};
+
+static void zero(void* p, size_t n) {
+    memset(p, 0, n);
+    // Keep the compiler from dropping the memset of a dead buffer.
+    __asm__ volatile("" : : "r"(p) : "memory");
+}
+
+static uint32_t load_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void store_le32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d) \
+    a += b; d ^= a; d = ROTL32(d, 16); \
+    c += d; b ^= c; b = ROTL32(b, 12); \
+    a += b; d ^= a; d = ROTL32(d, 8); \
+    c += d; b ^= c; b = ROTL32(b, 7)
+
+static void chacha_block(const uint32_t in[16], uint8_t out[BLOCK_SIZE]) {
+    uint32_t x[16];
+    memcpy(x, in, sizeof(x));
+    for (int i = 0; i < 10; ++i) {
+        QUARTERROUND(x[0], x[4], x[8], x[12]);
+        QUARTERROUND(x[1], x[5], x[9], x[13]);
+        QUARTERROUND(x[2], x[6], x[10], x[14]);
+        QUARTERROUND(x[3], x[7], x[11], x[15]);
+        QUARTERROUND(x[0], x[5], x[10], x[15]);
+        QUARTERROUND(x[1], x[6], x[11], x[12]);
+        QUARTERROUND(x[2], x[7], x[8], x[13]);
+        QUARTERROUND(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; ++i)
+        store_le32(out + 4 * i, x[i] + in[i]);
+    zero(x, sizeof(x));
+}
+
+// Key the generator with KEY_SIZE bytes of key followed by IV_SIZE of IV.
+static void chacha_keysetup(struct __arc4random_state* rs, const uint8_t* key) {
+    // "expand 32-byte k"
+    rs->input[0] = 0x61707865;
+    rs->input[1] = 0x3320646e;
+    rs->input[2] = 0x79622d32;
+    rs->input[3] = 0x6b206574;
+    for (int i = 0; i < 8; ++i)
+        rs->input[4 + i] = load_le32(key + 4 * i);
+    rs->input[12] = 0;
+    rs->input[13] = 0;
+    rs->input[14] = load_le32(key + KEY_SIZE);
+    rs->input[15] = load_le32(key + KEY_SIZE + 4);
+}
+
+static void rng_stir(struct __arc4random_state* rs) {
+    uint8_t seed[KEY_SIZE + IV_SIZE];
+    size_t actual;
+    zx_status_t status = _zx_cprng_draw(seed, sizeof(seed), &actual);
+    // There is no way to report this, and no safe way to go on.
+    if (status != ZX_OK || actual != sizeof(seed))
+        __builtin_trap();
+
+    chacha_keysetup(rs, seed);
+    zero(seed, sizeof(seed));
+
+    // Throw away any keystream made with the old key.
+    zero(rs->buf, sizeof(rs->buf));
+    rs->have = 0;
+    rs->count = RESEED_BYTES;
+}
+
+static void rng_refill(struct __arc4random_state* rs) {
+    for (size_t i = 0; i < BUFFER_SIZE; i += BLOCK_SIZE) {
+        chacha_block(rs->input, rs->buf + i);
+        if (++rs->input[12] == 0)
+            ++rs->input[13];
+    }
+
+    // Fast key erasure: the start of the keystream is the next key.
+    chacha_keysetup(rs, rs->buf);
+    zero(rs->buf, KEY_SIZE + IV_SIZE);
+    rs->have = BUFFER_SIZE - KEY_SIZE - IV_SIZE;
+}
+
+static void rng_get(struct __arc4random_state* rs, uint8_t* out, size_t n) {
+    while (n > 0) {
+        // Check the budget as we go, so a single large request is spread
+        // over as many kernel keys as many small ones would be.
+        if (rs->count == 0)
+            rng_stir(rs);
+        if (rs->have == 0)
+            rng_refill(rs);
+        size_t m = n < rs->have ? n : rs->have;
+        if (m > rs->count)
+            m = rs->count;
+        uint8_t* keystream = rs->buf + BUFFER_SIZE - rs->have;
+        memcpy(out, keystream, m);
+        zero(keystream, m);
+        out += m;
+        n -= m;
+        rs->have -= m;
+        rs->count -= m;
+    }
+}
+
+// What a thread's state is set to once __arc4random_thread_cleanup() has
+// run. The thread may still call arc4random after that, from an atexit
+// handler of the last thread for instance, but nothing would free a new
+// state, so those calls go to the kernel instead.
+#define STATE_EXITED ((struct __arc4random_state*)-1)
+
+// Returns NULL if the state could not be allocated, or the thread is
+// exiting.
+static struct __arc4random_state* rng_self(void) {
+    thrd_t self = __thrd_current();
+    struct __arc4random_state* rs = self->arc4random_state;
+    if (rs == STATE_EXITED)
+        return NULL;
+    if (rs == NULL) {
+        rs = malloc(sizeof(*rs));
+        if (rs == NULL)
+            return NULL;
+        rng_stir(rs);
+        self->arc4random_state = rs;
+    }
+    return rs;
+}
+
+// Without a generator, go to the kernel for every byte.
+static void draw_from_kernel(uint8_t* out, size_t n) {
+    while (n > 0) {
+        size_t chunk = n < MAX_DRAW ? n : MAX_DRAW;
+        size_t actual;
+        zx_status_t status = _zx_cprng_draw(out, chunk, &actual);
+        if (status != ZX_OK || actual != chunk)
+            __builtin_trap();
+        out += chunk;
+        n -= chunk;
+    }
+}
+
+void arc4random_buf(void* buf, size_t n) {
+    struct __arc4random_state* rs = rng_self();
+    if (rs == NULL) {
+        draw_from_kernel(buf, n);
+    } else {
+        rng_get(rs, buf, n);
+    }
+}
+
+uint32_t arc4random(void) {
+    uint32_t value;
+    arc4random_buf(&value, sizeof(value));
+    return value;
+}
+
+uint32_t arc4random_uniform(uint32_t upper_bound) {
+    if (upper_bound < 2)
+        return 0;
+
+    // Reject values below 2**32 % upper_bound, so the ones left fall
+    // evenly into the upper_bound buckets.
+    uint32_t min = -upper_bound % upper_bound;
+    for (;;) {
+        uint32_t r = arc4random();
+        if (r >= min)
+            return r % upper_bound;
+    }
+}
+
+void __arc4random_thread_cleanup(void) {
+    thrd_t self = __thrd_current();
+    struct __arc4random_state* rs = self->arc4random_state;
+    if (rs != NULL && rs != STATE_EXITED) {
+        zero(rs, sizeof(*rs));
+        free(rs);
+    }
+    self->arc4random_state = STATE_EXITED;
+}